@@ -0,0 +1,200 @@
+#include "blockundojournal.h"
+#include "utils.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QObject>
+
+Q_LOGGING_CATEGORY(LOG_UNDOJOURNAL, "updatesystem.blockundojournal")
+
+static const quint32 JournalMagic = 0x554e444f; // "UNDO"
+static const quint32 JournalVersion = 2;
+static const quint8 EndMarker = 0;
+static const quint8 EntryMarker = 1;
+static const qint64 MaxEntrySize = 1024 * 1024;
+
+BlockUndoJournal::BlockUndoJournal(const QString &filename) :
+    m_journal(filename)
+{
+}
+
+/*!
+    \brief Returns the path of the journaled file, as given to begin()
+    Returns an empty string if the journal can't be read.
+ */
+QString BlockUndoJournal::path()
+{
+    m_journal.close();
+    QString path;
+    qint64 originalSize;
+    if(m_journal.open(QFile::ReadOnly))
+    {
+        QDataStream stream(&m_journal);
+        stream.setVersion(QDataStream::Qt_5_0);
+        if(!readHeader(stream, &path, &originalSize))
+            path.clear();
+        m_journal.close();
+    }
+    return path;
+}
+
+/*!
+    \brief Start a new journal for the file at \a path of \a originalSize bytes
+ */
+void BlockUndoJournal::begin(const QString &path, qint64 originalSize)
+{
+    QDir().mkpath(QFileInfo(m_journal.fileName()).path());
+    if(!m_journal.open(QFile::WriteOnly | QFile::Truncate))
+        throw QObject::tr("Unable to open journal %1 for writing").arg(m_journal.fileName());
+
+    QDataStream stream(&m_journal);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << JournalMagic << JournalVersion << path << originalSize;
+    if(stream.status() != QDataStream::Ok)
+        throw QObject::tr("Unable to write journal %1").arg(m_journal.fileName());
+}
+
+/*!
+    \brief Save the current content of \a length bytes of \a file at \a offset
+ */
+void BlockUndoJournal::save(QFile *file, qint64 offset, qint64 length)
+{
+    Q_ASSERT(m_journal.isOpen());
+    if(!file->seek(offset))
+        throw QObject::tr("Unable to read file %1").arg(file->fileName());
+
+    QDataStream stream(&m_journal);
+    stream.setVersion(QDataStream::Qt_5_0);
+    while(length > 0)
+    {
+        qint64 size = qMin(length, MaxEntrySize);
+        QByteArray data = file->read(size);
+        if(data.size() != size)
+            throw QObject::tr("Unable to read file %1").arg(file->fileName());
+        stream << EntryMarker << offset << data;
+        offset += size;
+        length -= size;
+    }
+
+    if(stream.status() != QDataStream::Ok)
+        throw QObject::tr("Unable to write journal %1").arg(m_journal.fileName());
+}
+
+/*!
+    \brief Mark the journal as complete and wait for it to be on disk
+ */
+void BlockUndoJournal::commit()
+{
+    Q_ASSERT(m_journal.isOpen());
+    QDataStream stream(&m_journal);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << EndMarker << JournalMagic;
+    if(stream.status() != QDataStream::Ok || !Utils::syncFile(&m_journal))
+        throw QObject::tr("Unable to write journal %1").arg(m_journal.fileName());
+    m_journal.close();
+}
+
+bool BlockUndoJournal::readHeader(QDataStream &stream, QString *path, qint64 *originalSize)
+{
+    quint32 magic = 0, version = 0;
+    stream >> magic >> version;
+    if(stream.status() != QDataStream::Ok || magic != JournalMagic || version != JournalVersion)
+        return false;
+    stream >> *path >> *originalSize;
+    return stream.status() == QDataStream::Ok;
+}
+
+/*!
+    \brief Restore \a file as it was when the journal was started, then remove the journal
+    Nothing is restored if the journal wasn't committed, the file wasn't modified in that case.
+    \return true if \a file was restored
+ */
+bool BlockUndoJournal::rollback(QFile *file)
+{
+    m_journal.close();
+    if(!m_journal.open(QFile::ReadOnly))
+        throw QObject::tr("Unable to open journal %1 for reading").arg(m_journal.fileName());
+
+    QDataStream stream(&m_journal);
+    stream.setVersion(QDataStream::Qt_5_0);
+    QString path;
+    qint64 originalSize = 0;
+    bool committed = readHeader(stream, &path, &originalSize);
+
+    // Check the journal is complete before touching the file
+    while(committed)
+    {
+        quint8 marker = EndMarker;
+        stream >> marker;
+        if(stream.status() != QDataStream::Ok || (marker != EntryMarker && marker != EndMarker))
+        {
+            committed = false;
+        }
+        else if(marker == EndMarker)
+        {
+            quint32 magic = 0;
+            stream >> magic;
+            committed = stream.status() == QDataStream::Ok && magic == JournalMagic;
+            break;
+        }
+        else
+        {
+            qint64 offset;
+            QByteArray data;
+            stream >> offset >> data;
+        }
+    }
+
+    if(committed && !file->exists())
+    {
+        // Nothing left to restore, the file is recreated by the next update
+        qCDebug(LOG_UNDOJOURNAL) << "Dropping journal of missing file" << file->fileName();
+    }
+    else if(committed)
+    {
+        qCDebug(LOG_UNDOJOURNAL) << "Restoring" << file->fileName() << "from" << m_journal.fileName();
+
+        m_journal.seek(0);
+        stream.resetStatus();
+        readHeader(stream, &path, &originalSize);
+
+        if(!file->open(QFile::ReadWrite) || !file->resize(originalSize))
+            throw QObject::tr("Unable to restore file %1").arg(file->fileName());
+
+        quint8 marker;
+        stream >> marker;
+        while(marker == EntryMarker)
+        {
+            qint64 offset;
+            QByteArray data;
+            stream >> offset >> data;
+            if(!file->seek(offset) || file->write(data) != data.size())
+                throw QObject::tr("Unable to restore file %1").arg(file->fileName());
+            stream >> marker;
+        }
+
+        if(!Utils::syncFile(file))
+            throw QObject::tr("Unable to restore file %1").arg(file->fileName());
+        file->close();
+        remove();
+        return true;
+    }
+    else
+    {
+        qCDebug(LOG_UNDOJOURNAL) << "Dropping uncommitted journal" << m_journal.fileName();
+    }
+
+    remove();
+    return false;
+}
+
+/*!
+    \brief Remove the journal, the file modifications are then permanent
+ */
+void BlockUndoJournal::remove()
+{
+    m_journal.close();
+    if(m_journal.exists() && !m_journal.remove())
+        throw QObject::tr("Unable to remove journal %1").arg(m_journal.fileName());
+}
@@ -0,0 +1,52 @@
+#ifndef BLOCKUNDOJOURNAL_H
+#define BLOCKUNDOJOURNAL_H
+
+#include "../qtupdatesystem_global.h"
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+
+/*!
+    \brief Undo log of the parts of a file that are about to be overwritten in place
+
+    The original content of every extent is saved and synced to the journal before the file is modified:
+    \list 1
+     \li begin(), with the path of the file so pending journals can be recovered without knowing their operation
+     \li save() each extent that will be overwritten or truncated
+     \li commit(), the file can then be modified
+     \li remove() once the file modifications are synced
+    \endlist
+    If the process is interrupted, rollback() restores the original file.
+    A journal that wasn't committed means the file wasn't modified yet and is simply dropped.
+    Errors are reported by throwing a QString.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT BlockUndoJournal
+{
+public:
+    BlockUndoJournal(const QString &filename);
+
+    QString fileName() const;
+    bool exists() const;
+    QString path();
+    void begin(const QString &path, qint64 originalSize);
+    void save(QFile *file, qint64 offset, qint64 length);
+    void commit();
+    bool rollback(QFile *file);
+    void remove();
+
+private:
+    bool readHeader(QDataStream &stream, QString *path, qint64 *originalSize);
+    QFile m_journal;
+};
+
+inline QString BlockUndoJournal::fileName() const
+{
+    return m_journal.fileName();
+}
+
+inline bool BlockUndoJournal::exists() const
+{
+    return m_journal.exists();
+}
+
+#endif // BLOCKUNDOJOURNAL_H
@@ -0,0 +1,262 @@
+#include "dirscanner.h"
+#include "utils.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QRunnable>
+#include <QScopedArrayPointer>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <algorithm>
+#include <atomic>
+
+#if defined(Q_OS_LINUX)
+#include <cstddef>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(LOG_DIRSCANNER, "updatesystem.dirscanner")
+
+#if defined(Q_OS_LINUX)
+namespace
+{
+    struct LinuxDirent64
+    {
+        quint64 d_ino;
+        qint64 d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+}
+#endif
+
+/*
+    State of a scan() shared by its threads
+ */
+class DirScanner::Scan
+{
+public:
+    Scan(const DirScanner *scanner, const QString &root, const Callback &callback, int threadCount) :
+        m_scanner(scanner), m_root(Utils::cleanPath(root)), m_callback(callback),
+        m_queues(new Queue[threadCount]), m_queueCount(threadCount), m_pending(1), m_queued(1)
+    {
+        m_queues[0].dirs.append(QString());
+    }
+
+    void run(int worker)
+    {
+        QString dir;
+        while(m_pending.load() > 0)
+        {
+            if(!take(worker, &dir))
+            {
+                // Checked again with the lock held, so a directory queued meanwhile isn't missed
+                QMutexLocker locker(&m_idleMutex);
+                if(m_pending.load() > 0 && m_queued.load() == 0)
+                    m_idle.wait(&m_idleMutex);
+                continue;
+            }
+
+            int queued = 0;
+            EntryList entries = m_scanner->list(m_root + dir);
+            foreach(const Entry &entry, entries)
+            {
+                if(!entry.isDir())
+                    continue;
+                QString child = childPath(dir, entry.name);
+                if(m_scanner->m_descendFilter && !m_scanner->m_descendFilter(child))
+                    continue;
+                ++m_pending;
+                ++m_queued;
+                ++queued;
+                QMutexLocker locker(&m_queues[worker].mutex);
+                m_queues[worker].dirs.append(child);
+            }
+            if(queued > 1)
+                wakeIdle(); // This thread lists one of them
+            m_callback(dir, entries);
+            if(--m_pending == 0)
+                wakeIdle();
+        }
+    }
+
+private:
+    struct Queue
+    {
+        QMutex mutex;
+        QList<QString> dirs;
+    };
+
+    void wakeIdle()
+    {
+        QMutexLocker locker(&m_idleMutex);
+        m_idle.wakeAll();
+    }
+
+    /*
+        The last directory of its own queue, so a thread goes deep into the tree,
+        or the first directory of another queue, the highest one in the tree
+     */
+    bool take(int worker, QString *dir)
+    {
+        {
+            QMutexLocker locker(&m_queues[worker].mutex);
+            if(!m_queues[worker].dirs.isEmpty())
+            {
+                *dir = m_queues[worker].dirs.takeLast();
+                --m_queued;
+                return true;
+            }
+        }
+
+        for(int i = 1; i < m_queueCount; ++i)
+        {
+            Queue &victim = m_queues[(worker + i) % m_queueCount];
+            QMutexLocker locker(&victim.mutex);
+            if(!victim.dirs.isEmpty())
+            {
+                *dir = victim.dirs.takeFirst();
+                --m_queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const DirScanner *m_scanner;
+    QString m_root;
+    Callback m_callback;
+    QScopedArrayPointer<Queue> m_queues;
+    int m_queueCount;
+    std::atomic<int> m_pending; ///< Directories queued or being listed
+    std::atomic<int> m_queued; ///< Directories queued
+    QMutex m_idleMutex;
+    QWaitCondition m_idle; ///< Woken when directories are queued or the scan is done
+};
+
+namespace
+{
+    template<class Scan>
+    class ScanTask : public QRunnable
+    {
+    public:
+        ScanTask(Scan *scan, int worker) : m_scan(scan), m_worker(worker) {}
+        virtual void run() Q_DECL_OVERRIDE { m_scan->run(m_worker); }
+
+    private:
+        Scan *m_scan;
+        int m_worker;
+    };
+}
+
+DirScanner::DirScanner() :
+    m_threadCount(qMax(1, QThread::idealThreadCount()))
+{
+}
+
+/*!
+    \brief Returns the entries of \a directory sorted by name, an empty list if it can't be read
+ */
+DirScanner::EntryList DirScanner::list(const QString &directory) const
+{
+    EntryList entries;
+
+#if defined(Q_OS_LINUX)
+    int fd = ::open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        qCDebug(LOG_DIRSCANNER) << "Unable to open" << directory;
+        return entries;
+    }
+
+    alignas(LinuxDirent64) char buffer[32768];
+    long read;
+    while((read = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0)
+    {
+        for(long pos = 0; pos < read;)
+        {
+            const LinuxDirent64 *dirent = reinterpret_cast<const LinuxDirent64 *>(buffer + pos);
+            pos += dirent->d_reclen;
+
+            const char *name = buffer + (pos - dirent->d_reclen) + offsetof(LinuxDirent64, d_name);
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            unsigned char type = dirent->d_type;
+            if(type == DT_LNK || type == DT_UNKNOWN)
+            {
+                // Links are followed, broken ones are skipped like QDir does
+                struct stat st;
+                if(::fstatat(fd, name, &st, 0) != 0)
+                    continue;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+            }
+            if(type != DT_DIR && type != DT_REG)
+                continue;
+
+            Entry entry;
+            entry.name = QFile::decodeName(name);
+            entry.type = type == DT_DIR ? Dir : File;
+            if(!m_ignoredNames.contains(entry.name))
+                entries.append(entry);
+        }
+    }
+    if(read < 0)
+        qCDebug(LOG_DIRSCANNER) << "Unable to read" << directory;
+    ::close(fd);
+#else
+    QFileInfoList infos = QDir(directory).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden);
+    foreach(const QFileInfo &info, infos)
+    {
+        Entry entry;
+        entry.name = info.fileName();
+        entry.type = info.isDir() ? Dir : File;
+        if(!m_ignoredNames.contains(entry.name))
+            entries.append(entry);
+    }
+#endif
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.name < b.name;
+    });
+    return entries;
+}
+
+/*!
+    \brief List the tree of \a root, \a callback is called with the entries of each directory
+    Directories are listed concurrently and \a callback is called from the scanning threads,
+    in no particular order.
+    \sa setDescendFilter()
+ */
+void DirScanner::scan(const QString &root, const Callback &callback) const
+{
+    Scan scan(this, root, callback, m_threadCount);
+    QThreadPool pool;
+    pool.setMaxThreadCount(m_threadCount);
+    for(int worker = 0; worker < m_threadCount; ++worker)
+        pool.start(new ScanTask<Scan>(&scan, worker));
+    pool.waitForDone();
+}
+
+/*!
+    \brief Returns the entries of every directory of the tree of \a root
+ */
+DirScanner::Tree DirScanner::scan(const QString &root) const
+{
+    Tree tree;
+    QMutex mutex;
+    scan(root, [&tree, &mutex](const QString &relativeDir, const EntryList &entries) {
+        QMutexLocker locker(&mutex);
+        tree.insert(relativeDir, entries);
+    });
+    return tree;
+}
@@ -0,0 +1,104 @@
+#ifndef DIRSCANNER_H
+#define DIRSCANNER_H
+
+#include "../qtupdatesystem_global.h"
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+/*!
+    \brief Lists directory trees without stating every entry
+
+    On Linux directories are read with getdents64, entry types come from d_type
+    and only symbolic links are resolved. Elsewhere QDir is used.
+    Entries are files and directories (links are followed), including hidden ones, sorted by name.
+
+    scan() lists subdirectories concurrently: each thread has its own queue of directories to list,
+    and takes directories from the queues of the others when its own is empty.
+    Threads without directories to list wait until one is queued or the scan is done.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT DirScanner
+{
+public:
+    enum Type {
+        File,
+        Dir
+    };
+
+    struct Entry
+    {
+        QString name;
+        Type type;
+        bool isDir() const { return type == Dir; }
+        bool isFile() const { return type == File; }
+    };
+    typedef QVector<Entry> EntryList;
+    typedef QHash<QString, EntryList> Tree; ///< Entries of each directory, by path relative to the root ("" for the root)
+    typedef std::function<void(const QString &relativeDir, const EntryList &entries)> Callback;
+    typedef std::function<bool(const QString &relativeDir)> Filter;
+
+    DirScanner();
+
+    QStringList ignoredNames() const;
+    void setIgnoredNames(const QStringList &names);
+    void setDescendFilter(const Filter &filter);
+    int threadCount() const;
+    void setThreadCount(int threadCount);
+
+    EntryList list(const QString &directory) const;
+    void scan(const QString &root, const Callback &callback) const;
+    Tree scan(const QString &root) const;
+
+    static QString childPath(const QString &relativeDir, const QString &name);
+
+private:
+    class Scan;
+    QSet<QString> m_ignoredNames;
+    Filter m_descendFilter; ///< Subdirectories are listed only if it returns true
+    int m_threadCount;
+};
+
+inline QStringList DirScanner::ignoredNames() const
+{
+    return m_ignoredNames.toList();
+}
+
+/*!
+    Entries named \a names are skipped, in every directory
+ */
+inline void DirScanner::setIgnoredNames(const QStringList &names)
+{
+    m_ignoredNames = names.toSet();
+}
+
+/*!
+    Only directories for which \a filter returns \c true are listed by scan(), the root is always listed.
+    \a filter is called concurrently by the scanning threads.
+ */
+inline void DirScanner::setDescendFilter(const DirScanner::Filter &filter)
+{
+    m_descendFilter = filter;
+}
+
+inline int DirScanner::threadCount() const
+{
+    return m_threadCount;
+}
+
+inline void DirScanner::setThreadCount(int threadCount)
+{
+    m_threadCount = threadCount;
+}
+
+/*!
+    Returns the path of \a name in \a relativeDir, relative to the root
+ */
+inline QString DirScanner::childPath(const QString &relativeDir, const QString &name)
+{
+    return relativeDir.isEmpty() ? name : relativeDir + QLatin1Char('/') + name;
+}
+
+#endif // DIRSCANNER_H
@@ -0,0 +1,71 @@
+#include "filestamp.h"
+#include "jsonutil.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+
+#if defined(Q_OS_UNIX)
+#  include <sys/stat.h>
+#endif
+
+static const QString Size = QStringLiteral("size");
+static const QString MTime = QStringLiteral("mtime");
+static const QString CTime = QStringLiteral("ctime");
+static const QString Inode = QStringLiteral("inode");
+static const QString Sha1 = QStringLiteral("sha1");
+
+FileStamp::FileStamp() :
+    size(-1), mtime(0), ctime(0), inode(0)
+{
+}
+
+/*!
+    \brief Returns the current stamp of \a filename, without sha1
+    The stamp is invalid if the file doesn't exist.
+ */
+FileStamp FileStamp::stat(const QString &filename)
+{
+    FileStamp stamp;
+#if defined(Q_OS_UNIX)
+    struct ::stat st;
+    if(::stat(QFile::encodeName(filename).constData(), &st) != 0 || !S_ISREG(st.st_mode))
+        return stamp;
+    stamp.size = st.st_size;
+    stamp.inode = st.st_ino;
+#  if defined(Q_OS_LINUX)
+    stamp.mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#  else
+    // Only seconds are portable, a rewrite that restores the modification time still changes the status time
+    stamp.mtime = qint64(st.st_mtime) * 1000000000;
+    stamp.ctime = qint64(st.st_ctime) * 1000000000;
+#  endif
+#else
+    QFileInfo info(filename);
+    if(!info.isFile())
+        return stamp;
+    stamp.size = info.size();
+    stamp.mtime = info.lastModified().toMSecsSinceEpoch() * 1000000;
+#endif
+    return stamp;
+}
+
+void FileStamp::fromJsonObject(const QJsonObject &object)
+{
+    size = JsonUtil::asInt64String(object, Size);
+    mtime = JsonUtil::asInt64String(object, MTime);
+    ctime = object.contains(CTime) ? JsonUtil::asInt64String(object, CTime) : 0;
+    inode = quint64(JsonUtil::asInt64String(object, Inode));
+    sha1 = JsonUtil::asString(object, Sha1);
+}
+
+QJsonObject FileStamp::toJsonObject() const
+{
+    QJsonObject object;
+    object.insert(Size, QString::number(size));
+    object.insert(MTime, QString::number(mtime));
+    object.insert(CTime, QString::number(ctime));
+    object.insert(Inode, QString::number(qint64(inode)));
+    object.insert(Sha1, sha1);
+    return object;
+}
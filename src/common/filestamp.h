@@ -0,0 +1,57 @@
+#ifndef FILESTAMP_H
+#define FILESTAMP_H
+
+#include <QJsonObject>
+#include <QString>
+#include "../qtupdatesystem_global.h"
+
+/*!
+    \brief Size, modification time and inode of a file with the sha1 it had
+    The sha1 is trusted as long as the stats of the file still match, so the file doesn't have to be hashed again.
+
+    A file may be modified again in the same clock tick as its stamp without changing its stats.
+    As git does for its index, a saved stamp is only trusted if it's older than the file it's saved in, see isRacy().
+ */
+class QTUPDATESYSTEMSHARED_EXPORT FileStamp
+{
+public:
+    FileStamp();
+    static FileStamp stat(const QString &filename);
+
+    bool isValid() const;
+    bool matches(const FileStamp &other) const;
+    bool isRacy(qint64 savedTime) const;
+
+    void fromJsonObject(const QJsonObject &object);
+    QJsonObject toJsonObject() const;
+
+    qint64 size; ///< -1 if unknown
+    qint64 mtime; ///< Modification time in nanoseconds since epoch, precision depends on the filesystem
+    qint64 ctime; ///< Status change time in nanoseconds since epoch, 0 if the modification time is precise enough
+    quint64 inode; ///< 0 if unavailable
+    QString sha1;
+};
+
+inline bool FileStamp::isValid() const
+{
+    return size >= 0 && !sha1.isEmpty();
+}
+
+/*!
+    Returns \c true if \a other describes the same file content, sha1 apart
+ */
+inline bool FileStamp::matches(const FileStamp &other) const
+{
+    return size >= 0 && size == other.size && mtime == other.mtime && ctime == other.ctime && inode == other.inode;
+}
+
+/*!
+    Returns \c true if the file may have changed after the stamp without changing its stats,
+    \a savedTime being the modification time of the file the stamp was saved in
+ */
+inline bool FileStamp::isRacy(qint64 savedTime) const
+{
+    return qMax(mtime, ctime) >= savedTime;
+}
+
+#endif // FILESTAMP_H
@@ -0,0 +1,673 @@
+#include "httpserver.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QLoggingCategory>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QUuid>
+#include <algorithm>
+
+#if defined(Q_OS_LINUX)
+#include <cerrno>
+#include <sys/sendfile.h>
+#endif
+
+Q_LOGGING_CATEGORY(LOG_HTTPSERVER, "updatesystem.httpserver")
+
+HttpServer::Resource::Resource() :
+    m_size(0), m_found(false)
+{
+}
+
+/*!
+    \brief Returns \c true if no part of [\a start, \a end) is missing
+ */
+bool HttpServer::Resource::isAvailable(qint64 start, qint64 end) const
+{
+    qint64 position = 0;
+    foreach(const Segment &segment, m_segments)
+    {
+        if(position >= end)
+            break;
+        if(segment.type == Missing && position + segment.size > start)
+            return false;
+        position += segment.size;
+    }
+    return true;
+}
+
+void HttpServer::Resource::addData(const QByteArray &data)
+{
+    Segment segment;
+    segment.type = Data;
+    segment.data = data;
+    segment.offset = 0;
+    segment.size = data.size();
+    append(segment);
+}
+
+void HttpServer::Resource::addFile(const QString &filename, qint64 offset, qint64 size)
+{
+    Segment segment;
+    segment.type = File;
+    segment.filename = filename;
+    segment.offset = offset;
+    segment.size = size;
+    append(segment);
+}
+
+/*!
+    \brief Add the whole content of \a filename
+    \return false if \a filename isn't a file, the resource is left unchanged
+ */
+bool HttpServer::Resource::addFile(const QString &filename)
+{
+    QFileInfo info(filename);
+    if(!info.isFile())
+        return false;
+    addFile(filename, 0, info.size());
+    return true;
+}
+
+void HttpServer::Resource::addMissing(qint64 size)
+{
+    Segment segment;
+    segment.type = Missing;
+    segment.offset = 0;
+    segment.size = size;
+    append(segment);
+}
+
+void HttpServer::Resource::append(const Segment &segment)
+{
+    m_found = true;
+    if(segment.size <= 0)
+        return;
+
+    // Contiguous parts of the same file are sent at once
+    if(!m_segments.isEmpty())
+    {
+        Segment &last = m_segments.last();
+        if(last.type == segment.type && (segment.type == Missing ||
+           (segment.type == File && last.filename == segment.filename && last.offset + last.size == segment.offset)))
+        {
+            last.size += segment.size;
+            m_size += segment.size;
+            return;
+        }
+    }
+    m_segments.append(segment);
+    m_size += segment.size;
+}
+
+/*
+    State of a client connection, destroyed with its socket
+ */
+class HttpServer::Connection
+{
+public:
+    Connection(HttpServer *server, QTcpSocket *socket);
+
+    void readRequests();
+    void writeResponse();
+
+private:
+    static const int MaxHeaderSize = 16 * 1024;
+    static const qint64 BufferedChunkSize = 64 * 1024;
+    static const qint64 SendFileChunkSize = 16 * 1024 * 1024;
+    static const int IdleTimeout = 60 * 1000;
+
+    void handleRequest(const QByteArray &head);
+    void respond(int status, const QList<QByteArray> &headers, qint64 contentLength = 0); // No Content-Length if contentLength < 0
+    void queueData(const QByteArray &data);
+    void queueBody(const Resource &resource, qint64 start, qint64 end);
+    void finishResponse();
+    bool openFile(const QString &filename);
+    static QByteArray reasonPhrase(int status);
+
+    HttpServer *m_server;
+    QTcpSocket *m_socket;
+    QTimer m_idleTimer;
+    QByteArray m_buffer; ///< Received data not handled yet
+    QList<Resource::Segment> m_body; ///< Parts of the response not sent yet
+    QFile m_file; ///< File of the segment being sent
+    bool m_responding;
+    bool m_keepAlive;
+    bool m_sendFile; ///< sendfile works for this connection
+};
+
+HttpServer::Connection::Connection(HttpServer *server, QTcpSocket *socket) :
+    m_server(server), m_socket(socket), m_responding(false), m_keepAlive(true), m_sendFile(true)
+{
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(IdleTimeout);
+    QObject::connect(&m_idleTimer, &QTimer::timeout, m_socket, [this]() {
+        if(!m_responding)
+            m_socket->disconnectFromHost();
+    });
+    QObject::connect(m_socket, &QTcpSocket::readyRead, m_socket, [this]() { readRequests(); });
+    QObject::connect(m_socket, &QTcpSocket::bytesWritten, m_socket, [this]() { writeResponse(); });
+    QObject::connect(m_socket, &QTcpSocket::disconnected, m_socket, &QObject::deleteLater);
+    QObject::connect(m_socket, &QObject::destroyed, [this]() { delete this; });
+    m_idleTimer.start();
+}
+
+/*!
+    \brief Handle the requests received, one at a time
+    Pipelined requests wait for the response of the previous one.
+ */
+void HttpServer::Connection::readRequests()
+{
+    m_idleTimer.start();
+    m_buffer += m_socket->readAll();
+
+    while(!m_responding && m_socket->state() == QAbstractSocket::ConnectedState)
+    {
+        int end = m_buffer.indexOf("\r\n\r\n");
+        if(end < 0)
+        {
+            if(m_buffer.size() > MaxHeaderSize)
+            {
+                m_keepAlive = false;
+                respond(400, QList<QByteArray>());
+                finishResponse();
+            }
+            return;
+        }
+
+        QByteArray head = m_buffer.left(end);
+        m_buffer.remove(0, end + 4);
+        handleRequest(head);
+    }
+}
+
+void HttpServer::Connection::handleRequest(const QByteArray &head)
+{
+    QList<QByteArray> lines = head.split('\n');
+    QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+    QHash<QByteArray, QByteArray> headers;
+    foreach(const QByteArray &line, lines)
+    {
+        int colon = line.indexOf(':');
+        if(colon > 0)
+            headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+    }
+
+    if(requestLine.size() != 3 || !requestLine[2].startsWith("HTTP/1."))
+    {
+        m_keepAlive = false;
+        respond(400, QList<QByteArray>());
+        finishResponse();
+        return;
+    }
+
+    const QByteArray method = requestLine[0];
+    const QByteArray connection = headers.value("connection").toLower();
+    m_keepAlive = requestLine[2] == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+    // Requests with a body aren't expected, the connection can't be reused
+    if(headers.value("content-length", "0") != "0" || headers.contains("transfer-encoding"))
+        m_keepAlive = false;
+
+    if(method != "GET" && method != "HEAD")
+    {
+        respond(405, QList<QByteArray>() << "Allow: GET, HEAD");
+        finishResponse();
+        return;
+    }
+
+    QString path = QUrl::fromEncoded(requestLine[1]).path();
+    if(path.startsWith(QLatin1Char('/')))
+        path.remove(0, 1);
+    if(path.split(QLatin1Char('/')).contains(QStringLiteral("..")))
+    {
+        respond(404, QList<QByteArray>());
+        finishResponse();
+        return;
+    }
+
+    Resource resource = m_server->resource(path);
+    QList<QByteArray> responseHeaders;
+    if(resource.isFound() && !resource.entityTag().isEmpty())
+    {
+        responseHeaders << "ETag: \"" + resource.entityTag() + '"';
+        if(headers.contains("if-none-match") && matchEntityTag(headers.value("if-none-match"), resource.entityTag()))
+        {
+            respond(304, responseHeaders, -1);
+            finishResponse();
+            return;
+        }
+    }
+
+    // Ranges of another version of the resource are ignored, the whole resource is sent
+    bool validRange = false;
+    Ranges ranges;
+    const QByteArray ifRange = headers.value("if-range");
+    if(resource.isFound() && headers.contains("range")
+       && (ifRange.isEmpty() || (ifRange != "*" && !ifRange.startsWith("W/") && matchEntityTag(ifRange, resource.entityTag()))))
+    {
+        ranges = parseRanges(headers.value("range"), resource.size(), &validRange);
+    }
+    if(validRange && ranges.isEmpty())
+    {
+        respond(416, QList<QByteArray>() << "Content-Range: bytes */" + QByteArray::number(resource.size()));
+        finishResponse();
+        return;
+    }
+
+    if(!validRange)
+        ranges = Ranges() << Range(0, resource.size());
+    else
+        ranges = mergeRanges(ranges, RangeMergeGap);
+    if(ranges.size() > MaxRanges)
+        ranges = Ranges() << Range(ranges.first().start, ranges.last().end);
+
+    bool available = resource.isFound();
+    foreach(const Range &range, ranges)
+        available = available && resource.isAvailable(range.start, range.end);
+    if(!available)
+    {
+        if(resource.redirect().isValid())
+        {
+            qCDebug(LOG_HTTPSERVER) << "Redirecting" << path << "to" << resource.redirect();
+            respond(307, QList<QByteArray>() << "Location: " + resource.redirect().toEncoded());
+        }
+        else
+        {
+            respond(404, QList<QByteArray>());
+        }
+        finishResponse();
+        return;
+    }
+
+    const QByteArray contentType = resource.contentType().isEmpty() ? QByteArray("application/octet-stream") : resource.contentType();
+    const QByteArray size = QByteArray::number(resource.size());
+    const bool body = method == "GET";
+    responseHeaders << "Accept-Ranges: bytes";
+    if(!validRange)
+    {
+        responseHeaders << "Content-Type: " + contentType;
+        respond(200, responseHeaders, resource.size());
+        if(body)
+            queueBody(resource, 0, resource.size());
+    }
+    else if(ranges.size() == 1)
+    {
+        const Range &range = ranges.first();
+        responseHeaders << "Content-Type: " + contentType;
+        responseHeaders << "Content-Range: bytes " + QByteArray::number(range.start) + '-' + QByteArray::number(range.end - 1) + '/' + size;
+        respond(206, responseHeaders, range.end - range.start);
+        if(body)
+            queueBody(resource, range.start, range.end);
+    }
+    else
+    {
+        const QByteArray boundary = QUuid::createUuid().toRfc4122().toHex();
+        const QByteArray closing = "--" + boundary + "--\r\n";
+        QList<QByteArray> partHeaders;
+        qint64 length = closing.size();
+        foreach(const Range &range, ranges)
+        {
+            partHeaders << "--" + boundary + "\r\nContent-Type: " + contentType
+                           + "\r\nContent-Range: bytes " + QByteArray::number(range.start) + '-' + QByteArray::number(range.end - 1) + '/' + size
+                           + "\r\n\r\n";
+            length += partHeaders.last().size() + (range.end - range.start) + 2;
+        }
+
+        responseHeaders << "Content-Type: multipart/byteranges; boundary=" + boundary;
+        respond(206, responseHeaders, length);
+        if(body)
+        {
+            for(int i = 0; i < ranges.size(); ++i)
+            {
+                queueData(partHeaders[i]);
+                queueBody(resource, ranges[i].start, ranges[i].end);
+                queueData("\r\n");
+            }
+            queueData(closing);
+        }
+    }
+    writeResponse();
+}
+
+void HttpServer::Connection::respond(int status, const QList<QByteArray> &headers, qint64 contentLength)
+{
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(status) + ' ' + reasonPhrase(status) + "\r\n";
+    response += "Server: QtUpdateSystem\r\n";
+    foreach(const QByteArray &header, headers)
+        response += header + "\r\n";
+    if(contentLength >= 0)
+        response += "Content-Length: " + QByteArray::number(contentLength) + "\r\n";
+    if(!m_keepAlive)
+        response += "Connection: close\r\n";
+    response += "\r\n";
+
+    m_responding = true;
+    m_socket->write(response);
+}
+
+void HttpServer::Connection::queueData(const QByteArray &data)
+{
+    Resource::Segment part;
+    part.type = Resource::Data;
+    part.data = data;
+    part.offset = 0;
+    part.size = data.size();
+    m_body.append(part);
+}
+
+/*!
+    \brief Queue the segments of \a resource that covers [\a start, \a end)
+ */
+void HttpServer::Connection::queueBody(const Resource &resource, qint64 start, qint64 end)
+{
+    qint64 position = 0;
+    foreach(const Resource::Segment &segment, resource.segments())
+    {
+        qint64 segmentStart = qMax(start, position);
+        qint64 segmentEnd = qMin(end, position + segment.size);
+        if(segmentStart < segmentEnd)
+        {
+            Resource::Segment part = segment;
+            part.offset += segmentStart - position;
+            part.size = segmentEnd - segmentStart;
+            m_body.append(part);
+        }
+        position += segment.size;
+        if(position >= end)
+            break;
+    }
+}
+
+/*!
+    \brief Send the queued body
+    Data is written to the socket buffer. Files are sent directly from the kernel when the buffer is empty,
+    or by chunks through the buffer, until the socket is writable again.
+ */
+void HttpServer::Connection::writeResponse()
+{
+    if(!m_responding)
+        return;
+
+    while(!m_body.isEmpty())
+    {
+        Resource::Segment &part = m_body.first();
+        if(part.type == Resource::Data)
+        {
+            m_socket->write(part.data.constData() + part.offset, part.size);
+            m_body.removeFirst();
+            continue;
+        }
+
+        if(m_socket->bytesToWrite() > 0)
+        {
+            m_socket->flush();
+            if(m_socket->bytesToWrite() > 0)
+                return; // Resumed by bytesWritten()
+        }
+
+        if(!openFile(part.filename))
+        {
+            qCWarning(LOG_HTTPSERVER) << "Unable to open" << part.filename;
+            m_socket->abort();
+            return;
+        }
+
+        qint64 sent = 0;
+#if defined(Q_OS_LINUX)
+        if(m_sendFile)
+        {
+            off_t offset = part.offset;
+            ssize_t count = ::sendfile(int(m_socket->socketDescriptor()), m_file.handle(), &offset, size_t(qMin(part.size, qint64(SendFileChunkSize))));
+            if(count == 0)
+            {
+                qCWarning(LOG_HTTPSERVER) << part.filename << "is shorter than expected";
+                m_socket->abort();
+                return;
+            }
+            else if(count > 0)
+                sent = count;
+            else if(errno == EINVAL || errno == ENOSYS)
+                m_sendFile = false;
+            else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                m_socket->abort();
+                return;
+            }
+        }
+#endif
+        if(sent == 0)
+        {
+            QByteArray chunk;
+            if(m_file.seek(part.offset))
+                chunk = m_file.read(qMin(part.size, qint64(BufferedChunkSize)));
+            if(chunk.isEmpty())
+            {
+                qCWarning(LOG_HTTPSERVER) << "Unable to read" << part.filename;
+                m_socket->abort();
+                return;
+            }
+            m_socket->write(chunk);
+            sent = chunk.size();
+        }
+
+        part.offset += sent;
+        part.size -= sent;
+        if(part.size == 0)
+            m_body.removeFirst();
+    }
+
+    finishResponse();
+}
+
+void HttpServer::Connection::finishResponse()
+{
+    m_body.clear();
+    m_file.close();
+    m_responding = false;
+    m_idleTimer.start();
+
+    if(!m_keepAlive)
+    {
+        m_socket->disconnectFromHost();
+    }
+    else if(!m_buffer.isEmpty())
+    {
+        // Pipelined requests are handled from the event loop, to not recurse
+        QTimer::singleShot(0, m_socket, [this]() { readRequests(); });
+    }
+}
+
+bool HttpServer::Connection::openFile(const QString &filename)
+{
+    if(m_file.isOpen() && m_file.fileName() == filename)
+        return true;
+    m_file.close();
+    m_file.setFileName(filename);
+    return m_file.open(QFile::ReadOnly);
+}
+
+QByteArray HttpServer::Connection::reasonPhrase(int status)
+{
+    switch(status)
+    {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 416: return "Range Not Satisfiable";
+    default: return "Unknown";
+    }
+}
+
+HttpServer::HttpServer(QObject *parent) :
+    QTcpServer(parent), m_threadCount(0), m_nextWorker(0)
+{
+}
+
+HttpServer::~HttpServer()
+{
+    stopThreads();
+}
+
+/*!
+    \brief Handle connections by \a threadCount threads, 0 to handle them in the thread of the server
+    Must be set before listen().
+ */
+void HttpServer::setThreadCount(int threadCount)
+{
+    Q_ASSERT(!isListening());
+    m_threadCount = qMax(0, threadCount);
+}
+
+/*!
+    \brief Returns the satisfiable ranges of the Range \a header, for a resource of \a size bytes
+    \a valid is set to \c false if \a header can't be parsed, it must then be ignored.
+    If \a valid is \c true and the returned list is empty, no range can be satisfied.
+ */
+HttpServer::Ranges HttpServer::parseRanges(const QByteArray &header, qint64 size, bool *valid)
+{
+    *valid = false;
+    QByteArray value = header.trimmed();
+    if(!value.startsWith("bytes="))
+        return Ranges();
+
+    Ranges ranges;
+    foreach(QByteArray spec, value.mid(6).split(','))
+    {
+        spec = spec.trimmed();
+        int dash = spec.indexOf('-');
+        if(dash < 0)
+            return Ranges();
+
+        bool okFirst = true, okLast = true;
+        QByteArray first = spec.left(dash).trimmed(), last = spec.mid(dash + 1).trimmed();
+        if(first.isEmpty())
+        {
+            // Last bytes
+            qint64 suffix = last.toLongLong(&okLast);
+            if(!okLast || suffix < 0)
+                return Ranges();
+            if(suffix > 0 && size > 0)
+                ranges.append(Range(qMax<qint64>(0, size - suffix), size));
+        }
+        else
+        {
+            qint64 start = first.toLongLong(&okFirst);
+            qint64 end = last.isEmpty() ? size : last.toLongLong(&okLast) + 1;
+            if(!okFirst || !okLast || start < 0 || end <= start)
+                return Ranges();
+            if(start < size)
+                ranges.append(Range(start, qMin(end, size)));
+        }
+    }
+
+    *valid = true;
+    return ranges;
+}
+
+/*!
+    \brief Sort \a ranges and merge those that overlap or are separated by less than \a gap bytes
+ */
+HttpServer::Ranges HttpServer::mergeRanges(Ranges ranges, qint64 gap)
+{
+    std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) {
+        return a.start < b.start;
+    });
+
+    Ranges merged;
+    foreach(const Range &range, ranges)
+    {
+        if(!merged.isEmpty() && range.start <= merged.last().end + gap)
+            merged.last().end = qMax(merged.last().end, range.end);
+        else
+            merged.append(range);
+    }
+    return merged;
+}
+
+/*!
+    \brief Returns \c true if \a entityTag is in the list of entity tags of an If-None-Match or If-Range \a header
+    Weak tags match like strong ones, "*" matches any tag.
+ */
+bool HttpServer::matchEntityTag(const QByteArray &header, const QByteArray &entityTag)
+{
+    if(entityTag.isEmpty())
+        return false;
+
+    foreach(QByteArray tag, header.split(','))
+    {
+        tag = tag.trimmed();
+        if(tag == "*")
+            return true;
+        if(tag.startsWith("W/"))
+            tag.remove(0, 2);
+        if(tag.size() >= 2 && tag.startsWith('"') && tag.endsWith('"') && tag.mid(1, tag.size() - 2) == entityTag)
+            return true;
+    }
+    return false;
+}
+
+void HttpServer::incomingConnection(qintptr socketDescriptor)
+{
+    if(m_threadCount == 0)
+    {
+        accept(socketDescriptor, this);
+        return;
+    }
+
+    // Connections are spread between the threads, each one serves its connections until they are closed
+    startThreads();
+    QObject *worker = m_workers[m_nextWorker];
+    m_nextWorker = (m_nextWorker + 1) % m_workers.size();
+    QTimer::singleShot(0, worker, [this, socketDescriptor, worker]() {
+        accept(socketDescriptor, worker);
+    });
+}
+
+void HttpServer::accept(qintptr socketDescriptor, QObject *parent)
+{
+    QTcpSocket *socket = new QTcpSocket(parent);
+    if(!socket->setSocketDescriptor(socketDescriptor))
+    {
+        qCWarning(LOG_HTTPSERVER) << "Unable to accept connection" << socket->errorString();
+        delete socket;
+        return;
+    }
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    new Connection(this, socket);
+}
+
+void HttpServer::startThreads()
+{
+    while(m_threads.size() < m_threadCount)
+    {
+        QThread *thread = new QThread;
+        QObject *worker = new QObject;
+        worker->moveToThread(thread);
+        // The connections of the thread are deleted with their parent
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        m_threads.append(thread);
+        m_workers.append(worker);
+    }
+}
+
+void HttpServer::stopThreads()
+{
+    foreach(QThread *thread, m_threads)
+    {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+    m_threads.clear();
+    m_workers.clear();
+}
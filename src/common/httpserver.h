@@ -0,0 +1,178 @@
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include "../qtupdatesystem_global.h"
+#include <QByteArray>
+#include <QString>
+#include <QTcpServer>
+#include <QUrl>
+#include <QVector>
+
+class QThread;
+
+/*!
+    \brief Event driven HTTP/1.1 server of static resources, with Range support
+
+    Subclasses describe each resource by the segments its content is made of:
+    in memory data, parts of files and missing parts.
+    Requests of missing parts are redirected to the redirect() url of the resource, if any.
+
+    Connections are kept alive and requests are handled in order.
+    Many ranges are answered by a multipart/byteranges response, after merging the close ones.
+    Resources with an entity tag handle If-None-Match and If-Range.
+    On Linux, file segments are sent with sendfile, without copying them to user space.
+
+    Connections are handled by the event loop of the server thread,
+    or spread between setThreadCount() threads, each with its own event loop.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT HttpServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    struct Range
+    {
+        Range(qint64 start = 0, qint64 end = 0) : start(start), end(end) {}
+        qint64 start; ///< First byte of the range
+        qint64 end; ///< Byte after the last one of the range
+    };
+    typedef QVector<Range> Ranges;
+
+    class QTUPDATESYSTEMSHARED_EXPORT Resource
+    {
+    public:
+        enum SegmentType
+        {
+            Data,
+            File,
+            Missing
+        };
+
+        struct Segment
+        {
+            SegmentType type;
+            QByteArray data;
+            QString filename;
+            qint64 offset; ///< Position of the segment in data or in filename
+            qint64 size;
+        };
+
+        Resource();
+
+        bool isFound() const;
+        qint64 size() const;
+        const QVector<Segment> &segments() const;
+        bool isAvailable(qint64 start, qint64 end) const;
+
+        void addData(const QByteArray &data);
+        void addFile(const QString &filename, qint64 offset, qint64 size);
+        bool addFile(const QString &filename);
+        void addMissing(qint64 size);
+
+        QByteArray contentType() const;
+        void setContentType(const QByteArray &contentType);
+        QByteArray entityTag() const;
+        void setEntityTag(const QByteArray &entityTag);
+        QUrl redirect() const;
+        void setRedirect(const QUrl &redirect);
+
+    private:
+        void append(const Segment &segment);
+        QVector<Segment> m_segments;
+        qint64 m_size;
+        bool m_found;
+        QByteArray m_contentType;
+        QByteArray m_entityTag;
+        QUrl m_redirect;
+    };
+
+    static const int MaxRanges = 64; ///< Ranges of a multipart response, more ranges are merged into one
+    static const qint64 RangeMergeGap = 256; ///< Ranges closer than this are merged, it's about the size of a part header
+
+    explicit HttpServer(QObject *parent = 0);
+    ~HttpServer();
+
+    int threadCount() const;
+    void setThreadCount(int threadCount);
+
+    static Ranges parseRanges(const QByteArray &header, qint64 size, bool *valid);
+    static Ranges mergeRanges(Ranges ranges, qint64 gap);
+    static bool matchEntityTag(const QByteArray &header, const QByteArray &entityTag);
+
+protected:
+    /*!
+        Returns the resource at \a path, relative to the root of the server and without its leading '/'.
+        It's called concurrently by the serving threads if threadCount() isn't 0.
+     */
+    virtual Resource resource(const QString &path) = 0;
+    virtual void incomingConnection(qintptr socketDescriptor) Q_DECL_OVERRIDE;
+
+private:
+    class Connection;
+    void accept(qintptr socketDescriptor, QObject *parent);
+    void startThreads();
+    void stopThreads();
+
+    int m_threadCount;
+    QVector<QThread *> m_threads;
+    QVector<QObject *> m_workers; ///< Parent of the connections of each thread
+    int m_nextWorker;
+};
+
+inline int HttpServer::threadCount() const
+{
+    return m_threadCount;
+}
+
+inline bool HttpServer::Resource::isFound() const
+{
+    return m_found;
+}
+
+inline qint64 HttpServer::Resource::size() const
+{
+    return m_size;
+}
+
+inline const QVector<HttpServer::Resource::Segment> &HttpServer::Resource::segments() const
+{
+    return m_segments;
+}
+
+inline QByteArray HttpServer::Resource::contentType() const
+{
+    return m_contentType;
+}
+
+inline void HttpServer::Resource::setContentType(const QByteArray &contentType)
+{
+    m_contentType = contentType;
+}
+
+inline QByteArray HttpServer::Resource::entityTag() const
+{
+    return m_entityTag;
+}
+
+/*!
+    Set the strong entity tag of the resource, without quotes, it must change when its content changes
+ */
+inline void HttpServer::Resource::setEntityTag(const QByteArray &entityTag)
+{
+    m_entityTag = entityTag;
+}
+
+inline QUrl HttpServer::Resource::redirect() const
+{
+    return m_redirect;
+}
+
+/*!
+    Requests that can't be served, because the resource isn't found or because of missing parts,
+    are redirected to \a redirect
+ */
+inline void HttpServer::Resource::setRedirect(const QUrl &redirect)
+{
+    m_redirect = redirect;
+}
+
+#endif // HTTPSERVER_H
@@ -7,13 +7,15 @@
 Package::Package()
 {
     size = -1;
+    applySize = 0;
 }
 
-Package::Package(const QString &to, const QString &from, qint64 size)
+Package::Package(const QString &to, const QString &from, qint64 size, qint64 applySize)
 {
     this->to = to;
     this->from = from;
     this->size = size;
+    this->applySize = applySize;
 }
 
 QString Package::repositoryPackageName(const QString &from, const QString &to)
@@ -36,6 +38,7 @@ void Package::fromJsonObjectV1(const QJsonObject &packageObject)
     size = JsonUtil::asString(packageObject, QStringLiteral("size")).toLongLong(&ok);
     if(!ok)
         THROW(JsonError, QObject::tr("package 'size' is not a qint64 string"));
+    applySize = packageObject.contains(QStringLiteral("applySize")) ? JsonUtil::asInt64String(packageObject, QStringLiteral("applySize")) : 0;
 }
 
 QJsonObject Package::toJsonObjectV1() const
@@ -44,6 +47,8 @@ QJsonObject Package::toJsonObjectV1() const
     packageObject.insert(QStringLiteral("from"), from);
     packageObject.insert(QStringLiteral("to"), to);
     packageObject.insert(QStringLiteral("size"), QString::number(size));
+    if(applySize > 0)
+        packageObject.insert(QStringLiteral("applySize"), QString::number(applySize));
 
     return packageObject;
 }
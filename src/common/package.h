@@ -10,10 +10,11 @@ class Package
 {
 public:
     Package();
-    Package(const QString &to, const QString &from, qint64 size);
+    Package(const QString &to, const QString &from, qint64 size, qint64 applySize = 0);
     QString to;
     QString from;
     qint64 size;
+    qint64 applySize; ///< Bytes decoded or written by the apply of the package, 0 if unknown
 
     static QString repositoryPackageName(const QString &from, const QString &to);
     QString url() const;
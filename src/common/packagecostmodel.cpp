@@ -0,0 +1,16 @@
+#include "packagecostmodel.h"
+
+PackageCostModel::PackageCostModel() :
+    m_hopCost(DefaultHopCost), m_applyCostRatio(DefaultApplyCostPercent / 100.0)
+{
+}
+
+/*!
+    \brief Returns the cost of \a package, never negative
+ */
+qint64 PackageCostModel::cost(const Package &package) const
+{
+    qint64 downloadSize = qMax(Q_INT64_C(0), package.size - skippedSize(package));
+    qint64 applyCost = qint64(qMax(Q_INT64_C(0), package.applySize) * m_applyCostRatio);
+    return downloadSize + applyCost + qMax(Q_INT64_C(0), m_hopCost);
+}
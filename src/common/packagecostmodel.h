@@ -0,0 +1,85 @@
+#ifndef PACKAGECOSTMODEL_H
+#define PACKAGECOSTMODEL_H
+
+#include "../qtupdatesystem_global.h"
+#include "package.h"
+#include <QHash>
+#include <QString>
+
+/*!
+    \brief Cost of going through a package when looking for the best path, in downloaded bytes
+
+    The cost of a package is the data that must really be downloaded, the bytes its apply decodes
+    or writes, weighted by applyCostRatio(), and hopCost() for the requests of one more package.
+    The data that must be downloaded is the size of the package, minus the estimated size of the operations
+    that will be skipped, because the local file is already valid or the data is already available.
+    The request and apply costs are opt-in: by default packages are only compared by size.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT PackageCostModel
+{
+public:
+    static const qint64 DefaultHopCost = 0;
+    static const int DefaultApplyCostPercent = 0;
+
+    PackageCostModel();
+
+    qint64 cost(const Package &package) const;
+
+    qint64 hopCost() const;
+    void setHopCost(qint64 hopCost);
+    qreal applyCostRatio() const;
+    void setApplyCostRatio(qreal applyCostRatio);
+
+    qint64 skippedSize(const Package &package) const;
+    void setSkippedSize(const Package &package, qint64 skippedSize);
+    void clearSkippedSizes();
+
+private:
+    qint64 m_hopCost;
+    qreal m_applyCostRatio;
+    QHash<QString, qint64> m_skippedSizes; ///< Package url -> estimated size of the skipped operations
+};
+
+inline qint64 PackageCostModel::hopCost() const
+{
+    return m_hopCost;
+}
+
+/*!
+    Set the cost of one more package in the path: the latency of its metadata and data requests,
+    as the bytes that could have been downloaded meanwhile
+ */
+inline void PackageCostModel::setHopCost(qint64 hopCost)
+{
+    m_hopCost = hopCost;
+}
+
+inline qreal PackageCostModel::applyCostRatio() const
+{
+    return m_applyCostRatio;
+}
+
+/*!
+    Set the cost of one byte decoded or written by the apply, relative to one downloaded byte
+ */
+inline void PackageCostModel::setApplyCostRatio(qreal applyCostRatio)
+{
+    m_applyCostRatio = applyCostRatio;
+}
+
+inline qint64 PackageCostModel::skippedSize(const Package &package) const
+{
+    return m_skippedSizes.value(package.url(), 0);
+}
+
+inline void PackageCostModel::setSkippedSize(const Package &package, qint64 skippedSize)
+{
+    m_skippedSizes.insert(package.url(), skippedSize);
+}
+
+inline void PackageCostModel::clearSkippedSizes()
+{
+    m_skippedSizes.clear();
+}
+
+#endif // PACKAGECOSTMODEL_H
@@ -0,0 +1,221 @@
+#include "packagegraph.h"
+
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QPair>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
+
+Q_DECLARE_LOGGING_CATEGORY(LOG_PACKAGES)
+
+namespace
+{
+    const qint64 Unreachable = std::numeric_limits<qint64>::max();
+}
+
+PackageGraph::PackageGraph()
+{
+}
+
+PackageGraph::PackageGraph(const QVector<Package> &packages)
+{
+    setPackages(packages);
+}
+
+/*!
+    \brief Use \a costModel for the next paths, cached trees are dropped
+ */
+void PackageGraph::setCostModel(const PackageCostModel &costModel)
+{
+    m_costModel = costModel;
+    updateCosts();
+}
+
+/*!
+    \brief Find the next paths without \a package, cached trees are dropped
+    Packages are enabled again by setPackages().
+ */
+void PackageGraph::disablePackage(const Package &package)
+{
+    for(int i = 0; i < m_packages.size(); ++i)
+    {
+        if(m_packages.at(i) == package)
+            m_disabled[i] = true;
+    }
+    m_trees.clear();
+}
+
+void PackageGraph::updateCosts()
+{
+    m_trees.clear();
+    m_costs.resize(m_packages.size());
+    for(int i = 0; i < m_packages.size(); ++i)
+        m_costs[i] = m_costModel.cost(m_packages.at(i));
+}
+
+/*!
+    \brief Compile the graph of \a packages, cached trees are dropped
+ */
+void PackageGraph::setPackages(const QVector<Package> &packages)
+{
+    QElapsedTimer t;
+    t.start();
+
+    m_packages = packages;
+    m_nodes.clear();
+    m_disabled.fill(false, packages.size());
+    updateCosts();
+    m_completes.clear();
+    m_from.resize(packages.size());
+    m_to.resize(packages.size());
+
+    QVector<int> incomingCounts;
+    auto node = [this, &incomingCounts](const QString &revision) -> int {
+        QHash<QString, int>::const_iterator it = m_nodes.constFind(revision);
+        if(it != m_nodes.constEnd())
+            return it.value();
+        incomingCounts.append(0);
+        return m_nodes.insert(revision, m_nodes.size()).value();
+    };
+
+    for(int i = 0; i < packages.size(); ++i)
+    {
+        const Package &package = packages.at(i);
+        m_to[i] = node(package.to);
+        if(package.from.isEmpty())
+        {
+            m_from[i] = -1;
+            m_completes.append(i);
+        }
+        else
+        {
+            m_from[i] = node(package.from);
+            ++incomingCounts[m_to[i]];
+        }
+    }
+
+    m_incomingOffsets.resize(m_nodes.size() + 1);
+    m_incomingOffsets[0] = 0;
+    for(int n = 0; n < m_nodes.size(); ++n)
+        m_incomingOffsets[n + 1] = m_incomingOffsets[n] + incomingCounts.at(n);
+
+    m_incoming.resize(m_incomingOffsets.last());
+    QVector<int> fill = m_incomingOffsets;
+    for(int i = 0; i < packages.size(); ++i)
+    {
+        if(m_from.at(i) >= 0)
+            m_incoming[fill[m_to.at(i)]++] = i;
+    }
+
+    qCDebug(LOG_PACKAGES) << "Graph of" << m_nodes.size() << "revisions built in" << t.elapsed() << "ms";
+}
+
+/*!
+    \brief Returns the indexes in packages() of the cheapest path from \a from to \a to
+    An empty \a from means no local revision, the path starts with a complete package.
+    The path is empty if \a from is \a to or if \a to can't be reached.
+ */
+QVector<int> PackageGraph::findBestPathIndexes(const QString &from, const QString &to)
+{
+    QVector<int> path;
+    if(from == to)
+        return path;
+
+    QHash<QString, int>::const_iterator target = m_nodes.constFind(to);
+    if(target == m_nodes.constEnd())
+        return path;
+
+    const Tree &bestTree = tree(target.value());
+    int node = from.isEmpty() ? -1 : m_nodes.value(from, -1);
+    qint64 patchCost = node >= 0 ? bestTree.cost.at(node) : Unreachable;
+    if(patchCost > bestTree.completeCost)
+    {
+        path.append(bestTree.complete);
+        node = m_to.at(bestTree.complete);
+    }
+    else if(patchCost == Unreachable)
+    {
+        return path;
+    }
+
+    for(int package = bestTree.next.at(node); package >= 0; package = bestTree.next.at(node))
+    {
+        path.append(package);
+        node = m_to.at(package);
+    }
+    return path;
+}
+
+QVector<Package> PackageGraph::findBestPath(const QString &from, const QString &to)
+{
+    QVector<Package> path;
+    foreach(int index, findBestPathIndexes(from, to))
+        path.append(m_packages.at(index));
+    return path;
+}
+
+/*!
+    \brief Returns the shortest path tree toward \a target, computed by Dijkstra on the reversed patches
+ */
+const PackageGraph::Tree &PackageGraph::tree(int target)
+{
+    QHash<int, Tree>::iterator it = m_trees.find(target);
+    if(it != m_trees.end())
+        return it.value();
+
+    QElapsedTimer t;
+    t.start();
+
+    Tree bestTree;
+    bestTree.cost.fill(Unreachable, m_nodes.size());
+    bestTree.next.fill(-1, m_nodes.size());
+    bestTree.cost[target] = 0;
+
+    typedef QPair<qint64, int> Entry; // Cost, node
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > queue;
+    queue.push(Entry(0, target));
+    while(!queue.empty())
+    {
+        Entry entry = queue.top();
+        queue.pop();
+        if(entry.first > bestTree.cost.at(entry.second))
+            continue; // Already reached at a lower cost
+
+        for(int i = m_incomingOffsets.at(entry.second); i < m_incomingOffsets.at(entry.second + 1); ++i)
+        {
+            int package = m_incoming.at(i);
+            if(m_disabled.at(package))
+                continue;
+            int from = m_from.at(package);
+            qint64 cost = entry.first + m_costs.at(package);
+            if(cost < bestTree.cost.at(from))
+            {
+                bestTree.cost[from] = cost;
+                bestTree.next[from] = package;
+                queue.push(Entry(cost, from));
+            }
+        }
+    }
+
+    bestTree.complete = -1;
+    bestTree.completeCost = Unreachable;
+    foreach(int package, m_completes)
+    {
+        if(m_disabled.at(package))
+            continue;
+        qint64 remaining = bestTree.cost.at(m_to.at(package));
+        if(remaining == Unreachable)
+            continue;
+        qint64 cost = m_costs.at(package) + remaining;
+        if(cost < bestTree.completeCost)
+        {
+            bestTree.completeCost = cost;
+            bestTree.complete = package;
+        }
+    }
+
+    qCDebug(LOG_PACKAGES) << "Best paths tree built in" << t.elapsed() << "ms";
+    return m_trees.insert(target, bestTree).value();
+}
@@ -0,0 +1,72 @@
+#ifndef PACKAGEGRAPH_H
+#define PACKAGEGRAPH_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include "package.h"
+#include "packagecostmodel.h"
+
+/*!
+    \brief Compiled graph of packages, to find the best path between revisions
+
+    Revisions are interned to integer nodes and patches are kept in a compressed
+    adjacency array, indexed by the revision they lead to.
+    The cost of each package is given by costModel().
+    Best paths are computed backward from the target revision, so one shortest path tree
+    answers every starting revision, and trees are cached until the packages or the cost model change.
+
+    Complete packages can only be the first package of a path.
+    Packages that can't be downloaded are disabled, the next paths go around them.
+ */
+class PackageGraph
+{
+public:
+    PackageGraph();
+    explicit PackageGraph(const QVector<Package> &packages);
+
+    const QVector<Package> &packages() const;
+    void setPackages(const QVector<Package> &packages);
+    const PackageCostModel &costModel() const;
+    void setCostModel(const PackageCostModel &costModel);
+    void disablePackage(const Package &package);
+
+    QVector<int> findBestPathIndexes(const QString &from, const QString &to);
+    QVector<Package> findBestPath(const QString &from, const QString &to);
+
+private:
+    struct Tree
+    {
+        QVector<qint64> cost; ///< Cost from each node to the target
+        QVector<int> next; ///< First package of the best path from each node, -1 if none
+        int complete; ///< Best complete package to start with, -1 if none
+        qint64 completeCost;
+    };
+
+    const Tree &tree(int target);
+    void updateCosts();
+
+    QVector<Package> m_packages;
+    PackageCostModel m_costModel;
+    QVector<qint64> m_costs; ///< Cost of each package
+    QVector<bool> m_disabled; ///< Packages that must not be used
+    QHash<QString, int> m_nodes; ///< Revision -> node
+    QVector<int> m_from; ///< Node each package starts from, -1 for complete packages
+    QVector<int> m_to; ///< Node each package leads to
+    QVector<int> m_incomingOffsets; ///< Patches leading to node n are m_incoming[m_incomingOffsets[n]..m_incomingOffsets[n + 1]]
+    QVector<int> m_incoming;
+    QVector<int> m_completes;
+    QHash<int, Tree> m_trees; ///< Target node -> shortest path tree
+};
+
+inline const QVector<Package> &PackageGraph::packages() const
+{
+    return m_packages;
+}
+
+inline const PackageCostModel &PackageGraph::costModel() const
+{
+    return m_costModel;
+}
+
+#endif // PACKAGEGRAPH_H
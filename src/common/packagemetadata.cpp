@@ -3,6 +3,8 @@
 #include "jsonutil.h"
 #include "../exceptions.h"
 #include "../operations/addoperation.h"
+#include "../operations/appendoperation.h"
+#include "../operations/blockpatchoperation.h"
 #include "../operations/patchoperation.h"
 #include "../operations/adddirectoryoperation.h"
 #include "../operations/removedirectoryoperation.h"
@@ -78,6 +80,10 @@ void PackageMetadata::operationsFromJsonArrayV1(const QJsonArray &operations)
                 op = new AddOperation();
             else if(type == PatchOperation::Action)
                 op = new PatchOperation();
+            else if(type == AppendOperation::Action)
+                op = new AppendOperation();
+            else if(type == BlockPatchOperation::Action)
+                op = new BlockPatchOperation();
             else if(type == AddDirectoryOperation::Action)
                 op = new AddDirectoryOperation();
             else
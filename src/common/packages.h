@@ -4,11 +4,15 @@
 #include <QVector>
 #include <QJsonObject>
 #include "package.h"
+#include "packagecostmodel.h"
 
 class Packages : public QVector<Package>
 {
 public:
-    QVector<Package> findBestPath(const QString &from, const QString &to);
+    QVector<Package> findBestPath(const QString &from, const QString &to, const PackageCostModel &costModel = PackageCostModel()) const;
+
+    static QString routeName(const QString &from);
+    static bool isRouteName(const QString &name);
 
     void fromJsonObject(const QJsonObject &object);
     QJsonObject toJsonObject() const;
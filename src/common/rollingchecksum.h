@@ -0,0 +1,55 @@
+#ifndef ROLLINGCHECKSUM_H
+#define ROLLINGCHECKSUM_H
+
+#include <QtGlobal>
+
+/*!
+    \brief rsync weak checksum of a fixed size window that can be moved one byte at a time
+
+    Used to find blocks of a file at any position in another file: the checksum is
+    rolled over every position and only the candidates it matches are hashed.
+ */
+class RollingChecksum
+{
+public:
+    RollingChecksum() : m_a(0), m_b(0), m_length(0) {}
+    RollingChecksum(const char *data, qint64 length) { reset(data, length); }
+
+    void reset(const char *data, qint64 length);
+    void roll(char out, char in);
+    quint32 value() const;
+
+private:
+    quint32 m_a, m_b;
+    quint32 m_length;
+};
+
+/*!
+    \brief Start a new window over the \a length first bytes of \a data
+ */
+inline void RollingChecksum::reset(const char *data, qint64 length)
+{
+    m_a = m_b = 0;
+    m_length = quint32(length);
+    for(qint64 i = 0; i < length; ++i)
+    {
+        m_a += quint8(data[i]);
+        m_b += quint32(length - i) * quint8(data[i]);
+    }
+}
+
+/*!
+    \brief Move the window one byte forward, \a out leaves it and \a in enters it
+ */
+inline void RollingChecksum::roll(char out, char in)
+{
+    m_a += quint8(in) - quint8(out);
+    m_b += m_a - m_length * quint8(out);
+}
+
+inline quint32 RollingChecksum::value() const
+{
+    return (m_a & 0xffff) | (m_b << 16);
+}
+
+#endif // ROLLINGCHECKSUM_H
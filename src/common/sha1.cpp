@@ -0,0 +1,537 @@
+#include "sha1.h"
+
+#include <QFile>
+#include <QIODevice>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define SHA1_X86
+#  include <immintrin.h>
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#    define SHA1_TARGET_SHANI
+#  else
+#    include <cpuid.h>
+#    define SHA1_TARGET_SHANI __attribute__((target("sha,ssse3,sse4.1")))
+#  endif
+#endif
+
+namespace
+{
+    const quint32 InitialState[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    const int SmallFileSize = 1024 * 1024; // Files hashed in parallel lanes by hashFiles()
+    const int FilesPerBatch = 64;
+
+    inline quint32 rotl(quint32 x, int n)
+    {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    inline quint32 loadBigEndian(const uchar *p)
+    {
+        return (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | quint32(p[3]);
+    }
+
+    inline void storeBigEndian(uchar *p, quint32 v)
+    {
+        p[0] = uchar(v >> 24);
+        p[1] = uchar(v >> 16);
+        p[2] = uchar(v >> 8);
+        p[3] = uchar(v);
+    }
+
+    void compressPortable(quint32 *state, const uchar *blocks, size_t count)
+    {
+        quint32 w[16];
+        for(; count > 0; --count, blocks += 64)
+        {
+            for(int t = 0; t < 16; ++t)
+                w[t] = loadBigEndian(blocks + 4 * t);
+
+            quint32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+            for(int t = 0; t < 80; ++t)
+            {
+                if(t >= 16)
+                    w[t & 15] = rotl(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1);
+
+                quint32 f, k;
+                if(t < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if(t < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if(t < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+
+                quint32 tmp = rotl(a, 5) + f + e + k + w[t & 15];
+                e = d;
+                d = c;
+                c = rotl(b, 30);
+                b = a;
+                a = tmp;
+            }
+
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+        }
+    }
+
+#ifdef SHA1_X86
+    bool cpuHasShaExtensions()
+    {
+#  if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if(info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool sse41 = (info[2] & (1 << 19)) != 0, ssse3 = (info[2] & (1 << 9)) != 0;
+        __cpuidex(info, 7, 0);
+        return sse41 && ssse3 && (info[1] & (1 << 29)) != 0;
+#  else
+        unsigned int eax, ebx, ecx, edx;
+        if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+        bool sse41 = (ecx & bit_SSE4_1) != 0, ssse3 = (ecx & bit_SSSE3) != 0;
+        if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+        return sse41 && ssse3 && (ebx & (1u << 29)) != 0;
+#  endif
+    }
+
+    // Each step does 4 rounds and prepares the message words of the steps to come
+#  define SHA1_STEP(g) \
+    { \
+        if(g < 4) \
+            msg[g % 4] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(blocks + 16 * g)), byteSwap); \
+        __m128i x = g == 0 ? _mm_add_epi32(e0, msg[0]) : _mm_sha1nexte_epu32(saved, msg[g % 4]); \
+        saved = abcd; \
+        if(g >= 3 && g <= 18) \
+            msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], msg[g % 4]); \
+        abcd = _mm_sha1rnds4_epu32(abcd, x, g / 5); \
+        if(g >= 1 && g <= 16) \
+            msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], msg[g % 4]); \
+        if(g >= 2 && g <= 17) \
+            msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], msg[g % 4]); \
+    }
+
+    SHA1_TARGET_SHANI void compressShaNi(quint32 *state, const uchar *blocks, size_t count)
+    {
+        const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+
+        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(state)), 0x1B);
+        __m128i e0 = _mm_set_epi32(int(state[4]), 0, 0, 0);
+
+        for(; count > 0; --count, blocks += 64)
+        {
+            const __m128i abcdBefore = abcd, e0Before = e0;
+            __m128i msg[4], saved = abcd;
+
+            SHA1_STEP(0)  SHA1_STEP(1)  SHA1_STEP(2)  SHA1_STEP(3)  SHA1_STEP(4)
+            SHA1_STEP(5)  SHA1_STEP(6)  SHA1_STEP(7)  SHA1_STEP(8)  SHA1_STEP(9)
+            SHA1_STEP(10) SHA1_STEP(11) SHA1_STEP(12) SHA1_STEP(13) SHA1_STEP(14)
+            SHA1_STEP(15) SHA1_STEP(16) SHA1_STEP(17) SHA1_STEP(18) SHA1_STEP(19)
+
+            e0 = _mm_sha1nexte_epu32(saved, e0Before);
+            abcd = _mm_add_epi32(abcd, abcdBefore);
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state), _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = quint32(_mm_extract_epi32(e0, 3));
+    }
+#  undef SHA1_STEP
+
+    template<int N> inline __m128i rotl4(__m128i x)
+    {
+        return _mm_or_si128(_mm_slli_epi32(x, N), _mm_srli_epi32(x, 32 - N));
+    }
+
+    /*
+        Compress one block of 4 independent messages, lane i holds the state of message i.
+        SSE2 is part of every x86_64 CPU, no runtime check is needed there.
+     */
+    void compressLanes(quint32 state[5][4], const uchar *const blocks[4])
+    {
+        __m128i w[16];
+        for(int t = 0; t < 16; ++t)
+        {
+            w[t] = _mm_set_epi32(int(loadBigEndian(blocks[3] + 4 * t)), int(loadBigEndian(blocks[2] + 4 * t)),
+                                 int(loadBigEndian(blocks[1] + 4 * t)), int(loadBigEndian(blocks[0] + 4 * t)));
+        }
+
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[0]));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[1]));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[2]));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[3]));
+        __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[4]));
+        const __m128i a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+        for(int t = 0; t < 80; ++t)
+        {
+            if(t >= 16)
+            {
+                w[t & 15] = rotl4<1>(_mm_xor_si128(_mm_xor_si128(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                                   _mm_xor_si128(w[(t - 14) & 15], w[t & 15])));
+            }
+
+            __m128i f, k;
+            if(t < 20)
+            {
+                f = _mm_or_si128(_mm_and_si128(b, c), _mm_andnot_si128(b, d));
+                k = _mm_set1_epi32(0x5A827999);
+            }
+            else if(t < 40)
+            {
+                f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+                k = _mm_set1_epi32(0x6ED9EBA1);
+            }
+            else if(t < 60)
+            {
+                f = _mm_or_si128(_mm_and_si128(b, c), _mm_and_si128(d, _mm_or_si128(b, c)));
+                k = _mm_set1_epi32(int(0x8F1BBCDC));
+            }
+            else
+            {
+                f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+                k = _mm_set1_epi32(int(0xCA62C1D6));
+            }
+
+            __m128i tmp = _mm_add_epi32(_mm_add_epi32(rotl4<5>(a), f), _mm_add_epi32(_mm_add_epi32(e, k), w[t & 15]));
+            e = d;
+            d = c;
+            c = rotl4<30>(b);
+            b = a;
+            a = tmp;
+        }
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[0]), _mm_add_epi32(a, a0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[1]), _mm_add_epi32(b, b0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[2]), _mm_add_epi32(c, c0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[3]), _mm_add_epi32(d, d0));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[4]), _mm_add_epi32(e, e0));
+    }
+#endif
+
+    typedef void (*CompressFunction)(quint32 *state, const uchar *blocks, size_t count);
+
+    CompressFunction selectCompress()
+    {
+#ifdef SHA1_X86
+        if(cpuHasShaExtensions())
+            return compressShaNi;
+#endif
+        return compressPortable;
+    }
+
+    CompressFunction compress = selectCompress();
+
+    /*
+        Padding of a message of \a length bytes whose last partial block starts at \a rest:
+        the partial block, 0x80, zeros and the length in bits.
+        Returns the number of blocks written in \a tail (1 or 2).
+     */
+    int padding(const uchar *rest, quint64 length, uchar tail[128])
+    {
+        int restSize = int(length % 64);
+        int blocks = restSize < 56 ? 1 : 2;
+        std::memset(tail, 0, 128);
+        if(restSize > 0)
+            std::memcpy(tail, rest, size_t(restSize));
+        tail[restSize] = 0x80;
+        quint64 bits = length * 8;
+        storeBigEndian(tail + blocks * 64 - 8, quint32(bits >> 32));
+        storeBigEndian(tail + blocks * 64 - 4, quint32(bits));
+        return blocks;
+    }
+
+    void digest(const quint32 *state, uchar *out)
+    {
+        for(int i = 0; i < 5; ++i)
+            storeBigEndian(out + 4 * i, state[i]);
+    }
+
+#ifdef SHA1_X86
+    /*
+        Hash \a count messages by 4 in SIMD lanes.
+        When a message is done, its lane continues with the next message.
+     */
+    void hashMessagesInLanes(const uchar *const *messages, const quint64 *lengths, int count, uchar (*digests)[20])
+    {
+        struct Lane
+        {
+            int message; ///< -1 if the lane is idle
+            quint64 block, fullBlocks, blockCount;
+            uchar tail[128];
+        };
+
+        static const uchar idleBlock[64] = { 0 };
+        quint32 state[5][4];
+        Lane lanes[4];
+        int next = 0, active = 0;
+
+        auto start = [&](int l) {
+            Lane &lane = lanes[l];
+            if(next < count)
+            {
+                lane.message = next++;
+                quint64 length = lengths[lane.message];
+                lane.block = 0;
+                lane.fullBlocks = length / 64;
+                lane.blockCount = lane.fullBlocks + quint64(padding(messages[lane.message] + (length - length % 64), length, lane.tail));
+                for(int i = 0; i < 5; ++i)
+                    state[i][l] = InitialState[i];
+                ++active;
+            }
+            else
+            {
+                lane.message = -1;
+            }
+        };
+
+        for(int l = 0; l < 4; ++l)
+            start(l);
+
+        while(active > 0)
+        {
+            const uchar *blocks[4];
+            for(int l = 0; l < 4; ++l)
+            {
+                const Lane &lane = lanes[l];
+                if(lane.message < 0)
+                    blocks[l] = idleBlock;
+                else if(lane.block < lane.fullBlocks)
+                    blocks[l] = messages[lane.message] + 64 * lane.block;
+                else
+                    blocks[l] = lane.tail + 64 * (lane.block - lane.fullBlocks);
+            }
+
+            compressLanes(state, blocks);
+
+            for(int l = 0; l < 4; ++l)
+            {
+                Lane &lane = lanes[l];
+                if(lane.message >= 0 && ++lane.block == lane.blockCount)
+                {
+                    quint32 laneState[5];
+                    for(int i = 0; i < 5; ++i)
+                        laneState[i] = state[i][l];
+                    digest(laneState, digests[lane.message]);
+                    --active;
+                    start(l);
+                }
+            }
+        }
+    }
+#endif
+
+    /*
+        Hash \a count messages, in SIMD lanes if SHA-NI isn't available
+     */
+    void hashMessages(const uchar *const *messages, const quint64 *lengths, int count, uchar (*digests)[20])
+    {
+#ifdef SHA1_X86
+        if(compress == compressPortable)
+        {
+            hashMessagesInLanes(messages, lengths, count, digests);
+            return;
+        }
+#endif
+        for(int i = 0; i < count; ++i)
+        {
+            quint64 length = lengths[i];
+            quint32 state[5];
+            uchar tail[128];
+            std::memcpy(state, InitialState, sizeof(state));
+            compress(state, messages[i], size_t(length / 64));
+            compress(state, tail, size_t(padding(messages[i] + (length - length % 64), length, tail)));
+            digest(state, digests[i]);
+        }
+    }
+}
+
+Sha1Hash::Sha1Hash()
+{
+    reset();
+}
+
+void Sha1Hash::reset()
+{
+    std::memcpy(m_state, InitialState, sizeof(m_state));
+    m_length = 0;
+    m_bufferSize = 0;
+}
+
+void Sha1Hash::addData(const char *data, int length)
+{
+    if(length <= 0)
+        return;
+
+    const uchar *bytes = reinterpret_cast<const uchar *>(data);
+    m_length += quint64(length);
+
+    if(m_bufferSize > 0)
+    {
+        int size = qMin(64 - m_bufferSize, length);
+        std::memcpy(m_buffer + m_bufferSize, bytes, size_t(size));
+        m_bufferSize += size;
+        bytes += size;
+        length -= size;
+        if(m_bufferSize < 64)
+            return;
+        compress(m_state, m_buffer, 1);
+        m_bufferSize = 0;
+    }
+
+    if(length >= 64)
+    {
+        compress(m_state, bytes, size_t(length / 64));
+        bytes += length - length % 64;
+        length %= 64;
+    }
+
+    if(length > 0)
+    {
+        std::memcpy(m_buffer, bytes, size_t(length));
+        m_bufferSize = length;
+    }
+}
+
+/*!
+    Reads the data from the open \a device until it ends and hashes it.
+    Returns \c true if reading was successful.
+ */
+bool Sha1Hash::addData(QIODevice *device)
+{
+    if(!device->isReadable())
+        return false;
+
+    char buffer[65536];
+    qint64 read;
+    while((read = device->read(buffer, sizeof(buffer))) > 0)
+        addData(buffer, int(read));
+    return read == 0;
+}
+
+QByteArray Sha1Hash::result() const
+{
+    quint32 state[5];
+    uchar tail[128];
+    std::memcpy(state, m_state, sizeof(state));
+    compress(state, tail, size_t(padding(m_buffer, m_length, tail)));
+
+    QByteArray result(20, Qt::Uninitialized);
+    digest(state, reinterpret_cast<uchar *>(result.data()));
+    return result;
+}
+
+QByteArray Sha1Hash::hash(const QByteArray &data)
+{
+    Sha1Hash hash;
+    hash.addData(data);
+    return hash.result();
+}
+
+/*!
+    Returns \c true if the CPU SHA extensions are used
+ */
+bool Sha1Hash::isAccelerated()
+{
+    return compress != compressPortable;
+}
+
+/*!
+    \brief Use the CPU SHA extensions if \a accelerated, the portable code and SIMD lanes otherwise
+    This is meant to check every implementation on the same CPU and must not be called while hashing.
+    Returns \c false if the implementation isn't supported by the CPU.
+ */
+bool Sha1Hash::setAccelerated(bool accelerated)
+{
+    if(!accelerated)
+    {
+        compress = compressPortable;
+        return true;
+    }
+#ifdef SHA1_X86
+    if(cpuHasShaExtensions())
+    {
+        compress = compressShaNi;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/*!
+    \brief Returns the sha1 of each file of \a filenames, an empty QByteArray if the file can't be read
+    Small files are read entirely and hashed together, big ones are hashed one by one.
+ */
+QVector<QByteArray> Sha1Hash::hashFiles(const QStringList &filenames)
+{
+    QVector<QByteArray> results(filenames.size());
+    QVector<int> smallFiles;
+
+    for(int i = 0; i < filenames.size(); ++i)
+    {
+        QFile file(filenames[i]);
+        if(file.size() <= SmallFileSize)
+        {
+            smallFiles.append(i);
+        }
+        else if(file.open(QIODevice::ReadOnly))
+        {
+            Sha1Hash hash;
+            if(hash.addData(&file))
+                results[i] = hash.result();
+        }
+    }
+
+    for(int first = 0; first < smallFiles.size(); first += FilesPerBatch)
+    {
+        QVector<int> indexes;
+        QVector<QByteArray> contents;
+        for(int i = first; i < smallFiles.size() && i < first + FilesPerBatch; ++i)
+        {
+            QFile file(filenames[smallFiles[i]]);
+            if(file.open(QIODevice::ReadOnly))
+            {
+                QByteArray content = file.readAll();
+                if(file.error() == QFile::NoError)
+                {
+                    indexes.append(smallFiles[i]);
+                    contents.append(content);
+                }
+            }
+        }
+
+        QVector<const uchar *> messages(contents.size());
+        QVector<quint64> lengths(contents.size());
+        for(int i = 0; i < contents.size(); ++i)
+        {
+            messages[i] = reinterpret_cast<const uchar *>(contents[i].constData());
+            lengths[i] = quint64(contents[i].size());
+        }
+
+        QByteArray digests(20 * contents.size(), Qt::Uninitialized);
+        hashMessages(messages.constData(), lengths.constData(), contents.size(), reinterpret_cast<uchar (*)[20]>(digests.data()));
+        for(int i = 0; i < indexes.size(); ++i)
+            results[indexes[i]] = digests.mid(20 * i, 20);
+    }
+
+    return results;
+}
@@ -0,0 +1,46 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include "../qtupdatesystem_global.h"
+#include <QByteArray>
+#include <QStringList>
+#include <QVector>
+
+class QIODevice;
+
+/*!
+    \brief SHA1 hashing, with the same results as QCryptographicHash::Sha1
+
+    The fastest implementation supported by the CPU is chosen at runtime:
+    SHA extensions (SHA-NI) if available, portable code otherwise.
+    hashFiles() also hashes small files by 4 in parallel SIMD lanes when SHA-NI isn't available.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT Sha1Hash
+{
+public:
+    Sha1Hash();
+
+    void reset();
+    void addData(const char *data, int length);
+    void addData(const QByteArray &data);
+    bool addData(QIODevice *device);
+    QByteArray result() const;
+
+    static QByteArray hash(const QByteArray &data);
+    static QVector<QByteArray> hashFiles(const QStringList &filenames);
+    static bool isAccelerated();
+    static bool setAccelerated(bool accelerated);
+
+private:
+    quint32 m_state[5];
+    quint64 m_length; ///< Number of bytes hashed
+    uchar m_buffer[64];
+    int m_bufferSize; ///< Bytes in m_buffer not hashed yet
+};
+
+inline void Sha1Hash::addData(const QByteArray &data)
+{
+    addData(data.constData(), data.size());
+}
+
+#endif // SHA1_H
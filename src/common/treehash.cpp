@@ -0,0 +1,163 @@
+#include "treehash.h"
+#include "jsonutil.h"
+#include "../exceptions.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <atomic>
+
+static const QString Version = QStringLiteral("version");
+static const QString ChunkSize = QStringLiteral("chunkSize");
+static const QString Root = QStringLiteral("root");
+static const QString TreeVersion = QStringLiteral("1");
+
+namespace
+{
+    /*
+        Hashes a contiguous range of chunks, each task reads its own part of the file
+     */
+    class ChunkHashTask : public QRunnable
+    {
+    public:
+        ChunkHashTask(const QString &filename, qint64 chunkSize, qint64 first, qint64 count, QByteArray *hashes, std::atomic<bool> *failed) :
+            m_filename(filename), m_chunkSize(chunkSize), m_first(first), m_count(count), m_hashes(hashes), m_failed(failed) {}
+
+        virtual void run() Q_DECL_OVERRIDE
+        {
+            QFile file(m_filename);
+            if(!file.open(QFile::ReadOnly) || !file.seek(m_first * m_chunkSize))
+            {
+                *m_failed = true;
+                return;
+            }
+
+            QByteArray chunk;
+            for(qint64 i = 0; i < m_count && !*m_failed; ++i)
+            {
+                chunk = file.read(m_chunkSize);
+                if(chunk.isEmpty() && m_first + i > 0)
+                {
+                    *m_failed = true;
+                    return;
+                }
+                m_hashes[i] = TreeHash::leafHash(chunk.constData(), chunk.size());
+            }
+        }
+
+    private:
+        QString m_filename;
+        qint64 m_chunkSize, m_first, m_count;
+        QByteArray *m_hashes;
+        std::atomic<bool> *m_failed;
+    };
+}
+
+TreeHash::TreeHash() :
+    m_chunkSize(DefaultChunkSize)
+{
+}
+
+/*!
+    \brief Loads the tree signature from \a object
+    Unknown versions leave the tree null, so the sha1 signature is used instead.
+ */
+void TreeHash::fromJsonObject(const QJsonObject &object)
+{
+    m_root.clear();
+    if(object.value(Version).toString() != TreeVersion)
+        return;
+
+    m_chunkSize = JsonUtil::asInt64String(object, ChunkSize);
+    if(m_chunkSize <= 0)
+        THROW(JsonError, QObject::tr("'%1' must be positive").arg(ChunkSize));
+    m_root = QByteArray::fromHex(JsonUtil::asString(object, Root).toLatin1());
+}
+
+QJsonObject TreeHash::toJsonObject() const
+{
+    QJsonObject object;
+    object.insert(Version, TreeVersion);
+    object.insert(ChunkSize, QString::number(m_chunkSize));
+    object.insert(Root, QString(m_root.toHex()));
+    return object;
+}
+
+/*!
+    \brief Returns the tree signature of \a filename, a null one if the file can't be read
+    Chunks are hashed by as many threads as there are cores.
+ */
+TreeHash TreeHash::hashFile(const QString &filename, qint64 chunkSize)
+{
+    TreeHash tree;
+    tree.m_chunkSize = chunkSize;
+
+    qint64 size = QFile(filename).size();
+    qint64 chunkCount = qMax<qint64>(1, (size + chunkSize - 1) / chunkSize);
+    QVector<QByteArray> hashes = chunkHashes(filename, chunkSize, 0, chunkCount);
+    if(!hashes.isEmpty())
+        tree.m_root = rootHash(hashes);
+    return tree;
+}
+
+/*!
+    \brief Returns the leaf hashes of \a chunkCount chunks of \a filename from \a firstChunk
+    Any range of chunks can be checked this way, independently of the rest of the file.
+    Returns an empty vector if the chunks can't be read.
+ */
+QVector<QByteArray> TreeHash::chunkHashes(const QString &filename, qint64 chunkSize, qint64 firstChunk, qint64 chunkCount)
+{
+    QVector<QByteArray> hashes(int(chunkCount));
+    std::atomic<bool> failed(false);
+
+    QThreadPool pool;
+    int threadCount = int(qMin<qint64>(qMax(1, QThread::idealThreadCount()), chunkCount));
+    pool.setMaxThreadCount(threadCount);
+    qint64 perThread = (chunkCount + threadCount - 1) / threadCount;
+    for(qint64 first = 0; first < chunkCount; first += perThread)
+    {
+        qint64 count = qMin(perThread, chunkCount - first);
+        pool.start(new ChunkHashTask(filename, chunkSize, firstChunk + first, count, hashes.data() + first, &failed));
+    }
+    pool.waitForDone();
+
+    if(failed)
+        return QVector<QByteArray>();
+    return hashes;
+}
+
+QByteArray TreeHash::leafHash(const char *data, qint64 size)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData("\x00", 1);
+    hash.addData(data, int(size));
+    return hash.result();
+}
+
+QByteArray TreeHash::nodeHash(const QByteArray &left, const QByteArray &right)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData("\x01", 1);
+    hash.addData(left);
+    hash.addData(right);
+    return hash.result();
+}
+
+QByteArray TreeHash::rootHash(QVector<QByteArray> hashes)
+{
+    if(hashes.isEmpty())
+        return QByteArray();
+
+    while(hashes.size() > 1)
+    {
+        int size = hashes.size();
+        for(int i = 0; i < size / 2; ++i)
+            hashes[i] = nodeHash(hashes[2 * i], hashes[2 * i + 1]);
+        if(size % 2 == 1)
+            hashes[size / 2] = hashes[size - 1];
+        hashes.resize((size + 1) / 2);
+    }
+    return hashes.first();
+}
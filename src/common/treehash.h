@@ -0,0 +1,71 @@
+#ifndef TREEHASH_H
+#define TREEHASH_H
+
+#include "../qtupdatesystem_global.h"
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+/*!
+    \brief SHA-256 Merkle tree signature of a file
+
+    The file is split in chunks of chunkSize() bytes, each chunk is hashed independently (leaf hashes),
+    then pairs of hashes are hashed together up to the root. The last hash of a level without a pair
+    is moved to the next level as is.
+    Leaves are computed in parallel, so a huge file is verified by all the cores.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT TreeHash
+{
+public:
+    static const qint64 DefaultChunkSize = 4 * 1024 * 1024; // 4MB
+    static const qint64 MinFileSize = 16 * DefaultChunkSize; // 64MB, smaller files are hashed fast enough by one core
+
+    TreeHash();
+
+    bool isNull() const;
+    qint64 chunkSize() const;
+    QByteArray root() const;
+    bool operator==(const TreeHash &other) const;
+    bool operator!=(const TreeHash &other) const;
+
+    void fromJsonObject(const QJsonObject &object);
+    QJsonObject toJsonObject() const;
+
+    static TreeHash hashFile(const QString &filename, qint64 chunkSize = DefaultChunkSize);
+    static QVector<QByteArray> chunkHashes(const QString &filename, qint64 chunkSize, qint64 firstChunk, qint64 chunkCount);
+    static QByteArray leafHash(const char *data, qint64 size);
+    static QByteArray nodeHash(const QByteArray &left, const QByteArray &right);
+    static QByteArray rootHash(QVector<QByteArray> hashes);
+
+private:
+    qint64 m_chunkSize;
+    QByteArray m_root;
+};
+
+inline bool TreeHash::isNull() const
+{
+    return m_root.isEmpty();
+}
+
+inline qint64 TreeHash::chunkSize() const
+{
+    return m_chunkSize;
+}
+
+inline QByteArray TreeHash::root() const
+{
+    return m_root;
+}
+
+inline bool TreeHash::operator==(const TreeHash &other) const
+{
+    return m_chunkSize == other.m_chunkSize && m_root == other.m_root;
+}
+
+inline bool TreeHash::operator!=(const TreeHash &other) const
+{
+    return !(*this == other);
+}
+
+#endif // TREEHASH_H
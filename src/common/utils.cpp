@@ -1,5 +1,23 @@
 #include "utils.h"
+#include <QDateTime>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#if defined(Q_OS_WIN)
+#  include <windows.h>
+#  include <io.h>
+#else
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#if defined(Q_OS_LINUX)
+#  include <errno.h>
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#endif
 
 namespace Utils {
 
@@ -54,4 +72,144 @@ QString formatMs(qint64 millisec)
     return QStringLiteral("%1 days").arg(time, 0, 'g', 2);
 }
 
+/*!
+    \brief Flush \a file and wait for its content to be on disk
+    Required before anything that relies on the file surviving a crash.
+ */
+bool syncFile(QFile *file)
+{
+    if(!file->flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file->handle()))) != 0;
+#else
+    return ::fsync(file->handle()) == 0;
+#endif
+}
+
+/*!
+    \brief Wait for all the written files of the filesystem containing \a path to be on disk
+    One call replaces syncing every file that was modified, when many were.
+    On Windows, flushing a whole volume requires administrator rights, so nothing is done.
+ */
+bool syncFileSystem(const QString &path)
+{
+#if defined(Q_OS_LINUX)
+    int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY);
+    if(fd == -1)
+        return false;
+    bool synced = ::syncfs(fd) == 0;
+    ::close(fd);
+    return synced;
+#elif defined(Q_OS_WIN)
+    Q_UNUSED(path);
+    return true;
+#else
+    Q_UNUSED(path);
+    ::sync();
+    return true;
+#endif
+}
+
+/*!
+    \brief Copy \a source to \a destination, which must not exist
+    If \a hardLink is \c true, a hard link is created if possible instead of a copy.
+    The copy keeps the modification time of \a source, so its stamp can be trusted like the one of the source.
+    On Linux the content is shared with a reflink if the filesystem supports it,
+    or copied by the kernel with copy_file_range.
+ */
+bool copyFile(const QString &source, const QString &destination, bool hardLink)
+{
+    const QByteArray sourceName = QFile::encodeName(source);
+    const QByteArray destinationName = QFile::encodeName(destination);
+
+#if defined(Q_OS_UNIX)
+    if(hardLink && ::link(sourceName.constData(), destinationName.constData()) == 0)
+        return true;
+#elif defined(Q_OS_WIN)
+    if(hardLink && CreateHardLinkW(reinterpret_cast<LPCWSTR>(destination.utf16()), reinterpret_cast<LPCWSTR>(source.utf16()), NULL))
+        return true;
+#else
+    Q_UNUSED(hardLink);
+#endif
+
+#if defined(Q_OS_LINUX)
+    int in = ::open(sourceName.constData(), O_RDONLY | O_CLOEXEC);
+    if(in < 0)
+        return false;
+
+    struct stat st;
+    int out = ::fstat(in, &st) == 0 ? ::open(destinationName.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777) : -1;
+    if(out < 0)
+    {
+        ::close(in);
+        return false;
+    }
+
+    bool copied = false, fallback = true;
+# if defined(FICLONE)
+    copied = ::ioctl(out, FICLONE, in) == 0;
+# endif
+# if defined(SYS_copy_file_range)
+    if(!copied)
+    {
+        qint64 remaining = st.st_size;
+        long count = 1;
+        while(remaining > 0 && (count = ::syscall(SYS_copy_file_range, in, nullptr, out, nullptr, size_t(qMin<qint64>(remaining, 1 << 30)), 0u)) > 0)
+            remaining -= count;
+        copied = remaining == 0;
+        // Copies unsupported between those files fail before anything is written
+        fallback = !copied && count < 0 && remaining == st.st_size
+                && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP);
+    }
+# endif
+    ::fchmod(out, st.st_mode & 07777);
+    const struct timespec times[2] = { st.st_atim, st.st_mtim };
+    ::futimens(out, times);
+    if(::close(out) != 0)
+        copied = false;
+    ::close(in);
+
+    if(copied)
+        return true;
+    ::unlink(destinationName.constData());
+    if(!fallback)
+        return false;
+#endif
+
+    if(!QFile::copy(source, destination))
+        return false;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0) && !defined(Q_OS_WIN) // Windows keeps it already
+    QFile copy(destination);
+    if(copy.open(QFile::ReadWrite))
+        copy.setFileTime(QFileInfo(source).lastModified(), QFileDevice::FileModificationTime);
+#endif
+    return true;
+}
+
+/*!
+    \brief Returns the number of hard links to \a filename, 0 if it doesn't exist
+    Returns 1 where hard links aren't supported.
+ */
+int linkCount(const QString &filename)
+{
+#if defined(Q_OS_UNIX)
+    struct stat st;
+    if(::stat(QFile::encodeName(filename).constData(), &st) != 0)
+        return 0;
+    return int(st.st_nlink);
+#elif defined(Q_OS_WIN)
+    HANDLE handle = CreateFileW(reinterpret_cast<LPCWSTR>(filename.utf16()), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(handle == INVALID_HANDLE_VALUE)
+        return 0;
+    BY_HANDLE_FILE_INFORMATION info;
+    int count = GetFileInformationByHandle(handle, &info) ? int(info.nNumberOfLinks) : 1;
+    CloseHandle(handle);
+    return count;
+#else
+    return QFile::exists(filename) ? 1 : 0;
+#endif
+}
+
 }
@@ -4,8 +4,14 @@
 #include <QString>
 #include "../qtupdatesystem_global.h"
 
+class QFile;
+
 namespace Utils {
     QTUPDATESYSTEMSHARED_EXPORT QString cleanPath(const QString &pathName, bool separatorAtEnd = true);
     QTUPDATESYSTEMSHARED_EXPORT QString formatMs(qint64 millisec);
+    QTUPDATESYSTEMSHARED_EXPORT bool syncFile(QFile *file);
+    QTUPDATESYSTEMSHARED_EXPORT bool syncFileSystem(const QString &path);
+    QTUPDATESYSTEMSHARED_EXPORT bool copyFile(const QString &source, const QString &destination, bool hardLink = false);
+    QTUPDATESYSTEMSHARED_EXPORT int linkCount(const QString &filename);
 }
 #endif // UTILS_H
@@ -21,6 +21,8 @@ QString Warning::typeString() const
         return QStringLiteral("CopyRemove");
     case CopyMkPath:
         return QStringLiteral("CopyMkPath");
+    case PackageDownload:
+        return QStringLiteral("PackageDownload");
     default:
         return QStringLiteral("Unknown");
     }
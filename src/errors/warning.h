@@ -53,7 +53,8 @@ public:
         RemoveDirs,
         Copy,
         CopyRemove,
-        CopyMkPath
+        CopyMkPath,
+        PackageDownload
     };
 
 #if defined(ERROR_CONTEXT)
@@ -1,13 +1,17 @@
 #include "addoperation.h"
 #include "../common/jsonutil.h"
+#include "../common/rollingchecksum.h"
 #include "../common/utils.h"
+#include "../exceptions.h"
 #include "../tools/brotli.h"
 #include "../tools/lzma.h"
 #include <QLoggingCategory>
+#include <QBuffer>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
 #include <QJsonDocument>
+#include <QMultiHash>
 
 Q_LOGGING_CATEGORY(LOG_ADDOP, "updatesystem.addoperation")
 
@@ -19,14 +23,61 @@ const QString AddOperation::DataSha1 = QStringLiteral("dataSha1");
 const QString AddOperation::DataCompression = QStringLiteral("dataCompression");
 const QString AddOperation::FinalSize = QStringLiteral("finalSize");
 const QString AddOperation::FinalSha1 = QStringLiteral("finalSha1");
+const QString AddOperation::FinalSample = QStringLiteral("finalSample");
+const QString AddOperation::FinalTree = QStringLiteral("finalTree");
+const QString AddOperation::BlockSize = QStringLiteral("blockSize");
+const QString AddOperation::Blocks = QStringLiteral("blocks");
+
+const QString BLOCK_ROLLING = QStringLiteral("rolling");
+const QString BLOCK_SHA1 = QStringLiteral("sha1");
+const QString BLOCK_SIZE = QStringLiteral("size");
 
 const QString COMPRESSION_LZMA = QStringLiteral("lzma");
 const QString COMPRESSION_BROTLI = QStringLiteral("brotli");
 const QString COMPRESSION_NONE = QStringLiteral("none");
 
+/*!
+    \brief Writes the decompressed data of a streamed operation while hashing it
+ */
+class AddOperation::StreamWriter : public QIODevice
+{
+public:
+    StreamWriter(const QString &filename) :
+        file(filename)
+    {
+        setOpenMode(QIODevice::WriteOnly);
+    }
+
+    QFile file;
+    Sha1Hash finalHash;
+    QScopedPointer<QIODevice> decompressor;
+
+protected:
+    qint64 readData(char *, qint64) Q_DECL_OVERRIDE
+    {
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 len) Q_DECL_OVERRIDE
+    {
+        finalHash.addData(data, len);
+        qint64 written = file.write(data, len);
+        if(written != len)
+            setErrorString(file.errorString());
+        return written;
+    }
+};
+
 AddOperation::AddOperation() : Operation()
 {
     m_finalSize = 0;
+    m_blockSize = 0;
+}
+
+AddOperation::~AddOperation()
+{
+    if(m_stream)
+        abortStream();
 }
 
 Operation::FileType AddOperation::fileType() const
@@ -44,9 +95,66 @@ void AddOperation::fromJsonObjectV1(const QJsonObject &object)
     m_compression = JsonUtil::asString(object, DataCompression);
     m_finalSize = JsonUtil::asInt64String(object, FinalSize);
     m_finalSha1 = JsonUtil::asString(object, FinalSha1);
+    m_finalSample = object.contains(FinalSample) ? JsonUtil::asString(object, FinalSample) : QString();
+    m_finalTree = TreeHash();
+    if(object.contains(FinalTree))
+        m_finalTree.fromJsonObject(JsonUtil::asObject(object, FinalTree));
+    m_blockSize = 0;
+    m_blocks.clear();
+    if(object.contains(BlockSize))
+    {
+        m_blockSize = JsonUtil::asInt64String(object, BlockSize);
+        blocksFromJsonArray(JsonUtil::asArray(object, Blocks));
+    }
 }
 
-void AddOperation::readAll(QIODevice *from, QIODevice *to, QCryptographicHash *hash)
+QJsonArray AddOperation::blocksToJsonArray() const
+{
+    QJsonArray blocks;
+    foreach(const Block &block, m_blocks)
+    {
+        QJsonObject object;
+        object.insert(BLOCK_ROLLING, QString::number(block.rolling, 16));
+        object.insert(BLOCK_SHA1, QString(block.sha1.toHex()));
+        object.insert(BLOCK_SIZE, QString::number(block.size));
+        blocks.append(object);
+    }
+    return blocks;
+}
+
+void AddOperation::blocksFromJsonArray(const QJsonArray &blocks)
+{
+    if(m_blockSize <= 0 || blocks.size() != (m_finalSize + m_blockSize - 1) / m_blockSize)
+        THROW(JsonError, QObject::tr("Invalid blocks of %1").arg(path()));
+
+    qint64 offset = 0;
+    m_blocks.clear();
+    m_blocks.reserve(blocks.size());
+    foreach(const QJsonValue &value, blocks)
+    {
+        QJsonObject object = JsonUtil::asObject(value);
+        Block block;
+        bool ok;
+        block.rolling = JsonUtil::asString(object, BLOCK_ROLLING).toUInt(&ok, 16);
+        block.sha1 = QByteArray::fromHex(JsonUtil::asString(object, BLOCK_SHA1).toLatin1());
+        block.offset = offset;
+        block.size = JsonUtil::asInt64String(object, BLOCK_SIZE);
+        if(!ok || block.sha1.size() != 20 || block.size <= 0)
+            THROW(JsonError, QObject::tr("Invalid blocks of %1").arg(path()));
+        offset += block.size;
+        m_blocks.append(block);
+    }
+
+    if(offset != m_size)
+        THROW(JsonError, QObject::tr("Invalid blocks of %1").arg(path()));
+}
+
+qint64 AddOperation::blockLength(int index) const
+{
+    return qMin(m_blockSize, m_finalSize - index * m_blockSize);
+}
+
+void AddOperation::readAll(QIODevice *from, QIODevice *to, Sha1Hash *hash)
 {
     char buffer[65536];
     qint64 read;
@@ -60,7 +168,24 @@ void AddOperation::readAll(QIODevice *from, QIODevice *to, QCryptographicHash *h
         throw QObject::tr("Read failed: %1").arg(from->errorString());
 }
 
-void AddOperation::create(const QString &filepath, const QString &newFilename, const QString &tmpDirectory)
+/*!
+    \brief Returns \c true if \a file content is the final one
+    The tree signature, if any, is preferred so huge files are verified by all the cores.
+ */
+bool AddOperation::isFinalFile(QFile *file) const
+{
+    if(file->size() != m_finalSize)
+        return false;
+    if(!m_finalTree.isNull())
+        return TreeHash::hashFile(file->fileName(), m_finalTree.chunkSize()) == m_finalTree;
+    return sha1(file) == m_finalSha1;
+}
+
+/*!
+    \param blockSize If not 0 and the file is bigger, the file is compressed by blocks of that size,
+    so a damaged local file can be repaired by downloading only the blocks that differ
+ */
+void AddOperation::create(const QString &filepath, const QString &newFilename, const QString &tmpDirectory, qint64 blockSize)
 {
     // Final file informations
     QFile file(newFilename);
@@ -68,8 +193,12 @@ void AddOperation::create(const QString &filepath, const QString &newFilename, c
         throw QObject::tr("File %1 doesn't exists").arg(newFilename);
     m_finalSha1 = sha1(&file);
     m_finalSize = file.size();
+    m_finalSample = sample(&file);
+    m_finalTree = treeHash(&file);
+    m_blockSize = blockSize > 0 && m_finalSize > blockSize ? blockSize : 0;
+    m_blocks.clear();
     setPath(filepath);
-    setDataFilename(tmpDirectory + "add_" + m_finalSha1);
+    setDataFilename(tmpDirectory + "add_" + m_finalSha1 + (m_blockSize > 0 ? "_" + QString::number(m_blockSize) : QString()));
 
     QFile dataFile(dataFilename());
     QFile metadataFile(dataFilename() + ".metadata");
@@ -84,6 +213,8 @@ void AddOperation::create(const QString &filepath, const QString &newFilename, c
                 m_size = JsonUtil::asInt64String(object, DataSize);
                 m_sha1 = JsonUtil::asString(object, DataSha1);
                 m_compression = JsonUtil::asString(object, DataCompression);
+                if(m_blockSize > 0)
+                    blocksFromJsonArray(JsonUtil::asArray(object, Blocks));
                 return;
             }
             catch(...) { }
@@ -100,11 +231,36 @@ void AddOperation::create(const QString &filepath, const QString &newFilename, c
     if (!metadataFile.open(QFile::WriteOnly | QFile::Truncate | QFile::Text))
         throw QObject::tr("Unable to open file %1 for writing : %2").arg(metadataFile.fileName(), metadataFile.errorString());
 
-    QScopedPointer<QIODevice> compressor(BrotliCompressor(&file));
     m_compression = COMPRESSION_BROTLI;
-    
-    QCryptographicHash sha1Hash(QCryptographicHash::Sha1);
-    readAll(compressor.data(), &dataFile, &sha1Hash);
+    Sha1Hash sha1Hash;
+
+    if(m_blockSize > 0)
+    {
+        // Blocks are compressed independently, so each one can be downloaded and decompressed alone
+        while(!file.atEnd())
+        {
+            QBuffer buffer;
+            buffer.setData(file.read(m_blockSize));
+            if(buffer.size() == 0)
+                throw QObject::tr("Unable to read file %1").arg(file.fileName());
+
+            Block block;
+            block.rolling = RollingChecksum(buffer.data().constData(), buffer.size()).value();
+            block.sha1 = Sha1Hash::hash(buffer.data());
+            block.offset = dataFile.pos();
+
+            buffer.open(QBuffer::ReadOnly);
+            QScopedPointer<QIODevice> compressor(BrotliCompressor(&buffer));
+            readAll(compressor.data(), &dataFile, &sha1Hash);
+            block.size = dataFile.pos() - block.offset;
+            m_blocks.append(block);
+        }
+    }
+    else
+    {
+        QScopedPointer<QIODevice> compressor(BrotliCompressor(&file));
+        readAll(compressor.data(), &dataFile, &sha1Hash);
+    }
 
     m_sha1 = QString(sha1Hash.result().toHex());
     m_size = dataFile.size();
@@ -122,6 +278,8 @@ void AddOperation::create(const QString &filepath, const QString &newFilename, c
         object.insert(DataSize, QString::number(m_size));
         object.insert(DataSha1, m_sha1);
         object.insert(DataCompression, m_compression);
+        if(m_blockSize > 0)
+            object.insert(Blocks, blocksToJsonArray());
         if(metadataFile.write(QJsonDocument(object).toJson()) == -1)
             throw QObject::tr("Unable to write metadata");
 
@@ -134,12 +292,16 @@ void AddOperation::create(const QString &filepath, const QString &newFilename, c
 
 Operation::Status AddOperation::localDataStatus()
 {
+    if(isStreamed())
+        return ApplyRequired; // Both data and final signatures were checked while streaming
+
     QFile file(localFilename());
 
     if(file.exists())
     {
         // Check final file content
-        if(file.size() == m_finalSize && sha1(&file) == m_finalSha1)
+        if(file.size() == m_finalSize && matchesSample(&file, m_finalSample)
+                && localFileSha1(&file, { KnownFile(m_finalSha1, m_finalTree) }) == m_finalSha1)
         {
             qCDebug(LOG_ADDOP) << "File is already at the right version" << path();
             return Valid;
@@ -147,10 +309,18 @@ Operation::Status AddOperation::localDataStatus()
     }
 
     file.setFileName(dataFilename());
+    if(isPartialDownload())
+    {
+        // Blocks signatures are checked while applying
+        if(requiredSize() == 0 || file.size() == requiredSize())
+            return ApplyRequired;
+        return DownloadRequired;
+    }
+
     if(file.exists())
     {
         // Check downloaded data file content
-        if(file.size() == size() && sha1(&file) == sha1())
+        if(file.size() == size() && (isDataVerified() || sha1(&file) == sha1()))
         {
             qCDebug(LOG_ADDOP) << "File data is valid" << path();
             return ApplyRequired;
@@ -162,14 +332,37 @@ Operation::Status AddOperation::localDataStatus()
     return DownloadRequired;
 }
 
+void AddOperation::mkLocalPath()
+{
+    QFileInfo fileInfo(localFilename());
+    QDir filedir = fileInfo.dir();
+    if(!filedir.exists() && !filedir.mkpath(filedir.absolutePath()))
+        throw QObject::tr("Unable to create directory %1 for %2").arg(filedir.path(), path());
+}
+
 void AddOperation::applyData()
 {
     // Ensure file directory exists
+    mkLocalPath();
+
+    if(isStreamed())
+    {
+        if(QFile::exists(localFilename()) && !QFile::remove(localFilename()))
+            throw QObject::tr("Unable to remove file %1").arg(path());
+        if(!QFile::rename(streamFilename(), localFilename()))
+            throw QObject::tr("Unable to rename file %1 to %2").arg(streamFilename(), path());
+        m_streamed = false;
+        qCDebug(LOG_ADDOP) << "Streamed file committed" << path();
+
+        if(QFile::exists(dataFilename()))
+            cleanup();
+        return;
+    }
+
+    if(m_blockSize > 0)
     {
-        QFileInfo fileInfo(localFilename());
-        QDir filedir = fileInfo.dir();
-        if(!filedir.exists() && !filedir.mkpath(filedir.absolutePath()))
-            throw QObject::tr("Unable to create directory %1 for %2").arg(filedir.path(), path());
+        applyBlocks();
+        return;
     }
 
     if(m_compression == COMPRESSION_NONE)
@@ -177,6 +370,7 @@ void AddOperation::applyData()
         QFile dataFile(dataFilename());
         if(!dataFile.rename(localFilename()))
             throw QObject::tr("Unable to rename file %1 to %2").arg(dataFilename(), path());
+        QFile::remove(dataSha1Filename());
         qCDebug(LOG_ADDOP) << "Rename succeeded" << path();
         return;
     }
@@ -184,6 +378,9 @@ void AddOperation::applyData()
     {
         qCDebug(LOG_ADDOP) << "Decompressing" << dataFilename() << "to" << path() << "by" << m_compression;
 
+        // A new file, the previous one may be hard linked by a copy
+        if(QFile::exists(localFilename()) && !QFile::remove(localFilename()))
+            throw QObject::tr("Unable to remove file %1").arg(path());
         QFile file(localFilename());
         if(!file.open(QFile::WriteOnly | QFile::Truncate))
             throw QObject::tr("Unable to open file %1 for writing").arg(file.fileName());
@@ -193,7 +390,7 @@ void AddOperation::applyData()
             throw QObject::tr("Unable to open file %1 for reading").arg(dataFile.fileName());
 
         QScopedPointer<QIODevice> decompressor(m_compression == COMPRESSION_BROTLI ? BrotliDecompressor(&dataFile) : LZMADecompressor(&dataFile));
-        QCryptographicHash sha1Hash(QCryptographicHash::Sha1);
+        Sha1Hash sha1Hash;
         readAll(decompressor.data(), &file, &sha1Hash);
 
         if(QString(sha1Hash.result().toHex()) != m_finalSha1)
@@ -217,6 +414,297 @@ void AddOperation::applyData()
     }
 }
 
+/*!
+    \brief Build the final file block by block
+    Blocks found in the local file by planRepair() are copied from it,
+    the other ones are decompressed from the data in order.
+ */
+void AddOperation::applyBlocks()
+{
+    qCDebug(LOG_ADDOP) << "Decompressing" << m_blocks.size() << "blocks to" << path() << "by" << m_compression;
+
+    QFile file(blocksFilename());
+    if(!file.open(QFile::WriteOnly | QFile::Truncate))
+        throw QObject::tr("Unable to open file %1 for writing").arg(file.fileName());
+
+    QFile localFile(localFilename());
+    if(isPartialDownload() && !localFile.open(QFile::ReadOnly))
+        throw QObject::tr("Unable to open file %1 for reading").arg(localFile.fileName());
+
+    QFile dataFile(dataFilename());
+    if(requiredSize() > 0 && !dataFile.open(QFile::ReadOnly))
+        throw QObject::tr("Unable to open file %1 for reading").arg(dataFile.fileName());
+
+    Sha1Hash sha1Hash;
+    for(int i = 0; i < m_blocks.size(); ++i)
+    {
+        const Block &block = m_blocks[i];
+        QByteArray data;
+        if(isPartialDownload() && m_localBlocks[i] >= 0)
+        {
+            if(!localFile.seek(m_localBlocks[i]))
+                throw QObject::tr("Unable to read file %1").arg(localFile.fileName());
+            data = localFile.read(blockLength(i));
+        }
+        else
+        {
+            QBuffer buffer;
+            buffer.setData(dataFile.read(block.size));
+            buffer.open(QBuffer::ReadOnly);
+            QScopedPointer<QIODevice> decompressor(m_compression == COMPRESSION_BROTLI ? BrotliDecompressor(&buffer) : LZMADecompressor(&buffer));
+            data = decompressor->readAll();
+        }
+
+        if(data.size() != blockLength(i) || Sha1Hash::hash(data) != block.sha1)
+            throw QObject::tr("Block %1 of %2 is invalid").arg(i).arg(path());
+
+        sha1Hash.addData(data);
+        if(file.write(data) != data.size())
+            throw QObject::tr("Write failed: %1").arg(file.errorString());
+    }
+
+    if(QString(sha1Hash.result().toHex()) != m_finalSha1)
+        throw QObject::tr("Final sha1 file signature doesn't match");
+
+    if(!file.flush())
+        throw QObject::tr("Unable to flush all extracted data");
+
+    file.close();
+    localFile.close();
+    dataFile.close();
+
+    if(QFile::exists(localFilename()) && !QFile::remove(localFilename()))
+        throw QObject::tr("Unable to remove file %1").arg(path());
+    if(!file.rename(localFilename()))
+        throw QObject::tr("Unable to rename file %1 to %2").arg(file.fileName(), path());
+
+    qCDebug(LOG_ADDOP) << "Decompression succeeded of" << path();
+
+    m_partialDownload = false;
+    m_localBlocks.clear();
+    if(QFile::exists(dataFilename()))
+        cleanup();
+}
+
+/*!
+    \brief Find the blocks of the final file that are already in the local file
+    Only the compressed data of the missing blocks will have to be downloaded.
+ */
+void AddOperation::planRepair()
+{
+    m_partialDownload = false;
+    m_requiredData.clear();
+    m_localBlocks.clear();
+    if(m_blockSize <= 0 || (m_compression != COMPRESSION_BROTLI && m_compression != COMPRESSION_LZMA))
+        return;
+
+    QFile file(localFilename());
+    if(file.size() == 0 || !file.open(QFile::ReadOnly))
+        return;
+
+    m_localBlocks.fill(-1, m_blocks.size());
+    int found = findLocalBlocks(&file);
+    if(found == 0)
+    {
+        m_localBlocks.clear();
+        return;
+    }
+
+    for(int i = 0; i < m_blocks.size(); ++i)
+    {
+        if(m_localBlocks[i] >= 0)
+            continue;
+        const Block &block = m_blocks[i];
+        if(!m_requiredData.isEmpty() && m_requiredData.last().offset + m_requiredData.last().size == block.offset)
+            m_requiredData.last().size += block.size;
+        else
+            m_requiredData.append(DataRange(block.offset, block.size));
+    }
+    m_partialDownload = true;
+
+    qCDebug(LOG_ADDOP) << "Repairing" << path() << ":" << found << "/" << m_blocks.size() << "blocks found locally,"
+                       << requiredSize() << "/" << size() << "bytes to download";
+}
+
+/*!
+    \brief Fill m_localBlocks by searching every block of the final file in \a file
+    Full blocks are searched at any position with a rolling checksum, the last one
+    is only searched at the end of the file or at its final position.
+    \return The number of blocks found
+ */
+int AddOperation::findLocalBlocks(QFile *file)
+{
+    int found = 0;
+    const qint64 fileSize = file->size();
+    const int fullBlocks = blockLength(m_blocks.size() - 1) == m_blockSize ? m_blocks.size() : m_blocks.size() - 1;
+
+    uchar *map = file->map(0, fileSize);
+    if(map != nullptr)
+    {
+        const char *data = reinterpret_cast<const char *>(map);
+        QMultiHash<quint32, int> index;
+        for(int i = 0; i < fullBlocks; ++i)
+            index.insert(m_blocks[i].rolling, i);
+
+        qint64 pos = 0;
+        RollingChecksum checksum;
+        if(fileSize >= m_blockSize)
+            checksum.reset(data, m_blockSize);
+        while(pos + m_blockSize <= fileSize)
+        {
+            QByteArray sha1;
+            bool matched = false;
+            QMultiHash<quint32, int>::const_iterator it = index.constFind(checksum.value());
+            for(; it != index.constEnd() && it.key() == checksum.value(); ++it)
+            {
+                if(m_localBlocks[it.value()] >= 0)
+                    continue;
+                if(sha1.isNull())
+                    sha1 = Sha1Hash::hash(QByteArray::fromRawData(data + pos, int(m_blockSize)));
+                if(sha1 == m_blocks[it.value()].sha1)
+                {
+                    m_localBlocks[it.value()] = pos;
+                    ++found;
+                    matched = true; // Identical blocks are all found at the same position
+                }
+            }
+
+            if(matched && pos + 2 * m_blockSize <= fileSize)
+            {
+                pos += m_blockSize;
+                checksum.reset(data + pos, m_blockSize);
+            }
+            else if(matched || pos + m_blockSize == fileSize)
+            {
+                break;
+            }
+            else
+            {
+                checksum.roll(data[pos], data[pos + m_blockSize]);
+                ++pos;
+            }
+        }
+        file->unmap(map);
+    }
+    else
+    {
+        qCDebug(LOG_ADDOP) << "Unable to map" << file->fileName() << ", searching blocks at their final position only";
+        for(int i = 0; i < fullBlocks; ++i)
+        {
+            if(!file->seek(i * m_blockSize))
+                break;
+            if(Sha1Hash::hash(file->read(m_blockSize)) == m_blocks[i].sha1)
+            {
+                m_localBlocks[i] = i * m_blockSize;
+                ++found;
+            }
+        }
+    }
+
+    if(fullBlocks < m_blocks.size())
+    {
+        int last = m_blocks.size() - 1;
+        qint64 length = blockLength(last);
+        QList<qint64> positions;
+        positions << last * m_blockSize << fileSize - length;
+        foreach(qint64 position, positions)
+        {
+            if(position < 0 || position + length > fileSize || !file->seek(position))
+                continue;
+            if(Sha1Hash::hash(file->read(length)) == m_blocks[last].sha1)
+            {
+                m_localBlocks[last] = position;
+                ++found;
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+bool AddOperation::canStream() const
+{
+    if(m_blockSize > 0)
+        return false; // Each block is a separate compressed stream
+    return m_compression == COMPRESSION_NONE || m_compression == COMPRESSION_BROTLI || m_compression == COMPRESSION_LZMA;
+}
+
+/*!
+    \brief Decompress the data as it is downloaded to streamFilename()
+    The final file is only replaced by apply(), once the final signature is checked.
+    The data signature is checked by the caller while receiving the data.
+ */
+void AddOperation::beginStream()
+{
+    Q_ASSERT(canStream());
+    abortStream();
+    mkLocalPath();
+
+    m_stream.reset(new StreamWriter(streamFilename()));
+    if(!m_stream->file.open(QFile::WriteOnly | QFile::Truncate))
+        throw QObject::tr("Unable to open file %1 for writing").arg(m_stream->file.fileName());
+
+    if(m_compression == COMPRESSION_BROTLI)
+        m_stream->decompressor.reset(BrotliDecompressorWriter(m_stream.data()));
+    else if(m_compression == COMPRESSION_LZMA)
+        m_stream->decompressor.reset(LZMADecompressorWriter(m_stream.data()));
+
+    qCDebug(LOG_ADDOP) << "Streaming" << path() << "by" << m_compression;
+}
+
+void AddOperation::writeStream(const char *data, qint64 len)
+{
+    Q_ASSERT(m_stream);
+    QIODevice *device = m_stream->decompressor ? m_stream->decompressor.data() : m_stream.data();
+    if(device->write(data, len) != len)
+        throw QObject::tr("Unable to stream %1 : %2").arg(path(), device->errorString());
+}
+
+void AddOperation::endStream()
+{
+    Q_ASSERT(m_stream);
+    if(m_stream->decompressor && !m_stream->decompressor->atEnd())
+        throw QObject::tr("Compressed data of %1 is truncated").arg(path());
+
+    if(!m_stream->file.flush())
+        throw QObject::tr("Unable to flush all extracted data");
+
+    if(m_stream->file.size() != m_finalSize || QString(m_stream->finalHash.result().toHex()) != m_finalSha1)
+        throw QObject::tr("Final sha1 file signature doesn't match");
+
+    m_stream->file.close();
+    m_stream.reset();
+    m_streamed = true;
+    qCDebug(LOG_ADDOP) << "Streaming succeeded of" << path();
+}
+
+void AddOperation::abortStream()
+{
+    if(m_stream)
+    {
+        m_stream->decompressor.reset();
+        m_stream->file.close();
+        m_stream.reset();
+    }
+    if(QFile::exists(streamFilename()) && !QFile::remove(streamFilename()))
+        throwWarning(QObject::tr("Unable to remove temporary file %1").arg(streamFilename()));
+    Operation::abortStream();
+}
+
+void AddOperation::cleanup()
+{
+    if(QFile::exists(blocksFilename()))
+        QFile::remove(blocksFilename());
+    if(isStreamed())
+    {
+        abortStream();
+        if(!QFile::exists(dataFilename()))
+            return;
+    }
+    Operation::cleanup();
+}
+
 void AddOperation::fillJsonObjectV1(QJsonObject &object)
 {
     Operation::fillJsonObjectV1(object);
@@ -227,9 +715,26 @@ void AddOperation::fillJsonObjectV1(QJsonObject &object)
     object.insert(DataCompression, m_compression);
     object.insert(FinalSize, QString::number(m_finalSize));
     object.insert(FinalSha1, m_finalSha1);
+    if(!m_finalSample.isEmpty())
+        object.insert(FinalSample, m_finalSample);
+    if(!m_finalTree.isNull())
+        object.insert(FinalTree, m_finalTree.toJsonObject());
+    if(m_blockSize > 0)
+    {
+        object.insert(BlockSize, QString::number(m_blockSize));
+        object.insert(Blocks, blocksToJsonArray());
+    }
 }
 
 QString AddOperation::type() const
 {
     return Action;
 }
+
+/*!
+    The whole final file is decompressed
+ */
+qint64 AddOperation::applySize() const
+{
+    return m_finalSize;
+}
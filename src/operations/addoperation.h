@@ -2,7 +2,10 @@
 #define UPDATER_ADDOPERATION_H
 
 #include "operation.h"
-#include <QCryptographicHash>
+#include "../common/sha1.h"
+#include <QJsonArray>
+#include <QScopedPointer>
+#include <QVector>
 
 class DownloadManager;
 class QFile;
@@ -11,10 +14,22 @@ class AddOperation : public Operation
 {
 public:
     AddOperation();
+    ~AddOperation();
     static const QString Action;
     virtual FileType fileType() const Q_DECL_OVERRIDE;
     virtual void fromJsonObjectV1(const QJsonObject &object) Q_DECL_OVERRIDE;
-    void create(const QString &filepath, const QString &newFilename, const QString &tmpDirectory);
+    void create(const QString &filepath, const QString &newFilename, const QString &tmpDirectory, qint64 blockSize = 0);
+
+    virtual qint64 applySize() const Q_DECL_OVERRIDE;
+    virtual bool canStream() const Q_DECL_OVERRIDE;
+    virtual void beginStream() Q_DECL_OVERRIDE;
+    virtual void writeStream(const char *data, qint64 len) Q_DECL_OVERRIDE;
+    virtual void endStream() Q_DECL_OVERRIDE;
+    virtual void abortStream() Q_DECL_OVERRIDE;
+    virtual void cleanup() Q_DECL_OVERRIDE;
+    virtual void planRepair() Q_DECL_OVERRIDE;
+    QString streamFilename() const;
+    QString blocksFilename() const;
 protected:
     static const QString DataOffset;
     static const QString DataSize;
@@ -22,14 +37,64 @@ protected:
     static const QString DataCompression;
     static const QString FinalSize;
     static const QString FinalSha1;
+    static const QString FinalSample;
+    static const QString FinalTree;
+    static const QString BlockSize;
+    static const QString Blocks;
     virtual Status localDataStatus() Q_DECL_OVERRIDE;
     virtual void applyData() Q_DECL_OVERRIDE;
     virtual QString type() const Q_DECL_OVERRIDE;
+    virtual QString finalSha1() const Q_DECL_OVERRIDE;
     virtual void fillJsonObjectV1(QJsonObject & object) Q_DECL_OVERRIDE;
-    void readAll(QIODevice *from, QIODevice *to, QCryptographicHash *hash);
+    void readAll(QIODevice *from, QIODevice *to, Sha1Hash *hash);
+    bool isFinalFile(QFile *file) const;
+    void mkLocalPath();
+    void applyBlocks();
+    qint64 blockLength(int index) const;
+    int findLocalBlocks(QFile *file);
+    QJsonArray blocksToJsonArray() const;
+    void blocksFromJsonArray(const QJsonArray &blocks);
+
+    struct Block
+    {
+        quint32 rolling; ///< RollingChecksum of the final data
+        QByteArray sha1; ///< Sha1 of the final data
+        qint64 offset; ///< Offset of the compressed block in the operation data
+        qint64 size; ///< Size of the compressed block
+    };
 
     QString m_compression, m_finalSha1;
+    QString m_finalSample; ///< Fingerprint of the final file, empty for small files
+    TreeHash m_finalTree; ///< Tree signature of the final file, null for small files
     qint64 m_finalSize;
+    qint64 m_blockSize; ///< If not 0, the final file is compressed by blocks of this size
+    QVector<Block> m_blocks;
+    QVector<qint64> m_localBlocks; ///< Position of each block in the local file, -1 if it must be downloaded
+
+private:
+    class StreamWriter;
+    QScopedPointer<StreamWriter> m_stream;
 };
 
+inline QString AddOperation::finalSha1() const
+{
+    return m_finalSha1;
+}
+
+/*!
+    Temporary name of the file while its data is streamed
+ */
+inline QString AddOperation::streamFilename() const
+{
+    return localFilename() + ".stream";
+}
+
+/*!
+    Temporary name of the file while it is rebuilt from its blocks
+ */
+inline QString AddOperation::blocksFilename() const
+{
+    return localFilename() + ".blocks";
+}
+
 #endif // UPDATER_ADDOPERATION_H
@@ -0,0 +1,301 @@
+#include "appendoperation.h"
+#include "../common/jsonutil.h"
+#include "../tools/brotli.h"
+#include "../tools/lzma.h"
+#include <QLoggingCategory>
+#include <QFile>
+#include <QJsonDocument>
+#include <cstring>
+
+Q_LOGGING_CATEGORY(LOG_APPENDOP, "updatesystem.appendoperation")
+
+const QString AppendOperation::Action = QStringLiteral("append");
+const QString AppendOperation::TailSha1 = QStringLiteral("tailSha1");
+
+const QString COMPRESSION_LZMA = QStringLiteral("lzma");
+const QString COMPRESSION_BROTLI = QStringLiteral("brotli");
+const QString COMPRESSION_NONE = QStringLiteral("none");
+
+const QString PATCHTYPE_APPEND = QStringLiteral("append");
+
+AppendOperation::AppendOperation() : PatchOperation()
+{
+}
+
+/*!
+    \brief Returns \c true if the file \a newFilename is the file \a oldFilename with data appended
+ */
+bool AppendOperation::isAppend(const QString &oldFilename, const QString &newFilename)
+{
+    QFile oldFile(oldFilename), newFile(newFilename);
+    if(oldFile.size() == 0 || oldFile.size() >= newFile.size())
+        return false;
+    if(!oldFile.open(QFile::ReadOnly) || !newFile.open(QFile::ReadOnly))
+        return false;
+
+    char oldBuffer[65536], newBuffer[65536];
+    qint64 read;
+    while((read = oldFile.read(oldBuffer, sizeof(oldBuffer))) > 0)
+    {
+        if(newFile.read(newBuffer, read) != read || memcmp(oldBuffer, newBuffer, size_t(read)) != 0)
+            return false;
+    }
+    return read == 0;
+}
+
+/*!
+    Returns the sha1 of the m_localSize first bytes of \a file.
+ */
+QString AppendOperation::prefixSha1(QFile *file) const
+{
+    if(!file->open(QIODevice::ReadOnly))
+        return QString();
+
+    Sha1Hash sha1Hash;
+    char buffer[65536];
+    qint64 remaining = m_localSize, read = 0;
+    while(remaining > 0 && (read = file->read(buffer, qMin<qint64>(remaining, sizeof(buffer)))) > 0)
+    {
+        sha1Hash.addData(buffer, int(read));
+        remaining -= read;
+    }
+    file->close();
+
+    if(remaining > 0)
+        return QString();
+    return QString(sha1Hash.result().toHex());
+}
+
+Operation::Status AppendOperation::localDataStatus()
+{
+    QFile file(localFilename());
+
+    if(file.exists())
+    {
+        if(file.size() == m_finalSize && matchesSample(&file, m_finalSample)
+                && localFileSha1(&file, { KnownFile(m_finalSha1, m_finalTree) }) == m_finalSha1)
+        {
+            qCDebug(LOG_APPENDOP) << "File is already at the right version" << path();
+            return Valid;
+        }
+
+        // Data appended by an interrupted apply is dropped by applyData()
+        QString baseSha1;
+        if(file.size() == m_localSize && matchesSample(&file, m_localSample))
+            baseSha1 = localFileSha1(&file, { KnownFile(m_localSha1, m_localTree) });
+        else if(file.size() > m_localSize && file.size() <= m_finalSize)
+            baseSha1 = prefixSha1(&file);
+        if(baseSha1 == m_localSha1)
+        {
+            qCDebug(LOG_APPENDOP) << "File is as expected for appending" << path();
+
+            file.setFileName(dataFilename());
+            if(file.exists())
+            {
+                // Check downloaded data file content
+                if(file.size() == size() && (isDataVerified() || sha1(&file) == sha1()))
+                {
+                    qCDebug(LOG_APPENDOP) << "File data is valid" << path();
+                    return ApplyRequired;
+                }
+                throwWarning(QObject::tr("File data is invalid and will be downloaded again"));
+            }
+            return DownloadRequired;
+        }
+
+        throwWarning(QObject::tr("File content is invalid"));
+    }
+    else
+    {
+        throwWarning(QObject::tr("File doesn't exists and can't be appended to, complete file download will happen"));
+    }
+
+    return LocalFileInvalid;
+}
+
+/*!
+    \brief Append the decompressed data to the local file
+    Only the new tail is written and hashed: the beginning of the file was verified to be the local revision
+    by localDataStatus(), so a valid tail makes a valid final file.
+    The whole file is read back to check the final signature in paranoid mode or if the tail signature is unknown.
+ */
+void AppendOperation::applyData()
+{
+    qCDebug(LOG_APPENDOP) << "Appending" << dataFilename() << "to" << path() << "by" << m_compression;
+
+    detachLocalFile();
+    QFile file(localFilename());
+    if(!file.open(QFile::ReadWrite))
+        throw QObject::tr("Unable to open file %1 for writing").arg(file.fileName());
+
+    if(!file.resize(m_localSize) || !file.seek(m_localSize))
+        throw QObject::tr("Unable to truncate file %1 : %2").arg(path(), file.errorString());
+
+    QFile dataFile(dataFilename());
+    if(!dataFile.open(QFile::ReadOnly))
+        throw QObject::tr("Unable to open file %1 for reading").arg(dataFile.fileName());
+
+    QScopedPointer<QIODevice> decompressor;
+    if(m_compression == COMPRESSION_BROTLI)
+        decompressor.reset(BrotliDecompressor(&dataFile));
+    else if(m_compression == COMPRESSION_LZMA)
+        decompressor.reset(LZMADecompressor(&dataFile));
+    else if(m_compression != COMPRESSION_NONE)
+        throw QObject::tr("Unsupported compression %1").arg(m_compression);
+
+    Sha1Hash tailHash;
+    readAll(decompressor ? decompressor.data() : &dataFile, &file, &tailHash);
+
+    if(!file.flush())
+        throw QObject::tr("Unable to flush all extracted data");
+
+    decompressor.reset();
+    dataFile.close();
+    file.close();
+
+    bool valid;
+    if(m_tailSha1.isEmpty() || isParanoidCheck())
+        valid = isFinalFile(&file);
+    else
+        valid = file.size() == m_finalSize && QString(tailHash.result().toHex()) == m_tailSha1;
+    if(!valid)
+    {
+        // Restore the previous revision, so the operation can be applied again
+        file.resize(m_localSize);
+        throw QObject::tr("Final sha1 file signature doesn't match");
+    }
+
+    qCDebug(LOG_APPENDOP) << "Append succeeded" << path();
+
+    cleanup();
+}
+
+/*!
+    \brief Create an operation that appends the end of \a newFilename to \a oldFilename
+    \sa isAppend()
+ */
+void AppendOperation::create(const QString &filepath, const QString &oldFilename, const QString &newFilename, const QString &tmpDirectory)
+{
+    setPath(filepath);
+
+    QFile newFile(newFilename);
+    QFile oldFile(oldFilename);
+
+    if(!newFile.exists(newFilename))
+        throw QObject::tr("File %1 doesn't exists").arg(newFilename);
+    if(!oldFile.exists(oldFilename))
+        throw QObject::tr("File %1 doesn't exists").arg(oldFilename);
+
+    m_finalSha1 = sha1(&newFile);
+    m_finalSize = newFile.size();
+    m_finalSample = sample(&newFile);
+    m_finalTree = treeHash(&newFile);
+    m_localSha1 = sha1(&oldFile);
+    m_localSize = oldFile.size();
+    m_localSample = sample(&oldFile);
+    m_localTree = treeHash(&oldFile);
+    if(m_localSize >= m_finalSize)
+        throw QObject::tr("File %1 isn't bigger than %2").arg(newFilename, oldFilename);
+
+    setDataFilename(tmpDirectory + "append_" + m_finalSha1 + "_" + m_localSha1);
+    QFile dataFile(dataFilename());
+    QFile metadataFile(dataFilename() + ".metadata");
+    if(dataFile.exists() && metadataFile.exists())
+    {
+        if (metadataFile.open(QFile::ReadOnly | QFile::Text))
+        {
+            try
+            {
+                QJsonObject object = JsonUtil::fromJson(metadataFile.readAll());
+                m_size = JsonUtil::asInt64String(object, DataSize);
+                m_sha1 = JsonUtil::asString(object, DataSha1);
+                m_compression = JsonUtil::asString(object, DataCompression);
+                m_patchtype = JsonUtil::asString(object, PathType);
+                m_tailSha1 = JsonUtil::asString(object, TailSha1);
+                return;
+            }
+            catch(...) { }
+            metadataFile.close();
+        }
+    }
+
+    if (!newFile.open(QFile::ReadOnly) || !newFile.seek(m_localSize))
+        throw QObject::tr("Unable to open file %1 for reading").arg(newFile.fileName());
+
+    if(!dataFile.open(QFile::WriteOnly | QFile::Truncate))
+        throw QObject::tr("Unable to open file %1 for writing").arg(dataFile.fileName());
+
+    if (!metadataFile.open(QFile::WriteOnly | QFile::Truncate | QFile::Text))
+        throw QObject::tr("Unable to open file %1 for writing : %2").arg(metadataFile.fileName(), metadataFile.errorString());
+
+    m_compression = COMPRESSION_BROTLI;
+    m_patchtype = PATCHTYPE_APPEND;
+
+    Sha1Hash tailHash;
+    char buffer[65536];
+    qint64 read;
+    while((read = newFile.read(buffer, sizeof(buffer))) > 0)
+        tailHash.addData(buffer, int(read));
+    if(read < 0 || !newFile.seek(m_localSize))
+        throw QObject::tr("Unable to read file %1 : %2").arg(newFile.fileName(), newFile.errorString());
+    m_tailSha1 = QString(tailHash.result().toHex());
+
+    Sha1Hash sha1Hash;
+    QScopedPointer<QIODevice> compressor(BrotliCompressor(&newFile));
+    readAll(compressor.data(), &dataFile, &sha1Hash);
+
+    m_sha1 = QString(sha1Hash.result().toHex());
+    m_size = dataFile.size();
+
+    if(!dataFile.flush())
+        throw QObject::tr("Unable to flush all compressed data");
+
+    dataFile.close();
+
+    // Writing metadata
+    {
+        QJsonObject object;
+        object.insert(Path, path());
+        object.insert(DataSize, QString::number(m_size));
+        object.insert(DataSha1, m_sha1);
+        object.insert(DataCompression, m_compression);
+        object.insert(PathType, m_patchtype);
+        object.insert(TailSha1, m_tailSha1);
+
+        if(metadataFile.write(QJsonDocument(object).toJson()) == -1)
+            throw QObject::tr("Unable to write metadata");
+
+        if(!metadataFile.flush())
+            throw QObject::tr("Unable to flush metadata");
+
+        metadataFile.close();
+    }
+}
+
+void AppendOperation::fillJsonObjectV1(QJsonObject &object)
+{
+    PatchOperation::fillJsonObjectV1(object);
+
+    if(!m_tailSha1.isEmpty())
+        object.insert(TailSha1, m_tailSha1);
+}
+
+void AppendOperation::fromJsonObjectV1(const QJsonObject &object)
+{
+    PatchOperation::fromJsonObjectV1(object);
+
+    m_tailSha1 = object.contains(TailSha1) ? JsonUtil::asString(object, TailSha1) : QString();
+}
+
+QString AppendOperation::type() const
+{
+    return Action;
+}
+
+/*!
+    Only the tail is decompressed
+ */
+qint64 AppendOperation::applySize() const
+{
+    return m_finalSize - m_localSize;
+}
@@ -0,0 +1,30 @@
+#ifndef UPDATER_APPENDOPERATION_H
+#define UPDATER_APPENDOPERATION_H
+
+#include "patchoperation.h"
+
+/*!
+    \brief Extends a file that only grew since the previous revision
+
+    The data is the compressed tail of the final file, the beginning of the local file is kept as is.
+ */
+class AppendOperation : public PatchOperation
+{
+public:
+    AppendOperation();
+    static const QString Action;
+    static const QString TailSha1;
+    void create(const QString &path, const QString &oldFilename, const QString &newFilename, const QString &tmpDirectory);
+    static bool isAppend(const QString &oldFilename, const QString &newFilename);
+    virtual qint64 applySize() const Q_DECL_OVERRIDE;
+    virtual void fromJsonObjectV1(const QJsonObject &object) Q_DECL_OVERRIDE;
+protected:
+    virtual Status localDataStatus() Q_DECL_OVERRIDE;
+    virtual void applyData() Q_DECL_OVERRIDE;
+    virtual QString type() const Q_DECL_OVERRIDE;
+    virtual void fillJsonObjectV1(QJsonObject & object) Q_DECL_OVERRIDE;
+    QString prefixSha1(QFile *file) const;
+    QString m_tailSha1; ///< Sha1 of the appended data, empty for packages that predate it
+};
+
+#endif // UPDATER_APPENDOPERATION_H
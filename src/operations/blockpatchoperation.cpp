@@ -0,0 +1,309 @@
+#include "blockpatchoperation.h"
+#include "../common/blockundojournal.h"
+#include "../common/jsonutil.h"
+#include "../common/utils.h"
+#include "../tools/brotli.h"
+#include "../tools/lzma.h"
+#include <QCryptographicHash>
+#include <QLoggingCategory>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+Q_LOGGING_CATEGORY(LOG_BLOCKPATCHOP, "updatesystem.blockpatchoperation")
+
+const QString BlockPatchOperation::Action = QStringLiteral("blockpatch");
+
+const QString BlockPatchOperation::WriteSize = QStringLiteral("writeSize");
+const QString BlockPatchOperation::Writes = QStringLiteral("writes");
+
+const QString COMPRESSION_LZMA = QStringLiteral("lzma");
+const QString COMPRESSION_BROTLI = QStringLiteral("brotli");
+const QString COMPRESSION_NONE = QStringLiteral("none");
+
+const QString PATCHTYPE_BLOCKS = QStringLiteral("blocks");
+
+static QByteArray readFully(QIODevice *device, qint64 size)
+{
+    QByteArray data;
+    while(data.size() < size)
+    {
+        QByteArray chunk = device->read(size - data.size());
+        if(chunk.isEmpty())
+            break;
+        data += chunk;
+    }
+    return data;
+}
+
+BlockPatchOperation::BlockPatchOperation() : PatchOperation()
+{
+    m_writeSize = DefaultWriteSize;
+}
+
+qint64 BlockPatchOperation::writeLength(qint64 index) const
+{
+    return qMin(m_writeSize, m_finalSize - index * m_writeSize);
+}
+
+/*!
+    Undo journal of the operation, keyed by its path in journalDirectory()
+ */
+QString BlockPatchOperation::journalFilename() const
+{
+    return journalDirectory(tmpDirectory()) + QCryptographicHash::hash(path().toUtf8(), QCryptographicHash::Sha1).toHex() + ".journal";
+}
+
+/*!
+    \brief Write the changed blocks in the local file
+    Only the changed blocks are read (to be journaled) and written, the whole file is read back
+    once to check the final signature.
+ */
+void BlockPatchOperation::applyData()
+{
+    qCDebug(LOG_BLOCKPATCHOP) << "Writing" << m_writes.size() << "blocks from" << dataFilename() << "to" << path() << "by" << m_compression;
+
+    detachLocalFile();
+    QFile file(localFilename());
+    if(!file.open(QFile::ReadWrite))
+        throw QObject::tr("Unable to open file %1 for writing").arg(file.fileName());
+    if(file.size() != m_localSize)
+        throw QObject::tr("File %1 size doesn't match").arg(path());
+
+    QFile dataFile(dataFilename());
+    if(!dataFile.open(QFile::ReadOnly))
+        throw QObject::tr("Unable to open file %1 for reading").arg(dataFile.fileName());
+
+    QScopedPointer<QIODevice> decompressor;
+    if(m_compression == COMPRESSION_BROTLI)
+        decompressor.reset(BrotliDecompressor(&dataFile));
+    else if(m_compression == COMPRESSION_LZMA)
+        decompressor.reset(LZMADecompressor(&dataFile));
+    else if(m_compression != COMPRESSION_NONE)
+        throw QObject::tr("Unsupported compression %1").arg(m_compression);
+    QIODevice *source = decompressor ? decompressor.data() : &dataFile;
+
+    // Save everything that will be overwritten or truncated
+    BlockUndoJournal journal(journalFilename());
+    journal.begin(path(), m_localSize);
+    foreach(qint64 index, m_writes)
+    {
+        qint64 offset = index * m_writeSize;
+        if(offset < m_localSize)
+            journal.save(&file, offset, qMin(writeLength(index), m_localSize - offset));
+    }
+    if(m_finalSize < m_localSize)
+        journal.save(&file, m_finalSize, m_localSize - m_finalSize);
+    journal.commit();
+
+    try
+    {
+        if(!file.resize(m_finalSize))
+            throw QObject::tr("Unable to resize file %1 : %2").arg(path(), file.errorString());
+
+        foreach(qint64 index, m_writes)
+        {
+            QByteArray block = readFully(source, writeLength(index));
+            if(block.size() != writeLength(index))
+                throw QObject::tr("Data of %1 is truncated").arg(path());
+            if(!file.seek(index * m_writeSize) || file.write(block) != block.size())
+                throw QObject::tr("Write failed: %1").arg(file.errorString());
+        }
+
+        if(!Utils::syncFile(&file))
+            throw QObject::tr("Unable to flush all extracted data");
+        file.close();
+
+        if(!isFinalFile(&file))
+            throw QObject::tr("Final sha1 file signature doesn't match");
+    }
+    catch(const QString &)
+    {
+        file.close();
+        journal.rollback(&file);
+        throw;
+    }
+
+    journal.remove();
+    qCDebug(LOG_BLOCKPATCHOP) << "Patch succeeded" << path();
+
+    decompressor.reset();
+    dataFile.close();
+    cleanup();
+}
+
+void BlockPatchOperation::fillJsonObjectV1(QJsonObject &object)
+{
+    PatchOperation::fillJsonObjectV1(object);
+
+    QJsonArray writes;
+    foreach(qint64 index, m_writes)
+        writes.append(QString::number(index));
+    object.insert(WriteSize, QString::number(m_writeSize));
+    object.insert(Writes, writes);
+}
+
+void BlockPatchOperation::fromJsonObjectV1(const QJsonObject &object)
+{
+    PatchOperation::fromJsonObjectV1(object);
+
+    m_writeSize = JsonUtil::asInt64String(object, WriteSize);
+    m_writes.clear();
+    foreach(const QJsonValue &value, JsonUtil::asArray(object, Writes))
+        m_writes.append(JsonUtil::asInt64String(value));
+}
+
+/*!
+    \brief Create an operation that writes the blocks of \a newFilename that differ from \a oldFilename
+    \return false if too many blocks changed for an in place patch to be worth it
+ */
+bool BlockPatchOperation::create(const QString &filepath, const QString &oldFilename, const QString &newFilename, const QString &tmpDirectory)
+{
+    setPath(filepath);
+
+    QFile newFile(newFilename);
+    QFile oldFile(oldFilename);
+
+    if(!newFile.exists(newFilename))
+        throw QObject::tr("File %1 doesn't exists").arg(newFilename);
+    if(!oldFile.exists(oldFilename))
+        throw QObject::tr("File %1 doesn't exists").arg(oldFilename);
+
+    m_finalSize = newFile.size();
+    m_localSize = oldFile.size();
+    m_writeSize = DefaultWriteSize;
+    m_writes.clear();
+
+    // Find the changed blocks
+    {
+        if (!newFile.open(QFile::ReadOnly))
+            throw QObject::tr("Unable to open file %1 for reading").arg(newFile.fileName());
+        if (!oldFile.open(QFile::ReadOnly))
+            throw QObject::tr("Unable to open file %1 for reading").arg(oldFile.fileName());
+
+        qint64 blockCount = (m_finalSize + m_writeSize - 1) / m_writeSize;
+        qint64 maxWrites = blockCount / 4;
+        for(qint64 index = 0; index < blockCount; ++index)
+        {
+            QByteArray newBlock = newFile.read(m_writeSize);
+            QByteArray oldBlock = oldFile.read(m_writeSize);
+            if(newBlock != oldBlock.left(newBlock.size()) || oldBlock.size() < newBlock.size())
+            {
+                m_writes.append(index);
+                if(m_writes.size() > maxWrites)
+                    return false;
+            }
+        }
+        newFile.close();
+        oldFile.close();
+    }
+
+    m_finalSha1 = sha1(&newFile);
+    m_finalSample = sample(&newFile);
+    m_finalTree = treeHash(&newFile);
+    m_localSha1 = sha1(&oldFile);
+    m_localSample = sample(&oldFile);
+    m_localTree = treeHash(&oldFile);
+
+    setDataFilename(tmpDirectory + "blockpatch_" + m_finalSha1 + "_" + m_localSha1);
+    QFile dataFile(dataFilename());
+    QFile metadataFile(dataFilename() + ".metadata");
+    if(dataFile.exists() && metadataFile.exists())
+    {
+        if (metadataFile.open(QFile::ReadOnly | QFile::Text))
+        {
+            try
+            {
+                QJsonObject object = JsonUtil::fromJson(metadataFile.readAll());
+                m_size = JsonUtil::asInt64String(object, DataSize);
+                m_sha1 = JsonUtil::asString(object, DataSha1);
+                m_compression = JsonUtil::asString(object, DataCompression);
+                m_patchtype = JsonUtil::asString(object, PathType);
+                return true;
+            }
+            catch(...) { }
+            metadataFile.close();
+        }
+    }
+
+    // Concatenate the changed blocks, then compress them
+    QFile rawFile(dataFilename() + ".raw");
+    {
+        if (!newFile.open(QFile::ReadOnly))
+            throw QObject::tr("Unable to open file %1 for reading").arg(newFile.fileName());
+        if(!rawFile.open(QFile::WriteOnly | QFile::Truncate))
+            throw QObject::tr("Unable to open file %1 for writing").arg(rawFile.fileName());
+
+        foreach(qint64 index, m_writes)
+        {
+            if(!newFile.seek(index * m_writeSize))
+                throw QObject::tr("Unable to read file %1").arg(newFile.fileName());
+            QByteArray block = newFile.read(writeLength(index));
+            if(rawFile.write(block) != block.size())
+                throw QObject::tr("Write failed: %1").arg(rawFile.errorString());
+        }
+        rawFile.close();
+        newFile.close();
+    }
+
+    if(!rawFile.open(QFile::ReadOnly))
+        throw QObject::tr("Unable to open file %1 for reading").arg(rawFile.fileName());
+
+    if(!dataFile.open(QFile::WriteOnly | QFile::Truncate))
+        throw QObject::tr("Unable to open file %1 for writing").arg(dataFile.fileName());
+
+    if (!metadataFile.open(QFile::WriteOnly | QFile::Truncate | QFile::Text))
+        throw QObject::tr("Unable to open file %1 for writing : %2").arg(metadataFile.fileName(), metadataFile.errorString());
+
+    m_compression = COMPRESSION_BROTLI;
+    m_patchtype = PATCHTYPE_BLOCKS;
+
+    Sha1Hash sha1Hash;
+    {
+        QScopedPointer<QIODevice> compressor(BrotliCompressor(&rawFile));
+        readAll(compressor.data(), &dataFile, &sha1Hash);
+    }
+    rawFile.close();
+    rawFile.remove();
+
+    m_sha1 = QString(sha1Hash.result().toHex());
+    m_size = dataFile.size();
+
+    if(!dataFile.flush())
+        throw QObject::tr("Unable to flush all compressed data");
+
+    dataFile.close();
+
+    // Writing metadata
+    {
+        QJsonObject object;
+        object.insert(Path, path());
+        object.insert(DataSize, QString::number(m_size));
+        object.insert(DataSha1, m_sha1);
+        object.insert(DataCompression, m_compression);
+        object.insert(PathType, m_patchtype);
+
+        if(metadataFile.write(QJsonDocument(object).toJson()) == -1)
+            throw QObject::tr("Unable to write metadata");
+
+        if(!metadataFile.flush())
+            throw QObject::tr("Unable to flush metadata");
+
+        metadataFile.close();
+    }
+
+    return true;
+}
+
+QString BlockPatchOperation::type() const
+{
+    return Action;
+}
+
+/*!
+    Only the changed blocks are written
+ */
+qint64 BlockPatchOperation::applySize() const
+{
+    return m_writes.size() * m_writeSize;
+}
@@ -0,0 +1,49 @@
+#ifndef UPDATER_BLOCKPATCHOPERATION_H
+#define UPDATER_BLOCKPATCHOPERATION_H
+
+#include "patchoperation.h"
+#include <QVector>
+
+/*!
+    \brief Patches a huge file in place by writing only the blocks that changed
+
+    The data is the compressed content of the changed blocks, in order.
+    The original content of those blocks is saved in a BlockUndoJournal of the update temporary directory
+    before the file is modified, so an interrupted apply is rolled back when the next update starts,
+    whatever the next path is.
+    \sa journalDirectory()
+ */
+class BlockPatchOperation : public PatchOperation
+{
+public:
+    static const qint64 MinFileSize = 16 * 1024 * 1024; // 16MB
+    static const qint64 DefaultWriteSize = 64 * 1024; // 64KB
+
+    BlockPatchOperation();
+    static const QString Action;
+    virtual void fromJsonObjectV1(const QJsonObject &object) Q_DECL_OVERRIDE;
+    bool create(const QString &path, const QString &oldFilename, const QString &newFilename, const QString &tmpDirectory);
+    QString journalFilename() const;
+    static QString journalDirectory(const QString &tmpDirectory);
+    virtual qint64 applySize() const Q_DECL_OVERRIDE;
+protected:
+    static const QString WriteSize;
+    static const QString Writes;
+    virtual void applyData() Q_DECL_OVERRIDE;
+    virtual QString type() const Q_DECL_OVERRIDE;
+    virtual void fillJsonObjectV1(QJsonObject & object) Q_DECL_OVERRIDE;
+    qint64 writeLength(qint64 index) const;
+
+    qint64 m_writeSize;
+    QVector<qint64> m_writes; ///< Indexes of the blocks of m_writeSize bytes that are written, in order
+};
+
+/*!
+    Directory of the undo journals of the updates that use \a tmpDirectory
+ */
+inline QString BlockPatchOperation::journalDirectory(const QString &tmpDirectory)
+{
+    return tmpDirectory + QStringLiteral("journals/");
+}
+
+#endif // UPDATER_BLOCKPATCHOPERATION_H
@@ -1,7 +1,9 @@
 #include "operation.h"
+#include "../common/sha1.h"
+#include "../common/utils.h"
 #include <QLoggingCategory>
 #include <QFile>
-#include <QCryptographicHash>
+#include <QFileInfo>
 #include <QRegularExpression>
 #include <QDebug>
 
@@ -14,6 +16,10 @@ Operation::Operation()
     m_offset = 0;
     m_size = 0;
     m_status = Unknown;
+    m_index = -1;
+    m_streamed = false;
+    m_partialDownload = false;
+    m_paranoidCheck = false;
 }
 
 QString Operation::sha1(QFile * file) const
@@ -24,7 +30,7 @@ QString Operation::sha1(QFile * file) const
         return QString();
     }
 
-    QCryptographicHash sha1Hash(QCryptographicHash::Sha1);
+    Sha1Hash sha1Hash;
     sha1Hash.addData(file);
 
     file->close();
@@ -32,9 +38,171 @@ QString Operation::sha1(QFile * file) const
     return QString(sha1Hash.result().toHex());
 }
 
+/*!
+    \brief Returns the sha1 of the local \a file
+    The file is hashed only if it doesn't match the local stamp anymore, the stamp is then updated.
+
+    Huge files are compared to the tree signatures of \a candidates first, those are computed by all the cores.
+    If every candidate has a tree signature and none matches, an empty sha1 is returned.
+    \sa setLocalStamp()
+ */
+QString Operation::localFileSha1(QFile *file, const QVector<KnownFile> &candidates)
+{
+    FileStamp current = FileStamp::stat(file->fileName());
+    if(m_localStamp.isValid() && m_localStamp.matches(current))
+        return m_localStamp.sha1;
+
+    bool sha1Required = candidates.isEmpty();
+    TreeHash tree;
+    foreach(const KnownFile &candidate, candidates)
+    {
+        if(candidate.tree.isNull())
+        {
+            sha1Required = true;
+            continue;
+        }
+        if(tree.isNull() || tree.chunkSize() != candidate.tree.chunkSize())
+            tree = TreeHash::hashFile(file->fileName(), candidate.tree.chunkSize());
+        if(tree == candidate.tree)
+        {
+            current.sha1 = candidate.sha1;
+            m_localStamp = current;
+            return current.sha1;
+        }
+    }
+
+    if(!sha1Required)
+        return QString();
+
+    current.sha1 = sha1(file);
+    m_localStamp = current;
+    return current.sha1;
+}
+
+/*!
+    \brief Returns a cheap fingerprint of \a file: the sha1 of its first, middle and last blocks
+    Files smaller than SampleMinSize are cheap enough to hash, they have no fingerprint.
+ */
+QString Operation::sample(QFile *file) const
+{
+    qint64 size = file->size();
+    if(size < SampleMinSize || !file->open(QIODevice::ReadOnly))
+        return QString();
+
+    Sha1Hash sha1Hash;
+    const qint64 offsets[] = { 0, (size - SampleBlockSize) / 2, size - SampleBlockSize };
+    for(qint64 offset : offsets)
+    {
+        if(!file->seek(offset))
+        {
+            file->close();
+            return QString();
+        }
+        sha1Hash.addData(file->read(SampleBlockSize));
+    }
+    file->close();
+
+    return QString(sha1Hash.result().toHex());
+}
+
+/*!
+    \brief Returns the tree signature of \a file, a null one for files smaller than TreeHash::MinFileSize
+ */
+TreeHash Operation::treeHash(QFile *file) const
+{
+    if(file->size() < TreeHash::MinFileSize)
+        return TreeHash();
+    return TreeHash::hashFile(file->fileName());
+}
+
+/*!
+    \brief Returns \c false if \a file can't have the expected content, without hashing it entirely
+    The fingerprint isn't read if the local stamp already tells the sha1 of \a file.
+    \sa sample()
+ */
+bool Operation::matchesSample(QFile *file, const QString &expectedSample) const
+{
+    if(expectedSample.isEmpty())
+        return true;
+    if(m_localStamp.isValid() && m_localStamp.matches(FileStamp::stat(file->fileName())))
+        return true;
+    return sample(file) == expectedSample;
+}
+
+/*!
+    \brief Give the local file its own content, before it is modified in place
+    A file hard linked by Updater::copy() shares its content with the copy, which would be modified too.
+ */
+void Operation::detachLocalFile()
+{
+    if(Utils::linkCount(localFilename()) <= 1)
+        return;
+
+    qCDebug(LOG_OP) << "Detaching hard linked file" << path();
+    const QString detached = localFilename() + QStringLiteral(".detached");
+    QFile::remove(detached);
+    if(!Utils::copyFile(localFilename(), detached))
+        throw QObject::tr("Unable to copy file %1").arg(path());
+    if(!QFile::remove(localFilename()))
+        throw QObject::tr("Unable to remove file %1").arg(path());
+    if(!QFile::rename(detached, localFilename()))
+        throw QObject::tr("Unable to rename file %1 to %2").arg(detached, path());
+}
+
+/*!
+    Returns the sha1 of the local file once the operation is applied, empty if there is no such file
+ */
+QString Operation::finalSha1() const
+{
+    return QString();
+}
+
+/*!
+    Returns the number of bytes decoded or written by the apply, an estimate of its cost
+ */
+qint64 Operation::applySize() const
+{
+    return 0;
+}
+
+/*!
+    \brief Returns \c true if dataFilename() content was verified while being downloaded
+    The verification is trusted as long as the data file isn't modified,
+    so the data file doesn't have to be hashed again.
+    \sa setDataVerified()
+ */
+bool Operation::isDataVerified() const
+{
+    QFileInfo dataInfo(dataFilename());
+    QFileInfo sha1Info(dataSha1Filename());
+    if(!dataInfo.exists() || !sha1Info.exists() || dataInfo.size() != size() || sha1Info.lastModified() < dataInfo.lastModified())
+        return false;
+
+    QFile sha1File(dataSha1Filename());
+    if(!sha1File.open(QFile::ReadOnly | QFile::Text))
+        return false;
+    return QString::fromLatin1(sha1File.readAll()).trimmed() == sha1();
+}
+
+/*!
+    \brief Record that dataFilename() content matches sha1()
+    \sa isDataVerified()
+ */
+void Operation::setDataVerified()
+{
+    QFile sha1File(dataSha1Filename());
+    if(!sha1File.open(QFile::WriteOnly | QFile::Truncate | QFile::Text) || sha1File.write(sha1().toLatin1()) == -1)
+        qCDebug(LOG_OP) << "Unable to write" << sha1File.fileName();
+}
+
 void Operation::setup(const QString &updateDir, const QString &tmpUpdateDir, int uniqueid)
 {
     m_status = Unknown;
+    m_index = uniqueid;
+    m_localStamp = FileStamp();
+    m_partialDownload = false;
+    m_requiredData.clear();
+    m_tmpDirectory = tmpUpdateDir;
     setDataFilename(tmpUpdateDir + "Operation" + QString::number(uniqueid));
     setUpdateDirectory(updateDir);
 }
@@ -54,6 +222,12 @@ void Operation::apply()
         applyData();
         Q_ASSERT(localDataStatus() == Valid);
         m_status = Valid;
+        m_localStamp = FileStamp();
+        if(!finalSha1().isEmpty())
+        {
+            m_localStamp = FileStamp::stat(localFilename());
+            m_localStamp.sha1 = finalSha1();
+        }
         qCDebug(LOG_OP) << "Apply succeeded on [" << type() << "] " << path();
     }
     catch(const QString &msg)
@@ -72,9 +246,103 @@ void Operation::cleanup()
     {
         if(!QFile(dataFilename()).remove())
             throwWarning(QObject::tr("Unable to remove temporary file %1").arg(dataFilename()));
+        QFile::remove(dataSha1Filename());
     }
 }
 
+/*!
+    \brief Returns \c true if the operation data can be applied while being downloaded
+    \sa beginStream()
+ */
+bool Operation::canStream() const
+{
+    return false;
+}
+
+/*!
+    \brief Start streaming the operation data
+    Data is then given by writeStream() and verified by endStream().
+    Errors are reported by throwing a QString, in that case abortStream() must be called.
+ */
+void Operation::beginStream()
+{
+    throw QObject::tr("Streaming isn't supported by %1 operations").arg(type());
+}
+
+void Operation::writeStream(const char *, qint64)
+{
+    throw QObject::tr("Streaming isn't supported by %1 operations").arg(type());
+}
+
+/*!
+    \brief Finish streaming the operation data
+    On success, the operation is streamed and apply() only has to commit the result.
+ */
+void Operation::endStream()
+{
+    throw QObject::tr("Streaming isn't supported by %1 operations").arg(type());
+}
+
+/*!
+    \brief Drop any data streamed so far
+ */
+void Operation::abortStream()
+{
+    m_streamed = false;
+}
+
+/*!
+    \brief Find the parts of the data required to repair the local file
+    Called instead of checkLocalData() when the local file is known to be invalid.
+    By default, the whole data is required.
+ */
+void Operation::planRepair()
+{
+}
+
+/*!
+    Returns the number of bytes to download.
+ */
+qint64 Operation::requiredSize() const
+{
+    if(!isPartialDownload())
+        return size();
+
+    qint64 total = 0;
+    foreach(const DataRange &range, m_requiredData)
+        total += range.size;
+    return total;
+}
+
+/*!
+    \brief Returns the position relative to offset() of the \a received th byte to download
+    \param contiguous If not null, set to the number of bytes to download that follow without gap
+ */
+qint64 Operation::requiredDataPosition(qint64 received, qint64 *contiguous) const
+{
+    if(!isPartialDownload())
+    {
+        if(contiguous)
+            *contiguous = size() - received;
+        return received;
+    }
+
+    foreach(const DataRange &range, m_requiredData)
+    {
+        if(received < range.size)
+        {
+            if(contiguous)
+                *contiguous = range.size - received;
+            return range.offset + received;
+        }
+        received -= range.size;
+    }
+
+    if(contiguous)
+        *contiguous = 0;
+    return size();
+}
+
 Operation::FileType Operation::fileType() const
 {
     return None;
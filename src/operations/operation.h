@@ -5,8 +5,11 @@
 #include <QProcess>
 #include <QJsonObject>
 #include <QFile>
+#include <QVector>
 #include <functional>
 #include "../common/utils.h"
+#include "../common/filestamp.h"
+#include "../common/treehash.h"
 
 class QFile;
 class DownloadManager;
@@ -38,24 +41,51 @@ public:
 
     QString dataFilename() const;
     QString dataDownloadFilename() const;
+    QString dataSha1Filename() const;
+    bool isDataVerified() const;
+    void setDataVerified();
     void setDataFilename(const QString &dataFilename);
 
     QString localFilename() const;
     void setUpdateDirectory(const QString &updateDirectory);
+    QString tmpDirectory() const;
 
     QString path() const;
     QString sha1() const;
     QString sha1(QFile *dataFile) const;
+    virtual QString finalSha1() const;
+    virtual qint64 applySize() const;
+
+    FileStamp localStamp() const;
+    void setLocalStamp(const FileStamp &stamp);
+    bool isParanoidCheck() const;
+    void setParanoidCheck(bool paranoidCheck);
 
     QString errorString() const;
     Status status() const;
+    void setStatus(Status status);
 
     // Update methods
     void setup(const QString &updateDir, const QString &tmpUpdateDir, int uniqueid);
+    int index() const;
     void checkLocalData(); // FileManager thread
     void apply(); // FileManager thread
     virtual void cleanup();  // DownloadManager thread
 
+    // Streaming methods, DownloadManager thread
+    virtual bool canStream() const;
+    virtual void beginStream();
+    virtual void writeStream(const char *data, qint64 len);
+    virtual void endStream();
+    virtual void abortStream();
+    bool isStreamed() const;
+
+    // Partial download methods, DownloadManager thread
+    virtual void planRepair();
+    bool isPartialDownload() const;
+    qint64 requiredSize() const;
+    qint64 requiredDataPosition(qint64 received, qint64 *contiguous = nullptr) const;
+
     virtual FileType fileType() const;
     virtual void fromJsonObjectV1(const QJsonObject &object);
     QJsonObject toJsonObjectV1();
@@ -64,22 +94,50 @@ public:
 
 private:
     Status m_status;
+    int m_index;
     QString m_localFilename, m_dataFilename;
+    QString m_tmpDirectory;
     QString m_path;
     Q_DISABLE_COPY(Operation)
 
 protected:
+    static const qint64 SampleMinSize = 1024 * 1024; // 1MB
+    static const qint64 SampleBlockSize = 4096; // 4KB
     static const QString Path;
     virtual Status localDataStatus() = 0; // FileManager thread
     virtual void applyData() = 0; // FileManager thread
     virtual QString type() const = 0;
     virtual void fillJsonObjectV1(QJsonObject & object);
+
+    struct KnownFile
+    {
+        KnownFile(const QString &sha1 = QString(), const TreeHash &tree = TreeHash()) : sha1(sha1), tree(tree) {}
+        QString sha1;
+        TreeHash tree; ///< Null if the file has no tree signature
+    };
+    QString localFileSha1(QFile *file, const QVector<KnownFile> &candidates = QVector<KnownFile>());
+    QString sample(QFile *file) const;
+    TreeHash treeHash(QFile *file) const;
+    bool matchesSample(QFile *file, const QString &expectedSample) const;
     void throwWarning(const QString &warning);
     void setPath(const QString &path);
+    void detachLocalFile();
 
     std::function<void(const QString &message)> m_warningListener;
     qint64 m_offset, m_size;
     QString m_sha1, m_errorString;
+    bool m_streamed; ///< Data has been streamed and verified, only the commit is left to apply()
+    FileStamp m_localStamp; ///< Stamp of the local file, if known
+    bool m_paranoidCheck; ///< Applied files are always hashed entirely
+
+    struct DataRange
+    {
+        DataRange(qint64 offset = 0, qint64 size = 0) : offset(offset), size(size) {}
+        qint64 offset; ///< Relative to offset()
+        qint64 size;
+    };
+    bool m_partialDownload; ///< Only m_requiredData has to be downloaded, set by planRepair()
+    QVector<DataRange> m_requiredData;
 };
 
 inline qint64 Operation::offset() const
@@ -107,6 +165,11 @@ inline QString Operation::dataDownloadFilename() const
     return m_dataFilename + ".part";
 }
 
+inline QString Operation::dataSha1Filename() const
+{
+    return m_dataFilename + ".sha1";
+}
+
 inline void Operation::setDataFilename(const QString &dataFilename)
 {
     m_dataFilename = dataFilename;
@@ -122,6 +185,14 @@ inline void Operation::setUpdateDirectory(const QString &updateDirectory)
     m_localFilename = updateDirectory + path();
 }
 
+/*!
+    Returns the temporary directory of the update, as given to setup()
+ */
+inline QString Operation::tmpDirectory() const
+{
+    return m_tmpDirectory;
+}
+
 inline QString Operation::path() const
 {
     return m_path;
@@ -132,6 +203,59 @@ inline QString Operation::sha1() const
     return m_sha1;
 }
 
+inline bool Operation::isStreamed() const
+{
+    return m_streamed;
+}
+
+/*!
+    Returns \c true if only parts of the data have to be downloaded.
+    The downloaded data is then the concatenation of those parts and its signature is checked by apply().
+    \sa planRepair(), requiredDataPosition()
+ */
+inline bool Operation::isPartialDownload() const
+{
+    return m_partialDownload;
+}
+
+/*!
+    Position of the operation in its package, set by setup()
+ */
+inline int Operation::index() const
+{
+    return m_index;
+}
+
+/*!
+    Stamp of the local file, as checked by checkLocalData() or written by apply()
+    \sa setLocalStamp()
+ */
+inline FileStamp Operation::localStamp() const
+{
+    return m_localStamp;
+}
+
+/*!
+    Trust \a stamp: if the local file still matches it, the file isn't hashed by checkLocalData()
+ */
+inline void Operation::setLocalStamp(const FileStamp &stamp)
+{
+    m_localStamp = stamp;
+}
+
+inline bool Operation::isParanoidCheck() const
+{
+    return m_paranoidCheck;
+}
+
+/*!
+    Set if the whole local file must be hashed again after apply, even if the operation only wrote part of it
+ */
+inline void Operation::setParanoidCheck(bool paranoidCheck)
+{
+    m_paranoidCheck = paranoidCheck;
+}
+
 inline QString Operation::errorString() const
 {
     return m_errorString;
@@ -142,6 +266,15 @@ inline Operation::Status Operation::status() const
     return m_status;
 }
 
+/*!
+    \brief Force the status of the operation without checking the local data
+    Used when the status is already known, like while repairing files known to be invalid.
+ */
+inline void Operation::setStatus(Operation::Status status)
+{
+    m_status = status;
+}
+
 inline void Operation::setWarningListener(std::function<void (const QString &)> listener)
 {
     m_warningListener = listener;
@@ -16,6 +16,8 @@ const QString PatchOperation::Action = QStringLiteral("patch");
 
 const QString PatchOperation::LocalSize = QStringLiteral("localSize");
 const QString PatchOperation::LocalSha1 = QStringLiteral("localSha1");
+const QString PatchOperation::LocalSample = QStringLiteral("localSample");
+const QString PatchOperation::LocalTree = QStringLiteral("localTree");
 const QString PatchOperation::PathType = QStringLiteral("patchType");
 
 const QString COMPRESSION_LZMA = QStringLiteral("lzma");
@@ -35,9 +37,17 @@ Operation::Status PatchOperation::localDataStatus()
 
     if(file.exists())
     {
-        if(file.size() == m_finalSize || file.size() == m_localSize)
+        // Fingerprints reject files that are neither versions without reading them entirely
+        bool maybeFinal = file.size() == m_finalSize && matchesSample(&file, m_finalSample);
+        bool maybeLocal = file.size() == m_localSize && matchesSample(&file, m_localSample);
+        if(maybeFinal || maybeLocal)
         {
-            QString hash = sha1(&file);
+            QVector<KnownFile> candidates;
+            if(maybeFinal)
+                candidates.append(KnownFile(m_finalSha1, m_finalTree));
+            if(maybeLocal)
+                candidates.append(KnownFile(m_localSha1, m_localTree));
+            QString hash = localFileSha1(&file, candidates);
 
             if(hash == m_finalSha1)
             {
@@ -52,7 +62,7 @@ Operation::Status PatchOperation::localDataStatus()
                 if(file.exists())
                 {
                     // Check downloaded data file content
-                    if(file.size() == size() && sha1(&file) == sha1())
+                    if(file.size() == size() && (isDataVerified() || sha1(&file) == sha1()))
                     {
                         qCDebug(LOG_PATCHOP) << "File data is valid" << path();
                         return ApplyRequired;
@@ -101,7 +111,7 @@ void PatchOperation::applyData()
             source.reset(LZMADecompressor(&dataFile));
         else
             throw QObject::tr("Unsupported compression %1").arg(m_compression);
-        QCryptographicHash sha1Hash(QCryptographicHash::Sha1);
+        Sha1Hash sha1Hash;
         QScopedPointer<QIODevice> xd3(XDelta3(source.data(), &baseFile, false));
         readAll(xd3.data(), &file, &sha1Hash);
 
@@ -139,6 +149,10 @@ void PatchOperation::fillJsonObjectV1(QJsonObject &object)
 
     object.insert(LocalSize, QString::number(m_localSize));
     object.insert(LocalSha1, m_localSha1);
+    if(!m_localSample.isEmpty())
+        object.insert(LocalSample, m_localSample);
+    if(!m_localTree.isNull())
+        object.insert(LocalTree, m_localTree.toJsonObject());
     object.insert(PathType, m_patchtype);
 }
 
@@ -148,6 +162,10 @@ void PatchOperation::fromJsonObjectV1(const QJsonObject &object)
 
     m_localSize = JsonUtil::asInt64String(object, LocalSize);
     m_localSha1 = JsonUtil::asString(object, LocalSha1);
+    m_localSample = object.contains(LocalSample) ? JsonUtil::asString(object, LocalSample) : QString();
+    m_localTree = TreeHash();
+    if(object.contains(LocalTree))
+        m_localTree.fromJsonObject(JsonUtil::asObject(object, LocalTree));
     m_patchtype = JsonUtil::asString(object, PathType);
 }
 
@@ -165,6 +183,8 @@ void PatchOperation::create(const QString &filepath, const QString &oldFilename,
 
         m_finalSha1 = sha1(&newFile);
         m_finalSize = newFile.size();
+        m_finalSample = sample(&newFile);
+        m_finalTree = treeHash(&newFile);
     }
 
     // Old file informations
@@ -174,6 +194,8 @@ void PatchOperation::create(const QString &filepath, const QString &oldFilename,
 
         m_localSha1 = sha1(&oldFile);
         m_localSize = oldFile.size();
+        m_localSample = sample(&oldFile);
+        m_localTree = treeHash(&oldFile);
     }
 
     if(m_localSize == m_finalSize && m_localSha1 == m_finalSha1)
@@ -218,7 +240,7 @@ void PatchOperation::create(const QString &filepath, const QString &oldFilename,
     m_compression = COMPRESSION_BROTLI;
     m_patchtype = PATCHTYPE_XDELTA;
     
-    QCryptographicHash sha1Hash(QCryptographicHash::Sha1);
+    Sha1Hash sha1Hash;
     QScopedPointer<QIODevice> xd3(XDelta3(&newFile, &oldFile, true));
     QScopedPointer<QIODevice> compressor(BrotliCompressor(xd3.data()));
     readAll(compressor.data(), &dataFile, &sha1Hash);
@@ -252,7 +274,20 @@ void PatchOperation::create(const QString &filepath, const QString &oldFilename,
     }
 }
 
+bool PatchOperation::canStream() const
+{
+    return false; // The patched file must be read while the patch is applied
+}
+
 QString PatchOperation::type() const
 {
     return Action;
 }
+
+/*!
+    The local file is read and the final file is written by the delta decoder
+ */
+qint64 PatchOperation::applySize() const
+{
+    return m_localSize + m_finalSize;
+}
@@ -11,9 +11,13 @@ public:
     virtual void fromJsonObjectV1(const QJsonObject &object) Q_DECL_OVERRIDE;
     void create(const QString &path, const QString &oldFilename, const QString &newFilename, const QString &tmpDirectory);
     bool required() const;
+    virtual qint64 applySize() const Q_DECL_OVERRIDE;
+    virtual bool canStream() const Q_DECL_OVERRIDE;
 protected:
     static const QString LocalSize;
     static const QString LocalSha1;
+    static const QString LocalSample;
+    static const QString LocalTree;
     static const QString PathType;
     virtual Status localDataStatus() Q_DECL_OVERRIDE;
     virtual void applyData() Q_DECL_OVERRIDE;
@@ -21,6 +25,8 @@ protected:
     virtual void fillJsonObjectV1(QJsonObject & object) Q_DECL_OVERRIDE;
 
     QString m_patchtype, m_localSha1;
+    QString m_localSample; ///< Fingerprint of the file to patch, empty for small files
+    TreeHash m_localTree; ///< Tree signature of the file to patch, null for small files
     qint64 m_localSize;
 };
 
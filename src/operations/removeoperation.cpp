@@ -14,13 +14,16 @@ RemoveOperation::RemoveOperation() : Operation()
     m_localSize = 0;
 }
 
-void RemoveOperation::create(const QString &path, const QString &oldFilename)
+/*!
+    \param oldSha1 Sha1 of \a oldFilename if already known, it's computed otherwise
+ */
+void RemoveOperation::create(const QString &path, const QString &oldFilename, const QString &oldSha1)
 {
     QFile file(oldFilename);
     if(!file.exists(oldFilename))
         throw QObject::tr("File %1 doesn't exists").arg(oldFilename);
 
-    m_localSha1 = sha1(&file);
+    m_localSha1 = oldSha1.isEmpty() ? sha1(&file) : oldSha1;
     m_localSize = file.size();
     setPath(path);
 }
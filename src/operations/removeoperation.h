@@ -8,7 +8,7 @@ class RemoveOperation : public Operation
 public:
     RemoveOperation();
     static const QString Action;
-    void create(const QString &path, const QString &oldFilename);
+    void create(const QString &path, const QString &oldFilename, const QString &oldSha1 = QString());
     virtual void fromJsonObjectV1(const QJsonObject &object) override;
 protected:
     virtual void fillJsonObjectV1(QJsonObject & object) Q_DECL_OVERRIDE;
@@ -1,6 +1,7 @@
 #include "packager.h"
 #include "common/utils.h"
 #include "common/package.h"
+#include "common/sha1.h"
 #include "operations/operation.h"
 #include "exceptions.h"
 
@@ -20,7 +21,7 @@
 
 Q_LOGGING_CATEGORY(LOG_PACKAGER, "updatesystem.packager")
 
-Packager::Packager(QObject *parent) : QObject(parent), m_temporaryDir(nullptr)
+Packager::Packager(QObject *parent) : QObject(parent), m_blockSize(0), m_appendEnabled(false), m_blockPatchEnabled(false), m_temporaryDir(nullptr)
 {
 
 }
@@ -87,10 +88,15 @@ PackageMetadata Packager::generate()
 
     qCDebug(LOG_PACKAGER) << "Comparing directories...";
     {
-        QFileInfoList newFiles = dirList(newDir);
-        QFileInfoList oldFiles = oldDirectoryPath().isNull() ? QFileInfoList() : dirList(oldDir);
+        // Both trees are listed concurrently before being compared
+        DirScanner scanner;
+        scanner.setIgnoredNames(QStringList() << QStringLiteral(".git"));
+        m_newTree = scanner.scan(newDirectoryPath());
+        m_oldTree = oldDirectoryPath().isNull() ? DirScanner::Tree() : scanner.scan(oldDirectoryPath());
         m_tasks.clear();
-        compareDirectories(QString(), newFiles, oldFiles);
+        compareDirectories(QString(), m_newTree.value(QString()), m_oldTree.value(QString()));
+        m_newTree.clear();
+        m_oldTree.clear();
     }
     qCDebug(LOG_PACKAGER) << "Directory comparison done in" << Utils::formatMs(stepTimer.restart());
 
@@ -104,6 +110,24 @@ PackageMetadata Packager::generate()
             setTmpDirectoryPath(m_temporaryDir->path());
         }
 
+        // Removed files are hashed all together, many small files are hashed in parallel lanes
+        {
+            QStringList removedFiles;
+            QVector<PackagerTask *> removeTasks;
+            foreach(const QSharedPointer<PackagerTask> &task, m_tasks)
+            {
+                if(task->operationType == PackagerTask::RemoveFile)
+                {
+                    removedFiles.append(task->oldFilename);
+                    removeTasks.append(task.data());
+                }
+            }
+
+            QVector<QByteArray> sha1s = Sha1Hash::hashFiles(removedFiles);
+            for(int i = 0; i < removeTasks.size(); ++i)
+                removeTasks[i]->oldSha1 = QString(sha1s[i].toHex());
+        }
+
         QThreadPool threadPool;
         int pos = 0, size = m_tasks.size();
         for(int i = 0; i < m_tasks.size(); ++i)
@@ -113,6 +137,9 @@ PackageMetadata Packager::generate()
                 emit progress(++pos, size);
             });
             task->tmpDirectory = tmpDirectoryPath();
+            task->blockSize = blockSize();
+            task->appendEnabled = isAppendEnabled();
+            task->blockPatchEnabled = isBlockPatchEnabled();
             if(task->isRunSlow())
                 threadPool.start(task);
             else
@@ -127,7 +154,7 @@ PackageMetadata Packager::generate()
     {
         if(!deltaFile.open(QFile::WriteOnly))
             THROW(PackagingFailed, tr("Unable to create new delta file"));
-        qint64 totalSize = 0;
+        qint64 totalSize = 0, applySize = 0;
         qint64 read;
         char buffer[8096];
         QFile operationFile;
@@ -154,9 +181,10 @@ PackageMetadata Packager::generate()
                 task.operation->setOffset(totalSize);
                 totalSize += task.operation->size();
             }
+            applySize += task.operation->applySize();
             metadata.addOperation(task.operation);
         }
-        metadata.setPackage(Package(newRevisionName(), oldRevisionName(), totalSize));
+        metadata.setPackage(Package(newRevisionName(), oldRevisionName(), totalSize, applySize));
 
         if(!deltaFile.flush())
              THROW(WriteFailure, deltaFile.fileName());
@@ -177,114 +205,93 @@ PackageMetadata Packager::generate()
     return metadata;
 }
 
-QFileInfoList Packager::dirList(const QDir & dir)
+void Packager::addRemoveDirTask(const QString &path)
 {
-    QFileInfoList list = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden, QDir::Name);
-    for (int i = list.size()-1; i >= 0; --i)
+    foreach(const DirScanner::Entry &file, m_oldTree.value(path))
     {
-        if (list.at(i).fileName() == QLatin1String(".git"))
-            list.removeAt(i);
-    }
-    return list;
-}
-
-
-void Packager::addRemoveDirTask(QString path, QFileInfo &pathInfo)
-{
-    QFileInfoList files = dirList(QDir(pathInfo.absoluteFilePath()));
-    for(int pos = 0, len = files.size(); pos < len; ++pos)
-    {
-        QFileInfo & file = files[pos];
+        QString filePath = path + QLatin1Char('/') + file.name;
         if(file.isDir())
-        {
-            addRemoveDirTask(path+QLatin1Char('/')+file.fileName(), file);
-        }
+            addRemoveDirTask(filePath);
         else
-        {
-            addTask(PackagerTask::RemoveFile, path+QLatin1Char('/')+file.fileName(), QString(), file.filePath());
-        }
+            addTask(PackagerTask::RemoveFile, filePath, QString(), oldDirectoryPath() + filePath);
     }
     addTask(PackagerTask::RemoveDir, path);
 }
 
-void Packager::compareDirectories(QString path, const QFileInfoList & newFiles, const QFileInfoList & oldFiles)
+void Packager::compareDirectories(const QString &path, const DirScanner::EntryList &newFiles, const DirScanner::EntryList &oldFiles)
 {
     int newPos = 0, newLen = newFiles.size();
     int oldPos = 0, oldLen = oldFiles.size();
 
+    QString prefix;
     if(!path.isEmpty())
     {
         addTask(PackagerTask::AddDir, path);
-        path += QLatin1Char('/');
+        prefix = path + QLatin1Char('/');
     }
     while(newPos < newLen || oldPos < oldLen)
     {
-        QFileInfo newFile, oldFile;
         int diff;
-        if(newPos < newLen)
-            newFile = newFiles[newPos];
-        if(oldPos < oldLen)
-            oldFile = oldFiles[oldPos];
-
         if(newPos < newLen && oldPos < oldLen)
-            diff = QString::compare(newFile.fileName(), oldFile.fileName());
+            diff = QString::compare(newFiles[newPos].name, oldFiles[oldPos].name);
         else
             diff = newPos < newLen ? -1 : 1;
 
         if(diff < 0)
         {
+            const DirScanner::Entry &newFile = newFiles[newPos];
+            QString filePath = prefix + newFile.name;
             if(newFile.isFile())
             {
                 // Add newFile
-                addTask(PackagerTask::Add, path+newFile.fileName(), newFile.filePath());
+                addTask(PackagerTask::Add, filePath, newDirectoryPath() + filePath);
             }
-            else if(newFile.isDir())
+            else
             {
-                compareDirectories(path + newFile.fileName(),
-                                   dirList(QDir(newFile.filePath())), QFileInfoList());
+                compareDirectories(filePath, m_newTree.value(filePath), DirScanner::EntryList());
             }
             ++newPos;
         }
         else if(diff > 0)
         {
             // Del oldFile
+            const DirScanner::Entry &oldFile = oldFiles[oldPos];
+            QString filePath = prefix + oldFile.name;
             if(oldFile.isDir())
-                addRemoveDirTask(path + oldFile.fileName(), oldFile);
+                addRemoveDirTask(filePath);
             else
-                addTask(PackagerTask::RemoveFile, path + oldFile.fileName(), QString(), oldFile.filePath());
+                addTask(PackagerTask::RemoveFile, filePath, QString(), oldDirectoryPath() + filePath);
             ++oldPos;
         }
         else // diff == 0
         {
+            const DirScanner::Entry &newFile = newFiles[newPos];
+            const DirScanner::Entry &oldFile = oldFiles[oldPos];
+            QString filePath = prefix + newFile.name;
             if(newFile.isFile())
             {
                 if(!oldFile.isFile())
                 {
                     // RMD + ADD
-                    addRemoveDirTask(path + oldFile.fileName(), oldFile);
-                    //m_tasks.emplace_back(PackagerTask(PackagerTask::RemoveDir, path + newFile.fileName(), QString(), newFile.filePath()));
-                    addTask(PackagerTask::Add, path + newFile.fileName(), newFile.filePath());
+                    addRemoveDirTask(filePath);
+                    addTask(PackagerTask::Add, filePath, newDirectoryPath() + filePath);
                 }
                 else
                 {
                     // Make diff
-                    addTask(PackagerTask::Patch, path + newFile.fileName(), newFile.filePath(), oldFile.filePath());
+                    addTask(PackagerTask::Patch, filePath, newDirectoryPath() + filePath, oldDirectoryPath() + filePath);
                 }
             }
-            else if(newFile.isDir())
+            else
             {
                 if(!oldFile.isDir())
                 {
-                    addTask(PackagerTask::RemoveFile, path + oldFile.fileName(), QString(), oldFile.filePath());
-                    compareDirectories(path + newFile.fileName(),
-                                       dirList(QDir(newFile.filePath())),
-                                       QFileInfoList());
+                    addTask(PackagerTask::RemoveFile, filePath, QString(), oldDirectoryPath() + filePath);
+                    compareDirectories(filePath, m_newTree.value(filePath), DirScanner::EntryList());
                 }
                 else
                 {
-                    compareDirectories(path + newFile.fileName(),
-                                       dirList(QDir(newFile.filePath())),
-                                       dirList(QDir(oldFile.filePath())));
+                    compareDirectories(filePath, m_newTree.value(filePath), m_oldTree.value(filePath));
                 }
             }
 
@@ -2,6 +2,7 @@
 #define PACKAGER_H
 
 #include "qtupdatesystem_global.h"
+#include "common/dirscanner.h"
 #include "common/packagemetadata.h"
 #include "common/utils.h"
 #include "packager/packagertask.h"
@@ -44,6 +45,15 @@ public:
     QString tmpDirectoryPath();
     void setTmpDirectoryPath(const QString &tmpDirectoryPath);
 
+    qint64 blockSize() const;
+    void setBlockSize(qint64 blockSize);
+
+    bool isAppendEnabled() const;
+    void setAppendEnabled(bool appendEnabled);
+
+    bool isBlockPatchEnabled() const;
+    void setBlockPatchEnabled(bool blockPatchEnabled);
+
     QString errorString() const;
 
 signals:
@@ -55,16 +65,19 @@ private:
     QString m_newDirectoryPath, m_newRevisionName;
     QString m_deltaFilename, m_deltaMetadataFilename;
     QString m_tmpDirectoryPath;
+    qint64 m_blockSize;
+    bool m_appendEnabled;
+    bool m_blockPatchEnabled;
 
     // Internal
     QTemporaryDir *m_temporaryDir;
 
 private:
-    QFileInfoList dirList(const QDir &dir);
     QVector<QSharedPointer<PackagerTask>> m_tasks;
-    void compareDirectories(QString path, const QFileInfoList &newFiles, const QFileInfoList &oldFiles);
+    DirScanner::Tree m_newTree, m_oldTree;
+    void compareDirectories(const QString &path, const DirScanner::EntryList &newFiles, const DirScanner::EntryList &oldFiles);
     void addTask(PackagerTask::Type operationType, QString path, QString newFilename = QString(), QString oldFilename = QString());
-    void addRemoveDirTask(QString path, QFileInfo &pathInfo);
+    void addRemoveDirTask(const QString &path);
     static QString generate_hash(const QString &srcFilename);
 };
 
@@ -132,4 +145,47 @@ inline void Packager::setTmpDirectoryPath(const QString &tmpDirectoryPath)
     m_tmpDirectoryPath = Utils::cleanPath(tmpDirectoryPath);
 }
 
+inline qint64 Packager::blockSize() const
+{
+    return m_blockSize;
+}
+
+/*!
+    \brief Compress added files bigger than \a blockSize by blocks
+    Damaged files can then be repaired by downloading only the blocks that differ.
+    Updaters older than block compressed add operations can't read such packages, so 0 (the default) disables blocks.
+ */
+inline void Packager::setBlockSize(qint64 blockSize)
+{
+    m_blockSize = blockSize;
+}
+
+inline bool Packager::isAppendEnabled() const
+{
+    return m_appendEnabled;
+}
+
+/*!
+    \brief Ship files that only grew as append operations, with only their new tail
+    Updaters older than append operations can't read such packages, so it's disabled by default.
+ */
+inline void Packager::setAppendEnabled(bool appendEnabled)
+{
+    m_appendEnabled = appendEnabled;
+}
+
+inline bool Packager::isBlockPatchEnabled() const
+{
+    return m_blockPatchEnabled;
+}
+
+/*!
+    \brief Patch huge files with localized changes in place, by writing only the changed blocks
+    Updaters older than block patch operations can't read such packages, so it's disabled by default.
+ */
+inline void Packager::setBlockPatchEnabled(bool blockPatchEnabled)
+{
+    m_blockPatchEnabled = blockPatchEnabled;
+}
+
 #endif // PACKAGER_H
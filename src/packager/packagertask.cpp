@@ -1,7 +1,10 @@
 #include "packagertask.h"
 #include <QLoggingCategory>
+#include <QFileInfo>
 #include "../operations/operation.h"
 #include "../operations/addoperation.h"
+#include "../operations/appendoperation.h"
+#include "../operations/blockpatchoperation.h"
 #include "../operations/adddirectoryoperation.h"
 #include "../operations/patchoperation.h"
 #include "../operations/removeoperation.h"
@@ -14,6 +17,9 @@ PackagerTask::PackagerTask(PackagerTask::Type operationType, QString path, QStri
     this->path = path;
     this->oldFilename = oldFilename;
     this->newFilename = newFilename;
+    this->blockSize = 0;
+    this->appendEnabled = false;
+    this->blockPatchEnabled = false;
     setAutoDelete(false);
 }
 
@@ -31,11 +37,29 @@ void PackagerTask::run()
         {
             AddOperation * op = new AddOperation();
             operation = QSharedPointer<Operation>(op);
-            op->create(path, newFilename, tmpDirectory);
+            op->create(path, newFilename, tmpDirectory, blockSize);
             break;
         }
         case Patch:
         {
+            if(appendEnabled && AppendOperation::isAppend(oldFilename, newFilename))
+            {
+                // Only the new tail has to be shipped and written
+                AppendOperation * op = new AppendOperation();
+                operation = QSharedPointer<Operation>(op);
+                op->create(path, oldFilename, newFilename, tmpDirectory);
+                break;
+            }
+            if(blockPatchEnabled && QFileInfo(newFilename).size() >= BlockPatchOperation::MinFileSize)
+            {
+                // Huge files with localized changes are patched in place
+                QSharedPointer<BlockPatchOperation> op(new BlockPatchOperation());
+                if(op->create(path, oldFilename, newFilename, tmpDirectory))
+                {
+                    operation = op;
+                    break;
+                }
+            }
             PatchOperation * op = new PatchOperation();
             operation = QSharedPointer<Operation>(op);
             op->create(path, oldFilename, newFilename, tmpDirectory);
@@ -45,7 +69,7 @@ void PackagerTask::run()
         {
             RemoveOperation * op = new RemoveOperation();
             operation = QSharedPointer<Operation>(op);
-            op->create(path, oldFilename);
+            op->create(path, oldFilename, oldSha1);
             break;
         }
         case RemoveDir:
@@ -27,6 +27,10 @@ public:
     QString oldFilename;
     QString newFilename;
     QString tmpDirectory;
+    qint64 blockSize;
+    bool appendEnabled;
+    bool blockPatchEnabled;
+    QString oldSha1; ///< Sha1 of oldFilename, if already known
     QString errorString;
     QSharedPointer<Operation> operation;
     bool isRunSlow() const;
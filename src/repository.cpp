@@ -1,5 +1,6 @@
 #include "repository.h"
 #include "common/jsonutil.h"
+#include "common/packagegraph.h"
 #include "common/utils.h"
 #include "exceptions.h"
 
@@ -8,6 +9,8 @@
 #include <QDir>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QSet>
+#include <QStringList>
 
 
 const QString Repository::CurrentVersionFile = "current";
@@ -185,11 +188,14 @@ void Repository::simplify()
 {
     QVector<bool> useful(m_packages.size(), false);
     const QString & currentVersion = m_versions.at(m_currentVersion).revision;
+    PackageGraph graph(m_packages); // One shortest path tree toward the current version answers every version
 
-    markPackagesAsUseful(useful, m_packages.findBestPath(QString(), currentVersion));
+    foreach(int index, graph.findBestPathIndexes(QString(), currentVersion))
+        useful[index] = true;
     for(int i = 0; i < m_versions.size(); ++i)
     {
-        markPackagesAsUseful(useful, m_packages.findBestPath(m_versions.at(i).revision, currentVersion));
+        foreach(int index, graph.findBestPathIndexes(m_versions.at(i).revision, currentVersion))
+            useful[index] = true;
     }
 
     for(int i = m_packages.size() - 1; i >= 0; --i)
@@ -199,29 +205,58 @@ void Repository::simplify()
     }
 }
 
-void Repository::markPackagesAsUseful(QVector<bool> &useful, const QVector<Package> packages)
-{
-    foreach(const Package &usefulPackage, packages)
-    {
-        for(int i = 0; i < m_packages.size(); ++i)
-        {
-            if(m_packages.at(i) == usefulPackage)
-            {
-                useful[i] = true;
-                break;
-            }
-        }
-    }
-}
-
 void Repository::save()
 {
     JsonUtil::toJsonFile(m_directory + PackagesFile, m_packages.toJsonObject());
     JsonUtil::toJsonFile(m_directory + VersionsFile, m_versions.toJsonObject());
+    saveRoutes();
     if(m_currentVersion != -1)
         JsonUtil::toJsonFile(m_directory + CurrentVersionFile, m_versions.at(m_currentVersion).toJsonObject());
 }
 
+/*!
+    \brief Publish the best path from every version, and for new installations, to the current version
+    Each path is a file named by Packages::routeName(), so an updater only downloads its own path
+    instead of the whole packages list.
+    Routes are written before "current", an updater checks the "to" revision of a route and falls back
+    to the packages list if it isn't the current revision it knows.
+ */
+void Repository::saveRoutes()
+{
+    QSet<QString> routeNames;
+    if(m_currentVersion != -1)
+    {
+        const QString & currentVersion = m_versions.at(m_currentVersion).revision;
+        PackageGraph graph(m_packages);
+
+        QStringList revisions;
+        revisions.append(QString());
+        foreach(const Version &version, m_versions)
+            revisions.append(version.revision);
+
+        foreach(const QString &revision, revisions)
+        {
+            Packages route;
+            route += graph.findBestPath(revision, currentVersion);
+            if(route.isEmpty())
+                continue;
+
+            QJsonObject object = route.toJsonObject();
+            object.insert(QStringLiteral("to"), currentVersion);
+            JsonUtil::toJsonFile(m_directory + Packages::routeName(revision), object);
+            routeNames.insert(Packages::routeName(revision));
+        }
+    }
+
+    // Routes of removed versions
+    QDir dir(m_directory);
+    foreach(const QString &name, dir.entryList(QDir::Files))
+    {
+        if(Packages::isRouteName(name) && !routeNames.contains(name))
+            dir.remove(name);
+    }
+}
+
 bool Repository::setCurrentRevision(const QString &revision)
 {
     for(int i = 0; i < m_versions.size(); ++i)
@@ -14,6 +14,7 @@
  *  - current : a json file that hold the current distributed revision (revision)
  *  - versions : a json file that hold a list of revisions
  *  - packages : a json file that hold a list of available packages (from/to/size)
+ *  - route, route_REVISION : json files that hold the best list of packages from nothing or REVISION to the current revision
  *  - PACKNAME.metadata : a json file that hold informations about a package (operations/size/...)
  *  - PACKNAME : a data file that contains all data necessary for a package
  *
@@ -56,7 +57,7 @@ private:
     Versions m_versions;
     int m_currentVersion;
     void ensurePackageVersionExists(const Package &package);
-    void markPackagesAsUseful(QVector<bool> &useful, const QVector<Package> packages);
+    void saveRoutes();
 };
 
 inline QString Repository::directory() const
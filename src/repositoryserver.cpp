@@ -0,0 +1,76 @@
+#include "repositoryserver.h"
+#include "common/packagemetadata.h"
+#include "common/sha1.h"
+#include "common/utils.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(LOG_REPOSITORYSERVER, "updatesystem.repositoryserver")
+
+RepositoryServer::RepositoryServer(const QString &directory, QObject *parent) :
+    HttpServer(parent)
+{
+    setDirectory(directory);
+}
+
+void RepositoryServer::setDirectory(const QString &directory)
+{
+    Q_ASSERT(!isListening());
+    m_directory = directory.isEmpty() ? QString() : Utils::cleanPath(directory);
+    m_entityTags.clear();
+}
+
+HttpServer::Resource RepositoryServer::resource(const QString &path)
+{
+    Resource resource;
+    if(m_directory.isEmpty() || path.isEmpty() || path.startsWith(QLatin1Char('.')) || path.contains(QLatin1Char('/')) || path.contains(QLatin1Char('\\')))
+        return resource;
+
+    QFileInfo info(m_directory + path);
+    if(!resource.addFile(info.filePath()))
+        return resource;
+
+    // Informations files are json, package data is binary
+    if(!QFileInfo(m_directory + path + PackageMetadata::FileExtension).isFile())
+        resource.setContentType("application/json");
+    resource.setEntityTag(entityTag(path, info));
+    return resource;
+}
+
+/*!
+    \brief Returns the entity tag of the file \a name of the repository
+    The tag of package data is computed from its metadata, so the data doesn't have to be read.
+ */
+QByteArray RepositoryServer::entityTag(const QString &name, const QFileInfo &info)
+{
+    QFileInfo hashed(m_directory + name + PackageMetadata::FileExtension);
+    if(!hashed.isFile())
+        hashed = info;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_entityTags.constFind(name);
+        if(it != m_entityTags.constEnd() && it.value().size == hashed.size() && it.value().modified == hashed.lastModified())
+            return it.value().tag;
+    }
+
+    EntityTag entityTag;
+    entityTag.size = hashed.size();
+    entityTag.modified = hashed.lastModified();
+
+    QFile file(hashed.filePath());
+    Sha1Hash hash;
+    if(hashed.size() <= MaxHashedSize && file.open(QFile::ReadOnly) && hash.addData(&file))
+        entityTag.tag = name.toUtf8() + '-' + hash.result().toHex();
+    else
+        entityTag.tag = name.toUtf8() + '-' + QByteArray::number(entityTag.size, 16) + '-' + QByteArray::number(entityTag.modified.toMSecsSinceEpoch(), 16);
+
+    // Tags are only used in quoted strings
+    entityTag.tag.replace('"', '_').replace('\\', '_');
+
+    QMutexLocker locker(&m_mutex);
+    m_entityTags.insert(name, entityTag);
+    return entityTag.tag;
+}
@@ -0,0 +1,54 @@
+#ifndef REPOSITORYSERVER_H
+#define REPOSITORYSERVER_H
+
+#include "qtupdatesystem_global.h"
+#include "common/httpserver.h"
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+
+class QFileInfo;
+
+/*!
+    \brief Serve the files of a package repository to updaters over HTTP
+
+    Only the files of the repository directory itself are served, subdirectories and hidden files aren't.
+    Entity tags are derived from the file names and hashes:
+    package data is tagged by the sha1 of its metadata, which lists the hash of every operation,
+    other files are tagged by the sha1 of their content.
+    Those are computed once per file version, and resource() can be called by many threads.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT RepositoryServer : public HttpServer
+{
+    Q_OBJECT
+public:
+    explicit RepositoryServer(const QString &directory = QString(), QObject *parent = 0);
+
+    QString directory() const;
+    void setDirectory(const QString &directory);
+
+protected:
+    virtual Resource resource(const QString &path) Q_DECL_OVERRIDE;
+
+private:
+    static const qint64 MaxHashedSize = 16 * 1024 * 1024; ///< Bigger files without metadata are tagged by their stats
+
+    struct EntityTag
+    {
+        qint64 size;
+        QDateTime modified;
+        QByteArray tag;
+    };
+    QByteArray entityTag(const QString &name, const QFileInfo &info);
+
+    QString m_directory;
+    QMutex m_mutex; ///< Protects m_entityTags
+    QHash<QString, EntityTag> m_entityTags; ///< By name, valid while the size and modification time of the hashed file match
+};
+
+inline QString RepositoryServer::directory() const
+{
+    return m_directory;
+}
+
+#endif // REPOSITORYSERVER_H
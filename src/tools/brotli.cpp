@@ -25,7 +25,7 @@ private:
 class BrotliDecompressorQIODevice : public QIODevice
 {
 public:
-    BrotliDecompressorQIODevice(QIODevice *source, QObject *parent = nullptr);
+    BrotliDecompressorQIODevice(QIODevice *device, QIODevice::OpenMode mode, QObject *parent = nullptr);
     virtual ~BrotliDecompressorQIODevice();
     bool atEnd() const;
 protected:
@@ -35,7 +35,7 @@ private:
     static const int BufferSize = 65536;
     BrotliDecoderState *_state;
     BrotliDecoderResult _result;
-    QIODevice *_source;
+    QIODevice *_device; ///< Source in ReadOnly mode, destination in WriteOnly mode
     quint8 _buffer[BufferSize];
     const uint8_t *_next_in;
     size_t _available_in;
@@ -49,7 +49,15 @@ QIODevice * BrotliCompressor(QIODevice *source, quint32 quality, quint32 lgwin,
 
 QIODevice * BrotliDecompressor(QIODevice *source, QObject *parent)
 {
-    return new BrotliDecompressorQIODevice(source, parent);
+    return new BrotliDecompressorQIODevice(source, QIODevice::ReadOnly, parent);
+}
+
+/*!
+    Returns a device that decompresses the data written to it into \a destination.
+ */
+QIODevice * BrotliDecompressorWriter(QIODevice *destination, QObject *parent)
+{
+    return new BrotliDecompressorQIODevice(destination, QIODevice::WriteOnly, parent);
 }
 
 BrotliCompressorQIODevice::BrotliCompressorQIODevice(QIODevice *source, quint32 quality /*= 9*/, quint32 lgwin /*= 0*/, QObject *parent /*= nullptr*/) : QIODevice(parent)
@@ -105,12 +113,12 @@ qint64 BrotliCompressorQIODevice::writeData(const char *, qint64)
     return -1; // todo: throw exception ?
 }
 
-BrotliDecompressorQIODevice::BrotliDecompressorQIODevice(QIODevice *source, QObject *parent /*= nullptr*/) : QIODevice(parent)
+BrotliDecompressorQIODevice::BrotliDecompressorQIODevice(QIODevice *device, QIODevice::OpenMode mode, QObject *parent /*= nullptr*/) : QIODevice(parent)
 {
-    setOpenMode(QIODevice::ReadOnly);
+    setOpenMode(mode);
     _state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
     _result = BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT;
-    _source = source;
+    _device = device;
     _available_in = 0;
 }
 
@@ -130,11 +138,11 @@ qint64 BrotliDecompressorQIODevice::readData(char *data, qint64 maxlen)
     uint8_t* next_out = (uint8_t*)data;
     do {
         if (_result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
-            if (this->_source->atEnd()) {
+            if (this->_device->atEnd()) {
                 this->setErrorString(QStringLiteral("corrupt input"));
                 return -1;
             }
-            _available_in = _source->read((char*)_buffer, BufferSize);
+            _available_in = _device->read((char*)_buffer, BufferSize);
             _next_in = _buffer;
         }
         _result = BrotliDecoderDecompressStream(_state, &_available_in, &_next_in, &available_out, &next_out, nullptr);
@@ -142,7 +150,27 @@ qint64 BrotliDecompressorQIODevice::readData(char *data, qint64 maxlen)
     return maxlen - available_out;
 }
 
-qint64 BrotliDecompressorQIODevice::writeData(const char *, qint64)
+qint64 BrotliDecompressorQIODevice::writeData(const char *data, qint64 len)
 {
-    return -1; // todo: throw exception ?
+    size_t available_in = len;
+    const uint8_t* next_in = (const uint8_t*)data;
+    do {
+        size_t available_out = BufferSize;
+        uint8_t* next_out = _buffer;
+        _result = BrotliDecoderDecompressStream(_state, &available_in, &next_in, &available_out, &next_out, nullptr);
+        if (_result == BROTLI_DECODER_RESULT_ERROR) {
+            this->setErrorString(QStringLiteral("corrupt input"));
+            return -1;
+        }
+        qint64 produced = BufferSize - available_out;
+        if (produced > 0 && _device->write((const char*)_buffer, produced) != produced) {
+            this->setErrorString(_device->errorString());
+            return -1;
+        }
+    } while (_result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    if (available_in > 0) {
+        this->setErrorString(QStringLiteral("unexpected data after the end of the stream"));
+        return -1;
+    }
+    return len;
 }
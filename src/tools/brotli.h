@@ -5,5 +5,6 @@
 
 QIODevice * BrotliCompressor(QIODevice *source, quint32 quality = 9, quint32 lgwin = 0, QObject *parent = nullptr);
 QIODevice * BrotliDecompressor(QIODevice *source, QObject *parent = nullptr);
+QIODevice * BrotliDecompressorWriter(QIODevice *destination, QObject *parent = nullptr);
 
 #endif // QTBROTLI_H
@@ -24,7 +24,7 @@ private:
 class LZMADecompressorQIODevice : public QIODevice
 {
 public:
-    LZMADecompressorQIODevice(QIODevice *source, QObject *parent = nullptr);
+    LZMADecompressorQIODevice(QIODevice *device, QIODevice::OpenMode mode, QObject *parent = nullptr);
     virtual ~LZMADecompressorQIODevice();
     bool atEnd() const;
 protected:
@@ -36,7 +36,7 @@ private:
     lzma_ret _ret;
     lzma_action _action;
     quint8 _buffer[BufferSize];
-    QIODevice *_source;
+    QIODevice *_device; ///< Source in ReadOnly mode, destination in WriteOnly mode
 };
 
 QIODevice * LZMACompressor(QIODevice *source, quint32 preset, QObject *parent)
@@ -46,7 +46,15 @@ QIODevice * LZMACompressor(QIODevice *source, quint32 preset, QObject *parent)
 
 QIODevice * LZMADecompressor(QIODevice *source, QObject *parent)
 {
-    return new LZMADecompressorQIODevice(source, parent);
+    return new LZMADecompressorQIODevice(source, QIODevice::ReadOnly, parent);
+}
+
+/*!
+    Returns a device that decompresses the data written to it into \a destination.
+ */
+QIODevice * LZMADecompressorWriter(QIODevice *destination, QObject *parent)
+{
+    return new LZMADecompressorQIODevice(destination, QIODevice::WriteOnly, parent);
 }
 
 static QString message_strm(lzma_ret code)
@@ -140,12 +148,12 @@ qint64 LZMACompressorQIODevice::writeData(const char *, qint64)
     return -1; // todo: throw exception ?
 }
 
-LZMADecompressorQIODevice::LZMADecompressorQIODevice(QIODevice *source, QObject *parent /*= nullptr*/) : QIODevice(parent)
+LZMADecompressorQIODevice::LZMADecompressorQIODevice(QIODevice *device, QIODevice::OpenMode mode, QObject *parent /*= nullptr*/) : QIODevice(parent)
 {
-    setOpenMode(QIODevice::ReadOnly);
+    setOpenMode(mode);
     _strm = LZMA_STREAM_INIT;
     _ret = lzma_alone_decoder(&_strm, UINT64_MAX);
-    _source = source;
+    _device = device;
     _action = LZMA_RUN;
     if (_ret != LZMA_OK)
         setErrorString(message_strm(_ret));
@@ -167,13 +175,13 @@ qint64 LZMADecompressorQIODevice::readData(char *data, qint64 maxlen)
     _strm.next_out = (uint8_t*)data;
     while (_ret == LZMA_OK && _strm.avail_out > 0) {
         if (_strm.avail_in == 0) {
-            if (_source->atEnd()) {
+            if (_device->atEnd()) {
                 setErrorString(QStringLiteral("corrupt input"));
                 return -1;
             }
-            _strm.avail_in = _source->read((char*)_buffer, BufferSize);
+            _strm.avail_in = _device->read((char*)_buffer, BufferSize);
             _strm.next_in = _buffer;
-            if (_source->atEnd())
+            if (_device->atEnd())
                 _action = LZMA_FINISH;
         }
         _ret = lzma_code(&_strm, _action);
@@ -185,8 +193,32 @@ qint64 LZMADecompressorQIODevice::readData(char *data, qint64 maxlen)
     return maxlen - _strm.avail_out;
 }
 
-qint64 LZMADecompressorQIODevice::writeData(const char *, qint64)
+qint64 LZMADecompressorQIODevice::writeData(const char *data, qint64 len)
 {
-    return -1; // todo: throw exception ?
+    if (_ret == LZMA_STREAM_END && len > 0) {
+        setErrorString(QStringLiteral("unexpected data after the end of the stream"));
+        return -1;
+    }
+    _strm.next_in = (const uint8_t*)data;
+    _strm.avail_in = len;
+    do {
+        _strm.next_out = _buffer;
+        _strm.avail_out = BufferSize;
+        _ret = lzma_code(&_strm, LZMA_RUN);
+        if (_ret != LZMA_OK && _ret != LZMA_STREAM_END) {
+            setErrorString(message_strm(_ret));
+            return -1;
+        }
+        qint64 produced = BufferSize - _strm.avail_out;
+        if (produced > 0 && _device->write((const char*)_buffer, produced) != produced) {
+            setErrorString(_device->errorString());
+            return -1;
+        }
+    } while (_ret == LZMA_OK && (_strm.avail_in > 0 || _strm.avail_out == 0));
+    if (_strm.avail_in > 0) {
+        setErrorString(QStringLiteral("unexpected data after the end of the stream"));
+        return -1;
+    }
+    return len;
 }
 
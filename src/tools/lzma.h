@@ -5,5 +5,6 @@
 
 QIODevice * LZMACompressor(QIODevice *source, quint32 preset = 9, QObject *parent = nullptr);
 QIODevice * LZMADecompressor(QIODevice *source, QObject *parent = nullptr);
+QIODevice * LZMADecompressorWriter(QIODevice *destination, QObject *parent = nullptr);
 
 #endif // QTLZMA_H
@@ -4,6 +4,9 @@
 #include "common/utils.h"
 #include "updater/downloadmanager.h"
 #include "updater/copythread.h"
+#include "updater/localfilereply.h"
+#include "updater/packagecache.h"
+#include "updater/peerserver.h"
 
 #include <QLoggingCategory>
 #include <QNetworkReply>
@@ -23,6 +26,10 @@ Updater::Updater(QObject *parent)
 {
     // Init
     m_state = Idle;
+    m_streamingEnabled = false;
+    m_paranoidCheckEnabled = false;
+    m_hardLinkCopyEnabled = false;
+    m_peerServer = nullptr;
 
     // Network
     m_manager = new QNetworkAccessManager(this);
@@ -42,7 +49,15 @@ Updater::~Updater()
 QNetworkReply* Updater::get(const QString & what)
 {
     QNetworkRequest request(QUrl(remoteRepository() + what));
-    QNetworkReply *reply = m_manager->get(request);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    // Peer servers redirect what they don't have to the remote repository
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+#endif
+    QNetworkReply *reply;
+    if(request.url().isLocalFile())
+        reply = new LocalFileReply(request, 0, -1, this);
+    else
+        reply = m_manager->get(request);
     connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
     return reply;
 }
@@ -82,7 +97,8 @@ void Updater::onInfoFinished()
 
         qCDebug(LOG_UPDATER) << "Remote informations downloaded";
 
-        m_remoteRevision.fromJsonObject(JsonUtil::fromJson(m_currentRequest->readAll()));
+        m_remoteInformations = m_currentRequest->readAll();
+        m_remoteRevision.fromJsonObject(JsonUtil::fromJson(m_remoteInformations));
 
         qCDebug(LOG_UPDATER) << "Remote informations analyzed";
 
@@ -95,6 +111,7 @@ void Updater::onInfoFinished()
         {
             qCDebug(LOG_UPDATER) << "Already at the latest version";
             setState(AlreadyUptodate);
+            updatePeerServer();
         }
         else
         {
@@ -132,6 +149,9 @@ void Updater::update()
         clearError();
         m_localRepository.setUpdateInProgress(true);
         m_localRepository.save();
+        if(m_peerServer)
+            m_peerServer->setLocalRepository(LocalRepository()); // Installed files are about to change
+        m_downloadStatistics = DownloadStatistics();
 
         DownloadManager * downloader = new DownloadManager(m_localRepository, this);
         connect(downloader, &DownloadManager::checkProgress, this, &Updater::updateCheckProgress);
@@ -140,6 +160,7 @@ void Updater::update()
         connect(downloader, &DownloadManager::progress, this, &Updater::updateProgress);
         connect(downloader, &DownloadManager::finished, this, &Updater::onUpdateFinished);
         connect(downloader, &DownloadManager::warning, this, &Updater::warning);
+        connect(downloader, &DownloadManager::statistics, this, &Updater::onDownloadStatistics);
     }
     else
     {
@@ -177,11 +198,17 @@ void Updater::update()
     \sa update()
 */
 
+void Updater::onDownloadStatistics(const DownloadStatistics &statistics)
+{
+    m_downloadStatistics = statistics;
+}
+
 void Updater::onUpdateFinished(const QString &errorString)
 {
     if(errorString.isEmpty())
     {
         m_localRepository.load();
+        updatePeerServer();
         setState(Uptodate);
         emit updateFinished(true);
     }
@@ -195,7 +222,9 @@ void Updater::onUpdateFinished(const QString &errorString)
 
 /*!
     \brief Copy the local repository to another directory.
-    If the copy destination is a repository, the copy operation update it.
+    If the copy destination is a repository, the copy operation update it:
+    files whose stamps show they already have the right content are kept, unless paranoid checks are enabled.
+    Other files are copied in parallel.
     \sa copyFinished()
 */
 void Updater::copy(const QString &copyDirectory)
@@ -207,6 +236,8 @@ void Updater::copy(const QString &copyDirectory)
         clearError();
 
         CopyThread *copier = new CopyThread(m_localRepository, copyDirectory, this);
+        copier->setHardLinkEnabled(m_hardLinkCopyEnabled);
+        copier->setSkipUnchangedEnabled(!m_paranoidCheckEnabled);
 
         connect(copier, &CopyThread::progression, this, &Updater::copyProgress);
         connect(copier, &CopyThread::copyFinished, this, &Updater::onCopyFinished);
@@ -248,7 +279,12 @@ void Updater::removeOtherFiles(std::function<bool(QFileInfo)> testFunction)
 {
     if(isIdle())
     {
-        removeOtherFiles(m_localRepository.directory(), testFunction);
+        // Unmanaged directories are removed or kept as a whole, their content isn't listed
+        DirScanner scanner;
+        scanner.setDescendFilter([this](const QString &relativeDir) {
+            return m_localRepository.isManaged(relativeDir, true);
+        });
+        removeOtherFiles(scanner.scan(m_localRepository.directory()), QString(), testFunction);
     }
     else
     {
@@ -256,19 +292,19 @@ void Updater::removeOtherFiles(std::function<bool(QFileInfo)> testFunction)
     }
 }
 
-void Updater::removeOtherFiles(const QString &directory, std::function<bool(QFileInfo)> testFunction)
+void Updater::removeOtherFiles(const DirScanner::Tree &tree, const QString &relativeDir, std::function<bool(QFileInfo)> testFunction)
 {
-    QDir dir(directory);
-    QFileInfoList list = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden, QDir::Name);
-    foreach(const QFileInfo &file, list)
+    foreach(const DirScanner::Entry &entry, tree.value(relativeDir))
     {
-        if(!isManaged(file))
+        QString path = DirScanner::childPath(relativeDir, entry.name);
+        if(!m_localRepository.isManaged(path, entry.isDir()))
         {
+            QFileInfo file(m_localRepository.directory() + path);
             if(!testFunction || testFunction(file))
             {
-                if(file.isDir())
+                if(entry.isDir())
                 {
-                    if(!dir.rmpath(file.absoluteFilePath()))
+                    if(!QDir().rmpath(file.absoluteFilePath()))
                     {
                         qCWarning(LOG_UPDATER) << "Unable to remove dir" << file.path();
                     }
@@ -282,13 +318,76 @@ void Updater::removeOtherFiles(const QString &directory, std::function<bool(QFil
                 }
             }
         }
-        else if(file.isDir())
+        else if(entry.isDir())
         {
-            removeOtherFiles(file.absoluteFilePath(), testFunction);
+            removeOtherFiles(tree, path, testFunction);
         }
     }
 }
 
+/*!
+    \brief Serve the remote repository to other updaters on \a address and \a port, 0 for any free port
+    Other updaters use \c http://<address>:<port>/ as their remote repository.
+    They are served what this updater already has: the informations of the last revision it updated to,
+    the operation data of the object store and the installed files that are operation data themselves.
+    Anything else is redirected to the remote repository.
+    \pre An object store must be set, see setObjectStoreDirectory().
+    \return false if the server can't listen
+    \sa peerServerPort(), stopPeerServer()
+*/
+bool Updater::startPeerServer(quint16 port, const QHostAddress &address)
+{
+    if(m_objectStoreDirectory.isEmpty())
+    {
+        qWarning("Updater::startPeerServer : An object store is required");
+        return false;
+    }
+
+    stopPeerServer();
+    m_peerServer = new PeerServer(this);
+    m_peerServer->setObjectStoreDirectory(m_objectStoreDirectory);
+    m_peerServer->setRemoteRepository(m_updateUrl);
+    if(state() != Updating)
+        m_peerServer->setLocalRepository(m_localRepository);
+    if(!m_peerServer->listen(address, port))
+    {
+        qCWarning(LOG_UPDATER) << "Unable to start the peer server" << m_peerServer->errorString();
+        stopPeerServer();
+        return false;
+    }
+    qCDebug(LOG_UPDATER) << "Peer server listening on port" << m_peerServer->serverPort();
+    return true;
+}
+
+void Updater::stopPeerServer()
+{
+    delete m_peerServer;
+    m_peerServer = nullptr;
+}
+
+/*!
+    Returns the port the peer server listens on, 0 if it isn't started
+*/
+quint16 Updater::peerServerPort() const
+{
+    return m_peerServer ? m_peerServer->serverPort() : 0;
+}
+
+/*!
+    \brief Publish the state of the local repository, which matches the remote one, to peers
+*/
+void Updater::updatePeerServer()
+{
+    if(!m_objectStoreDirectory.isEmpty() && !m_remoteInformations.isEmpty())
+    {
+        PackageCache cache;
+        cache.setRepository(m_objectStoreDirectory, m_updateUrl);
+        cache.insert(QStringLiteral("current"), m_remoteInformations);
+    }
+    if(m_peerServer)
+        m_peerServer->setLocalRepository(m_localRepository);
+}
+
 void Updater::authenticationRequired(QNetworkReply *, QAuthenticator *authenticator)
 {
     if(!m_password.isEmpty() && authenticator->password() != m_password)
@@ -3,17 +3,22 @@
 
 #include <functional>
 #include "qtupdatesystem_global.h"
+#include "common/dirscanner.h"
+#include "common/packagecostmodel.h"
 #include "common/version.h"
 #include "updater/localrepository.h"
+#include "updater/downloadstatistics.h"
 #include "errors/warning.h"
 
 #include <QFileInfo>
+#include <QHostAddress>
 #include <QObject>
 
 class QNetworkAccessManager;
 class QNetworkReply;
 class QAuthenticator;
 class QSettings;
+class PeerServer;
 
 /*!
     \brief Provide remote update functionality
@@ -60,12 +65,32 @@ public:
     inline QString remoteRepository() const;
     inline void setRemoteRepository(const QString &remoteRepository);
 
+    inline bool isStreamingEnabled() const;
+    inline void setStreamingEnabled(bool streamingEnabled);
+
+    inline bool isParanoidCheckEnabled() const;
+    inline void setParanoidCheckEnabled(bool paranoidCheckEnabled);
+
+    inline bool isHardLinkCopyEnabled() const;
+    inline void setHardLinkCopyEnabled(bool hardLinkCopyEnabled);
+
+    inline QString objectStoreDirectory() const;
+    inline void setObjectStoreDirectory(const QString &objectStoreDirectory);
+
+    inline PackageCostModel packageCostModel() const;
+    inline void setPackageCostModel(const PackageCostModel &packageCostModel);
+
     inline QString username() const;
     inline QString password() const;
     inline void setCredentials(const QString &username, const QString &password);
 
     inline QString errorString() const;
     inline State state() const;
+    inline DownloadStatistics downloadStatistics() const;
+
+    bool startPeerServer(quint16 port = 0, const QHostAddress &address = QHostAddress::Any);
+    void stopPeerServer();
+    quint16 peerServerPort() const;
 
 public slots:
     void checkForUpdates();
@@ -88,6 +113,7 @@ private slots:
     void onInfoFinished();
     void onUpdateFinished(const QString &errorString);
     void onCopyFinished(const QString &errorString);
+    void onDownloadStatistics(const DownloadStatistics &statistics);
     void authenticationRequired(QNetworkReply *, QAuthenticator * authenticator);
 
 private:
@@ -95,23 +121,32 @@ private:
     void clearError();
     void setErrorString(const QString & msg);
     void setState(State newState);
-    void removeOtherFiles(const QString &directory, std::function<bool(QFileInfo)> testFunction);
+    void updatePeerServer();
+    void removeOtherFiles(const DirScanner::Tree &tree, const QString &relativeDir, std::function<bool(QFileInfo)> testFunction);
 
 private:
     // Network
     QNetworkAccessManager *m_manager;
     QNetworkReply *m_currentRequest, *metadata;
+    PeerServer *m_peerServer;
+    QByteArray m_remoteInformations; ///< "current" as received by the last check for updates
 
     // Config
     QString m_updateTmpDirectory;
     QString m_updateUrl;
     QString m_username, m_password;
+    bool m_streamingEnabled;
+    bool m_paranoidCheckEnabled;
+    bool m_hardLinkCopyEnabled;
+    QString m_objectStoreDirectory;
+    PackageCostModel m_packageCostModel;
 
     // Informations
     LocalRepository m_localRepository;
     Version m_remoteRevision;
     QString m_errorString;
     State m_state, m_beforeCopyState;
+    DownloadStatistics m_downloadStatistics;
 };
 
 /*!
@@ -215,6 +250,107 @@ inline void Updater::setRemoteRepository(const QString &updateUrl)
     m_updateUrl = updateUrl;
 }
 
+/*!
+    Returns \c true if added files are decompressed while being downloaded; otherwise returns \c false.
+    \sa setStreamingEnabled()
+*/
+inline bool Updater::isStreamingEnabled() const
+{
+    return m_streamingEnabled;
+}
+
+/*!
+    Decompress added files while they are downloaded, next to their final location.
+    This avoids writing the downloaded data to the temporary directory and reading it back.
+    Disabled by default.
+*/
+inline void Updater::setStreamingEnabled(bool streamingEnabled)
+{
+    Q_ASSERT(isIdle());
+    m_streamingEnabled = streamingEnabled;
+}
+
+/*!
+    Returns \c true if every local file is hashed while updating; otherwise returns \c false.
+    \sa setParanoidCheckEnabled()
+*/
+inline bool Updater::isParanoidCheckEnabled() const
+{
+    return m_paranoidCheckEnabled;
+}
+
+/*!
+    Hash every local file while updating, even if its size, modification time and inode
+    didn't change since it was last checked.
+    Disabled by default.
+*/
+inline void Updater::setParanoidCheckEnabled(bool paranoidCheckEnabled)
+{
+    Q_ASSERT(isIdle());
+    m_paranoidCheckEnabled = paranoidCheckEnabled;
+}
+
+/*!
+    Returns \c true if copy() hard links files instead of copying them; otherwise returns \c false.
+    \sa setHardLinkCopyEnabled()
+*/
+inline bool Updater::isHardLinkCopyEnabled() const
+{
+    return m_hardLinkCopyEnabled;
+}
+
+/*!
+    Hard link files instead of copying them in copy(), when both directories are on the same filesystem.
+    The copy shares the content of the local files, so it must be read-only and must be copied again
+    after each update instead of being updated itself.
+    Updates never modify a hard linked file in place: it gets its own content first.
+    Disabled by default.
+*/
+inline void Updater::setHardLinkCopyEnabled(bool hardLinkCopyEnabled)
+{
+    Q_ASSERT(isIdle());
+    m_hardLinkCopyEnabled = hardLinkCopyEnabled;
+}
+
+/*!
+    Returns the directory of the object store shared by installations, an empty string if there is none.
+    \sa setObjectStoreDirectory()
+*/
+inline QString Updater::objectStoreDirectory() const
+{
+    return m_objectStoreDirectory;
+}
+
+/*!
+    Set the directory of the object store shared by installations.
+    Operation data found in the store isn't downloaded, and downloaded data is added to the store,
+    so installations updated to the same revision download each file only once.
+    An empty directory disables the store, which is the default.
+*/
+inline void Updater::setObjectStoreDirectory(const QString &objectStoreDirectory)
+{
+    Q_ASSERT(isIdle());
+    m_objectStoreDirectory = objectStoreDirectory.isEmpty() ? QString() : Utils::cleanPath(objectStoreDirectory);
+}
+
+/*!
+    Returns the cost model used to choose the packages of an update.
+    \sa setPackageCostModel()
+*/
+inline PackageCostModel Updater::packageCostModel() const
+{
+    return m_packageCostModel;
+}
+
+/*!
+    Set the cost model used to choose the packages of an update, when the packages list is downloaded.
+    Skipped sizes of the model are completed by the estimates of the update.
+*/
+inline void Updater::setPackageCostModel(const PackageCostModel &packageCostModel)
+{
+    Q_ASSERT(isIdle());
+    m_packageCostModel = packageCostModel;
+}
 
 /*!
     username for remote url basic authentification.
@@ -262,6 +398,14 @@ inline Updater::State Updater::state() const
     return m_state;
 }
 
+/*!
+    Returns the network measurements of the last update.
+*/
+inline DownloadStatistics Updater::downloadStatistics() const
+{
+    return m_downloadStatistics;
+}
+
 inline void Updater::clearError()
 {
     m_errorString = QString();
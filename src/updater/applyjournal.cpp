@@ -0,0 +1,131 @@
+#include "applyjournal.h"
+#include "../common/utils.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(LOG_APPLYJOURNAL, "updatesystem.applyjournal")
+
+static const QByteArray JournalHeader = QByteArrayLiteral("QtUpdateSystem apply journal 1");
+
+ApplyJournal::ApplyJournal()
+{
+}
+
+ApplyJournal::~ApplyJournal()
+{
+    sync();
+}
+
+/*!
+    \brief Open the journal \a filename of the update of \a updateDirectory from \a fromRevision to \a toRevision
+    The entries of an interrupted run of the same update are loaded, any other journal is reset.
+    \return false if the journal can't be used, the update is then done without it.
+ */
+bool ApplyJournal::open(const QString &filename, const QString &updateDirectory, const QString &fromRevision, const QString &toRevision)
+{
+    QByteArray header = JournalHeader + '\t' + fromRevision.toUtf8() + '\t' + toRevision.toUtf8() + '\n';
+
+    m_file.close();
+    m_file.setFileName(filename);
+    m_updateDirectory = updateDirectory;
+    m_applied.clear();
+    m_pending.clear();
+
+    qint64 validSize = 0;
+    if(m_file.open(QFile::ReadOnly))
+    {
+        if(m_file.readLine() == header)
+        {
+            validSize = m_file.pos();
+            // A line without its end of line was interrupted and is dropped
+            QByteArray line;
+            while((line = m_file.readLine()).endsWith('\n'))
+            {
+                validSize = m_file.pos();
+                line.chop(1);
+                m_applied.insert(QString::fromUtf8(line));
+            }
+        }
+        m_file.close();
+    }
+
+    bool opened;
+    if(validSize > 0)
+    {
+        qCDebug(LOG_APPLYJOURNAL) << "Resuming update with" << m_applied.size() << "applied operations";
+        opened = m_file.open(QFile::ReadWrite) && m_file.resize(validSize) && m_file.seek(validSize);
+    }
+    else
+    {
+        opened = m_file.open(QFile::WriteOnly | QFile::Truncate) && m_file.write(header) == header.size();
+    }
+
+    if(!opened)
+    {
+        qCDebug(LOG_APPLYJOURNAL) << "Unable to write" << filename << m_file.errorString();
+        m_file.close();
+        m_applied.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+    \brief Record that the operation \a index of \a package is applied and verified
+    The journal is synced every BatchSize entries.
+ */
+void ApplyJournal::setApplied(const QString &package, int index)
+{
+    if(!isOpen())
+        return;
+
+    QString e = entry(package, index);
+    if(m_applied.contains(e))
+        return;
+
+    m_applied.insert(e);
+    m_pending.append(e);
+    if(m_pending.size() >= BatchSize)
+        sync();
+}
+
+/*!
+    \brief Write the pending entries once the files they describe are on disk
+ */
+bool ApplyJournal::sync()
+{
+    if(!isOpen() || m_pending.isEmpty())
+        return true;
+
+    if(!Utils::syncFileSystem(m_updateDirectory))
+    {
+        qCDebug(LOG_APPLYJOURNAL) << "Unable to sync" << m_updateDirectory;
+        return false;
+    }
+
+    QByteArray data;
+    foreach(const QString &e, m_pending)
+        data += e.toUtf8() + '\n';
+
+    if(m_file.write(data) != data.size() || !Utils::syncFile(&m_file))
+    {
+        qCDebug(LOG_APPLYJOURNAL) << "Unable to write" << m_file.fileName() << m_file.errorString();
+        return false;
+    }
+
+    m_pending.clear();
+    return true;
+}
+
+/*!
+    \brief Remove the journal, once the update is complete
+ */
+void ApplyJournal::remove()
+{
+    m_pending.clear();
+    m_applied.clear();
+    m_file.close();
+    if(m_file.exists())
+        m_file.remove();
+}
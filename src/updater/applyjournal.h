@@ -0,0 +1,66 @@
+#ifndef APPLYJOURNAL_H
+#define APPLYJOURNAL_H
+
+#include <QFile>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+/*!
+    \brief Write-ahead record of the operations applied and verified by an update
+
+    Entries are written by batches: the filesystem of the update directory is synced first,
+    then the entries are appended and synced. An entry on disk implies the files it describes are on disk.
+    Entries lost by a crash only cost a new check of their operation.
+
+    The journal is bound to the update it was created for (source and target revisions)
+    and is discarded if another update is started.
+ */
+class ApplyJournal
+{
+public:
+    static const int BatchSize = 256;
+
+    ApplyJournal();
+    ~ApplyJournal();
+
+    bool open(const QString &filename, const QString &updateDirectory, const QString &fromRevision, const QString &toRevision);
+    bool isOpen() const;
+    int count() const;
+    bool isApplied(const QString &package, int index) const;
+    void setApplied(const QString &package, int index);
+    bool sync();
+    void remove();
+
+private:
+    static QString entry(const QString &package, int index);
+    QFile m_file;
+    QString m_updateDirectory;
+    QSet<QString> m_applied; ///< Entries of the journal, synced or not
+    QStringList m_pending; ///< Entries not written yet
+};
+
+inline bool ApplyJournal::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+/*!
+    Number of operations known as applied
+ */
+inline int ApplyJournal::count() const
+{
+    return m_applied.size();
+}
+
+inline bool ApplyJournal::isApplied(const QString &package, int index) const
+{
+    return m_applied.contains(entry(package, index));
+}
+
+inline QString ApplyJournal::entry(const QString &package, int index)
+{
+    return package + QLatin1Char('\t') + QString::number(index);
+}
+
+#endif // APPLYJOURNAL_H
@@ -5,25 +5,79 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
+#include <QRunnable>
+#include <QThreadPool>
+
+class CopyThread::CopyTask : public QRunnable
+{
+public:
+    CopyTask(CopyThread *thread, const QString &filename) : m_thread(thread), m_filename(filename) {}
+    virtual void run() Q_DECL_OVERRIDE { m_thread->copyFile(m_filename); }
+
+private:
+    CopyThread *m_thread;
+    QString m_filename;
+};
 
 CopyThread::CopyThread(const LocalRepository &sourceRepository, const QString &destinationDir, QObject *parent) :
-    QThread(parent), m_sourceRepository(sourceRepository)
+    QThread(parent), m_sourceRepository(sourceRepository), m_hardLinkEnabled(false), m_skipUnchangedEnabled(true)
 {
     m_destinationDir = Utils::cleanPath(destinationDir);
 }
 
+/*!
+    \brief Copy \a filename, unless the destination already has the same content
+    The destination is trusted to be unchanged if it still matches its stamp, and to have the source content
+    if its stamp sha1 is the one of the source file, whose stamp must match too.
+ */
+void CopyThread::copyFile(const QString &filename)
+{
+    QString src = m_sourceRepository.directory() + filename;
+    QString dest = m_destinationDir + filename;
+
+    FileStamp sourceStamp = m_sourceStamps.value(filename);
+    if(sourceStamp.isValid() && !sourceStamp.matches(FileStamp::stat(src)))
+        sourceStamp = FileStamp();
+
+    FileStamp destStamp = m_destinationStamps.value(filename);
+    bool unchanged = m_skipUnchangedEnabled && sourceStamp.isValid() && destStamp.isValid()
+            && destStamp.sha1 == sourceStamp.sha1 && destStamp.matches(FileStamp::stat(dest));
+    if(!unchanged)
+    {
+        destStamp = FileStamp();
+        if(QFile::exists(dest) && !QFile::remove(dest))
+            EMIT_WARNING(CopyRemove, tr("Unable to remove %1").arg(dest), filename);
+
+        if(!Utils::copyFile(src, dest, m_hardLinkEnabled))
+        {
+            EMIT_WARNING(Copy, tr("Unable to copy %1 to %2").arg(src, dest), filename);
+        }
+        else if(sourceStamp.isValid())
+        {
+            destStamp = FileStamp::stat(dest);
+            destStamp.sha1 = sourceStamp.sha1;
+        }
+    }
+
+    if(destStamp.isValid())
+    {
+        QMutexLocker locker(&m_copiedStampsMutex);
+        m_copiedStamps.insert(filename, destStamp);
+    }
+
+    emit progression(m_copiedCount.fetchAndAddOrdered(1) + 1, m_sourceRepository.files().size());
+}
+
 void CopyThread::run()
 {
     try
     {
         LocalRepository destRepository(m_destinationDir);
-        QSet<QString> sourcefiles = m_sourceRepository.fileList().toSet();
-        QSet<QString> dirfiles = m_sourceRepository.dirList().toSet();
+        const QSet<QString> &sourcefiles = m_sourceRepository.files();
+        const QSet<QString> &dirfiles = m_sourceRepository.dirs();
 
-        int i = 0;
-        QFileInfo destFileInfo;
         QDir dir;
-        QString src, dest;
+        QString dest;
 
         foreach(const QString &dirname, dirfiles)
         {
@@ -32,25 +86,33 @@ void CopyThread::run()
                 EMIT_WARNING(CopyMkPath, tr("Unable to create path %1").arg(dest), dirname);
         }
 
+        // Parents of the files are created once, not for each file
+        QSet<QString> parents;
         foreach(const QString &filename, sourcefiles)
         {
-            src = m_sourceRepository.directory() + filename;
-            dest = m_destinationDir + filename;
-
-            destFileInfo.setFile(dest);
-            if(!dir.mkpath(destFileInfo.absolutePath()))
-                EMIT_WARNING(CopyMkPath, tr("Unable to create path %1").arg(destFileInfo.absolutePath()), filename);
-
-            if(QFile::exists(dest) && !QFile::remove(dest))
-                EMIT_WARNING(CopyRemove, tr("Unable to remove %1").arg(dest), filename);
+            int pos = filename.lastIndexOf(QLatin1Char('/'));
+            if(pos > 0)
+                parents.insert(filename.left(pos));
+        }
+        foreach(const QString &parent, parents - dirfiles)
+        {
+            dest = m_destinationDir + parent;
+            if(!dir.mkpath(dest))
+                EMIT_WARNING(CopyMkPath, tr("Unable to create path %1").arg(dest), parent);
+        }
 
-            if(!QFile::copy(src, dest))
-                EMIT_WARNING(Copy, tr("Unable to copy %1 to %2").arg(src, dest), filename);
+        m_sourceStamps = m_sourceRepository.fileStamps();
+        m_destinationStamps = destRepository.fileStamps();
+        m_copiedStamps.clear();
+        m_copiedCount.store(0);
 
-            emit progression(++i, sourcefiles.size());
-        }
+        QThreadPool pool;
+        pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+        foreach(const QString &filename, sourcefiles)
+            pool.start(new CopyTask(this, filename));
+        pool.waitForDone();
 
-        QSet<QString> diffFiles = destRepository.fileList().toSet() - sourcefiles - dirfiles;
+        QSet<QString> diffFiles = destRepository.files() - sourcefiles - dirfiles;
         foreach(const QString &filename, diffFiles)
         {
             dest = m_destinationDir + filename;
@@ -58,7 +120,7 @@ void CopyThread::run()
                 EMIT_WARNING(CopyRemove, tr("Unable to remove %1").arg(dest), filename);
         }
 
-        QSet<QString> diffDirList = destRepository.dirList().toSet() - sourcefiles - dirfiles;
+        QSet<QString> diffDirList = destRepository.dirs() - sourcefiles - dirfiles;
         foreach(const QString &dirToRemove, diffDirList)
         {
             QDir dir(m_destinationDir + dirToRemove);
@@ -66,8 +128,9 @@ void CopyThread::run()
                 dir.rmdir(dir.path());
         }
 
-        destRepository.setFileList(m_sourceRepository.fileList());
-        destRepository.setDirList(m_sourceRepository.dirList());
+        destRepository.setFiles(sourcefiles);
+        destRepository.setDirs(dirfiles);
+        destRepository.setFileStamps(m_copiedStamps);
         destRepository.setRevision(m_sourceRepository.revision());
         destRepository.setUpdateInProgress(m_sourceRepository.updateInProgress());
         destRepository.save();
@@ -3,6 +3,9 @@
 
 #include "../errors/warning.h"
 #include "localrepository.h"
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
 #include <QThread>
 #include <QString>
 #include <QSet>
@@ -14,6 +17,11 @@ class CopyThread : public QThread
 public:
     CopyThread(const LocalRepository &sourceRepository, const QString &destinationDir, QObject *parent = 0);
 
+    bool isHardLinkEnabled() const;
+    void setHardLinkEnabled(bool hardLinkEnabled);
+    bool isSkipUnchangedEnabled() const;
+    void setSkipUnchangedEnabled(bool skipUnchangedEnabled);
+
 signals:
     void warning(const Warning &warning);
     void progression(int copiedFileCount, int totalFileCount);
@@ -23,9 +31,45 @@ protected:
     void run() Q_DECL_OVERRIDE;
 
 private:
+    class CopyTask;
+    void copyFile(const QString &filename); // Copy threads
+
     LocalRepository m_sourceRepository;
     QString m_destinationDir;
+    bool m_hardLinkEnabled, m_skipUnchangedEnabled;
 
+    // Shared by the copy threads
+    QHash<QString, FileStamp> m_sourceStamps, m_destinationStamps;
+    QMutex m_copiedStampsMutex;
+    QHash<QString, FileStamp> m_copiedStamps; ///< Stamps of the destination files once copied
+    QAtomicInt m_copiedCount;
 };
 
+inline bool CopyThread::isHardLinkEnabled() const
+{
+    return m_hardLinkEnabled;
+}
+
+/*!
+    Hard link files instead of copying them, when the destination is on the same filesystem.
+    The copy then shares the content of the source files: it must not be modified, nor the source updated in place.
+ */
+inline void CopyThread::setHardLinkEnabled(bool hardLinkEnabled)
+{
+    m_hardLinkEnabled = hardLinkEnabled;
+}
+
+inline bool CopyThread::isSkipUnchangedEnabled() const
+{
+    return m_skipUnchangedEnabled;
+}
+
+/*!
+    Keep destination files whose stamp matches the source stamp, instead of copying them again
+ */
+inline void CopyThread::setSkipUnchangedEnabled(bool skipUnchangedEnabled)
+{
+    m_skipUnchangedEnabled = skipUnchangedEnabled;
+}
+
 #endif // COPYTHREAD_H
@@ -1,11 +1,14 @@
 #include "downloadmanager.h"
 #include "oneobjectthread.h"
 #include "filemanager.h"
+#include "localfilereply.h"
 #include "../exceptions.h"
 #include "../common/packages.h"
 #include "../common/jsonutil.h"
 #include "../common/packagemetadata.h"
 #include "../operations/operation.h"
+#include "../operations/blockpatchoperation.h"
+#include "../common/blockundojournal.h"
 
 #include <QLoggingCategory>
 #include <QNetworkReply>
@@ -17,6 +20,17 @@ Q_LOGGING_CATEGORY(LOG_DLMANAGER, "updatesystem.downloadmanager")
 
 Q_DECLARE_METATYPE(QSharedPointer<Operation>)
 int OperationPointerMetaType = qMetaTypeId< QSharedPointer<Operation> >();
+int DownloadStatisticsMetaType = qMetaTypeId<DownloadStatistics>();
+
+/**
+   \brief Returns true if \a reply failed because the requested file doesn't exist
+ */
+static bool isMissing(QNetworkReply *reply)
+{
+    int statusCode = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    return reply->error() == QNetworkReply::ContentNotFoundError || reply->error() == QNetworkReply::ContentGoneError
+            || statusCode == 404 || statusCode == 410;
+}
 
 DownloadManager::DownloadManager(const LocalRepository &sourceRepository, Updater *updater) :
     QObject(), m_localRepository(sourceRepository), m_temporaryDir(nullptr)
@@ -31,6 +45,21 @@ DownloadManager::DownloadManager(const LocalRepository &sourceRepository, Update
     m_remoteRevision = updater->remoteRevision();
     m_username = updater->username();
     m_password = updater->password();
+    m_isLocalRepository = QUrl(m_updateUrl).isLocalFile();
+    m_streamingEnabled = updater->isStreamingEnabled();
+    m_paranoidCheck = updater->isParanoidCheckEnabled();
+    m_objectStore.setDirectory(updater->objectStoreDirectory());
+    m_packageCache.setRepository(updater->objectStoreDirectory(), m_updateUrl);
+    m_packageGraph.setCostModel(updater->packageCostModel());
+    m_fileStamps = m_localRepository.fileStamps();
+    fixing = false;
+    m_rerouting = false;
+    m_abandoning = false;
+    m_packageRetries = 0;
+    streaming = false;
+    firstByteReceived = false;
+    transferBytes = 0;
+    maxRangesPerRequest = 32;
 
     m_manager = new QNetworkAccessManager(this);
     connect(m_manager, &QNetworkAccessManager::authenticationRequired, this, &DownloadManager::authenticationRequired);
@@ -57,6 +86,7 @@ DownloadManager::DownloadManager(const LocalRepository &sourceRepository, Update
         connect(filemanager, &FileManager::operationApplied, this, &DownloadManager::operationApplied);
 
         connect(this, &DownloadManager::downloadFinished, filemanager, &FileManager::downloadFinished);
+        connect(this, &DownloadManager::parallelApplyEnabledChanged, filemanager, &FileManager::setParallelApplyEnabled);
         connect(filemanager, &FileManager::applyFinished, this, &DownloadManager::applyFinished);
 
         connect(filemanager, &FileManager::warning, this, &DownloadManager::warning);
@@ -71,17 +101,20 @@ DownloadManager::DownloadManager(const LocalRepository &sourceRepository, Update
 
 DownloadManager::~DownloadManager()
 {
+    if(streaming && operation)
+        operation->abortStream();
     delete m_temporaryDir;
 }
 
 /**
    \brief Start the update sequence
-   update() : Get packages list
-    -> updatePackagesListRequestFinished() : Compute shortest path
+   update() : Get the route of the local revision
+    -> updateRouteRequestFinished() : Use the published path
+       or updatePackagesListRequestFinished() : Compute shortest path if the route isn't available
     -> updatePackageLoop() : iterate over package path
         -> updatePackageMetadataFinished() : load metadata & start package download
         -> updateDataFinished() : finish package application
-   \sa updatePackagesListRequestFinished()
+   \sa updateRouteRequestFinished()
  */
 void DownloadManager::update()
 {
@@ -95,17 +128,113 @@ void DownloadManager::update()
         }
         m_updateTmpDirectory = Utils::cleanPath(m_temporaryDir->path());
     }
+    else
+    {
+        // A temporary directory doesn't survive an interruption, so journaling is only useful otherwise
+        m_applyJournal.open(m_updateTmpDirectory + QStringLiteral("apply.journal"), m_updateDirectory, m_localRevision, m_remoteRevision);
+        recoverBlockJournals();
+    }
+
+    findPath(m_localRevision != m_remoteRevision ? m_localRevision : QString());
+}
 
-    packagesListRequest = get(QStringLiteral("packages"));
-    connect(packagesListRequest, &QNetworkReply::finished, this, &DownloadManager::updatePackagesListRequestFinished);
+/**
+   \brief Roll back the in place patches interrupted by a previous update
+   This is done before anything is checked, because the next path may not patch those files anymore.
+ */
+void DownloadManager::recoverBlockJournals()
+{
+    QDir journals(BlockPatchOperation::journalDirectory(m_updateTmpDirectory));
+    foreach(const QString &name, journals.entryList(QStringList() << QStringLiteral("*.journal"), QDir::Files))
+    {
+        BlockUndoJournal journal(journals.filePath(name));
+        const QString path = journal.path();
+        try
+        {
+            QFile file(m_updateDirectory + path);
+            if(!path.isEmpty() && journal.rollback(&file))
+            {
+                m_fileStamps.remove(path);
+                EMIT_WARNING(OperationApply, tr("Interrupted patch of %1 was rolled back").arg(path), path);
+            }
+            else
+            {
+                journal.remove();
+            }
+        }
+        catch(const QString &msg)
+        {
+            // The file is checked as usual, so it's repaired if needed
+            m_fileStamps.remove(path);
+            EMIT_WARNING(OperationApply, msg, path);
+        }
+    }
+    QDir().rmdir(journals.path()); // Only if empty
+}
+
+/**
+   \brief Find the best path from \a from to the remote revision, pathFound() is called with it
+   The route published by the repository is used if possible, the packages list otherwise.
+ */
+void DownloadManager::findPath(const QString &from)
+{
+    m_pathFrom = from;
+    if(!m_packageGraph.packages().isEmpty())
+    {
+        pathFound(m_packageGraph.findBestPath(from, m_remoteRevision));
+        return;
+    }
+
+    routeRequest = get(Packages::routeName(from));
+    connect(routeRequest, &QNetworkReply::finished, this, &DownloadManager::updateRouteRequestFinished);
+}
+
+/**
+   \brief Handle the downloaded route
+   A route that can't be downloaded, that doesn't start from the local revision,
+   that isn't continuous or that doesn't lead to the remote revision is replaced by the packages list.
+   \sa updatePackagesListRequestFinished()
+ */
+void DownloadManager::updateRouteRequestFinished()
+{
+    Packages route;
+    try
+    {
+        if(routeRequest->error() != QNetworkReply::NoError)
+            THROW(RequestFailed, routeRequest->errorString());
+
+        QByteArray data = routeRequest->readAll();
+        QJsonObject object = JsonUtil::fromJson(data);
+        route.fromJsonObject(object);
+        if(JsonUtil::asString(object, QStringLiteral("to")) != m_remoteRevision || route.isEmpty() || route.last().to != m_remoteRevision)
+            THROW(JsonError, tr("The route doesn't lead to %1").arg(m_remoteRevision));
+        QString revision = m_pathFrom;
+        foreach(const Package &package, route)
+        {
+            if(package.from != revision)
+                THROW(JsonError, tr("The route doesn't continue from %1").arg(revision));
+            if(m_deadPackages.contains(package))
+                THROW(InvalidPackage, tr("the route goes through %1 which can't be downloaded").arg(package.url()));
+            revision = package.to;
+        }
+        m_packageCache.insert(Packages::routeName(m_pathFrom), data);
+    }
+    catch(std::exception & msg)
+    {
+        qCDebug(LOG_DLMANAGER) << "Route unavailable, downloading the packages list:" << msg.what();
+        packagesListRequest = get(QStringLiteral("packages"));
+        connect(packagesListRequest, &QNetworkReply::finished, this, &DownloadManager::updatePackagesListRequestFinished);
+        return;
+    }
+
+    qCDebug(LOG_DLMANAGER) << "Route downloaded";
+    pathFound(route);
 }
 
 /**
    \brief Handle the downloaded packages list
    Parse the packages list
    Compute the shortest path
-   Start the update loop (updatePackageLoop())
-   \sa updatePackageLoop()
  */
 void DownloadManager::updatePackagesListRequestFinished()
 {
@@ -116,40 +245,187 @@ void DownloadManager::updatePackagesListRequestFinished()
 
         qCDebug(LOG_DLMANAGER) << "Packages list downloaded";
 
-        m_packages.fromJsonObject(JsonUtil::fromJson(packagesListRequest->readAll()));
+        QByteArray packages = packagesListRequest->readAll();
+        m_packages.fromJsonObject(JsonUtil::fromJson(packages));
+        m_packageGraph.setPackages(m_packages);
+        foreach(const Package &package, m_deadPackages)
+            m_packageGraph.disablePackage(package);
+        m_packageCache.insert(QStringLiteral("packages"), packages);
 
         qCDebug(LOG_DLMANAGER) << "Remote informations analyzed";
+    }
+    catch(std::exception & msg)
+    {
+        emit finished(msg.what());
+        return;
+    }
 
-        if(m_localRevision != m_remoteRevision)
-        {
-            downloadPath = m_packages.findBestPath(m_localRevision, m_remoteRevision);
-            if(downloadPath.isEmpty())
-                throw tr("No download path found from %1 to %2").arg(m_localRevision, m_remoteRevision);
-        }
-        else
-        {
-            downloadPath = m_packages.findBestPath(QString(), m_remoteRevision);
-            if(downloadPath.isEmpty())
-                throw tr("No download path found to %1").arg(m_remoteRevision);
-            downloadPath.remove(0, downloadPath.count() - 1);
-        }
-        downloadPathPos = 0;
+    pathFound(m_packageGraph.findBestPath(m_pathFrom, m_remoteRevision));
+}
 
-        downloadSize = 0;
-        checkPosition = 0;
-        downloadPosition = 0;
-        applyPosition = 0;
-        foreach(const Package &package, downloadPath)
+/**
+   \brief Start the update loop (updatePackageLoop()) with \a path,
+   or the fixing pass if some parts of the update have gone wrong
+   \sa updatePackageLoop()
+ */
+void DownloadManager::pathFound(const QVector<Package> &path)
+{
+    if(m_rerouting)
+    {
+        m_rerouting = false;
+        if(path.isEmpty())
         {
-            downloadSize += package.size;
+            emit finished(tr("No download path found from %1 to %2 without the failed packages").arg(m_pathFrom, m_remoteRevision));
+            return;
         }
 
+        qCDebug(LOG_DLMANAGER) << "Update continues from" << m_pathFrom << "through" << path.size() << "packages";
+        continuePath(path);
+        updatePackageLoop();
+        return;
+    }
+
+    downloadPath = path;
+    if(isFixingError())
+    {
+        startFixing();
+        return;
+    }
+
+    if(downloadPath.isEmpty())
+    {
+        if(m_localRevision != m_remoteRevision)
+            emit finished(tr("No download path found from %1 to %2").arg(m_localRevision, m_remoteRevision));
+        else
+            emit finished(tr("No download path found to %1").arg(m_remoteRevision));
+        return;
+    }
+    if(m_localRevision == m_remoteRevision)
+        downloadPath.remove(0, downloadPath.count() - 1);
+    downloadPathPos = 0;
+
+    downloadSize = 0;
+    checkPosition = 0;
+    downloadPosition = 0;
+    applyPosition = 0;
+    foreach(const Package &package, downloadPath)
+    {
+        downloadSize += package.size;
+    }
+
+    if(!loadAlternativeMetadata())
         updatePackageLoop();
+}
+
+/**
+   \brief Load the metadata of the best path for new installations, if it isn't the planned one,
+   so the size of its operations that would be skipped can be estimated before anything is downloaded
+   \return true if updateAlternativeMetadataFinished() will continue the update
+ */
+bool DownloadManager::loadAlternativeMetadata()
+{
+    if(m_packageGraph.packages().isEmpty() || m_localRevision == m_remoteRevision)
+        return false;
+
+    QVector<Package> completePath = m_packageGraph.findBestPath(QString(), m_remoteRevision);
+    if(completePath.isEmpty() || completePath.first() == downloadPath.first() || m_cachedMetadata.contains(completePath.first().url()))
+        return false;
+
+    metadataRequest = get(completePath.first().metadataUrl());
+    connect(metadataRequest, &QNetworkReply::finished, this, &DownloadManager::updateAlternativeMetadataFinished);
+    return true;
+}
+
+/**
+   \brief Keep the alternative metadata and start the update loop, the path is re-planned by the loop
+   The planned path is kept if the metadata can't be loaded.
+ */
+void DownloadManager::updateAlternativeMetadataFinished()
+{
+    try
+    {
+        if(metadataRequest->error() != QNetworkReply::NoError)
+            THROW(RequestFailed, metadataRequest->errorString());
+        QByteArray metadataJson = metadataRequest->readAll();
+        PackageMetadata alternative;
+        alternative.fromJsonObject(JsonUtil::fromJson(metadataJson));
+        m_cachedMetadata.insert(alternative.package().url(), alternative);
+        m_packageCache.insert(alternative.metadataUrl(), metadataJson);
     }
     catch(std::exception & msg)
     {
-        emit finished(msg.what());
+        qCDebug(LOG_DLMANAGER) << "Unable to load the alternative metadata" << msg.what();
+    }
+
+    updatePackageLoop();
+}
+
+/**
+   \brief Plan again the packages left, from the revision reached so far
+   The cost model is updated with the size of the operations of known packages that would be skipped,
+   from the local file stamps updated by the prepare and apply results so far.
+   Only possible when the packages list is known, a route has no alternative.
+ */
+void DownloadManager::replanPath()
+{
+    if(isFixingError() || m_packageGraph.packages().isEmpty() || m_localRevision == m_remoteRevision)
+        return;
+
+    PackageCostModel costModel = m_packageGraph.costModel();
+    foreach(const PackageMetadata &known, m_cachedMetadata)
+        costModel.setSkippedSize(known.package(), estimateSkippedSize(known));
+    m_packageGraph.setCostModel(costModel);
+
+    const QString reached = downloadPathPos > 0 ? downloadPath.at(downloadPathPos - 1).to : m_localRevision;
+    QVector<Package> remaining = m_packageGraph.findBestPath(reached, m_remoteRevision);
+    if(remaining.isEmpty() || remaining == downloadPath.mid(downloadPathPos))
+        return;
+
+    qCDebug(LOG_DLMANAGER) << "Path re-planned from" << reached << "through" << remaining.size() << "packages";
+    continuePath(remaining);
+}
+
+/**
+   \brief Replace the packages left by \a remaining
+   The download size becomes what was downloaded so far plus the size of \a remaining.
+   \sa replanPath(), reroute()
+ */
+void DownloadManager::continuePath(const QVector<Package> &remaining)
+{
+    downloadPath.resize(downloadPathPos);
+    downloadPath += remaining;
+    downloadSize = downloadPosition;
+    foreach(const Package &package, remaining)
+    {
+        downloadSize += package.size;
+    }
+}
+
+/**
+   \brief Returns the size of the operations of \a known that won't be downloaded,
+   because their data is in the object store or their local file is already the final one
+ */
+qint64 DownloadManager::estimateSkippedSize(const PackageMetadata &known) const
+{
+    qint64 skippedSize = 0;
+    foreach(QSharedPointer<Operation> op, known.operations())
+    {
+        if(op->size() <= 0)
+            continue;
+
+        if(m_objectStore.contains(op->sha1(), op->size()))
+        {
+            skippedSize += op->size();
+            continue;
+        }
+
+        // Stamps are only trusted by the prepare step if paranoid checks are disabled
+        const QString finalSha1 = op->finalSha1();
+        FileStamp stamp = m_fileStamps.value(op->path());
+        if(!m_paranoidCheck && !finalSha1.isEmpty() && stamp.isValid() && stamp.sha1 == finalSha1)
+            skippedSize += op->size();
     }
+    return skippedSize;
 }
 
 /**
@@ -162,6 +438,9 @@ void DownloadManager::updatePackageLoop()
 {
     if(downloadPathPos < downloadPath.size())
     {
+        m_packageRetries = 0;
+        m_readyPaths.clear();
+        replanPath();
         loadPackageMetadata();
     }
     else
@@ -170,50 +449,28 @@ void DownloadManager::updatePackageLoop()
         {
             if(!isFixingError())
             {
-                // First time we get in this loop
+                // First time we get in this loop, all failed paths are fixed in one pass
                 qCDebug(LOG_DLMANAGER) << "Some parts of the update have gone wrong, fixing...";
-                downloadPath = m_packages.findBestPath("", m_remoteRevision);
-                if(downloadPath.isEmpty())
-                    emit finished(tr("No download path found %1").arg(m_remoteRevision));
-            }
-            else
-            {
-                fixingPath = QString();
+                fixing = true;
+                findPath(QString());
+                return;
             }
 
             int fixedFailures = 0;
-            QMap<QString, Failure>::iterator it = failures.begin();
-            while(it != failures.end())
+            foreach(Failure reason, failures)
             {
-                if(it.value() == Fixed)
-                {
+                if(reason == Fixed)
                     ++fixedFailures;
-                }
-                else if(it.value() < NonRecoverable)
-                {
-                    fixingPath = it.key();
-                    it.value() = FixInProgress;
-                    break;
-                }
-                ++it;
             }
 
-            if(isFixingError())
+            qCDebug(LOG_DLMANAGER) << "Update finished with " << fixedFailures << "/" << failures.size() << "fixed errors";
+            if(fixedFailures == failures.size())
             {
-                downloadPathPos = 0;
-                loadPackageMetadata();
+                success();
             }
             else
             {
-                qCDebug(LOG_DLMANAGER) << "Update finished with " << fixedFailures << "/" << failures.size() << "fixed errors";
-                if(fixedFailures == failures.size())
-                {
-                    success();
-                }
-                else
-                {
-                    emit finished(tr("Unable to fixes all errors (%1/%2 fixed)").arg(fixedFailures).arg(failures.size()));
-                }
+                emit finished(tr("Unable to fixes all errors (%1/%2 fixed)").arg(fixedFailures).arg(failures.size()));
             }
         }
         else
@@ -224,6 +481,43 @@ void DownloadManager::updatePackageLoop()
     }
 }
 
+/**
+   \brief Fix all failed paths in one pass, with the path from an empty revision
+ */
+void DownloadManager::startFixing()
+{
+    if(downloadPath.isEmpty())
+    {
+        emit finished(tr("No download path found %1").arg(m_remoteRevision));
+        return;
+    }
+
+    fixingPaths.clear();
+    QMap<QString, Failure>::iterator it = failures.begin();
+    for(; it != failures.end(); ++it)
+    {
+        if(it.value() != Fixed && it.value() < NonRecoverable)
+        {
+            fixingPaths.insert(it.key());
+            it.value() = FixInProgress;
+        }
+    }
+
+    if(!fixingPaths.isEmpty())
+    {
+        qCDebug(LOG_DLMANAGER) << "Fixing" << fixingPaths.size() << "paths";
+        // Repairs of different paths don't depend on each other
+        emit parallelApplyEnabledChanged(true);
+        downloadPathPos = 0;
+        loadPackageMetadata();
+        return;
+    }
+
+    // Nothing can be fixed
+    downloadPathPos = downloadPath.size();
+    updatePackageLoop();
+}
+
 void DownloadManager::loadPackageMetadata()
 {
     const Package & package = downloadPath.at(downloadPathPos);
@@ -249,23 +543,32 @@ void DownloadManager::loadPackageMetadata()
  */
 void DownloadManager::updatePackageMetadataFinished()
 {
+    bool retry = false;
     try
     {
         if(metadataRequest->error() != QNetworkReply::NoError)
+        {
+            retry = !isMissing(metadataRequest);
             THROW(RequestFailed, metadataRequest->errorString());
-        metadata.fromJsonObject(JsonUtil::fromJson(metadataRequest->readAll()));
+        }
+        QByteArray metadataJson = metadataRequest->readAll();
+        metadata.fromJsonObject(JsonUtil::fromJson(metadataJson));
         m_cachedMetadata.insert(metadata.package().url(), metadata);
-        packageMetadataReady();
+        m_packageCache.insert(metadata.metadataUrl(), metadataJson);
     }
     catch(std::exception & msg)
     {
-        emit finished(msg.what());
+        metadataRequestFailed(msg.what(), retry);
+        return;
     }
+    packageMetadataReady();
 }
 
 void DownloadManager::packageMetadataReady()
 {
     metadata.setup(m_updateDirectory, m_updateTmpDirectory);
+    foreach(QSharedPointer<Operation> op, metadata.operations())
+        op->setParanoidCheck(m_paranoidCheck);
 
     if(metadata.operationCount() == 0)
     {
@@ -285,6 +588,12 @@ void DownloadManager::packageMetadataReady()
         Q_ASSERT(!isLastPackage() || m_dirListAfterUpdate.size() == 0);
         foreach(QSharedPointer<Operation> op, metadata.operations())
         {
+            // Applied by an interrupted run of this update, no need to check it again
+            if(m_applyJournal.isApplied(metadata.package().url(), op->index()))
+                op->setStatus(Operation::Valid);
+            else if(!m_paranoidCheck)
+                op->setLocalStamp(m_fileStamps.value(op->path()));
+
             if(isLastPackage())
             {
                 switch (op->fileType()) {
@@ -306,31 +615,81 @@ void DownloadManager::packageMetadataReady()
     }
     else
     {
-        while(operationIndex < metadata.operationCount())
+        planFixingOperations();
+    }
+}
+
+/**
+   \brief Plan the repair of all the fixing paths with the current package
+   The statuses of the operations are known without checking the local data:
+   operations on fixing paths must be downloaded again, the other ones are skipped.
+   Then the usual download flow requests all the required ranges in as few requests as possible.
+ */
+void DownloadManager::planFixingOperations()
+{
+    QSet<QString> pathsInPackage;
+    foreach(QSharedPointer<Operation> op, metadata.operations())
+    {
+        if(fixingPaths.contains(op->path()) && failures.value(op->path()) != NonRecoverable)
         {
-            operation = metadata.operation(operationIndex);
-            if(operation->path() == fixingPath)
+            pathsInPackage.insert(op->path());
+            if(op->size() > 0)
             {
-                preparedOperationIndex = operationIndex;
-                updateDataStartDownload(operation->offset() + operation->size());
-                return;
+                // Reuse the valid parts of the local file if possible
+                op->planRepair();
+                op->setStatus(op->requiredSize() > 0 ? Operation::DownloadRequired : Operation::ApplyRequired);
             }
-            ++operationIndex;
+            else
+                op->checkLocalData(); // Cheap, no data to hash
         }
-        if(isLastPackage())
-            failure(fixingPath, Fixed);
+        else
+        {
+            op->setStatus(Operation::Valid);
+        }
+    }
+
+    if(isLastPackage())
+    {
+        // Paths that don't exist in the remote revision have nothing left to fix
+        foreach(const QString &path, fixingPaths)
+        {
+            if(!pathsInPackage.contains(path) && failures.value(path) == FixInProgress)
+                failure(path, Fixed);
+        }
+    }
+
+    if(pathsInPackage.isEmpty())
+    {
+        ++downloadPathPos;
         updatePackageLoop();
+        return;
     }
+
+    qCDebug(LOG_DLMANAGER) << "Fixing" << pathsInPackage.size() << "paths with" << metadata.package().url();
+    preparedOperationIndex = metadata.operationCount() - 1;
+    operationIndex = -1;
+    nextOperation();
 }
 
 void DownloadManager::readyToApply(QSharedPointer<Operation> readyOperation)
 {
-    if(readyOperation->status() == Operation::DownloadRequired || isFixingError())
+    if(readyOperation->isStreamed())
+    {
+        m_readyPaths.insert(readyOperation->path());
+        emit operationReadyToApply(readyOperation);
+    }
+    else if(readyOperation->status() == Operation::DownloadRequired)
     {
         if( (!QFile::exists(readyOperation->dataFilename()) || QFile::remove(readyOperation->dataFilename()))
             && QFile(readyOperation->dataDownloadFilename()).rename(readyOperation->dataFilename())
            )
         {
+            if(!readyOperation->isPartialDownload())
+            {
+                readyOperation->setDataVerified(); // Verified by closeOperationData()
+                m_objectStore.insert(readyOperation->sha1(), readyOperation->dataFilename());
+            }
+            m_readyPaths.insert(readyOperation->path());
             emit operationReadyToApply(readyOperation);
         }
         else
@@ -342,14 +701,52 @@ void DownloadManager::readyToApply(QSharedPointer<Operation> readyOperation)
     else if(readyOperation->status() == Operation::ApplyRequired)
     {
         QFile::remove(readyOperation->dataDownloadFilename());
+        m_readyPaths.insert(readyOperation->path());
         emit operationReadyToApply(readyOperation);
     }
     else
     {
+        if(readyOperation->status() == Operation::Valid)
+            setApplied(readyOperation);
         incrementApplyPosition(readyOperation->size());
     }
 }
 
+/**
+   \brief Copy the data of \a op from the object store instead of downloading it
+   \return true if \a op data was found, \a op then only requires to be applied.
+ */
+bool DownloadManager::fetchOperationData(QSharedPointer<Operation> op)
+{
+    if(!m_objectStore.isEnabled() || isFixingError() || op->status() != Operation::DownloadRequired || op->isPartialDownload())
+        return false;
+
+    if(!m_objectStore.fetch(op->sha1(), op->size(), op->dataFilename(), m_paranoidCheck))
+        return false;
+
+    qCDebug(LOG_DLMANAGER) << "Operation data found in the object store" << op->path();
+    op->setDataVerified();
+    op->setStatus(Operation::ApplyRequired);
+    return true;
+}
+
+/**
+   \brief Record that \a validOperation doesn't have to be applied again
+   The stamp of its local file is kept for the next checks.
+   Repairs aren't recorded in the apply journal, they are planned from the failures of the current run.
+ */
+void DownloadManager::setApplied(QSharedPointer<Operation> validOperation)
+{
+    FileStamp stamp = validOperation->localStamp();
+    if(validOperation->fileType() == Operation::File && stamp.isValid())
+        m_fileStamps.insert(validOperation->path(), stamp);
+    else
+        m_fileStamps.remove(validOperation->path());
+
+    if(!isFixingError())
+        m_applyJournal.setApplied(metadata.package().url(), validOperation->index());
+}
+
 void DownloadManager::failure(const QString &path, Failure reason)
 {
     if(reason != Fixed)
@@ -358,12 +755,15 @@ void DownloadManager::failure(const QString &path, Failure reason)
         qCDebug(LOG_DLMANAGER) << "Operation fixed " << path;
 
     failures.insert(path, reason);
+    if(reason != Fixed)
+        m_fileStamps.remove(path);
 }
 
 /**
    \brief Find the next operation
    - dataRequest can be null if no download is in progress
-   - if dataRequest != nullptr, downloadSeek is the amount of download that will be wasted
+   - if dataRequest != nullptr, the data before the next operation is skipped
+     while it is received or a new request is started if it's faster
  */
 void DownloadManager::nextOperation()
 {
@@ -400,19 +800,19 @@ void DownloadManager::nextOperation()
             operation = metadata.operation(++operationIndex);
         }
 
-        // 2nd we compute the amount of data that can be skipped from download
+        // 2nd we skip the operations that doesn't require download
         while(!operation.isNull() && operationIndex <= preparedOperationIndex && operation->status() != Operation::DownloadRequired)
         {
-            downloadSeek += operation->size();
             readyToApply(operation);
             operation = metadata.operation(++operationIndex);
         }
 
+        offset = 0;
         if(operation.isNull())
         {
             updateDataStopDownload();
         }
-        else if(isSkipDownloadUseful(downloadSeek))
+        else if(!rangeReader.contains(operationPosition()) || isSkipDownloadUseful(rangeReader.bytesBefore(operationPosition())))
         {
             updateDataStopDownload();
             if(operationIndex <= preparedOperationIndex)
@@ -424,11 +824,7 @@ void DownloadManager::nextOperation()
         }
         else
         {
-            file.setFileName(operation->dataDownloadFilename());
-            if(!file.open(QFile::WriteOnly | QFile::Truncate))
-                throw(tr("Unable to open datafile for writing : %1").arg(file.fileName()));
-
-            offset = 0;
+            openOperationData();
         }
     }
     if(operation.isNull() && preparedOperationIndex + 1 == metadata.operationCount())
@@ -451,6 +847,14 @@ void DownloadManager::operationPrepared(QSharedPointer<Operation> preparedOperat
 
     qCDebug(LOG_DLMANAGER) << "Operation prepared" << preparedOperation->path();
 
+    // The package is abandoned, its operations are left as they are
+    if(m_abandoning)
+        return;
+
+    // Data not downloaded yet may be in the object store, data received meanwhile is then discarded
+    if(preparedOperationIndex >= operationIndex)
+        fetchOperationData(preparedOperation);
+
     // Download of prepared operation has already occured
     // [--DL--][--Prepared--][--Apply--]
     if(preparedOperationIndex < operationIndex)
@@ -491,9 +895,8 @@ void DownloadManager::operationPrepared(QSharedPointer<Operation> preparedOperat
 
             // Queue apply the current operation if its possible
             incrementDownloadPosition(preparedOperation->size() - offset);
+            discardOperationData();
             readyToApply(preparedOperation);
-
-            downloadSeek += preparedOperation->size() - offset;
             nextOperation();
         }
         //else
@@ -522,40 +925,60 @@ void DownloadManager::updateDataReadyRead()
 
     // Read all available data
     qint64 size;
-    qint64 availableSize = dataRequest->bytesAvailable();
+    LocalFileReply *localRequest = qobject_cast<LocalFileReply *>(dataRequest);
+    measureTransfer(dataRequest->bytesAvailable());
 
-    while(availableSize > 0)
+    forever
     {
-        if(downloadSeek > 0)
+        if(!rangeReader.readHeaders())
         {
-            if(availableSize <= downloadSeek)
+            if(maxRangesPerRequest > 1 && rangeReader.isParseError())
             {
-                dataRequest->read(availableSize);
-                downloadSeek -= availableSize;
-                return;
+                // Fallback to single range requests
+                qCDebug(LOG_DLMANAGER) << "Multi-range requests disabled :" << rangeReader.errorString();
+                maxRangesPerRequest = 1;
+                abortDataDownload();
+                updateDataStartDownload();
+            }
+            else
+            {
+                dataRequestFailed(rangeReader.errorString(), !isMissing(dataRequest));
             }
-            dataRequest->read(downloadSeek);
-            availableSize -= downloadSeek;
-            downloadSeek = 0;
+            return;
         }
 
-        size = operation->size() - offset;
-        Q_ASSERT(size >= 0);
-        if(size <= availableSize)
+        qint64 availableSize = rangeReader.bytesAvailable();
+        if(availableSize <= 0)
+            return;
+
+        // Position of the next byte required by the current operation
+        qint64 contiguous;
+        qint64 position = operationPosition(&contiguous);
+        if(rangeReader.position() < position)
         {
-            file.write(dataRequest->read(size));
-            incrementDownloadPosition(size);
-            operationDownloaded();
-            if(dataRequest == nullptr)
-                return; //< Futures download aborted
-            availableSize -= size;
+            size = qMin(availableSize, position - rangeReader.position());
+            skipOperationData(localRequest, size);
+            rangeReader.consumed(size);
+        }
+        else if(rangeReader.position() > position)
+        {
+            // Required data isn't part of the response, the request is retried a few times
+            dataRequestFailed(tr("Missing range %1-%2 in the response").arg(position).arg(rangeReader.position()), true);
+            return;
         }
         else
         {
-            file.write(dataRequest->read(availableSize));
-            incrementDownloadPosition(availableSize);
-            offset += availableSize;
-            availableSize = 0;
+            size = qMin(contiguous, availableSize);
+            writeOperationData(localRequest, size);
+            rangeReader.consumed(size);
+            incrementDownloadPosition(size);
+            offset += size;
+            if(offset == operation->requiredSize())
+            {
+                operationDownloaded();
+                if(dataRequest == nullptr)
+                    return; //< Futures download aborted
+            }
         }
     }
 }
@@ -564,17 +987,10 @@ void DownloadManager::operationDownloaded()
 {
     qCDebug(LOG_DLMANAGER) << "Operation downloaded" << operation->path();
 
-    Q_ASSERT(file.isOpen());
-    Q_ASSERT(file.size() == operation->size());
-
-    file.close();
-
-    if(isFixingError())
+    if(!closeOperationData())
     {
-        updateDataStopDownload();
-        readyToApply(operation);
-        qCDebug(LOG_DLMANAGER) << "DownloadFinished, cause isFixingError()" << fixingPath;
-        emit downloadFinished();
+        // The operation will be downloaded again while fixing errors
+        nextOperation();
         return;
     }
 
@@ -592,34 +1008,49 @@ void DownloadManager::operationDownloaded()
 void DownloadManager::operationApplied(QSharedPointer<Operation> appliedOperation)
 {
     qCDebug(LOG_DLMANAGER) << "Operation applied" << appliedOperation->path();
+    if(m_abandoning)
+    {
+        // Left by the abandoned package, already recorded as a failure
+        return;
+    }
+
     if(appliedOperation->status() != Operation::Valid)
     {
         if(isFixingError())
         {
-            Q_ASSERT(appliedOperation->path() == fixingPath);
-            failure(fixingPath, NonRecoverable);
-            downloadPathPos = downloadPath.size(); // stopPackageLoop
+            Q_ASSERT(fixingPaths.contains(appliedOperation->path()));
+            failure(appliedOperation->path(), NonRecoverable);
         }
         else
         {
             EMIT_WARNING(OperationApply, appliedOperation->errorString(), appliedOperation);
+            // The data may come from a corrupted object, which the repair must not fetch again
+            m_objectStore.verify(appliedOperation->sha1());
             failure(appliedOperation->path(), ApplyFailed);
         }
     }
     else if(failures.contains(appliedOperation->path()))
     {
         incrementApplyPosition(appliedOperation->size());
-        Q_ASSERT(!isFixingError() || appliedOperation->path() == fixingPath);
+        Q_ASSERT(!isFixingError() || fixingPaths.contains(appliedOperation->path()));
         failure(appliedOperation->path(), Fixed);
     }
     else
     {
+        setApplied(appliedOperation);
         incrementApplyPosition(appliedOperation->size());
     }
 }
 
 void DownloadManager::applyFinished()
 {
+    m_applyJournal.sync();
+    if(m_abandoning)
+    {
+        m_abandoning = false;
+        reroute();
+        return;
+    }
     ++downloadPathPos;
     qCDebug(LOG_DLMANAGER) << "Apply " << downloadPathPos << "/" << downloadPath.size() << "finished";
     updatePackageLoop();
@@ -627,8 +1058,8 @@ void DownloadManager::applyFinished()
 
 void DownloadManager::success()
 {
-    QSet<QString> diffFileList = m_localRepository.fileList().toSet() - m_fileListAfterUpdate - m_dirListAfterUpdate;
-    QSet<QString> diffDirList = m_localRepository.dirList().toSet() - m_fileListAfterUpdate - m_dirListAfterUpdate;
+    QSet<QString> diffFileList = m_localRepository.files() - m_fileListAfterUpdate - m_dirListAfterUpdate;
+    QSet<QString> diffDirList = m_localRepository.dirs() - m_fileListAfterUpdate - m_dirListAfterUpdate;
     foreach(const QString &fileToRemove, diffFileList)
     {
         QFile file(m_updateDirectory + fileToRemove);
@@ -643,18 +1074,100 @@ void DownloadManager::success()
             dir.rmdir(dir.path());
     }
 
-    m_localRepository.setFileList(QStringList(m_fileListAfterUpdate.toList()));
-    m_localRepository.setDirList(QStringList(m_dirListAfterUpdate.toList()));
+    // Only the changes are appended to the local status
+    foreach(const QString &path, m_localRepository.files() - m_fileListAfterUpdate)
+        m_localRepository.removeFile(path);
+    foreach(const QString &path, m_localRepository.dirs() - m_dirListAfterUpdate)
+        m_localRepository.removeDir(path);
+    foreach(const QString &path, m_dirListAfterUpdate)
+        m_localRepository.insertDir(path);
+    foreach(const QString &path, m_fileListAfterUpdate)
+        m_localRepository.insertFile(path, m_fileStamps.value(path));
     m_localRepository.setRevision(m_remoteRevision);
     m_localRepository.setUpdateInProgress(false);
     m_localRepository.save();
+    m_applyJournal.remove();
 
     emit finished(QString());
 }
 
+/**
+   \brief Returns true if opening a new request is faster than receiving \a skippableSize bytes
+   \sa updateSkipThreshold()
+ */
 bool DownloadManager::isSkipDownloadUseful(qint64 skippableSize)
 {
-    return skippableSize > 1024*1024; // 1MB
+    if(m_isLocalRepository)
+        return false; // Skipping data of a local reply costs nothing
+    return skippableSize > m_statistics.skipThreshold;
+}
+
+static qint64 movingAverage(qint64 average, qint64 sample)
+{
+    return average < 0 ? sample : (3 * average + sample) / 4;
+}
+
+/**
+   \brief Measure the latency and the bandwidth of the current data request
+   The latency is the delay before the first bytes, the bandwidth is measured
+   by windows of at least 250ms after that.
+ */
+void DownloadManager::measureTransfer(qint64 receivedSize)
+{
+    if(receivedSize <= 0)
+        return;
+
+    m_statistics.bytesReceived += receivedSize;
+    if(!firstByteReceived)
+    {
+        firstByteReceived = true;
+        m_statistics.latency = movingAverage(m_statistics.latency, requestTimer.elapsed());
+        transferTimer.start();
+        transferBytes = 0;
+        updateSkipThreshold();
+        return;
+    }
+
+    transferBytes += receivedSize;
+    if(transferTimer.elapsed() >= 250)
+        finishTransfer();
+}
+
+void DownloadManager::finishTransfer()
+{
+    if(!firstByteReceived)
+        return;
+
+    qint64 elapsed = transferTimer.elapsed();
+    if(elapsed > 0 && transferBytes >= 64 * 1024)
+    {
+        m_statistics.bandwidth = movingAverage(m_statistics.bandwidth, transferBytes * 1000 / elapsed);
+        updateSkipThreshold();
+    }
+    transferTimer.restart();
+    transferBytes = 0;
+    emit statistics(m_statistics);
+}
+
+/**
+   \brief Compute the amount of data worth skipping by a new request
+   Skipping is useful if the data that would be skipped takes longer to receive
+   than the latency of a new request (ie. bandwidth * latency).
+ */
+void DownloadManager::updateSkipThreshold()
+{
+    if(m_statistics.latency < 0 || m_statistics.bandwidth < 0)
+        return;
+
+    qint64 threshold = m_statistics.bandwidth * qMax(m_statistics.latency, Q_INT64_C(1)) / 1000;
+    if(threshold < DownloadStatistics::MinSkipThreshold)
+        threshold = DownloadStatistics::MinSkipThreshold;
+    else if(threshold > DownloadStatistics::MaxSkipThreshold)
+        threshold = DownloadStatistics::MaxSkipThreshold;
+
+    if(threshold != m_statistics.skipThreshold)
+        qCDebug(LOG_DLMANAGER) << "Skip threshold" << threshold << "for" << m_statistics.bandwidth << "B/s and" << m_statistics.latency << "ms";
+    m_statistics.skipThreshold = threshold;
 }
 
 /**
@@ -662,6 +1175,8 @@ bool DownloadManager::isSkipDownloadUseful(qint64 skippableSize)
  */
 void DownloadManager::updateDataFinished()
 {
+    finishTransfer();
+
     if(operationIndex < metadata.operationCount())
     {
         // This is never expected, even in the case the download chunk was limited,
@@ -670,62 +1185,196 @@ void DownloadManager::updateDataFinished()
 
         if(dataRequest->error() != QNetworkReply::NoError)
         {
-            // TODO : Recover in case of connection lost
+            // Connection lost or package missing
+            dataRequestFailed(dataRequest->errorString(), !isMissing(dataRequest));
         }
         else
         {
-            // Package file is probably corrupted or a bug occured
+            // Package file is probably truncated
+            dataRequestFailed(tr("The package ended before the data of %1").arg(operation->path()), true);
         }
+    }
+}
+
+/**
+   \brief Request the metadata of the current package again, or go around the package
+   \sa abandonPackage()
+ */
+void DownloadManager::metadataRequestFailed(const QString &errorString, bool retry)
+{
+    if(retry && ++m_packageRetries <= MaxPackageRetries)
+    {
+        qCDebug(LOG_DLMANAGER) << "Retrying" << downloadPath.at(downloadPathPos).metadataUrl() << errorString;
+        loadPackageMetadata();
+        return;
+    }
+
+    // No operation of the package is known by the file manager yet
+    if(abandonPackage(errorString))
+        reroute();
+}
+
+/**
+   \brief Download the data of the current package again from the current operation, or go around the package
+   The operations of an abandoned package that are still queued by the file manager aren't applied,
+   the update continues once they are drained.
+   \sa abandonPackage()
+ */
+void DownloadManager::dataRequestFailed(const QString &errorString, bool retry)
+{
+    abortDataDownload();
+
+    if(retry && ++m_packageRetries <= MaxPackageRetries)
+    {
+        qCDebug(LOG_DLMANAGER) << "Retrying" << metadata.dataUrl() << "from" << operation->path() << errorString;
+        updateDataStartDownload();
+        return;
+    }
 
-        // Restart download
-        //updateDataStopDownload();
-        //updateDataStartDownload();
+    if(abandonPackage(errorString))
+    {
+        m_abandoning = true;
+        emit downloadFinished();
+    }
+}
 
+/**
+   \brief Mark the current package as dead, so the next paths go around it
+   The update fails if there is no other way, while fixing errors or if the local revision is already the remote one.
+   \return true if the update continues with another path
+   \sa reroute()
+ */
+bool DownloadManager::abandonPackage(const QString &errorString)
+{
+    const Package package = downloadPath.at(downloadPathPos);
+    if(isFixingError() || m_localRevision == m_remoteRevision)
+    {
+        emit finished(tr("Unable to download %1 : %2").arg(package.url(), errorString));
+        return false;
     }
+
+    EMIT_WARNING(PackageDownload, tr("Unable to download %1, looking for another path : %2").arg(package.url(), errorString), package.url());
+    m_deadPackages.append(package);
+    m_packageGraph.disablePackage(package);
+
+    // Operations already sent to the file manager are applied anyway,
+    // their files don't match the revision reached and are repaired by the fixing pass
+    foreach(const QString &path, m_readyPaths)
+        failure(path, PackageAbandoned);
+    if(isLastPackage())
+    {
+        m_fileListAfterUpdate.clear();
+        m_dirListAfterUpdate.clear();
+    }
+    return true;
 }
 
+/**
+   \brief Find the best path from the revision reached so far, without the dead packages
+   Files changed by the abandoned package are recorded as failures, the fixing pass brings them to the remote revision.
+   \sa pathFound()
+ */
+void DownloadManager::reroute()
+{
+    const QString reached = downloadPathPos > 0 ? downloadPath.at(downloadPathPos - 1).to : m_localRevision;
+    qCDebug(LOG_DLMANAGER) << "Looking for another path from" << reached;
+    m_rerouting = true;
+    findPath(reached);
+}
+
+/**
+   \brief Start downloading the current operation and the following ones
+   Prepared operations that require download are requested with as few bytes
+   and requests as possible: close ranges are coalesced, the other ones are
+   requested as a multi-range request.
+   Operations that aren't prepared yet are downloaded until the end of the package.
+ */
 void DownloadManager::updateDataStartDownload()
 {
     Q_ASSERT(operation == metadata.operation(operationIndex));
 
-    qint64 skippableSize = 0;
-    qint64 endOffset = 0;
-    int i = operationIndex + 1;
-    while(i <= preparedOperationIndex)
+    RangeReader::Ranges ranges;
+    for(int i = operationIndex; i < metadata.operationCount(); ++i)
     {
-        // Find the next skip position
-        while(i <= preparedOperationIndex && metadata.operation(i)->status() == Operation::DownloadRequired)
-            ++i;
+        QSharedPointer<Operation> op = metadata.operation(i);
+        if(op->size() == 0)
+            continue;
 
-        // Compute how much data can be skipped
-        while(i <= preparedOperationIndex && metadata.operation(i)->status() != Operation::DownloadRequired)
+        if(ranges.isEmpty())
         {
-            skippableSize += metadata.operation(i)->size();
-            ++i;
+            appendOperationRanges(ranges, op);
+            continue;
         }
 
-        if(isSkipDownloadUseful(skippableSize))
+        RangeReader::Range &last = ranges.last();
+        if(i > preparedOperationIndex)
         {
-            // Skipping those data is useful
-            endOffset = metadata.operation(i)->offset();
+            // Status is unknown, so everything is downloaded
+            if(isSkipDownloadUseful(op->offset() - last.end) && ranges.size() < maxRangesPerRequest)
+                ranges.append(RangeReader::Range(op->offset(), -1));
+            else
+                last.end = -1;
             break;
         }
+
+        if(op->status() != Operation::DownloadRequired)
+            continue;
+
+        if(!appendOperationRanges(ranges, op))
+            break; // Next operations will be requested later
     }
 
-    updateDataStartDownload(endOffset);
+    updateDataStartDownload(ranges);
+}
+
+/**
+   \brief Returns the absolute position of the next byte to download for the current operation
+   \sa Operation::requiredDataPosition()
+ */
+qint64 DownloadManager::operationPosition(qint64 *contiguous) const
+{
+    return operation->offset() + operation->requiredDataPosition(offset, contiguous);
+}
+
+/**
+   \brief Add the data of \a op that must be downloaded to \a ranges
+   Ranges close to the last one are coalesced with it.
+   \return false if maxRangesPerRequest is reached, \a ranges is then left untouched
+ */
+bool DownloadManager::appendOperationRanges(RangeReader::Ranges &ranges, QSharedPointer<Operation> op)
+{
+    RangeReader::Ranges opRanges = ranges;
+    qint64 received = 0, contiguous;
+    while(received < op->requiredSize())
+    {
+        qint64 start = op->offset() + op->requiredDataPosition(received, &contiguous);
+        if(!opRanges.isEmpty() && !isSkipDownloadUseful(start - opRanges.last().end))
+            opRanges.last().end = start + contiguous;
+        else if(opRanges.size() < maxRangesPerRequest)
+            opRanges.append(RangeReader::Range(start, start + contiguous));
+        else if(ranges.isEmpty())
+            opRanges.last().end = start + contiguous; // The current operation is requested whatever the limit
+        else
+            return false;
+        received += contiguous;
+    }
+    ranges = opRanges;
+    return true;
 }
 
-void DownloadManager::updateDataStartDownload(qint64 endOffset)
+void DownloadManager::updateDataStartDownload(const RangeReader::Ranges &ranges)
 {
     Q_ASSERT(operation == metadata.operation(operationIndex));
+    offset = 0;
+    Q_ASSERT(ranges.first().start == operationPosition());
 
-    file.setFileName(operation->dataDownloadFilename());
-    if(!file.open(QFile::WriteOnly | QFile::Truncate))
-        throw(tr("Unable to open datafile for writing : %1").arg(file.fileName()));
+    openOperationData();
 
-    offset = 0;
-    downloadSeek = 0;
-    dataRequest = get(metadata.dataUrl(), operation->offset(), endOffset);
+    dataRequest = get(metadata.dataUrl(), ranges);
+    rangeReader.setReply(dataRequest, ranges);
+    ++m_statistics.requestCount;
+    requestTimer.start();
+    firstByteReceived = false;
     connect(dataRequest, &QNetworkReply::readyRead, this, &DownloadManager::updateDataReadyRead);
     connect(dataRequest, &QNetworkReply::finished, this, &DownloadManager::updateDataFinished);
 }
@@ -735,36 +1384,231 @@ void DownloadManager::updateDataStopDownload()
     qCDebug(LOG_DLMANAGER) << "GET STOPPED";
     disconnect(dataRequest, &QNetworkReply::readyRead, this, &DownloadManager::updateDataReadyRead);
     disconnect(dataRequest, &QNetworkReply::finished, this, &DownloadManager::updateDataFinished);
+    finishTransfer();
 
     file.close();
+    if(streaming)
+    {
+        operation->abortStream();
+        streaming = false;
+    }
 
-    downloadSeek = 0;
     dataRequest->abort();
     dataRequest->deleteLater();
     dataRequest = nullptr;
 }
 
-QNetworkReply *DownloadManager::get(const QString &what, qint64 startPosition, qint64 endPosition)
+/**
+   \brief Prepare the destination of the current operation data
+   Prepared operations that must be downloaded are streamed if possible,
+   other ones are written to dataDownloadFilename().
+ */
+void DownloadManager::openOperationData()
 {
-    QUrl url(m_updateUrl + what);
-    QNetworkRequest request(url);
+    streaming = m_streamingEnabled
+            && operationIndex <= preparedOperationIndex
+            && operation->status() == Operation::DownloadRequired
+            && operation->canStream();
+    dataError = QString();
+    dataHash.reset();
+
+    if(streaming)
+    {
+        try
+        {
+            operation->beginStream();
+            return;
+        }
+        catch(const QString &msg)
+        {
+            qCDebug(LOG_DLMANAGER) << "Unable to stream" << operation->path() << msg;
+            operation->abortStream();
+            streaming = false;
+        }
+    }
+
+    file.setFileName(operation->dataDownloadFilename());
+    if(!file.open(QFile::WriteOnly | QFile::Truncate))
+        throw(tr("Unable to open datafile for writing : %1").arg(file.fileName()));
+}
+
+/**
+   \brief Stop the current request and drop the data of the current operation received so far
+   The downloaded size goes back to the start of the current operation, which must be requested again.
+ */
+void DownloadManager::abortDataDownload()
+{
+    discardOperationData();
+    if(dataRequest != nullptr)
+        updateDataStopDownload();
+    incrementDownloadPosition(-offset);
+    offset = 0;
+}
+
+/**
+   \brief Drop the data of the current operation received so far
+ */
+void DownloadManager::discardOperationData()
+{
+    if(streaming)
+    {
+        operation->abortStream();
+        streaming = false;
+    }
+    else if(file.isOpen())
+    {
+        file.close();
+        file.remove();
+    }
+}
+
+void DownloadManager::skipOperationData(LocalFileReply *localRequest, qint64 size)
+{
+    m_statistics.bytesSkipped += size;
+    if(localRequest)
+    {
+        localRequest->discard(size);
+        return;
+    }
 
-    if(startPosition > 0)
+    while(size > 0)
     {
-        if(endPosition > 0 && endPosition > startPosition)
+        qint64 read = dataRequest->read(receiveBuffer, qMin<qint64>(size, sizeof(receiveBuffer)));
+        if(read <= 0)
+            break;
+        size -= read;
+    }
+}
+
+/**
+   \brief Receive \a size bytes of the current operation data
+   Data is read in a reusable buffer and hashed on the fly,
+   local replies are hashed in place and copied by the kernel.
+ */
+void DownloadManager::writeOperationData(LocalFileReply *localRequest, qint64 size)
+{
+    if(localRequest && localRequest->mappedData() != nullptr)
+    {
+        Q_ASSERT(size <= localRequest->bytesAvailable());
+        const char *data = localRequest->mappedData();
+        dataHash.addData(data, int(size));
+        if(!streaming)
         {
-            request.setRawHeader("Range", QStringLiteral("bytes=%1-%2").arg(startPosition).arg(endPosition).toLatin1());
+            if(localRequest->copyTo(&file, size) != size && dataError.isNull())
+                dataError = tr("Unable to write %1 : %2").arg(file.fileName(), file.errorString());
         }
         else
         {
-            request.setRawHeader("Range", QStringLiteral("bytes=%1-").arg(startPosition).toLatin1());
+            writeOperationData(data, size);
+            localRequest->discard(size);
+        }
+        return;
+    }
+
+    while(size > 0)
+    {
+        qint64 read = dataRequest->read(receiveBuffer, qMin<qint64>(size, sizeof(receiveBuffer)));
+        if(read <= 0)
+            break;
+        dataHash.addData(receiveBuffer, int(read));
+        writeOperationData(receiveBuffer, read);
+        size -= read;
+    }
+}
+
+void DownloadManager::writeOperationData(const char *data, qint64 size)
+{
+    if(!dataError.isNull())
+        return; // Remaining data of the operation is ignored
+
+    if(!streaming)
+    {
+        if(file.write(data, size) != size)
+            dataError = tr("Unable to write %1 : %2").arg(file.fileName(), file.errorString());
+        return;
+    }
+
+    try
+    {
+        operation->writeStream(data, size);
+    }
+    catch(const QString &msg)
+    {
+        dataError = msg;
+        operation->abortStream();
+    }
+}
+
+/**
+   \brief Finish receiving the current operation data
+   The data signature is checked and recorded, so the data file never has to be hashed again.
+   \return false if the operation data is invalid
+ */
+bool DownloadManager::closeOperationData()
+{
+    // Partial data is checked block by block when applied
+    if(dataError.isNull() && !operation->isPartialDownload() && QString(dataHash.result().toHex()) != operation->sha1())
+        dataError = tr("Downloaded data sha1 signature doesn't match");
+
+    if(streaming)
+    {
+        streaming = false;
+        if(dataError.isNull())
+        {
+            try
+            {
+                operation->endStream();
+                return true;
+            }
+            catch(const QString &msg)
+            {
+                dataError = msg;
+            }
         }
+        operation->abortStream();
     }
+    else
+    {
+        Q_ASSERT(file.isOpen());
+        Q_ASSERT(!dataError.isNull() || file.size() == operation->requiredSize());
+        file.close();
+        if(dataError.isNull())
+            return true;
+        file.remove();
+    }
+
+    EMIT_WARNING(OperationDownload, dataError, operation);
+    failure(operation->path(), isFixingError() ? NonRecoverable : DownloadFailed);
+    return false;
+}
 
-    qCDebug(LOG_DLMANAGER) << "GET(" << what << "," << startPosition << "-" << endPosition << ")";
-    QNetworkReply *reply = m_manager->get(request);
+QNetworkReply *DownloadManager::get(const QString &what, const RangeReader::Ranges &ranges)
+{
+    QUrl url(m_updateUrl + what);
+    QNetworkRequest request(url);
+
+    bool isRangeRequest = ranges.size() > 1 || (ranges.size() == 1 && (ranges.first().start > 0 || ranges.first().end >= 0));
+    if(isRangeRequest)
+        request.setRawHeader("Range", RangeReader::rangeHeader(ranges));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 6, 0)
+    // Peer servers redirect what they don't have to the remote repository
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+#endif
+
+    qCDebug(LOG_DLMANAGER) << "GET(" << what << "," << (isRangeRequest ? request.rawHeader("Range") : QByteArray()) << ")";
+    QNetworkReply *reply;
+    if(url.isLocalFile())
+    {
+        // Local replies are single range, the gaps are skipped for free
+        qint64 start = isRangeRequest ? ranges.first().start : 0;
+        qint64 end = isRangeRequest ? ranges.last().end : -1;
+        reply = new LocalFileReply(request, start, end > 0 ? end - 1 : -1, this);
+    }
+    else
+    {
+        reply = m_manager->get(request);
+    }
     connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
-    downloadSeek = startPosition > 0 && url.isLocalFile() ? startPosition : 0;
 
     return reply;
 }
@@ -2,11 +2,19 @@
 #define DOWNLOADMANAGER_H
 
 #include "../errors/warning.h"
+#include "applyjournal.h"
+#include "downloadstatistics.h"
+#include "objectstore.h"
+#include "packagecache.h"
+#include "rangereader.h"
 #include "../updater.h"
 #include "../common/package.h"
+#include "../common/packagegraph.h"
 #include "../common/packages.h"
 #include "../common/packagemetadata.h"
 #include <QFile>
+#include "../common/sha1.h"
+#include <QElapsedTimer>
 #include <QObject>
 #include <QMap>
 #include <QSet>
@@ -15,6 +23,7 @@ class QNetworkReply;
 class QNetworkAccessManager;
 class QTemporaryDir;
 class Operation;
+class LocalFileReply;
 
 class DownloadManager : public QObject
 {
@@ -25,7 +34,9 @@ public:
 private slots:
     void update();
     void authenticationRequired(QNetworkReply *, QAuthenticator * authenticator);
+    void updateRouteRequestFinished();
     void updatePackagesListRequestFinished();
+    void updateAlternativeMetadataFinished();
     void updatePackageMetadataFinished();
     void updateDataReadyRead();
     void updateDataFinished();
@@ -37,12 +48,14 @@ signals:
     void operationLoaded(QSharedPointer<Operation> operation);
     void operationReadyToApply(QSharedPointer<Operation> operation);
     void downloadFinished();
+    void parallelApplyEnabledChanged(bool enabled);
     void progress(qint64 bytesProgressed, qint64 bytesTotal);
     void checkProgress(qint64 bytesChecked, qint64 bytesTotal);
     void applyProgress(qint64 bytesApplied, qint64 bytesTotal);
     void downloadProgress(qint64 bytesReceived, qint64 bytesTotal);
     void finished(const QString &errorString);
     void warning(const Warning &warning);
+    void statistics(const DownloadStatistics &statistics);
 
 private:
     enum Failure
@@ -50,6 +63,7 @@ private:
         DownloadFailed,
         LocalFileInvalid,
         ApplyFailed,
+        PackageAbandoned,
         Fixed,
         NonRecoverable,
         FixInProgress,
@@ -57,21 +71,48 @@ private:
     };
     void success();
     void failure(const QString &path, Failure reason);
+    void recoverBlockJournals();
+    void findPath(const QString &from);
+    void pathFound(const QVector<Package> &path);
+    void startFixing();
+    bool loadAlternativeMetadata();
+    void metadataRequestFailed(const QString &errorString, bool retry);
+    void dataRequestFailed(const QString &errorString, bool retry);
+    bool abandonPackage(const QString &errorString);
+    void reroute();
+    void replanPath();
+    void continuePath(const QVector<Package> &remaining);
+    qint64 estimateSkippedSize(const PackageMetadata &known) const;
     void updatePackageLoop();
     void loadPackageMetadata();
     void packageMetadataReady();
+    void planFixingOperations();
     void updateDataReadAll();
     void updateDataStartDownload();
-    void updateDataStartDownload(qint64 endOffset);
+    void updateDataStartDownload(const RangeReader::Ranges &ranges);
+    bool appendOperationRanges(RangeReader::Ranges &ranges, QSharedPointer<Operation> op);
+    qint64 operationPosition(qint64 *contiguous = nullptr) const;
     void updateDataStopDownload();
+    void openOperationData();
+    void discardOperationData();
+    void abortDataDownload();
+    void skipOperationData(LocalFileReply *localRequest, qint64 size);
+    void writeOperationData(LocalFileReply *localRequest, qint64 size);
+    void writeOperationData(const char *data, qint64 size);
+    bool closeOperationData();
     void nextOperation();
     void operationDownloaded();
+    bool fetchOperationData(QSharedPointer<Operation> op);
     void readyToApply(QSharedPointer<Operation> readyOperation);
+    void setApplied(QSharedPointer<Operation> validOperation);
     bool isLastPackage();
     bool isFixingError();
     bool tryContinueDownload(qint64 skippableSize);
     bool isSkipDownloadUseful(qint64 skippableSize);
-    QNetworkReply *get(const QString &what, qint64 startPosition = 0, qint64 endPosition = 0);
+    void measureTransfer(qint64 receivedSize);
+    void finishTransfer();
+    void updateSkipThreshold();
+    QNetworkReply *get(const QString &what, const RangeReader::Ranges &ranges = RangeReader::Ranges());
     void incrementCheckPosition(qint64 size);
     void incrementDownloadPosition(qint64 size);
     void incrementApplyPosition(qint64 size);
@@ -82,18 +123,33 @@ private:
     QString m_updateDirectory, m_updateTmpDirectory;
     QString m_localRevision, m_remoteRevision;
     QString m_updateUrl, m_username, m_password;
+    bool m_isLocalRepository; ///< Data is read by LocalFileReply, skipping is free
+    bool m_streamingEnabled;
+    bool m_paranoidCheck; ///< Local files are always hashed, stamps aren't trusted
     QSet<QString> m_fileListAfterUpdate, m_dirListAfterUpdate;
+    ObjectStore m_objectStore; ///< Operation data shared with other installations
+    PackageCache m_packageCache; ///< Informations files kept for peers
 
     // Network
     QNetworkAccessManager *m_manager;
-    QNetworkReply *packagesListRequest, *metadataRequest, *dataRequest;
+    QNetworkReply *routeRequest, *packagesListRequest, *metadataRequest, *dataRequest;
 
     // Internal
     QMap<QString, PackageMetadata> m_cachedMetadata;
     QTemporaryDir * m_temporaryDir;
+    ApplyJournal m_applyJournal; ///< Operations already applied, kept to resume an interrupted update
+    QHash<QString, FileStamp> m_fileStamps; ///< Stamps of the local files, as known so far
 
     // Packages
     Packages m_packages;
+    PackageGraph m_packageGraph; ///< Compiled m_packages, keeps the best paths toward the remote revision
+    QString m_pathFrom; ///< Revision of the path being found
+    bool m_rerouting; ///< The path being found replaces the packages left in downloadPath
+    QVector<Package> m_deadPackages; ///< Packages that can't be downloaded, the next paths go around them
+    static const int MaxPackageRetries = 3; ///< Failed requests of a package before it's abandoned
+    int m_packageRetries; ///< Failed requests of the current package
+    bool m_abandoning; ///< The current package is abandoned, its queued operations are being drained
+    QSet<QString> m_readyPaths; ///< Paths changed by the operations of the current package sent to the file manager
     int downloadPathPos;
     QVector<Package> downloadPath;
     QMap<QString, Failure> failures; ///< Map<Path, Reason> of failures
@@ -101,14 +157,27 @@ private:
     // Progression
     qint64 downloadSize, checkPosition, downloadPosition, applyPosition;
 
+    // Statistics
+    DownloadStatistics m_statistics;
+    QElapsedTimer requestTimer; ///< Started when the current data request is sent
+    QElapsedTimer transferTimer; ///< Started when the current bandwidth measurement started
+    qint64 transferBytes; ///< Bytes received since transferTimer started
+    bool firstByteReceived;
+
     // Package download/application
     PackageMetadata metadata; ///< Informations about the package currently downloaded
     QSharedPointer<Operation> operation; ///< Current operation in download
-    QString fixingPath;
+    bool fixing; ///< Failed paths are being repaired
+    QSet<QString> fixingPaths; ///< Paths repaired by the current fixing pass
     QFile file;
+    bool streaming; ///< Current operation data is streamed instead of written to file
+    QString dataError; ///< Error that occured while receiving the current operation data
+    Sha1Hash dataHash; ///< Incremental hash of the current operation data
+    char receiveBuffer[65536];
     int preparedOperationIndex;
     int operationIndex;
-    qint64 downloadSeek; ///< If seeking the download can't be done server side (ie, it's a file)
+    RangeReader rangeReader; ///< Position of the data received by dataRequest
+    int maxRangesPerRequest; ///< 1 if the server doesn't handle multi-range requests
     qint64 offset; ///< Current download offset relative to operation->offset()
 
     // Disables the use of copy constructors and assignment operators
@@ -122,7 +191,7 @@ inline bool DownloadManager::isLastPackage()
 
 inline bool DownloadManager::isFixingError()
 {
-    return !fixingPath.isNull();
+    return fixing;
 }
 
 #endif // DOWNLOADMANAGER_H
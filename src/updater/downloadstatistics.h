@@ -0,0 +1,30 @@
+#ifndef DOWNLOADSTATISTICS_H
+#define DOWNLOADSTATISTICS_H
+
+#include <QMetaType>
+
+/*!
+    \brief Network measurements done while updating and the decisions they lead to
+    \sa Updater::downloadStatistics()
+ */
+struct DownloadStatistics
+{
+    static const qint64 DefaultSkipThreshold = 1024 * 1024; // 1MB
+    static const qint64 MinSkipThreshold = 64 * 1024; // 64KB
+    static const qint64 MaxSkipThreshold = 64 * 1024 * 1024; // 64MB
+
+    DownloadStatistics() :
+        requestCount(0), bytesReceived(0), bytesSkipped(0),
+        latency(-1), bandwidth(-1), skipThreshold(DefaultSkipThreshold) {}
+
+    int requestCount; ///< Number of data requests sent
+    qint64 bytesReceived; ///< Number of data bytes received
+    qint64 bytesSkipped; ///< Number of received bytes that weren't required
+    qint64 latency; ///< Average delay between a request and its first byte in ms, -1 if unknown
+    qint64 bandwidth; ///< Average throughput in bytes per second, -1 if unknown
+    qint64 skipThreshold; ///< Minimum amount of unrequired data that is worth a new request
+};
+
+Q_DECLARE_METATYPE(DownloadStatistics)
+
+#endif // DOWNLOADSTATISTICS_H
@@ -1,8 +1,30 @@
 #include "filemanager.h"
 #include "../operations/operation.h"
 
+#include <QRunnable>
+
+namespace
+{
+    class ApplyTask : public QRunnable
+    {
+    public:
+        ApplyTask(FileManager *manager, QSharedPointer<Operation> operation) :
+            m_manager(manager), m_operation(operation) {}
+
+        virtual void run() Q_DECL_OVERRIDE
+        {
+            m_operation->apply();
+            emit m_manager->operationApplied(m_operation);
+        }
+
+    private:
+        FileManager *m_manager;
+        QSharedPointer<Operation> m_operation;
+    };
+}
+
 FileManager::FileManager(QObject *parent) :
-    QObject(parent)
+    QObject(parent), m_parallelApply(false)
 {
 }
 
@@ -16,17 +38,42 @@ void FileManager::prepareOperation(QSharedPointer<Operation> operation)
     operation->setWarningListener([=] (const QString &message) {
         EMIT_WARNING(OperationPreparation, message, operation);
     });
-    operation->checkLocalData();
+    // The status may already be known, like for operations recorded by the apply journal
+    if(operation->status() == Operation::Unknown)
+        operation->checkLocalData();
     emit operationPrepared(operation);
 }
 
+/*!
+   \brief Apply \a operation
+   In parallel mode, file operations are applied by the thread pool.
+   Other operations (directories, ...) depend on the ones before them and wait for the pool.
+ */
 void FileManager::applyOperation(QSharedPointer<Operation> operation)
 {
+    if(m_parallelApply && operation->fileType() == Operation::File)
+    {
+        m_applyPool.start(new ApplyTask(this, operation));
+        return;
+    }
+
+    m_applyPool.waitForDone();
     operation->apply();
     emit operationApplied(operation);
 }
 
 void FileManager::downloadFinished()
 {
+    m_applyPool.waitForDone();
     emit applyFinished();
 }
+
+/*!
+   \brief Apply the file operations of a package concurrently
+   Only safe when the operations are independent, like when repairing files.
+ */
+void FileManager::setParallelApplyEnabled(bool enabled)
+{
+    m_applyPool.waitForDone();
+    m_parallelApply = enabled;
+}
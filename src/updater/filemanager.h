@@ -5,6 +5,7 @@
 
 #include <QObject>
 #include <QSharedPointer>
+#include <QThreadPool>
 
 class Operation;
 
@@ -25,6 +26,11 @@ public slots:
     void prepareOperation(QSharedPointer<Operation> operation);
     void applyOperation(QSharedPointer<Operation> operation);
     void downloadFinished();
+    void setParallelApplyEnabled(bool enabled);
+
+private:
+    bool m_parallelApply; ///< File operations are applied concurrently by m_applyPool
+    QThreadPool m_applyPool;
 };
 
 #endif // UPDATER_FILEMANAGER_H
@@ -0,0 +1,216 @@
+#include "localfilereply.h"
+
+#include <QLoggingCategory>
+
+#if defined(Q_OS_LINUX)
+#  include <errno.h>
+#  include <unistd.h>
+#  include <sys/types.h>
+#  include <sys/syscall.h>
+#endif
+
+Q_LOGGING_CATEGORY(LOG_LOCALFILEREPLY, "updatesystem.localfilereply")
+
+/*!
+   \param startPosition First byte to read
+   \param endPosition Last byte to read (inclusive, like HTTP ranges), -1 to read until the end of the file
+ */
+LocalFileReply::LocalFileReply(const QNetworkRequest &request, qint64 startPosition, qint64 endPosition, QObject *parent) :
+    QNetworkReply(parent), m_data(nullptr), m_copyFileRange(true)
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(QNetworkAccessManager::GetOperation);
+    setOpenMode(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    m_start = m_end = qMax(Q_INT64_C(0), startPosition);
+    m_file.setFileName(request.url().toLocalFile());
+    if(!m_file.open(QFile::ReadOnly))
+    {
+        setError(m_file.exists() ? ContentAccessDenied : ContentNotFoundError, m_file.errorString());
+    }
+    else
+    {
+        m_end = m_file.size();
+        if(endPosition >= 0 && endPosition >= startPosition)
+            m_end = qMin(m_end, endPosition + 1);
+        m_start = qMin(m_start, m_end);
+
+        if(m_end > m_start)
+        {
+            m_data = m_file.map(m_start, m_end - m_start);
+            if(m_data == nullptr)
+                qCDebug(LOG_LOCALFILEREPLY) << "Unable to map" << m_file.fileName() << ", falling back to read";
+        }
+        setHeader(QNetworkRequest::ContentLengthHeader, m_end - m_start);
+
+        // Answer like an HTTP server would
+        if(startPosition > 0 || endPosition >= 0)
+        {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+            setRawHeader("Content-Range", "bytes " + QByteArray::number(m_start) + '-' + QByteArray::number(m_end - 1)
+                         + '/' + QByteArray::number(m_file.size()));
+        }
+        else
+        {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        }
+    }
+    m_position = m_available = m_start;
+
+    // Signals must be emitted once the caller is connected to them
+    QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+}
+
+LocalFileReply::~LocalFileReply()
+{
+    if(m_data != nullptr)
+        m_file.unmap(m_data);
+}
+
+void LocalFileReply::abort()
+{
+    if(isFinished())
+        return;
+
+    setError(OperationCanceledError, tr("Operation canceled"));
+    setFinished(true);
+    emit finished();
+}
+
+qint64 LocalFileReply::bytesAvailable() const
+{
+    return m_available - m_position + QNetworkReply::bytesAvailable();
+}
+
+/*!
+   \brief Returns the mapped data at the current position, bytesAvailable() bytes can be accessed
+   Returns nullptr if the file couldn't be mapped.
+ */
+const char *LocalFileReply::mappedData() const
+{
+    if(m_data == nullptr)
+        return nullptr;
+    return reinterpret_cast<const char *>(m_data) + (m_position - m_start);
+}
+
+/*!
+   \brief Skip \a size bytes without reading them
+   \return The number of bytes skipped
+ */
+qint64 LocalFileReply::discard(qint64 size)
+{
+    size = qBound(Q_INT64_C(0), size, m_available - m_position);
+    m_position += size;
+    return size;
+}
+
+/*!
+   \brief Copy \a size bytes to \a destination without going through an intermediate buffer
+   The kernel copy_file_range is used if available, the mapping otherwise.
+   \return The number of bytes copied or -1 if an error occured
+ */
+qint64 LocalFileReply::copyTo(QFile *destination, qint64 size)
+{
+    size = qMin(size, m_available - m_position);
+    if(size <= 0)
+        return 0;
+
+    qint64 copied = 0;
+
+#if defined(Q_OS_LINUX) && defined(SYS_copy_file_range)
+    if(m_copyFileRange && destination->flush())
+    {
+        // Offsets are explicit, so the QFile position is kept in sync with the file descriptor
+        loff_t inOffset = m_position;
+        loff_t outOffset = destination->pos();
+        while(copied < size)
+        {
+            ssize_t ret = syscall(SYS_copy_file_range, m_file.handle(), &inOffset, destination->handle(), &outOffset, size_t(size - copied), 0u);
+            if(ret < 0 && errno == EINTR)
+                continue;
+            if(ret < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                // Not supported by the kernel or the file systems, don't try again
+                qCDebug(LOG_LOCALFILEREPLY) << "copy_file_range not available, falling back to write";
+                m_copyFileRange = false;
+            }
+            if(ret <= 0)
+                break;
+            copied += ret;
+        }
+        m_position += copied;
+        if(copied > 0 && !destination->seek(outOffset))
+            return -1;
+    }
+#endif
+
+    while(copied < size)
+    {
+        qint64 written;
+        if(m_data != nullptr)
+            written = destination->write(reinterpret_cast<const char *>(m_data) + (m_position - m_start), size - copied);
+        else
+            written = destination->write(read(size - copied));
+        if(written <= 0)
+            return -1;
+        if(m_data != nullptr)
+            m_position += written;
+        copied += written;
+    }
+
+    return copied;
+}
+
+qint64 LocalFileReply::readData(char *data, qint64 maxlen)
+{
+    qint64 size = qMin(maxlen, m_available - m_position);
+    if(size <= 0)
+        return 0;
+
+    if(m_data != nullptr)
+    {
+        memcpy(data, m_data + (m_position - m_start), size);
+    }
+    else
+    {
+        if(!m_file.seek(m_position))
+        {
+            setErrorString(m_file.errorString());
+            return -1;
+        }
+        size = m_file.read(data, size);
+        if(size < 0)
+        {
+            setErrorString(m_file.errorString());
+            return -1;
+        }
+    }
+
+    m_position += size;
+    return size;
+}
+
+void LocalFileReply::deliver()
+{
+    if(isFinished())
+        return;
+
+    if(error() == NoError && m_available < m_end)
+    {
+        m_available = qMin(m_end, m_available + ChunkSize);
+        emit downloadProgress(m_available - m_start, m_end - m_start);
+        emit readyRead();
+
+        if(isFinished())
+            return; // Aborted while reading
+        if(m_available < m_end)
+        {
+            QMetaObject::invokeMethod(this, "deliver", Qt::QueuedConnection);
+            return;
+        }
+    }
+
+    setFinished(true);
+    emit finished();
+}
@@ -0,0 +1,45 @@
+#ifndef LOCALFILEREPLY_H
+#define LOCALFILEREPLY_H
+
+#include "../qtupdatesystem_global.h"
+#include <QNetworkReply>
+#include <QFile>
+
+/*!
+    \brief Reply for file:// repositories that bypasses QNetworkAccessManager
+
+    The requested range is seeked directly and the package data is memory-mapped.
+    Data is made available by chunks, so the download manager event loop keeps running
+    while big packages are copied.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT LocalFileReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    LocalFileReply(const QNetworkRequest &request, qint64 startPosition = 0, qint64 endPosition = -1, QObject *parent = 0);
+    ~LocalFileReply();
+
+    void abort() Q_DECL_OVERRIDE;
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE;
+
+    const char *mappedData() const;
+    qint64 discard(qint64 size);
+    qint64 copyTo(QFile *destination, qint64 size);
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE;
+
+private slots:
+    void deliver();
+
+private:
+    static const qint64 ChunkSize = 1024 * 1024;
+    QFile m_file;
+    uchar *m_data; ///< Mapping of [m_start, m_end), nullptr if the mapping failed
+    qint64 m_start, m_end;
+    qint64 m_position; ///< Absolute position of the next byte to read
+    qint64 m_available; ///< Absolute position of the end of the data made available
+    bool m_copyFileRange;
+};
+
+#endif // LOCALFILEREPLY_H
@@ -3,25 +3,174 @@
 #include "../common/jsonutil.h"
 #include "../exceptions.h"
 
+#include <QBuffer>
+#include <QDataStream>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QRegularExpression>
+#include <QSaveFile>
 #include <QSettings>
+#include <QThread>
+#include <limits>
 
 static const QString Revision = QStringLiteral("Revision");
 static const QString UpdateInProgress = QStringLiteral("UpdateInProgress");
 static const QString FileList = QStringLiteral("FileList");
 static const QString DirList = QStringLiteral("DirList");
-static const QString StatusFileName = QStringLiteral("status.json");
+static const QString FileStamps = QStringLiteral("FileStamps");
+static const QString StatusSequence = QStringLiteral("BinaryStatusSequence"); // The first key of status.json
+static const QString StatusFileName = QStringLiteral("status.bin");
+static const QString JsonStatusFileName = QStringLiteral("status.json");
 
-LocalRepository::LocalRepository()
+static const quint32 StatusMagic = 0x51555353; // "QUSS"
+static const quint32 StatusVersion = 3;
+
+/*
+    The status file is a header (magic, version, sequence) followed by records, applied in order.
+    save() either rewrites the whole status or appends the records of the changes since the last save.
+    status.json, for the updaters of the previous release, is only written when the whole status is,
+    with the same sequence.
+ */
+enum StatusRecord
+{
+    RevisionRecord = 1, // QString
+    UpdateInProgressRecord, // bool
+    FileRecord, // path, stamp
+    RemoveFileRecord, // path
+    DirRecord, // path
+    RemoveDirRecord // path
+};
+
+static QJsonArray pathsToJsonArray(const QSet<QString> &paths)
+{
+    QJsonArray array;
+    foreach(const QString &path, paths)
+        array.append(path);
+    return array;
+}
+
+static QSet<QString> pathsFromJsonValue(const QJsonValue &value)
+{
+    const QJsonArray array = value.toArray();
+    QSet<QString> paths;
+    paths.reserve(array.size());
+    foreach(const QJsonValue &path, array)
+        paths.insert(path.toString());
+    return paths;
+}
+
+/*
+    Returns the sequence of the status.json \a filename, without parsing all of it
+    Keys are sorted, so the sequence is the first one. Returns 0 if the file was written by an updater
+    of the previous release, which doesn't know it, and -1 if the file doesn't exist.
+ */
+static qint64 jsonStatusSequence(const QString &filename)
+{
+    QFile file(filename);
+    if(!file.open(QFile::ReadOnly))
+        return -1;
+
+    static const QRegularExpression sequence(QStringLiteral("^\\{\\s*\"%1\"\\s*:\\s*\"(\\d+)\"").arg(StatusSequence));
+    QRegularExpressionMatch match = sequence.match(QString::fromUtf8(file.read(256)));
+    return match.hasMatch() ? match.captured(1).toLongLong() : 0;
+}
+
+/*
+    Paths are written as the length of the prefix shared with the previous path and the rest of the path
+ */
+static void writePath(QDataStream &stream, const QString &path, QByteArray *previous)
+{
+    QByteArray utf8 = path.toUtf8();
+    int prefix = 0, max = qMin(qMin(utf8.size(), previous->size()), 0xFFFF);
+    while(prefix < max && utf8.at(prefix) == previous->at(prefix))
+        ++prefix;
+
+    stream << quint16(prefix) << quint16(utf8.size() - prefix);
+    stream.writeRawData(utf8.constData() + prefix, utf8.size() - prefix);
+    *previous = utf8;
+}
+
+static bool readPath(QDataStream &stream, QString *path, QByteArray *previous)
 {
+    quint16 prefix, size;
+    stream >> prefix >> size;
+    if(stream.status() != QDataStream::Ok || prefix > previous->size())
+        return false;
+
+    QByteArray utf8 = previous->left(prefix);
+    utf8.resize(prefix + size);
+    if(stream.readRawData(utf8.data() + prefix, size) != size)
+        return false;
+
+    *path = QString::fromUtf8(utf8);
+    *previous = utf8;
+    return true;
+}
+
+static void writeStamp(QDataStream &stream, const FileStamp &stamp)
+{
+    if(!stamp.isValid())
+    {
+        stream << qint64(-1);
+        return;
+    }
+
+    QByteArray sha1 = QByteArray::fromHex(stamp.sha1.toLatin1());
+    stream << stamp.size << stamp.mtime << stamp.ctime << stamp.inode << quint8(sha1.size());
+    stream.writeRawData(sha1.constData(), sha1.size());
+}
+
+static FileStamp readStamp(QDataStream &stream)
+{
+    FileStamp stamp;
+    stream >> stamp.size;
+    if(stamp.size < 0)
+        return FileStamp();
+
+    quint8 sha1Size;
+    stream >> stamp.mtime >> stamp.ctime >> stamp.inode >> sha1Size;
+    QByteArray sha1(sha1Size, Qt::Uninitialized);
+    if(stream.readRawData(sha1.data(), sha1Size) != sha1Size)
+        return FileStamp();
+    stamp.sha1 = QString(sha1.toHex());
+    return stamp;
+}
+
+static bool sameStamp(const FileStamp &a, const FileStamp &b)
+{
+    if(!a.isValid() || !b.isValid())
+        return a.isValid() == b.isValid();
+    return a.matches(b) && a.sha1 == b.sha1;
+}
 
+LocalRepository::LocalRepository()
+{
+    reset();
 }
 
 LocalRepository::LocalRepository(const QString &directory)
 {
+    reset();
     setDirectory(directory);
 }
 
+void LocalRepository::reset()
+{
+    m_files.clear();
+    m_dirs.clear();
+    m_fileStamps.clear();
+    m_localRevision.clear();
+    m_updateInProgress = false;
+    m_rewriteRequired = true;
+    m_statusSequence = 0;
+    m_statusSize = 0;
+    m_statusRecords = 0;
+    m_pendingRecords.clear();
+    m_pendingCount = 0;
+    m_lastPath.clear();
+    m_stampedPaths.clear();
+}
+
 void LocalRepository::fromJsonObject(const QJsonObject & object)
 {
     const QString version = JsonUtil::asString(object, QStringLiteral("version"));
@@ -29,55 +178,437 @@ void LocalRepository::fromJsonObject(const QJsonObject & object)
         THROW(UnsupportedVersion, version);
     m_localRevision = object.value(Revision).toString();
     m_updateInProgress = object.value(UpdateInProgress).toBool();
-    m_fileList = object.value(FileList).toVariant().toStringList();
-    m_dirList = object.value(DirList).toVariant().toStringList();
+    m_files = pathsFromJsonValue(object.value(FileList));
+    m_dirs = pathsFromJsonValue(object.value(DirList));
+    m_statusSequence = object.value(StatusSequence).toString().toULongLong();
+
+    // Invalid stamps only cost a new hash of their file
+    m_fileStamps.clear();
+    const QJsonObject stamps = object.value(FileStamps).toObject();
+    for(QJsonObject::const_iterator it = stamps.constBegin(); it != stamps.constEnd(); ++it)
+    {
+        try
+        {
+            FileStamp stamp;
+            stamp.fromJsonObject(JsonUtil::asObject(it.value()));
+            m_fileStamps.insert(it.key(), stamp);
+        }
+        catch(...) { }
+    }
 }
 
+/*!
+    \brief Status of the previous release, still written for its updaters
+    It doesn't know stamps, they're only kept by the binary status.
+ */
 QJsonObject LocalRepository::toJsonObject() const
 {
     QJsonObject object;
-
     object.insert(QStringLiteral("version"), QStringLiteral("1"));
+    object.insert(StatusSequence, QString::number(m_statusSequence));
     object.insert(Revision, m_localRevision);
     object.insert(UpdateInProgress, m_updateInProgress);
-    object.insert(FileList, QJsonValue::fromVariant(m_fileList));
-    object.insert(DirList, QJsonValue::fromVariant(m_dirList));
-
+    object.insert(FileList, pathsToJsonArray(m_files));
+    object.insert(DirList, pathsToJsonArray(m_dirs));
     return object;
 }
 
+/*!
+    \brief Load the binary status \a filename
+    The file is mapped and parsed in place, or read if it can't be mapped. Records interrupted while being appended are ignored.
+ */
+bool LocalRepository::loadStatus(const QString &filename)
+{
+    QFile file(filename);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+
+    qint64 size = file.size();
+    const uchar *data = size > 0 && size <= std::numeric_limits<int>::max() ? file.map(0, size) : nullptr;
+    QBuffer buffer;
+    QDataStream stream;
+    if(data)
+    {
+        buffer.setData(QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(size)));
+        buffer.open(QIODevice::ReadOnly);
+        stream.setDevice(&buffer);
+    }
+    else
+    {
+        stream.setDevice(&file);
+    }
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    stream >> magic >> version >> m_statusSequence;
+    if(stream.status() != QDataStream::Ok || magic != StatusMagic || version != StatusVersion)
+        return false;
+
+    qint64 validSize = stream.device()->pos();
+    QString path;
+    while(!stream.atEnd())
+    {
+        quint8 type;
+        stream >> type;
+        bool ok = stream.status() == QDataStream::Ok;
+        switch(type)
+        {
+        case RevisionRecord:
+            stream >> m_localRevision;
+            break;
+        case UpdateInProgressRecord:
+            stream >> m_updateInProgress;
+            break;
+        case FileRecord:
+            if((ok = ok && readPath(stream, &path, &m_lastPath)))
+            {
+                FileStamp stamp = readStamp(stream);
+                if(!(ok = stream.status() == QDataStream::Ok))
+                    break;
+                m_files.insert(path);
+                if(stamp.isValid())
+                    m_fileStamps.insert(path, stamp);
+                else
+                    m_fileStamps.remove(path);
+            }
+            break;
+        case RemoveFileRecord:
+            if((ok = ok && readPath(stream, &path, &m_lastPath)))
+            {
+                m_files.remove(path);
+                m_fileStamps.remove(path);
+            }
+            break;
+        case DirRecord:
+            if((ok = ok && readPath(stream, &path, &m_lastPath)))
+                m_dirs.insert(path);
+            break;
+        case RemoveDirRecord:
+            if((ok = ok && readPath(stream, &path, &m_lastPath)))
+                m_dirs.remove(path);
+            break;
+        default:
+            ok = false;
+            break;
+        }
+
+        if(!ok || stream.status() != QDataStream::Ok)
+            break;
+        validSize = stream.device()->pos();
+        ++m_statusRecords;
+    }
+
+    m_statusSize = validSize;
+    m_rewriteRequired = validSize != size; // Nothing can be appended after an interrupted record
+    return true;
+}
+
 bool LocalRepository::load()
 {
+    reset();
+    const QString filename = m_directory + StatusFileName, jsonFilename = m_directory + JsonStatusFileName;
+    const bool statusLoaded = loadStatus(filename);
+
+    // status.json is newer if it was written by an updater of the previous release, which doesn't know the sequence,
+    // or if the binary status couldn't be rewritten after it
+    const qint64 jsonSequence = jsonStatusSequence(jsonFilename);
+    if(statusLoaded && (jsonSequence < 0 || (jsonSequence > 0 && quint64(jsonSequence) <= m_statusSequence)))
+    {
+        dropRacyStamps(filename);
+        return true;
+    }
+
+    // Status of a previous version, or a binary status that can't be read, rewritten by the next save()
+    reset();
     try
     {
-        fromJsonObject(JsonUtil::fromJsonFile(m_directory + StatusFileName));
+        fromJsonObject(JsonUtil::fromJsonFile(jsonFilename));
+        dropRacyStamps(jsonFilename);
         return true;
     }
     catch (...) {
-        return false;
+        reset();
+    }
+
+    if(statusLoaded && loadStatus(filename))
+    {
+        dropRacyStamps(filename);
+        return true;
+    }
+    reset();
+    return false;
+}
+
+/*!
+    \brief Write the whole status to \a filename, paths are sorted to share as much prefix as possible
+ */
+void LocalRepository::writeStatus(const QString &filename)
+{
+    // Written first, so it's never newer than the binary status
+    ++m_statusSequence;
+    JsonUtil::toJsonFile(m_directory + JsonStatusFileName, toJsonObject());
+
+    QSaveFile file(filename);
+    if(!file.open(QIODevice::WriteOnly))
+        THROW(UnableToOpenFile, filename, file.errorString());
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    QByteArray lastPath;
+    stream << StatusMagic << StatusVersion << m_statusSequence;
+    stream << quint8(RevisionRecord) << m_localRevision;
+    stream << quint8(UpdateInProgressRecord) << m_updateInProgress;
+
+    QStringList dirs = m_dirs.toList();
+    dirs.sort();
+    foreach(const QString &path, dirs)
+    {
+        stream << quint8(DirRecord);
+        writePath(stream, path, &lastPath);
+    }
+
+    QStringList files = m_files.toList();
+    files.sort();
+    foreach(const QString &path, files)
+    {
+        stream << quint8(FileRecord);
+        writePath(stream, path, &lastPath);
+        writeStamp(stream, m_fileStamps.value(path));
     }
+
+    if(stream.status() != QDataStream::Ok || !file.commit())
+        THROW(UnableToOpenFile, filename, file.errorString());
+
+    m_rewriteRequired = false;
+    m_statusSize = QFileInfo(filename).size();
+    m_statusRecords = 2 + dirs.size() + files.size();
+    m_pendingRecords.clear();
+    m_pendingCount = 0;
+    m_lastPath = lastPath;
 }
 
+/*!
+    \brief Save the status
+    Changes made by the incremental methods are appended to the status file,
+    which is rewritten if a bulk change happened or if most of its records are outdated.
+    status.json is only written along with a rewrite.
+ */
 void LocalRepository::save()
 {
-    JsonUtil::toJsonFile(m_directory + StatusFileName, toJsonObject());
+    QString filename = m_directory + StatusFileName;
+    int liveRecords = 2 + m_files.size() + m_dirs.size();
+    if(!m_rewriteRequired
+            && m_statusRecords + m_pendingCount <= 2 * liveRecords + CompactionMinRecords
+            && QFileInfo(filename).size() == m_statusSize) // Not modified by another instance
+    {
+        if(m_pendingRecords.isEmpty())
+            return;
+
+        if(appendRecords(filename, m_pendingRecords, m_pendingCount))
+        {
+            m_pendingRecords.clear();
+            m_pendingCount = 0;
+            settleRacyStamps(filename, m_stampedPaths);
+            return;
+        }
+    }
+
+    writeStatus(filename);
+    settleRacyStamps(filename, QSet<QString>::fromList(m_fileStamps.keys()));
 }
 
-bool LocalRepository::isManaged(const QFileInfo &file) const
+bool LocalRepository::appendRecords(const QString &filename, const QByteArray &records, int count)
 {
-    QString filename = Utils::cleanPath(file.absoluteFilePath(), false);
-    if(filename.startsWith(directory()))
+    QFile file(filename);
+    if(!file.open(QFile::WriteOnly | QFile::Append) || file.write(records) != records.size() || !file.flush())
+        return false;
+
+    m_statusSize += records.size();
+    m_statusRecords += count;
+    return true;
+}
+
+/*!
+    \brief Make sure the stamps of \a paths are older than the status file, so the next load() trusts them
+    Stamps taken in the same clock tick as the status write are racy: once the tick has passed, the stats
+    of their files are checked again and the status file is touched by appending the revision again.
+    Stamps that are still racy after RacyWaitMs are removed.
+ */
+void LocalRepository::settleRacyStamps(const QString &filename, QSet<QString> paths)
+{
+    m_stampedPaths.clear();
+    QElapsedTimer timer;
+    timer.start();
+    forever
+    {
+        const qint64 savedTime = FileStamp::stat(filename).mtime;
+        QSet<QString> racy;
+        foreach(const QString &path, paths)
+        {
+            if(m_fileStamps.contains(path) && m_fileStamps.value(path).isRacy(savedTime))
+                racy.insert(path);
+        }
+        if(racy.isEmpty())
+            return;
+
+        const bool timeout = timer.elapsed() >= RacyWaitMs;
+        if(!timeout)
+            QThread::msleep(RacyPollMs);
+
+        QByteArray records;
+        QDataStream stream(&records, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_0);
+        int count = 0;
+        foreach(const QString &path, racy)
+        {
+            if(!timeout && m_fileStamps.value(path).matches(FileStamp::stat(m_directory + path)))
+                continue;
+
+            m_fileStamps.remove(path);
+            stream << quint8(FileRecord);
+            writePath(stream, path, &m_lastPath);
+            writeStamp(stream, FileStamp());
+            ++count;
+        }
+        stream << quint8(RevisionRecord) << m_localRevision;
+        ++count;
+
+        if(!appendRecords(filename, records, count) || timeout)
+            return;
+        paths = racy;
+    }
+}
+
+/*!
+    \brief Remove the stamps that may have changed after being saved in \a filename
+    \sa FileStamp::isRacy()
+ */
+void LocalRepository::dropRacyStamps(const QString &filename)
+{
+    const qint64 savedTime = FileStamp::stat(filename).mtime;
+    for(QHash<QString, FileStamp>::iterator it = m_fileStamps.begin(); it != m_fileStamps.end();)
     {
-        filename = filename.remove(0, directory().size());
-        if(file.isDir())
-            return dirList().contains(filename);
+        if(it.value().isRacy(savedTime))
+            it = m_fileStamps.erase(it);
         else
-            return StatusFileName == filename || fileList().contains(filename);
+            ++it;
+    }
+}
+
+void LocalRepository::setRevision(const QString &revision)
+{
+    m_localRevision = revision;
+    if(m_rewriteRequired)
+        return;
+
+    QDataStream stream(&m_pendingRecords, QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(RevisionRecord) << revision;
+    ++m_pendingCount;
+}
+
+void LocalRepository::setUpdateInProgress(bool updateInProgress)
+{
+    m_updateInProgress = updateInProgress;
+    if(m_rewriteRequired)
+        return;
+
+    QDataStream stream(&m_pendingRecords, QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(UpdateInProgressRecord) << updateInProgress;
+    ++m_pendingCount;
+}
+
+/*!
+    \brief Manage the file \a path, with \a stamp if it's valid
+    Nothing is recorded if the file is already managed with the same stamp.
+ */
+void LocalRepository::insertFile(const QString &path, const FileStamp &stamp)
+{
+    if(m_files.contains(path) && sameStamp(m_fileStamps.value(path), stamp))
+        return;
+
+    m_files.insert(path);
+    if(stamp.isValid())
+    {
+        m_fileStamps.insert(path, stamp);
+        m_stampedPaths.insert(path);
     }
+    else
+    {
+        m_fileStamps.remove(path);
+    }
+
+    if(m_rewriteRequired)
+        return;
+
+    QDataStream stream(&m_pendingRecords, QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(FileRecord);
+    writePath(stream, path, &m_lastPath);
+    writeStamp(stream, stamp);
+    ++m_pendingCount;
+}
+
+void LocalRepository::removeFile(const QString &path)
+{
+    m_fileStamps.remove(path);
+    if(!m_files.remove(path) || m_rewriteRequired)
+        return;
+
+    QDataStream stream(&m_pendingRecords, QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(RemoveFileRecord);
+    writePath(stream, path, &m_lastPath);
+    ++m_pendingCount;
+}
+
+void LocalRepository::insertDir(const QString &path)
+{
+    if(m_dirs.contains(path))
+        return;
+
+    m_dirs.insert(path);
+    if(m_rewriteRequired)
+        return;
+
+    QDataStream stream(&m_pendingRecords, QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(DirRecord);
+    writePath(stream, path, &m_lastPath);
+    ++m_pendingCount;
+}
+
+void LocalRepository::removeDir(const QString &path)
+{
+    if(!m_dirs.remove(path) || m_rewriteRequired)
+        return;
+
+    QDataStream stream(&m_pendingRecords, QIODevice::Append);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint8(RemoveDirRecord);
+    writePath(stream, path, &m_lastPath);
+    ++m_pendingCount;
+}
+
+bool LocalRepository::isManaged(const QFileInfo &file) const
+{
+    QString filename = Utils::cleanPath(file.absoluteFilePath(), false);
+    if(filename.startsWith(m_directory))
+        return isManaged(filename.mid(m_directory.size()), file.isDir());
 
     return false;
 }
 
+/*!
+    \brief Returns \c true if \a path, relative to the directory, is managed
+ */
+bool LocalRepository::isManaged(const QString &path, bool isDir) const
+{
+    if(isDir)
+        return m_dirs.contains(path);
+    return StatusFileName == path || JsonStatusFileName == path || m_files.contains(path);
+}
+
 void LocalRepository::setDirectory(const QString &directory)
 {
     m_directory = Utils::cleanPath(QDir(directory).absolutePath());
@@ -4,7 +4,10 @@
 #include <QString>
 #include <QStringList>
 #include <QFileInfo>
+#include <QHash>
+#include <QSet>
 #include "../common/utils.h"
+#include "../common/filestamp.h"
 
 class QSettings;
 
@@ -20,25 +23,60 @@ public:
     void setDirectory(const QString &directory);
 
     inline QString revision() const;
-    inline void setRevision(const QString &revision);
+    void setRevision(const QString &revision);
 
     bool isManaged(const QFileInfo &file) const;
+    bool isManaged(const QString &path, bool isDir) const;
     inline bool isConsistent() const;
     inline bool updateInProgress() const;
-    inline void setUpdateInProgress(bool updateInProgress);
+    void setUpdateInProgress(bool updateInProgress);
 
+    inline const QSet<QString> &files() const;
+    inline void setFiles(const QSet<QString> &files);
     inline QStringList fileList() const;
     inline void setFileList(const QStringList &files);
 
+    inline const QSet<QString> &dirs() const;
+    inline void setDirs(const QSet<QString> &dirs);
     inline QStringList dirList() const;
     inline void setDirList(const QStringList &dirList);
 
+    inline QHash<QString, FileStamp> fileStamps() const;
+    inline void setFileStamps(const QHash<QString, FileStamp> &fileStamps);
+
+    // Incremental changes, appended to the status file by save()
+    void insertFile(const QString &path, const FileStamp &stamp = FileStamp());
+    void removeFile(const QString &path);
+    void insertDir(const QString &path);
+    void removeDir(const QString &path);
+
 private:
-    QJsonObject toJsonObject() const;
+    static const int CompactionMinRecords = 1024;
+    static const int RacyWaitMs = 2500; ///< Longer than the time resolution of the coarsest filesystems
+    static const int RacyPollMs = 10;
+
     void fromJsonObject(const QJsonObject & object);
-    QStringList m_fileList, m_dirList;
+    QJsonObject toJsonObject() const;
+    bool loadStatus(const QString &filename);
+    void writeStatus(const QString &filename);
+    bool appendRecords(const QString &filename, const QByteArray &records, int count);
+    void settleRacyStamps(const QString &filename, QSet<QString> paths);
+    void dropRacyStamps(const QString &filename);
+    void reset();
+    inline void setRewriteRequired();
+    QSet<QString> m_files, m_dirs; ///< Managed paths, relative to the directory
+    QHash<QString, FileStamp> m_fileStamps; ///< Stamps of the files, taken when they were applied or checked
     QString m_directory, m_localRevision;
     bool m_updateInProgress;
+
+    bool m_rewriteRequired; ///< The status file can't be appended to, save() rewrites it entirely
+    quint64 m_statusSequence; ///< Incremented by each rewrite, stored in both status files to tell which one is the newest
+    qint64 m_statusSize; ///< Size of the status file, as loaded or saved
+    int m_statusRecords; ///< Number of records in the status file, it is compacted when most of them are outdated
+    QByteArray m_pendingRecords; ///< Records appended by the next save()
+    int m_pendingCount;
+    QByteArray m_lastPath; ///< Last path written, paths are stored as a prefix of the previous one and a suffix
+    QSet<QString> m_stampedPaths; ///< Files whose stamp changed since the last save, they may be racy
 };
 
 inline QString LocalRepository::directory() const
@@ -51,11 +89,6 @@ inline QString LocalRepository::revision() const
     return m_localRevision;
 }
 
-inline void LocalRepository::setRevision(const QString &revision)
-{
-    m_localRevision = revision;
-}
-
 inline bool LocalRepository::isConsistent() const
 {
     return !m_updateInProgress;
@@ -66,29 +99,79 @@ inline bool LocalRepository::updateInProgress() const
     return m_updateInProgress;
 }
 
-inline void LocalRepository::setUpdateInProgress(bool updateInProgress)
+/*!
+    Managed files, isManaged() and set differences don't have to scan them
+ */
+inline const QSet<QString> &LocalRepository::files() const
 {
-    m_updateInProgress = updateInProgress;
+    return m_files;
+}
+
+inline void LocalRepository::setFiles(const QSet<QString> &files)
+{
+    m_files = files;
+    setRewriteRequired();
 }
 
 inline QStringList LocalRepository::fileList() const
 {
-    return m_fileList;
+    return m_files.toList();
 }
 
 inline void LocalRepository::setFileList(const QStringList &files)
 {
-    m_fileList = files;
+    m_files = files.toSet();
+    setRewriteRequired();
+}
+
+/*!
+    Managed directories
+ */
+inline const QSet<QString> &LocalRepository::dirs() const
+{
+    return m_dirs;
+}
+
+inline void LocalRepository::setDirs(const QSet<QString> &dirs)
+{
+    m_dirs = dirs;
+    setRewriteRequired();
 }
 
 inline QStringList LocalRepository::dirList() const
 {
-    return m_dirList;
+    return m_dirs.toList();
 }
 
 inline void LocalRepository::setDirList(const QStringList &dirList)
 {
-    m_dirList = dirList;
+    m_dirs = dirList.toSet();
+    setRewriteRequired();
+}
+
+/*!
+    Stamps of the managed files, a file whose stats still match its stamp doesn't have to be hashed.
+    Stamps of files that aren't managed aren't saved.
+ */
+inline QHash<QString, FileStamp> LocalRepository::fileStamps() const
+{
+    return m_fileStamps;
+}
+
+inline void LocalRepository::setFileStamps(const QHash<QString, FileStamp> &fileStamps)
+{
+    m_fileStamps = fileStamps;
+    setRewriteRequired();
+}
+
+/*!
+    Bulk changes replace the whole status, it can't be updated by appending records
+ */
+inline void LocalRepository::setRewriteRequired()
+{
+    m_rewriteRequired = true;
+    m_pendingRecords.clear();
+    m_pendingCount = 0;
 }
 
 #endif // LOCALREPOSITORY_H
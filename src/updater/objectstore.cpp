@@ -0,0 +1,159 @@
+#include "objectstore.h"
+#include "../common/sha1.h"
+#include "../common/utils.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(LOG_OBJECTSTORE, "updatesystem.objectstore")
+
+ObjectStore::ObjectStore()
+{
+}
+
+/*!
+    Set the directory of the store, an empty \a directory disables it
+ */
+void ObjectStore::setDirectory(const QString &directory)
+{
+    m_directory = directory.isEmpty() ? QString() : Utils::cleanPath(directory);
+}
+
+/*!
+    \brief Returns the filename of the object \a sha1, an empty string if \a sha1 isn't a valid sha1
+ */
+QString ObjectStore::objectFilename(const QString &sha1) const
+{
+    if(!isEnabled() || !isValidSha1(sha1))
+        return QString();
+    return m_directory + sha1.left(2) + QLatin1Char('/') + sha1;
+}
+
+/*!
+    \brief Returns \c true if the store has an object \a sha1 of \a size bytes
+ */
+bool ObjectStore::contains(const QString &sha1, qint64 size) const
+{
+    QString objectName = objectFilename(sha1);
+    if(objectName.isEmpty())
+        return false;
+    QFileInfo info(objectName);
+    return info.isFile() && info.size() == size;
+}
+
+/*!
+    \brief Copy the object \a sha1 of \a size bytes to \a filename, which is replaced
+    If \a verify is \c true the copy is hashed and removed if it doesn't match \a sha1.
+    \return false if the store doesn't have the object or if it can't be copied
+ */
+bool ObjectStore::fetch(const QString &sha1, qint64 size, const QString &filename, bool verify) const
+{
+    if(!contains(sha1, size))
+        return false;
+
+    if(QFile::exists(filename) && !QFile::remove(filename))
+        return false;
+    if(!Utils::copyFile(objectFilename(sha1), filename))
+    {
+        qCDebug(LOG_OBJECTSTORE) << "Unable to copy" << sha1 << "to" << filename;
+        return false;
+    }
+
+    if(verify)
+    {
+        if(!hashMatches(filename, sha1))
+        {
+            qCWarning(LOG_OBJECTSTORE) << "Object" << sha1 << "is corrupted";
+            QFile::remove(filename);
+            remove(sha1);
+            return false;
+        }
+    }
+
+    qCDebug(LOG_OBJECTSTORE) << "Fetched" << sha1;
+    return true;
+}
+
+/*!
+    \brief Store a copy of \a filename as the object \a sha1
+    \a filename content must have been verified to match \a sha1.
+    The object is copied to a temporary name first and renamed, so other installations never read a partial object.
+ */
+bool ObjectStore::insert(const QString &sha1, const QString &filename) const
+{
+    QString objectName = objectFilename(sha1);
+    if(objectName.isEmpty())
+        return false;
+    if(QFile::exists(objectName))
+        return true;
+
+    if(!QDir().mkpath(m_directory + sha1.left(2)))
+    {
+        qCDebug(LOG_OBJECTSTORE) << "Unable to create the directory of" << sha1;
+        return false;
+    }
+
+    QString tmpName = objectName + QStringLiteral(".%1.tmp").arg(QCoreApplication::applicationPid());
+    QFile::remove(tmpName);
+    if(!Utils::copyFile(filename, tmpName))
+    {
+        qCDebug(LOG_OBJECTSTORE) << "Unable to copy" << filename << "to the store";
+        return false;
+    }
+
+    // Another installation may have stored the same object meanwhile
+    if(!QFile::rename(tmpName, objectName))
+    {
+        QFile::remove(tmpName);
+        return QFile::exists(objectName);
+    }
+
+    qCDebug(LOG_OBJECTSTORE) << "Stored" << sha1;
+    return true;
+}
+
+/*!
+    \brief Remove the object \a sha1, if it's known to be unusable
+ */
+bool ObjectStore::remove(const QString &sha1) const
+{
+    QString objectName = objectFilename(sha1);
+    return !objectName.isEmpty() && QFile::remove(objectName);
+}
+
+/*!
+    \brief Hash the object \a sha1 and remove it if its content doesn't match
+    \return false if the object was corrupted, true if it's valid or not in the store
+ */
+bool ObjectStore::verify(const QString &sha1) const
+{
+    QString objectName = objectFilename(sha1);
+    if(objectName.isEmpty() || !QFile::exists(objectName) || hashMatches(objectName, sha1))
+        return true;
+
+    qCWarning(LOG_OBJECTSTORE) << "Object" << sha1 << "is corrupted";
+    remove(sha1);
+    return false;
+}
+
+bool ObjectStore::hashMatches(const QString &filename, const QString &sha1)
+{
+    QFile file(filename);
+    Sha1Hash hash;
+    return file.open(QFile::ReadOnly) && hash.addData(&file) && QString(hash.result().toHex()) == sha1;
+}
+
+bool ObjectStore::isValidSha1(const QString &sha1)
+{
+    if(sha1.size() != 40)
+        return false;
+    foreach(QChar c, sha1)
+    {
+        if(!((c >= QLatin1Char('0') && c <= QLatin1Char('9')) || (c >= QLatin1Char('a') && c <= QLatin1Char('f'))))
+            return false;
+    }
+    return true;
+}
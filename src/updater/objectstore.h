@@ -0,0 +1,47 @@
+#ifndef OBJECTSTORE_H
+#define OBJECTSTORE_H
+
+#include "../qtupdatesystem_global.h"
+#include <QString>
+
+/*!
+    \brief Content-addressed store of operation data, shared between installations
+
+    Objects are named by the sha1 of their content and stored in \c <directory>/<2 first hex digits>/<sha1>.
+    Only data whose sha1 was verified is inserted, so an object can be used instead of downloading it.
+    Objects are copied in and out of the store, sharing their content with a reflink when the filesystem supports it,
+    so applying an operation in place can't alter the store.
+ */
+class QTUPDATESYSTEMSHARED_EXPORT ObjectStore
+{
+public:
+    ObjectStore();
+
+    bool isEnabled() const;
+    QString directory() const;
+    void setDirectory(const QString &directory);
+
+    QString objectFilename(const QString &sha1) const;
+    bool contains(const QString &sha1, qint64 size) const;
+    bool fetch(const QString &sha1, qint64 size, const QString &filename, bool verify = false) const;
+    bool insert(const QString &sha1, const QString &filename) const;
+    bool remove(const QString &sha1) const;
+    bool verify(const QString &sha1) const;
+
+private:
+    static bool isValidSha1(const QString &sha1);
+    static bool hashMatches(const QString &filename, const QString &sha1);
+    QString m_directory;
+};
+
+inline bool ObjectStore::isEnabled() const
+{
+    return !m_directory.isEmpty();
+}
+
+inline QString ObjectStore::directory() const
+{
+    return m_directory;
+}
+
+#endif // OBJECTSTORE_H
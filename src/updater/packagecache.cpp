@@ -0,0 +1,72 @@
+#include "packagecache.h"
+#include "../common/utils.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QSaveFile>
+
+Q_LOGGING_CATEGORY(LOG_PACKAGECACHE, "updatesystem.packagecache")
+
+PackageCache::PackageCache()
+{
+}
+
+/*!
+    \brief Use the directory of \a remoteRepository in \a objectStoreDirectory
+    An empty \a objectStoreDirectory disables the cache.
+ */
+void PackageCache::setRepository(const QString &objectStoreDirectory, const QString &remoteRepository)
+{
+    if(objectStoreDirectory.isEmpty())
+    {
+        m_directory.clear();
+        return;
+    }
+
+    QByteArray key = QCryptographicHash::hash(remoteRepository.toUtf8(), QCryptographicHash::Sha1).toHex();
+    m_directory = Utils::cleanPath(objectStoreDirectory) + QStringLiteral("repositories/") + QString(key) + QLatin1Char('/');
+}
+
+/*!
+    \brief Returns the filename of \a name in the cache, an empty string if \a name isn't a file of a repository
+ */
+QString PackageCache::filename(const QString &name) const
+{
+    if(!isEnabled() || !isValidName(name))
+        return QString();
+    return m_directory + name;
+}
+
+bool PackageCache::contains(const QString &name) const
+{
+    QString cachedName = filename(name);
+    return !cachedName.isEmpty() && QFile::exists(cachedName);
+}
+
+/*!
+    \brief Replace the cached file \a name by \a data
+ */
+bool PackageCache::insert(const QString &name, const QByteArray &data) const
+{
+    QString cachedName = filename(name);
+    if(cachedName.isEmpty() || !QDir().mkpath(m_directory))
+        return false;
+
+    QSaveFile file(cachedName);
+    if(!file.open(QFile::WriteOnly) || file.write(data) != data.size() || !file.commit())
+    {
+        qCDebug(LOG_PACKAGECACHE) << "Unable to cache" << name << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+/*!
+    Repository files are named without any directory
+ */
+bool PackageCache::isValidName(const QString &name)
+{
+    return !name.isEmpty() && !name.startsWith(QLatin1Char('.')) && !name.contains(QLatin1Char('/')) && !name.contains(QLatin1Char('\\'));
+}
@@ -0,0 +1,41 @@
+#ifndef PACKAGECACHE_H
+#define PACKAGECACHE_H
+
+#include <QByteArray>
+#include <QString>
+
+/*!
+    \brief Copy of the informations files of a remote repository ("current", "packages", routes and package metadata)
+
+    Files are kept as they were received, in a directory of the object store specific to the remote repository,
+    so a peer server can serve them along with the operation data of the store.
+ */
+class PackageCache
+{
+public:
+    PackageCache();
+
+    bool isEnabled() const;
+    QString directory() const;
+    void setRepository(const QString &objectStoreDirectory, const QString &remoteRepository);
+
+    QString filename(const QString &name) const;
+    bool contains(const QString &name) const;
+    bool insert(const QString &name, const QByteArray &data) const;
+
+private:
+    static bool isValidName(const QString &name);
+    QString m_directory;
+};
+
+inline bool PackageCache::isEnabled() const
+{
+    return !m_directory.isEmpty();
+}
+
+inline QString PackageCache::directory() const
+{
+    return m_directory;
+}
+
+#endif // PACKAGECACHE_H
@@ -0,0 +1,173 @@
+#include "peerserver.h"
+#include "../common/jsonutil.h"
+#include "../common/packages.h"
+#include "../common/packagemetadata.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(LOG_PEERSERVER, "updatesystem.peerserver")
+
+PeerServer::PeerServer(QObject *parent) :
+    HttpServer(parent)
+{
+}
+
+void PeerServer::setRemoteRepository(const QString &remoteRepository)
+{
+    m_remoteRepository = remoteRepository;
+    m_packageCache.setRepository(m_objectStore.directory(), m_remoteRepository);
+    m_packages.clear();
+    m_availablePackages.clear();
+}
+
+void PeerServer::setObjectStoreDirectory(const QString &objectStoreDirectory)
+{
+    m_objectStore.setDirectory(objectStoreDirectory);
+    m_packageCache.setRepository(m_objectStore.directory(), m_remoteRepository);
+    m_packages.clear();
+    m_availablePackages.clear();
+}
+
+/*!
+    \brief Serve the installed files of \a localRepository
+    Its files must not change while they can be served, a default constructed repository stops serving them.
+ */
+void PeerServer::setLocalRepository(const LocalRepository &localRepository)
+{
+    m_localDirectory = localRepository.directory();
+    m_fileStamps = localRepository.fileStamps();
+    m_availablePackages.clear();
+}
+
+HttpServer::Resource PeerServer::resource(const QString &path)
+{
+    Resource resource;
+    if(!m_remoteRepository.isEmpty())
+        resource.setRedirect(QUrl(m_remoteRepository + path));
+
+    if(path == QLatin1String("current") || path == QLatin1String("packages") || Packages::isRouteName(path)
+            || path.endsWith(PackageMetadata::FileExtension))
+    {
+        resource.setContentType("application/json");
+        resource.addFile(m_packageCache.filename(path));
+        return resource;
+    }
+
+    auto it = m_availablePackages.constFind(path);
+    if(it != m_availablePackages.constEnd())
+        return it.value();
+
+    PackageData package;
+    if(!loadPackage(path, &package))
+        return resource;
+
+    bool available = true;
+    qint64 position = 0;
+    foreach(const OperationData &operation, package.operations)
+    {
+        if(operation.offset < position)
+            continue;
+        if(operation.offset > position)
+        {
+            resource.addMissing(operation.offset - position);
+            available = false;
+        }
+
+        if(m_objectStore.contains(operation.sha1, operation.size))
+            resource.addFile(m_objectStore.objectFilename(operation.sha1), 0, operation.size);
+        else if(isInstalled(operation))
+            resource.addFile(m_localDirectory + operation.path, 0, operation.size);
+        else
+        {
+            resource.addMissing(operation.size);
+            available = false;
+        }
+        position = operation.offset + operation.size;
+    }
+    if(package.size > position)
+    {
+        resource.addMissing(package.size - position);
+        available = false;
+    }
+
+    if(available)
+        m_availablePackages.insert(path, resource);
+    return resource;
+}
+
+/*!
+    \brief Load the operations of the package \a name from its cached metadata
+    \return false if the metadata isn't cached or can't be read
+ */
+bool PeerServer::loadPackage(const QString &name, PackageData *package)
+{
+    QString metadataFilename = m_packageCache.filename(name + PackageMetadata::FileExtension);
+    QFileInfo info(metadataFilename);
+    if(metadataFilename.isEmpty() || !info.isFile())
+        return false;
+
+    auto it = m_packages.constFind(name);
+    if(it != m_packages.constEnd() && it.value().modified == info.lastModified())
+    {
+        *package = it.value();
+        return true;
+    }
+
+    QFile file(metadataFilename);
+    if(!file.open(QFile::ReadOnly))
+        return false;
+
+    try
+    {
+        PackageMetadata metadata;
+        metadata.fromJsonObject(JsonUtil::fromJson(file.readAll()));
+
+        package->modified = info.lastModified();
+        package->size = metadata.size();
+        package->operations.clear();
+        foreach(const QSharedPointer<Operation> &op, metadata.operations())
+        {
+            if(op->size() <= 0)
+                continue;
+            OperationData operation;
+            operation.offset = op->offset();
+            operation.size = op->size();
+            operation.path = op->path();
+            operation.sha1 = op->sha1();
+            operation.isFile = op->finalSha1() == op->sha1();
+            package->operations.append(operation);
+        }
+        std::sort(package->operations.begin(), package->operations.end(), [](const OperationData &a, const OperationData &b) {
+            return a.offset < b.offset;
+        });
+    }
+    catch(std::exception &e)
+    {
+        qCDebug(LOG_PEERSERVER) << "Unable to load" << metadataFilename << e.what();
+        return false;
+    }
+    catch(const QString &msg)
+    {
+        qCDebug(LOG_PEERSERVER) << "Unable to load" << metadataFilename << msg;
+        return false;
+    }
+
+    m_packages.insert(name, *package);
+    return true;
+}
+
+/*!
+    \brief Returns \c true if the installed file of \a operation is its data, as known by its stamp
+ */
+bool PeerServer::isInstalled(const OperationData &operation) const
+{
+    if(!operation.isFile || m_localDirectory.isEmpty())
+        return false;
+
+    FileStamp stamp = m_fileStamps.value(operation.path);
+    return stamp.isValid() && stamp.sha1 == operation.sha1 && stamp.size == operation.size
+            && FileStamp::stat(m_localDirectory + operation.path).matches(stamp);
+}
@@ -0,0 +1,58 @@
+#ifndef PEERSERVER_H
+#define PEERSERVER_H
+
+#include "../common/filestamp.h"
+#include "../common/httpserver.h"
+#include "localrepository.h"
+#include "objectstore.h"
+#include "packagecache.h"
+#include <QDateTime>
+#include <QHash>
+#include <QVector>
+
+/*!
+    \brief Serves the remote repository to other updaters, from what an updated installation already has
+
+    Informations files come from the package cache. Package data is made of the data of its operations,
+    read from the object store or from the installed files when the data is the file itself.
+    Requests of anything else are redirected to the remote repository.
+ */
+class PeerServer : public HttpServer
+{
+public:
+    explicit PeerServer(QObject *parent = 0);
+
+    void setRemoteRepository(const QString &remoteRepository);
+    void setObjectStoreDirectory(const QString &objectStoreDirectory);
+    void setLocalRepository(const LocalRepository &localRepository);
+
+protected:
+    virtual Resource resource(const QString &path) Q_DECL_OVERRIDE;
+
+private:
+    struct OperationData
+    {
+        qint64 offset, size;
+        QString path, sha1;
+        bool isFile; ///< The data is the final file itself
+    };
+    struct PackageData
+    {
+        QDateTime modified; ///< Of the metadata file operations were loaded from
+        qint64 size;
+        QVector<OperationData> operations; ///< Sorted by offset
+    };
+
+    bool loadPackage(const QString &name, PackageData *package);
+    bool isInstalled(const OperationData &operation) const;
+
+    QString m_remoteRepository;
+    ObjectStore m_objectStore;
+    PackageCache m_packageCache;
+    QString m_localDirectory; ///< Empty while installed files can't be served
+    QHash<QString, FileStamp> m_fileStamps;
+    QHash<QString, PackageData> m_packages;
+    QHash<QString, Resource> m_availablePackages; ///< Package data without missing parts, by name
+};
+
+#endif // PEERSERVER_H
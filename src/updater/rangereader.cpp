@@ -0,0 +1,228 @@
+#include "rangereader.h"
+
+#include <QLoggingCategory>
+#include <QNetworkReply>
+#include <QObject>
+
+Q_LOGGING_CATEGORY(LOG_RANGEREADER, "updatesystem.rangereader")
+
+RangeReader::RangeReader() :
+    m_reply(nullptr), m_state(Unknown), m_position(0), m_partEnd(-1), m_parseError(false)
+{
+}
+
+/*!
+   \brief Start following \a reply, the response to a request of \a ranges
+   Until the response headers are received, the server is expected to honor the ranges.
+ */
+void RangeReader::setReply(QNetworkReply *reply, const Ranges &ranges)
+{
+    m_reply = reply;
+    m_ranges = ranges;
+    if(m_ranges.isEmpty())
+        m_ranges.append(Range(0, -1));
+    m_state = Unknown;
+    m_boundary.clear();
+    m_errorString.clear();
+    m_parseError = false;
+    m_position = m_ranges.first().start;
+    m_partEnd = m_ranges.first().end;
+}
+
+/*!
+   \brief Process the response and multipart headers received so far
+   Must be called before bytesAvailable() each time new data is received.
+   \return false if the response can't be understood
+ */
+bool RangeReader::readHeaders()
+{
+    if(m_state == Error)
+        return false;
+    if(m_state == Unknown && !readResponseHeaders())
+        return false;
+
+    while((m_state == Boundary || m_state == PartHeaders) && m_reply->canReadLine())
+    {
+        QByteArray line = m_reply->readLine().trimmed();
+        if(m_state == Boundary)
+        {
+            // Anything else is the preamble or the CRLF that ends the previous part
+            if(line == "--" + m_boundary)
+            {
+                m_state = PartHeaders;
+                m_partEnd = -1;
+            }
+            else if(line == "--" + m_boundary + "--")
+            {
+                m_state = Finished;
+            }
+        }
+        else if(line.isEmpty())
+        {
+            if(m_partEnd < 0)
+                return setError(QObject::tr("Missing Content-Range in multipart response"));
+            m_state = Body;
+        }
+        else if(line.toLower().startsWith("content-range:"))
+        {
+            if(!parseContentRange(line.mid(14).trimmed()))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+   \brief Returns the number of data bytes that can be read right now
+   Those bytes are contiguous and starts at position().
+ */
+qint64 RangeReader::bytesAvailable() const
+{
+    if(m_state != Body)
+        return 0;
+
+    qint64 available = m_reply->bytesAvailable();
+    if(m_partEnd >= 0)
+        available = qMin(available, m_partEnd - m_position);
+    return available;
+}
+
+/*!
+   \brief The caller has read or skipped \a size bytes of data from the reply
+ */
+void RangeReader::consumed(qint64 size)
+{
+    Q_ASSERT(m_state == Body);
+    m_position += size;
+    if(!m_boundary.isEmpty() && m_position == m_partEnd)
+        m_state = Boundary;
+}
+
+/*!
+   Returns \c true if the data at \a position is yet to be received by this reply.
+ */
+bool RangeReader::contains(qint64 position) const
+{
+    if(position < m_position || m_state == Finished || m_state == Error)
+        return false;
+    if(m_state == Body && (m_partEnd < 0 || position < m_partEnd))
+        return true;
+
+    foreach(const Range &range, m_ranges)
+    {
+        if(range.start <= position && (range.end < 0 || position < range.end))
+            return true;
+    }
+    return false;
+}
+
+/*!
+   Returns the number of bytes that will be received before \a position.
+ */
+qint64 RangeReader::bytesBefore(qint64 position) const
+{
+    qint64 size = 0;
+    foreach(const Range &range, m_ranges)
+    {
+        qint64 start = qMax(range.start, m_position);
+        qint64 end = range.end < 0 ? position : qMin(range.end, position);
+        if(end > start)
+            size += end - start;
+    }
+    return size;
+}
+
+/*!
+   Returns the value of the Range header that requests \a ranges.
+ */
+QByteArray RangeReader::rangeHeader(const Ranges &ranges)
+{
+    QByteArray header("bytes=");
+    for(int i = 0; i < ranges.size(); ++i)
+    {
+        if(i > 0)
+            header += ',';
+        header += QByteArray::number(ranges[i].start) + '-';
+        if(ranges[i].end >= 0)
+            header += QByteArray::number(ranges[i].end - 1);
+    }
+    return header;
+}
+
+bool RangeReader::readResponseHeaders()
+{
+    QVariant status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    int statusCode = status.toInt();
+
+    if(statusCode == 206)
+    {
+        QByteArray contentType = m_reply->rawHeader("Content-Type");
+        if(contentType.toLower().startsWith("multipart/byteranges"))
+        {
+            int pos = contentType.toLower().indexOf("boundary=");
+            if(pos < 0)
+                return setError(QObject::tr("Missing multipart boundary"));
+            m_boundary = contentType.mid(pos + 9);
+            pos = m_boundary.indexOf(';');
+            if(pos >= 0)
+                m_boundary.truncate(pos);
+            m_boundary = m_boundary.trimmed();
+            if(m_boundary.size() >= 2 && m_boundary.startsWith('"') && m_boundary.endsWith('"'))
+                m_boundary = m_boundary.mid(1, m_boundary.size() - 2);
+            m_state = Boundary;
+            qCDebug(LOG_RANGEREADER) << "Multipart response" << m_ranges.size() << "ranges";
+            return true;
+        }
+
+        // Single range, possibly a subset or a merge of the requested ones
+        if(!parseContentRange(m_reply->rawHeader("Content-Range")))
+            return false;
+        m_ranges = Ranges() << Range(m_position, m_partEnd);
+        m_state = Body;
+        return true;
+    }
+
+    if(statusCode == 200 || !status.isValid())
+    {
+        // Range header ignored, the whole file is sent
+        if(m_ranges.first().start > 0 || m_ranges.size() > 1)
+            qCDebug(LOG_RANGEREADER) << "Range request ignored by the server";
+        m_ranges = Ranges() << Range(0, -1);
+        m_position = 0;
+        m_partEnd = -1;
+        m_state = Body;
+        return true;
+    }
+
+    return setError(QObject::tr("Unexpected HTTP status %1").arg(statusCode), statusCode >= 200 && statusCode < 300);
+}
+
+bool RangeReader::parseContentRange(const QByteArray &value)
+{
+    // bytes <first>-<last>/<total>
+    int dash = value.indexOf('-');
+    int slash = value.indexOf('/');
+    bool startOk = false, lastOk = false;
+    if(value.startsWith("bytes ") && dash > 6)
+    {
+        qint64 start = value.mid(6, dash - 6).trimmed().toLongLong(&startOk);
+        qint64 last = value.mid(dash + 1, slash < 0 ? -1 : slash - dash - 1).trimmed().toLongLong(&lastOk);
+        if(startOk && lastOk && last >= start)
+        {
+            m_position = start;
+            m_partEnd = last + 1;
+            return true;
+        }
+    }
+    return setError(QObject::tr("Invalid Content-Range %1").arg(QString::fromLatin1(value)));
+}
+
+bool RangeReader::setError(const QString &errorString, bool parseError)
+{
+    qCDebug(LOG_RANGEREADER) << errorString;
+    m_errorString = errorString;
+    m_parseError = parseError;
+    m_state = Error;
+    return false;
+}
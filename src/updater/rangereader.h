@@ -0,0 +1,90 @@
+#ifndef RANGEREADER_H
+#define RANGEREADER_H
+
+#include "../qtupdatesystem_global.h"
+#include <QVector>
+#include <QByteArray>
+#include <QString>
+
+class QNetworkReply;
+
+/*!
+    \brief Follows the position of the data received for a range request
+
+    Handles multipart/byteranges responses (many ranges in one request),
+    single range responses and servers that ignore the Range header and answer with the whole file.
+    The caller reads the data from the reply itself, at most bytesAvailable() bytes at a time,
+    and reports it with consumed().
+ */
+class QTUPDATESYSTEMSHARED_EXPORT RangeReader
+{
+public:
+    struct Range
+    {
+        Range(qint64 start = 0, qint64 end = -1) : start(start), end(end) {}
+        qint64 start; ///< First byte of the range
+        qint64 end; ///< Byte after the last one of the range, -1 for the end of the file
+    };
+    typedef QVector<Range> Ranges;
+
+    RangeReader();
+
+    void setReply(QNetworkReply *reply, const Ranges &ranges);
+    bool readHeaders();
+    qint64 bytesAvailable() const;
+    void consumed(qint64 size);
+
+    qint64 position() const;
+    bool contains(qint64 position) const;
+    qint64 bytesBefore(qint64 position) const;
+    QString errorString() const;
+    bool isParseError() const;
+
+    static QByteArray rangeHeader(const Ranges &ranges);
+
+private:
+    enum State
+    {
+        Unknown, ///< Response headers not yet received
+        Boundary, ///< Waiting for the next multipart boundary
+        PartHeaders, ///< Reading multipart part headers
+        Body, ///< Receiving data
+        Finished, ///< Multipart closing boundary received
+        Error
+    };
+    bool readResponseHeaders();
+    bool parseContentRange(const QByteArray &value);
+    bool setError(const QString &errorString, bool parseError = true);
+
+    QNetworkReply *m_reply;
+    Ranges m_ranges;
+    State m_state;
+    QByteArray m_boundary; ///< Multipart boundary, empty if the response isn't multipart
+    qint64 m_position, m_partEnd;
+    QString m_errorString;
+    bool m_parseError;
+};
+
+/*!
+    Returns the absolute position in the file of the next byte of data.
+ */
+inline qint64 RangeReader::position() const
+{
+    return m_position;
+}
+
+inline QString RangeReader::errorString() const
+{
+    return m_errorString;
+}
+
+/*!
+    Returns \c true if the last error comes from a successful response that couldn't be understood,
+    \c false if the request itself failed.
+ */
+inline bool RangeReader::isParseError() const
+{
+    return m_parseError;
+}
+
+#endif // RANGEREADER_H
@@ -4,6 +4,7 @@
 #include <common/utils.h>
 
 #include "testutils.h"
+#include "tst_hash.h"
 #include "tst_repository.h"
 #include "tst_packager.h"
 #include "tst_updater.h"
@@ -42,6 +43,11 @@ int main(int argc, char *argv[])
     QDir().mkpath(dataDir + "/rev1/empty_dir");
     QDir().mkpath(dataDir + "/rev1/dirs/empty_dir2");
 
+    {
+        TestHash t;
+        ret += QTest::qExec(&t, QStringList());
+    }
+
     {
         TestPackager t;
         ret += QTest::qExec(&t, QStringList());
@@ -1,6 +1,8 @@
 #include "testutils.h"
 #include <exceptions.h>
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
 #include <QJsonDocument>
 #include <QTest>
 
@@ -42,6 +44,16 @@ void TestUtils::assertFileEquals(const QString &file1, const QString &file2)
     }
 }
 
+void TestUtils::writeFile(const QString &filename, const QByteArray &content)
+{
+    QDir().mkpath(QFileInfo(filename).path());
+    QFile file(filename);
+    if(!file.open(QFile::WriteOnly | QFile::Truncate))
+        THROW(UnableToOpenFile, filename);
+    if(file.write(content) != content.size())
+        THROW(WriteFailure, filename);
+}
+
 bool TestUtils::compareJson(const QString &file1, const QString &file2, bool expectParseError)
 {
     QFile f1(file1);
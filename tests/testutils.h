@@ -1,6 +1,7 @@
 #ifndef TESTUTILS_H
 #define TESTUTILS_H
 
+#include <QByteArray>
 #include <QString>
 
 #define FORCED_CLEANUP {\
@@ -15,6 +16,7 @@ class TestUtils
 public:
     static bool cleanup;
     static void assertFileEquals(const QString &file1, const QString &file2);
+    static void writeFile(const QString &filename, const QByteArray &content);
     static bool compareJson(const QString &file1, const QString &file2, bool expectParseError = false);
 };
 
@@ -0,0 +1,248 @@
+#include "tst_hash.h"
+#include "testutils.h"
+#include <common/sha1.h>
+#include <common/treehash.h>
+#include <QBuffer>
+#include <QCryptographicHash>
+
+const QString testOutput = testDir + "/tst_hash_output";
+
+/*!
+    \brief Returns \a length bytes that don't repeat by blocks
+ */
+static QByteArray content(int length)
+{
+    QByteArray data(length, Qt::Uninitialized);
+    for(int i = 0; i < length; ++i)
+        data[i] = char((i * 7 + i / 251) % 256);
+    return data;
+}
+
+static QByteArray expectedSha1(const QByteArray &data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+/*!
+    \brief Returns the implementations of Sha1Hash supported by the CPU, the portable one first
+    The portable implementation also hashes the files of Sha1Hash::hashFiles() in SIMD lanes.
+ */
+static QList<bool> sha1Implementations()
+{
+    QList<bool> implementations;
+    implementations << false;
+    if(Sha1Hash::setAccelerated(true))
+        implementations << true;
+    return implementations;
+}
+
+void TestHash::initTestCase()
+{
+    FORCED_CLEANUP
+    QVERIFY(QDir().mkpath(testOutput));
+}
+
+void TestHash::cleanupTestCase()
+{
+    // Back to the fastest implementation
+    Sha1Hash::setAccelerated(true);
+
+    if(!TestUtils::cleanup)
+        return;
+
+    QDir(testOutput).removeRecursively();
+}
+
+void TestHash::sha1()
+{
+    // Around the padding limits of a block, and a length that isn't a multiple of the block size
+    const int lengths[] = { 0, 1, 55, 56, 63, 64, 65, 127, 128, 1024 * 1024 + 1 };
+    foreach(bool accelerated, sha1Implementations())
+    {
+        QVERIFY(Sha1Hash::setAccelerated(accelerated));
+        QCOMPARE(Sha1Hash::isAccelerated(), accelerated);
+        for(int length : lengths)
+        {
+            const QByteArray data = content(length);
+            QVERIFY2(Sha1Hash::hash(data) == expectedSha1(data),
+                     QString("length %1, accelerated %2").arg(length).arg(accelerated).toLatin1());
+        }
+    }
+}
+
+void TestHash::sha1Chunks()
+{
+    const QByteArray data = content(100000);
+    const QByteArray expected = expectedSha1(data);
+    const int chunkSizes[] = { 1, 7, 55, 63, 64, 65, 1000, 65536 };
+    foreach(bool accelerated, sha1Implementations())
+    {
+        QVERIFY(Sha1Hash::setAccelerated(accelerated));
+        for(int chunkSize : chunkSizes)
+        {
+            Sha1Hash hash;
+            for(int pos = 0; pos < data.size(); pos += chunkSize)
+                hash.addData(data.constData() + pos, qMin(chunkSize, data.size() - pos));
+            QVERIFY2(hash.result() == expected, QString("chunks of %1, accelerated %2").arg(chunkSize).arg(accelerated).toLatin1());
+
+            // The result doesn't end the hash
+            QVERIFY(hash.result() == expected);
+            hash.addData("more");
+            QVERIFY(hash.result() == expectedSha1(data + "more"));
+
+            hash.reset();
+            hash.addData(data.left(chunkSize));
+            QVERIFY(hash.result() == expectedSha1(data.left(chunkSize)));
+        }
+
+        QBuffer buffer;
+        buffer.setData(data);
+        QVERIFY(buffer.open(QIODevice::ReadOnly));
+        Sha1Hash hash;
+        QVERIFY(hash.addData(&buffer));
+        QVERIFY(hash.result() == expected);
+    }
+}
+
+void TestHash::sha1Files()
+{
+    // 11 files: the last batch of 4 lanes has idle lanes, messages of different lengths end in the same lanes
+    const int lengths[] = { 0, 55, 56, 63, 64, 65, 1000, 4096, 100000, 1024 * 1024, 1024 * 1024 + 1 };
+    QStringList filenames;
+    QList<QByteArray> expected;
+    for(int length : lengths)
+    {
+        const QString filename = testOutput + QString("/file_%1").arg(length);
+        const QByteArray data = content(length);
+        try {
+            TestUtils::writeFile(filename, data);
+        } catch(std::exception &msg) {
+            QFAIL(msg.what());
+        }
+        filenames << filename;
+        expected << expectedSha1(data);
+    }
+    filenames << testOutput + "/missing";
+    expected << QByteArray();
+
+    foreach(bool accelerated, sha1Implementations())
+    {
+        QVERIFY(Sha1Hash::setAccelerated(accelerated));
+        for(int count = 1; count <= filenames.size(); ++count)
+        {
+            QVector<QByteArray> results = Sha1Hash::hashFiles(filenames.mid(0, count));
+            QCOMPARE(results.size(), count);
+            for(int i = 0; i < count; ++i)
+                QVERIFY2(results[i] == expected[i], QString("%1 of %2 files, accelerated %3").arg(filenames[i]).arg(count).arg(accelerated).toLatin1());
+        }
+    }
+}
+
+/*!
+    \brief Returns the leaf hashes of \a data by chunks of \a chunkSize, computed one by one
+ */
+static QVector<QByteArray> expectedLeaves(const QByteArray &data, int chunkSize)
+{
+    QVector<QByteArray> leaves;
+    int pos = 0;
+    do {
+        QCryptographicHash hash(QCryptographicHash::Sha256);
+        hash.addData(QByteArray(1, '\x00') + data.mid(pos, chunkSize));
+        leaves.append(hash.result());
+        pos += chunkSize;
+    } while(pos < data.size());
+    return leaves;
+}
+
+/*!
+    \brief Returns the root of \a leaves, the last hash of a level without a pair goes up as is
+ */
+static QByteArray expectedRoot(QVector<QByteArray> level)
+{
+    while(level.size() > 1)
+    {
+        QVector<QByteArray> next;
+        for(int i = 0; i + 1 < level.size(); i += 2)
+            next.append(QCryptographicHash::hash(QByteArray(1, '\x01') + level[i] + level[i + 1], QCryptographicHash::Sha256));
+        if(level.size() % 2 == 1)
+            next.append(level.last());
+        level = next;
+    }
+    return level.first();
+}
+
+void TestHash::treeHash()
+{
+    const int chunkSize = 1024;
+    // Around the chunk boundaries, with levels of an odd number of hashes
+    const int lengths[] = { 0, 1, chunkSize - 1, chunkSize, chunkSize + 1, 2 * chunkSize, 3 * chunkSize, 5 * chunkSize + 7, 16 * chunkSize };
+    for(int length : lengths)
+    {
+        const QString filename = testOutput + QString("/tree_%1").arg(length);
+        const QByteArray data = content(length);
+        try {
+            TestUtils::writeFile(filename, data);
+        } catch(std::exception &msg) {
+            QFAIL(msg.what());
+        }
+
+        TreeHash tree = TreeHash::hashFile(filename, chunkSize);
+        QVERIFY(!tree.isNull());
+        QCOMPARE(tree.chunkSize(), qint64(chunkSize));
+        QVERIFY2(tree.root() == expectedRoot(expectedLeaves(data, chunkSize)), QString("length %1").arg(length).toLatin1());
+
+        // Another chunk size is another signature
+        QVERIFY(TreeHash::hashFile(filename, chunkSize / 2) != tree);
+
+        TreeHash loaded;
+        loaded.fromJsonObject(tree.toJsonObject());
+        QVERIFY(loaded == tree);
+    }
+
+    // Unknown versions are ignored
+    QJsonObject object = TreeHash::hashFile(testOutput + "/tree_1", chunkSize).toJsonObject();
+    object.insert("version", QStringLiteral("2"));
+    TreeHash unknown;
+    unknown.fromJsonObject(object);
+    QVERIFY(unknown.isNull());
+
+    QVERIFY(TreeHash::hashFile(testOutput + "/missing", chunkSize).isNull());
+}
+
+void TestHash::treeHashChunks()
+{
+    // Many more chunks than threads, so each thread hashes a range of them
+    const int chunkSize = 1024;
+    const int chunkCount = 257;
+    const QString filename = testOutput + "/tree_chunks";
+    QByteArray data = content(chunkCount * chunkSize - 100);
+    try {
+        TestUtils::writeFile(filename, data);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    const QVector<QByteArray> leaves = expectedLeaves(data, chunkSize);
+    QCOMPARE(leaves.size(), chunkCount);
+
+    QVector<QByteArray> hashes = TreeHash::chunkHashes(filename, chunkSize, 0, chunkCount);
+    QVERIFY(hashes == leaves);
+    QVERIFY(TreeHash::rootHash(hashes) == TreeHash::hashFile(filename, chunkSize).root());
+
+    // Any range is checked independently of the rest of the file
+    QVERIFY(TreeHash::chunkHashes(filename, chunkSize, 100, 57) == leaves.mid(100, 57));
+    QVERIFY(TreeHash::chunkHashes(filename, chunkSize, chunkCount - 1, 1) == leaves.mid(chunkCount - 1));
+    QVERIFY(TreeHash::chunkHashes(filename, chunkSize, chunkCount - 1, 2).isEmpty()); // Past the end
+
+    // A modified byte only changes the hash of its chunk
+    data[150 * chunkSize + 10] = char(data[150 * chunkSize + 10] ^ 1);
+    try {
+        TestUtils::writeFile(filename, data);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    hashes = TreeHash::chunkHashes(filename, chunkSize, 0, chunkCount);
+    QCOMPARE(hashes.size(), chunkCount);
+    for(int i = 0; i < chunkCount; ++i)
+        QCOMPARE(hashes[i] == leaves[i], i != 150);
+    QVERIFY(TreeHash::rootHash(hashes) != TreeHash::rootHash(leaves));
+}
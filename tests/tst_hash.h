@@ -0,0 +1,23 @@
+#ifndef TST_HASH_H
+#define TST_HASH_H
+
+#include <QtTest>
+
+class TestHash : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestHash() {}
+
+private Q_SLOTS:
+    void initTestCase();
+    void sha1();
+    void sha1Chunks();
+    void sha1Files();
+    void treeHash();
+    void treeHashChunks();
+    void cleanupTestCase();
+};
+
+#endif // TST_HASH_H
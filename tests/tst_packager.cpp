@@ -76,3 +76,157 @@ void TestPackager::createComplete()
         QFAIL(msg.what());
     }
 }
+
+/*!
+    \brief Returns the type of the operation on each path of the metadata \a filename
+ */
+static QMap<QString, QString> operationTypes(const QString &filename)
+{
+    QMap<QString, QString> types;
+    QFile metadataFile(filename);
+    if(!metadataFile.open(QFile::ReadOnly))
+        return types;
+    QJsonArray operations = QJsonDocument::fromJson(metadataFile.readAll()).object().value("operations").toArray();
+    foreach(const QJsonValue &value, operations)
+        types.insert(value.toObject().value("path").toString(), value.toObject().value("type").toString());
+    return types;
+}
+
+void TestPackager::createPatchWithAppend()
+{
+    const QByteArray log = QByteArray("A line of a log file that only grows\n").repeated(100);
+    try {
+        TestUtils::writeFile(testOutput + "/append_old/grow.log", log);
+        TestUtils::writeFile(testOutput + "/append_new/grow.log", log + QByteArray("A new line\n").repeated(10));
+        TestUtils::writeFile(testOutput + "/append_old/changed.log", log);
+        TestUtils::writeFile(testOutput + "/append_new/changed.log", "A new first line\n" + log);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    Packager packager;
+    packager.setOldSource(testOutput + "/append_old", "1");
+    packager.setNewSource(testOutput + "/append_new", "2");
+    packager.setTmpDirectoryPath(testOutput + "/tmp");
+    QVERIFY(!packager.isAppendEnabled());
+
+    // Older updaters don't know append operations
+    packager.setDeltaFilename(testOutput + "/deltafile_no_append");
+    try {
+        packager.generate();
+    } catch(std::exception & msg) {
+        QFAIL(msg.what());
+    }
+    QMap<QString, QString> types = operationTypes(packager.deltaMetadataFilename());
+    QCOMPARE(types.value("grow.log"), QStringLiteral("patch"));
+    QCOMPARE(types.value("changed.log"), QStringLiteral("patch"));
+
+    packager.setAppendEnabled(true);
+    QVERIFY(packager.isAppendEnabled());
+    packager.setDeltaFilename(testOutput + "/deltafile_append");
+    try {
+        packager.generate();
+    } catch(std::exception & msg) {
+        QFAIL(msg.what());
+    }
+    types = operationTypes(packager.deltaMetadataFilename());
+    QCOMPARE(types.value("grow.log"), QStringLiteral("append"));
+    QCOMPARE(types.value("changed.log"), QStringLiteral("patch"));
+
+    // The tail signature lets the updater check the apply without reading the whole file back
+    QFile metadataFile(packager.deltaMetadataFilename());
+    QVERIFY(metadataFile.open(QFile::ReadOnly));
+    QString tailSha1;
+    foreach(const QJsonValue &value, QJsonDocument::fromJson(metadataFile.readAll()).object().value("operations").toArray())
+    {
+        if(value.toObject().value("path").toString() == "grow.log")
+            tailSha1 = value.toObject().value("tailSha1").toString();
+    }
+    QCOMPARE(tailSha1, QString(QCryptographicHash::hash(QByteArray("A new line\n").repeated(10), QCryptographicHash::Sha1).toHex()));
+}
+
+void TestPackager::createPatchWithSamples()
+{
+    QByteArray big(2 * 1024 * 1024, Qt::Uninitialized);
+    for(int i = 0; i < big.size(); ++i)
+        big[i] = char((i * 7) % 251);
+    QByteArray changed = big;
+    changed[0] = 'x';
+    try {
+        TestUtils::writeFile(testOutput + "/sample_old/big.bin", big);
+        TestUtils::writeFile(testOutput + "/sample_new/big.bin", changed);
+        TestUtils::writeFile(testOutput + "/sample_old/small.txt", "small");
+        TestUtils::writeFile(testOutput + "/sample_new/small.txt", "smaller");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    Packager packager;
+    packager.setOldSource(testOutput + "/sample_old", "1");
+    packager.setNewSource(testOutput + "/sample_new", "2");
+    packager.setTmpDirectoryPath(testOutput + "/tmp");
+    packager.setDeltaFilename(testOutput + "/deltafile_samples");
+    try {
+        packager.generate();
+    } catch(std::exception & msg) {
+        QFAIL(msg.what());
+    }
+
+    // Only files of 1MB or more have a fingerprint
+    QFile metadataFile(packager.deltaMetadataFilename());
+    QVERIFY(metadataFile.open(QFile::ReadOnly));
+    QJsonArray operations = QJsonDocument::fromJson(metadataFile.readAll()).object().value("operations").toArray();
+    QCOMPARE(operations.size(), 2);
+    foreach(const QJsonValue &value, operations)
+    {
+        QJsonObject operation = value.toObject();
+        if(operation.value("path").toString() == "big.bin")
+        {
+            QCOMPARE(operation.value("type").toString(), QStringLiteral("patch"));
+            QVERIFY(!operation.value("localSample").toString().isEmpty());
+            QVERIFY(!operation.value("finalSample").toString().isEmpty());
+            QVERIFY(operation.value("localSample") != operation.value("finalSample"));
+        }
+        else
+        {
+            QVERIFY(!operation.contains("localSample"));
+            QVERIFY(!operation.contains("finalSample"));
+        }
+    }
+}
+
+void TestPackager::createCompleteWithBlocks()
+{
+    Packager packager;
+    packager.setNewSource(dataDir + "/rev1", "REV1");
+    packager.setTmpDirectoryPath(testOutput + "/tmp");
+    packager.setBlockSize(1024);
+    QCOMPARE(packager.blockSize(), Q_INT64_C(1024));
+    packager.setDeltaFilename(testOutput + "/deltafile_blocks");
+    try {
+        packager.generate();
+    } catch(std::exception & msg) {
+        QFAIL(msg.what());
+    }
+
+    QFile metadataFile(packager.deltaMetadataFilename());
+    QVERIFY(metadataFile.open(QFile::ReadOnly));
+    QJsonArray operations = QJsonDocument::fromJson(metadataFile.readAll()).object().value("operations").toArray();
+    int operationsWithBlocks = 0;
+    foreach(const QJsonValue &value, operations)
+    {
+        QJsonObject operation = value.toObject();
+        qint64 finalSize = operation.value("finalSize").toString().toLongLong();
+        if(finalSize > 1024)
+        {
+            QCOMPARE(operation.value("blockSize").toString(), QStringLiteral("1024"));
+            QCOMPARE(qint64(operation.value("blocks").toArray().size()), (finalSize + 1023) / 1024);
+            ++operationsWithBlocks;
+        }
+        else
+        {
+            QVERIFY(!operation.contains("blocks"));
+        }
+    }
+    QCOMPARE(operationsWithBlocks, 4);
+}
@@ -14,6 +14,9 @@ private Q_SLOTS:
     void initTestCase();
     void createPatch();
     void createComplete();
+    void createCompleteWithBlocks();
+    void createPatchWithAppend();
+    void createPatchWithSamples();
     void cleanupTestCase();
 };
 
@@ -1,6 +1,9 @@
 #include "tst_repository.h"
 #include "testutils.h"
 #include <repository.h>
+#include <repositoryserver.h>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
 #include <QString>
 #include <exceptions.h>
 
@@ -9,6 +12,7 @@ const QString testOutputNew = testOutput + "/new";
 const QString testOutputAddPackage= testOutput + "/add_package";
 const QString dataAddDir = dataDir + "/repository_add";
 const QString dataNewDir = dataDir + "/repository_new";
+const QString dataServeDir = dataDir + "/repo_v1_rev1";
 
 void TestRepository::initTestCase()
 {
@@ -23,6 +27,67 @@ void TestRepository::initTestCase()
     QVERIFY(QFile::copy(dataAddDir + "/init/patchREV1_REV2.metadata", testOutputAddPackage + "/patchREV1_REV2.metadata"));
 }
 
+void TestRepository::serve()
+{
+    RepositoryServer server(dataServeDir);
+    server.setThreadCount(2);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    const QString url = QString("http://127.0.0.1:%1/").arg(server.serverPort());
+
+    QFile data(dataServeDir + "/complete_1");
+    QVERIFY(data.open(QFile::ReadOnly));
+    const QByteArray content = data.readAll();
+    QVERIFY(content.size() > 64);
+
+    QNetworkAccessManager manager;
+    auto get = [&manager](const QString &url, const QByteArray &header, const QByteArray &value) {
+        QNetworkRequest request(url);
+        if(!header.isEmpty())
+            request.setRawHeader(header, value);
+        QNetworkReply *reply = manager.get(request);
+        QSignalSpy spy(reply, SIGNAL(finished()));
+        spy.wait();
+        reply->deleteLater();
+        return reply;
+    };
+
+    QNetworkReply *reply = get(url + "complete_1", QByteArray(), QByteArray());
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 200);
+    QCOMPARE(reply->readAll(), content);
+    const QByteArray etag = reply->rawHeader("ETag");
+    QVERIFY(etag.startsWith("\"complete_1-"));
+
+    reply = get(url + "complete_1", "If-None-Match", etag);
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 304);
+
+    reply = get(url + "complete_1", "Range", "bytes=10-19");
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 206);
+    QCOMPARE(reply->rawHeader("Content-Range"), QByteArray("bytes 10-19/") + QByteArray::number(content.size()));
+    QCOMPARE(reply->readAll(), content.mid(10, 10));
+
+    // Another version of the resource is requested, it's sent whole
+    reply = get(url + "complete_1", "If-Range", "\"other\"");
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 200);
+
+    // Close ranges are merged, far ones are sent as parts
+    reply = get(url + "complete_1", "Range", QByteArray("bytes=0-1,3-4,") + QByteArray::number(content.size() - 2) + "-");
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 206);
+    QVERIFY(content.size() > 5 + HttpServer::RangeMergeGap + 2);
+    QVERIFY(reply->header(QNetworkRequest::ContentTypeHeader).toString().startsWith("multipart/byteranges; boundary="));
+    const QByteArray body = reply->readAll();
+    QVERIFY(body.contains("Content-Range: bytes 0-4/"));
+    QVERIFY(body.contains("\r\n\r\n" + content.mid(0, 5) + "\r\n"));
+    QVERIFY(body.contains("\r\n\r\n" + content.right(2) + "\r\n"));
+
+    reply = get(url + "complete_1", "Range", QByteArray("bytes=") + QByteArray::number(content.size()) + "-");
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 416);
+
+    reply = get(url + ".hidden", QByteArray(), QByteArray());
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 404);
+    reply = get(url + "missing", QByteArray(), QByteArray());
+    QCOMPARE(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(), 404);
+}
+
 void TestRepository::cleanupTestCase()
 {
     if(!TestUtils::cleanup)
@@ -132,3 +197,66 @@ void TestRepository::fixRepository()
 {
     QWARN("test not implemented");
 }
+
+void TestRepository::simplify()
+{
+    Repository pm;
+    try {
+        pm.addPackage(Package("1", QString(), 100));
+        pm.addPackage(Package("2", "1", 10));
+        pm.addPackage(Package("2", QString(), 200));
+        pm.addPackage(Package("3", "2", 10));
+        pm.addPackage(Package("3", "1", 50));
+        pm.addPackage(Package("3", QString(), 300));
+        pm.addPackage(Package("4", "3", 10));
+        QVERIFY(pm.setCurrentRevision("3"));
+    } catch(std::exception & e) {
+        QFAIL(QStringLiteral("Add package failed : %1").arg(e.what()).toLatin1());
+    }
+
+    Packages packages = pm.packages();
+    QCOMPARE(packages.findBestPath(QString(), "3"), QVector<Package>() << packages.at(0) << packages.at(1) << packages.at(3));
+    QCOMPARE(packages.findBestPath("2", "3"), QVector<Package>() << packages.at(3));
+    QCOMPARE(packages.findBestPath("3", "3"), QVector<Package>());
+    QCOMPARE(packages.findBestPath("4", "3").size(), 3);
+    QCOMPARE(packages.findBestPath("1", "4"), QVector<Package>() << packages.at(1) << packages.at(3) << packages.at(6));
+    QCOMPARE(packages.findBestPath("1", "5"), QVector<Package>());
+
+    pm.simplify();
+    QCOMPARE(QVector<Package>(pm.packages()), QVector<Package>() << packages.at(0) << packages.at(1) << packages.at(3));
+}
+
+void TestRepository::findBestPathCostModel()
+{
+    const qint64 MB = 1024 * 1024;
+    Repository pm;
+    try {
+        pm.addPackage(Package("1", QString(), 100 * MB));
+        pm.addPackage(Package("2", "1", 10 * MB));
+        pm.addPackage(Package("3", "2", 10 * MB));
+        pm.addPackage(Package("3", "1", 50 * MB));
+        pm.addPackage(Package("3", QString(), 300 * MB));
+    } catch(std::exception & e) {
+        QFAIL(QStringLiteral("Add package failed : %1").arg(e.what()).toLatin1());
+    }
+
+    // The default model only compares sizes
+    Packages packages = pm.packages();
+    QCOMPARE(packages.findBestPath(QString(), "3", PackageCostModel()), QVector<Package>() << packages.at(0) << packages.at(1) << packages.at(2));
+    QCOMPARE(packages.findBestPath("1", "3", PackageCostModel()), QVector<Package>() << packages.at(1) << packages.at(2));
+
+    PackageCostModel slowRequests;
+    slowRequests.setHopCost(200 * MB);
+    QCOMPARE(packages.findBestPath(QString(), "3", slowRequests), QVector<Package>() << packages.at(4));
+
+    PackageCostModel localFiles;
+    localFiles.setSkippedSize(packages.at(4), 250 * MB);
+    QCOMPARE(packages.findBestPath(QString(), "3", localFiles), QVector<Package>() << packages.at(4));
+    QCOMPARE(packages.findBestPath("1", "3", localFiles), QVector<Package>() << packages.at(1) << packages.at(2));
+
+    PackageCostModel slowApply;
+    slowApply.setApplyCostRatio(1);
+    packages[1].applySize = 500 * MB;
+    QCOMPARE(packages.findBestPath("1", "3", slowApply), QVector<Package>() << packages.at(3));
+    QCOMPARE(packages.findBestPath("1", "3", PackageCostModel()), QVector<Package>() << packages.at(1) << packages.at(2));
+}
@@ -15,6 +15,9 @@ private Q_SLOTS:
     void newRepository();
     void addPackage();
     void fixRepository();
+    void simplify();
+    void findBestPathCostModel();
+    void serve();
     void cleanupTestCase();
 };
 
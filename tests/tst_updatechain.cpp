@@ -3,6 +3,7 @@
 #include <repository.h>
 #include <packager.h>
 #include <updater.h>
+#include <common/utils.h>
 
 const QString dataUpdateChain = dataDir + "/updatechain";
 const QString testOutput = testDir + "/tst_updatechain_output";
@@ -10,6 +11,9 @@ const QString testOutputRepo = testOutput + "/repo";
 const QString testOutputTmp = testOutput + "/tmp";
 const QString testOutputLocalRepo = testOutput + "/local_repo";
 const QString testOutputLocalTmp = testOutput + "/local_tmp";
+const QString testOutputAppend = testOutput + "/append";
+const QString testOutputResume = testOutput + "/resume";
+const QString testOutputSample = testOutput + "/sample";
 
 void TestUpdateChain::initTestCase()
 {
@@ -19,6 +23,13 @@ void TestUpdateChain::initTestCase()
     QVERIFY(QDir().mkpath(testOutputTmp));
     QVERIFY(QDir().mkpath(testOutputLocalRepo));
     QVERIFY(QDir().mkpath(testOutputLocalTmp));
+    QVERIFY(QDir().mkpath(testOutputAppend + "/repo"));
+    QVERIFY(QDir().mkpath(testOutputAppend + "/local"));
+    QVERIFY(QDir().mkpath(testOutputResume + "/repo"));
+    QVERIFY(QDir().mkpath(testOutputResume + "/local"));
+    QVERIFY(QDir().mkpath(testOutputResume + "/tmp"));
+    QVERIFY(QDir().mkpath(testOutputSample + "/repo"));
+    QVERIFY(QDir().mkpath(testOutputSample + "/local"));
 }
 
 void TestUpdateChain::cleanupTestCase()
@@ -278,3 +289,316 @@ void TestUpdateChain::integrityCheck()
     QVERIFY(!QFile::exists(testOutputLocalRepo + "/rmfile.txt"));
     QVERIFY(!QFileInfo(testOutputLocalRepo + "/dirs/empty_dir2").isDir());
 }
+
+void TestUpdateChain::repairSeveralPaths()
+{
+    const QStringList corrupted = QStringList() << "dir2/patch_same.txt" << "path_diff.txt" << "path_diff2.txt" << "add.txt";
+    foreach(const QString &path, corrupted)
+    {
+        QFile file(testOutputLocalRepo + "/" + path);
+        QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+        QVERIFY(file.write("corrupted") > 0);
+    }
+
+    Updater u;
+    u.setLocalRepository(testOutputLocalRepo);
+    QCOMPARE(u.localRevision(), QString("2"));
+    u.setTmpDirectory(testOutputLocalTmp);
+    u.setRemoteRepository("file:///" + testOutputRepo + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::AlreadyUptodate, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0].size(), 1);
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("2"));
+
+        // One request for the check and one per package of the repair, not one per failed path
+        QVERIFY(u.downloadStatistics().requestCount <= 3);
+    }
+    try {
+        foreach(const QString &path, corrupted)
+            (TestUtils::assertFileEquals(testOutputLocalRepo + "/" + path, dataDir + "/rev2/" + path));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+}
+
+/*!
+    \brief Update \a localRepository to the current revision of \a remoteRepository
+ */
+static bool update(const QString &localRepository, const QString &remoteRepository, QString *errorString)
+{
+    Updater u;
+    u.setLocalRepository(localRepository);
+    u.setRemoteRepository("file:///" + remoteRepository + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        if(!spy.wait() || u.state() != Updater::UpdateRequired)
+        {
+            *errorString = "Check for updates failed : " + u.errorString();
+            return false;
+        }
+    }
+    QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+    u.update();
+    if(!spy.wait() || u.state() != Updater::Uptodate)
+    {
+        *errorString = "Update failed : " + u.errorString();
+        return false;
+    }
+    return true;
+}
+
+void TestUpdateChain::updateWithAppend()
+{
+    const QByteArray log = QByteArray("A line of a log file that only grows\n").repeated(1000);
+    const QByteArray grownLog = log + QByteArray("A new line\n").repeated(100);
+    try {
+        TestUtils::writeFile(testOutputAppend + "/v1/grow.log", log);
+        TestUtils::writeFile(testOutputAppend + "/v2/grow.log", grownLog);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    Repository pm;
+    pm.setDirectory(testOutputAppend + "/repo");
+    pm.load();
+    try {
+        Packager complete;
+        complete.setNewSource(testOutputAppend + "/v1", "1");
+        complete.setTmpDirectoryPath(testOutputTmp);
+        pm.addPackage(complete.generateForRepository(pm.directory()));
+
+        Packager p;
+        p.setTmpDirectoryPath(testOutputTmp);
+        p.setOldSource(testOutputAppend + "/v1", "1");
+        p.setNewSource(testOutputAppend + "/v2", "2");
+        p.setAppendEnabled(true);
+        pm.addPackage(p.generateForRepository(pm.directory()));
+    }
+    catch(std::exception & msg)
+    {
+        QFAIL(msg.what());
+    }
+    QVERIFY(pm.setCurrentRevision("1"));
+    pm.save();
+
+    QString errorString;
+    QVERIFY2(update(testOutputAppend + "/local", testOutputAppend + "/repo", &errorString), errorString.toLatin1());
+
+    // The appended file is shared with a hard linked copy, which must keep the previous content
+    {
+        Updater u;
+        u.setLocalRepository(testOutputAppend + "/local");
+        u.setHardLinkCopyEnabled(true);
+        QSignalSpy spy(&u, SIGNAL(copyFinished(bool)));
+        u.copy(testOutputAppend + "/copy");
+        QVERIFY(spy.wait());
+        QCOMPARE(spy[0][0].toBool(), true);
+    }
+    QCOMPARE(Utils::linkCount(testOutputAppend + "/local/grow.log"), 2);
+
+    QVERIFY(pm.setCurrentRevision("2"));
+    pm.save();
+    QVERIFY2(update(testOutputAppend + "/local", testOutputAppend + "/repo", &errorString), errorString.toLatin1());
+
+    try {
+        (TestUtils::assertFileEquals(testOutputAppend + "/local/grow.log", testOutputAppend + "/v2/grow.log"));
+        (TestUtils::assertFileEquals(testOutputAppend + "/copy/grow.log", testOutputAppend + "/v1/grow.log"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    QCOMPARE(Utils::linkCount(testOutputAppend + "/local/grow.log"), 1);
+}
+
+void TestUpdateChain::resumeInterruptedUpdate()
+{
+    Repository pm;
+    pm.setDirectory(testOutputResume + "/repo");
+    pm.load();
+    PackageMetadata metadata;
+    try {
+        Packager p;
+        p.setNewSource(dataDir + "/rev1", "1");
+        p.setTmpDirectoryPath(testOutputTmp);
+        metadata = p.generateForRepository(pm.directory());
+        pm.addPackage(metadata);
+    }
+    catch(std::exception & msg)
+    {
+        QFAIL(msg.what());
+    }
+    QVERIFY(pm.setCurrentRevision("1"));
+    pm.save();
+
+    // State left by an update killed after its first two file operations were applied and journaled
+    QStringList journaled;
+    QByteArray journal = QByteArrayLiteral("QtUpdateSystem apply journal 1\t\t1\n");
+    for(int i = 0; i < metadata.operationCount() && journaled.size() < 2; ++i)
+    {
+        QSharedPointer<Operation> op = metadata.operation(i);
+        if(op->fileType() != Operation::File)
+            continue;
+        QFile::remove(testOutputResume + "/local/" + op->path());
+        QVERIFY(QDir().mkpath(QFileInfo(testOutputResume + "/local/" + op->path()).path()));
+        QVERIFY(QFile::copy(dataDir + "/rev1/" + op->path(), testOutputResume + "/local/" + op->path()));
+        journal += metadata.package().url().toUtf8() + '\t' + QByteArray::number(i) + '\n';
+        journaled << op->path();
+    }
+    QCOMPARE(journaled.size(), 2);
+
+    // A journaled operation isn't checked again, tampering with its file shows it is skipped
+    try {
+        TestUtils::writeFile(testOutputResume + "/local/" + journaled[0], "tampered");
+        TestUtils::writeFile(testOutputResume + "/tmp/apply.journal", journal);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    Updater u;
+    u.setLocalRepository(testOutputResume + "/local");
+    u.setTmpDirectory(testOutputResume + "/tmp");
+    u.setRemoteRepository("file:///" + testOutputResume + "/repo/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("1"));
+    }
+    QVERIFY(!QFile::exists(testOutputResume + "/tmp/apply.journal"));
+    try {
+        TestUtils::assertFileEquals(testOutputResume + "/local/" + journaled[1], dataDir + "/rev1/" + journaled[1]);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    QFile tampered(testOutputResume + "/local/" + journaled[0]);
+    QVERIFY(tampered.open(QFile::ReadOnly));
+    QCOMPARE(tampered.readAll(), QByteArray("tampered"));
+    tampered.close();
+
+    // Once the update is complete the journal is gone, the next check repairs the file
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::AlreadyUptodate, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+    }
+    try {
+        TestUtils::assertFileEquals(testOutputResume + "/local/path_diff.txt", dataDir + "/rev1/path_diff.txt");
+        TestUtils::assertFileEquals(testOutputResume + "/local/path_diff2.txt", dataDir + "/rev1/path_diff2.txt");
+        TestUtils::assertFileEquals(testOutputResume + "/local/rmfile.txt", dataDir + "/rev1/rmfile.txt");
+        TestUtils::assertFileEquals(testOutputResume + "/local/dir2/patch_same.txt", dataDir + "/rev1/dir2/patch_same.txt");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+}
+
+/*!
+    \brief Overwrite \a length bytes of \a filename at \a offset, the size of the file is unchanged
+ */
+static bool corrupt(const QString &filename, qint64 offset, qint64 length)
+{
+    QFile file(filename);
+    return file.open(QFile::ReadWrite) && file.seek(offset) && file.write(QByteArray(int(length), 'x')) == length;
+}
+
+/*!
+    \brief Check and repair \a localRepository, already at the current revision of \a remoteRepository
+ */
+static bool repair(const QString &localRepository, const QString &remoteRepository, QString *errorString)
+{
+    Updater u;
+    u.setLocalRepository(localRepository);
+    u.setRemoteRepository("file:///" + remoteRepository + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        if(!spy.wait() || u.state() != Updater::AlreadyUptodate)
+        {
+            *errorString = "Check for updates failed : " + u.errorString();
+            return false;
+        }
+    }
+    QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+    u.update();
+    if(!spy.wait() || u.state() != Updater::Uptodate)
+    {
+        *errorString = "Repair failed : " + u.errorString();
+        return false;
+    }
+    return true;
+}
+
+void TestUpdateChain::rejectBySample()
+{
+    QByteArray big(2 * 1024 * 1024, Qt::Uninitialized);
+    for(int i = 0; i < big.size(); ++i)
+        big[i] = char((i * 7) % 251);
+    try {
+        TestUtils::writeFile(testOutputSample + "/v1/big.bin", big);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    Repository pm;
+    pm.setDirectory(testOutputSample + "/repo");
+    pm.load();
+    try {
+        Packager p;
+        p.setNewSource(testOutputSample + "/v1", "1");
+        p.setTmpDirectoryPath(testOutputTmp);
+        pm.addPackage(p.generateForRepository(pm.directory()));
+    }
+    catch(std::exception & msg)
+    {
+        QFAIL(msg.what());
+    }
+    QVERIFY(pm.setCurrentRevision("1"));
+    pm.save();
+
+    QString errorString;
+    QVERIFY2(update(testOutputSample + "/local", testOutputSample + "/repo", &errorString), errorString.toLatin1());
+
+    // Same size, a sampled block differs: rejected without being hashed entirely
+    QVERIFY(corrupt(testOutputSample + "/local/big.bin", big.size() / 2 - 100, 10));
+    QVERIFY2(repair(testOutputSample + "/local", testOutputSample + "/repo", &errorString), errorString.toLatin1());
+    try {
+        TestUtils::assertFileEquals(testOutputSample + "/local/big.bin", testOutputSample + "/v1/big.bin");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    // The fingerprint matches, the sha1 still rejects the file
+    QVERIFY(corrupt(testOutputSample + "/local/big.bin", 100000, 10));
+    QVERIFY2(repair(testOutputSample + "/local", testOutputSample + "/repo", &errorString), errorString.toLatin1());
+    try {
+        TestUtils::assertFileEquals(testOutputSample + "/local/big.bin", testOutputSample + "/v1/big.bin");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+}
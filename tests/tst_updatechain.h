@@ -19,6 +19,10 @@ private Q_SLOTS:
     void updateToV2WithFailures();
     void cleanupTestCase();
     void integrityCheck();
+    void repairSeveralPaths();
+    void updateWithAppend();
+    void resumeInterruptedUpdate();
+    void rejectBySample();
 };
 
 #endif // TST_UPDATECHAIN_H
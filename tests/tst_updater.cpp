@@ -1,6 +1,19 @@
 #include "tst_updater.h"
 #include "testutils.h"
 #include <updater.h>
+#include <repository.h>
+#include <repositoryserver.h>
+#include <updater/localfilereply.h>
+#include <updater/localrepository.h>
+#include <updater/objectstore.h>
+#include <updater/rangereader.h>
+#include <common/blockundojournal.h>
+#include <common/dirscanner.h>
+#include <common/filestamp.h>
+#include <common/utils.h>
+#include <operations/blockpatchoperation.h>
+#include <QCryptographicHash>
+#include <QDirIterator>
 #include <QFileInfo>
 
 const QString dataCopy = dataDir + "/updater_copy";
@@ -9,9 +22,31 @@ const QString dataRepoToV1 = dataDir + "/repo_v1_rev1";
 const QString dataRepoToV2 = dataDir + "/repo_v1_rev2";
 const QString testOutput = testDir + "/tst_updater_output";
 const QString testOutputCopy = testOutput + "/copy";
+const QString testOutputCopySource = testOutput + "/copy_source";
+const QString testOutputCopyIncremental = testOutput + "/copy_incremental";
 const QString testOutputIsManaged = testOutput + "/isManaged";
+const QString testOutputManaged = testOutput + "/managed";
+const QString testOutputStatus = testOutput + "/status";
+const QString testOutputScanner = testOutput + "/scanner";
+const QString testOutputReply = testOutput + "/reply";
+const QString testOutputStamps = testOutput + "/stamps";
+const QString testOutputJournal = testOutput + "/journal";
 const QString testOutputUpdate = testOutput + "/update";
 const QString testOutputUpdateTmp = testOutput + "/update_tmp";
+const QString testOutputStreaming = testOutput + "/streaming";
+const QString testOutputStreamingTmp = testOutput + "/streaming_tmp";
+const QString testOutputStore = testOutput + "/store";
+const QString testOutputStoreFirst = testOutput + "/store_first";
+const QString testOutputStoreSecond = testOutput + "/store_second";
+const QString testOutputStoreVerify = testOutput + "/store_verify";
+const QString testOutputPeer = testOutput + "/peer";
+const QString testOutputServer = testOutput + "/server";
+const QString testOutputRoutes = testOutput + "/routes";
+const QString testOutputRoutesRepo = testOutput + "/routes_repo";
+const QString testOutputBrokenRoute = testOutput + "/broken_route";
+const QString testOutputBrokenRouteRepo = testOutput + "/broken_route_repo";
+const QString testOutputReroute = testOutput + "/reroute";
+const QString testOutputRerouteRepo = testOutput + "/reroute_repo";
 
 void TestUpdater::initTestCase()
 {
@@ -19,8 +54,24 @@ void TestUpdater::initTestCase()
     QVERIFY(QDir().mkpath(testOutput));
     QVERIFY(QDir().mkpath(testOutputCopy));
     QVERIFY(QDir().mkpath(testOutputIsManaged));
+    QVERIFY(QDir().mkpath(testOutputReply));
+    QVERIFY(QDir().mkpath(testOutputStamps));
+    QVERIFY(QDir().mkpath(testOutputJournal));
     QVERIFY(QDir().mkpath(testOutputUpdate));
     QVERIFY(QDir().mkpath(testOutputUpdateTmp));
+    QVERIFY(QDir().mkpath(testOutputStreaming));
+    QVERIFY(QDir().mkpath(testOutputStreamingTmp));
+    QVERIFY(QDir().mkpath(testOutputStoreFirst));
+    QVERIFY(QDir().mkpath(testOutputStoreSecond));
+    QVERIFY(QDir().mkpath(testOutputStoreVerify));
+    QVERIFY(QDir().mkpath(testOutputPeer));
+    QVERIFY(QDir().mkpath(testOutputServer));
+    QVERIFY(QDir().mkpath(testOutputRoutes));
+    QVERIFY(QDir().mkpath(testOutputRoutesRepo));
+    QVERIFY(QDir().mkpath(testOutputBrokenRoute));
+    QVERIFY(QDir().mkpath(testOutputBrokenRouteRepo));
+    QVERIFY(QDir().mkpath(testOutputReroute));
+    QVERIFY(QDir().mkpath(testOutputRerouteRepo));
     QVERIFY(QFile::copy(dataCopy + "/init_repo/status.json", testOutputCopy + "/status.json"));
     QVERIFY(QFile::copy(dataRev1Local + "/status.json", testOutputIsManaged + "/status.json"));
     QVERIFY(QFile::copy(dataRev1Local + "/status.json", testOutputIsManaged + "/unmanaged.json"));
@@ -54,6 +105,88 @@ void TestUpdater::updaterCopy()
         QFAIL(msg.toLatin1());
     }
     QVERIFY(!QFile::exists(testOutputCopy + "/add.txt"));
+
+    // status.json is still written next to the binary status for the previous release
+    QVERIFY(QFile::exists(testOutputCopy + "/status.bin"));
+    QFile jsonStatus(testOutputCopy + "/status.json");
+    QVERIFY(jsonStatus.open(QFile::ReadOnly));
+    QCOMPARE(QJsonDocument::fromJson(jsonStatus.readAll()).object().value("Revision").toString(), u.localRevision());
+}
+
+/*!
+    \brief Write \a content to the file \a path of \a repository and record its stamp
+ */
+static void writeManagedFile(LocalRepository *repository, const QString &path, const QByteArray &content)
+{
+    TestUtils::writeFile(repository->directory() + path, content);
+    repository->insertFile(path);
+}
+
+static void stampManagedFiles(LocalRepository *repository)
+{
+    foreach(const QString &path, repository->files())
+    {
+        FileStamp stamp = FileStamp::stat(repository->directory() + path);
+        QFile file(repository->directory() + path);
+        if(file.open(QFile::ReadOnly))
+            stamp.sha1 = QString(QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1).toHex());
+        repository->insertFile(path, stamp);
+    }
+    repository->save();
+}
+
+static bool copyRepository(const QString &source, const QString &destination)
+{
+    Updater u;
+    u.setLocalRepository(source);
+    QSignalSpy spy(&u, SIGNAL(copyFinished(bool)));
+    u.copy(destination);
+    return spy.wait() && spy[0][0].toBool();
+}
+
+void TestUpdater::updaterCopyIncremental()
+{
+    LocalRepository source(testOutputCopySource);
+    try {
+        writeManagedFile(&source, "unchanged.txt", "unchanged");
+        writeManagedFile(&source, "changed.txt", "before");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    source.setRevision("1");
+    stampManagedFiles(&source);
+
+    QVERIFY(copyRepository(testOutputCopySource, testOutputCopyIncremental));
+    {
+        LocalRepository copy(testOutputCopyIncremental);
+        QCOMPARE(copy.revision(), QString("1"));
+        QVERIFY(copy.fileStamps().value("unchanged.txt").isValid());
+        QVERIFY(copy.fileStamps().value("changed.txt").isValid());
+    }
+
+    try {
+        TestUtils::writeFile(testOutputCopySource + "/changed.txt", "after");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    stampManagedFiles(&source);
+
+#if defined(Q_OS_LINUX)
+    // A link to the copied file keeps its inode, a new copy has another one.
+    // Elsewhere the link changes the status time of the copy, which would then be copied again
+    const QString witness = testOutput + "/copy_witness";
+    QVERIFY(Utils::copyFile(testOutputCopyIncremental + "/unchanged.txt", witness, true));
+#endif
+    QVERIFY(copyRepository(testOutputCopySource, testOutputCopyIncremental));
+    try {
+        TestUtils::assertFileEquals(testOutputCopySource + "/unchanged.txt", testOutputCopyIncremental + "/unchanged.txt");
+        TestUtils::assertFileEquals(testOutputCopySource + "/changed.txt", testOutputCopyIncremental + "/changed.txt");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+#if defined(Q_OS_LINUX)
+    QCOMPARE(FileStamp::stat(testOutputCopyIncremental + "/unchanged.txt").inode, FileStamp::stat(witness).inode);
+#endif
 }
 
 void TestUpdater::updaterIsManaged()
@@ -68,6 +201,179 @@ void TestUpdater::updaterIsManaged()
     QVERIFY(!u.isManaged(testOutputIsManaged + "/unmanaged.json"));
 }
 
+/*!
+    \brief Check the managed paths of \a repository, after files were inserted and removed
+ */
+static void checkManagedPaths(const LocalRepository &repository)
+{
+    QVERIFY(repository.isManaged("dir", true));
+    QVERIFY(repository.isManaged("dir/file.txt", false));
+    QVERIFY(repository.isManaged("status.bin", false));
+    QVERIFY(repository.isManaged("status.json", false));
+    QVERIFY(repository.isManaged(QFileInfo(testOutputManaged + "/dir/")));
+    QVERIFY(repository.isManaged(QFileInfo(testOutputManaged + "/dir/file.txt")));
+
+    // Files and directories are distinct
+    QVERIFY(!repository.isManaged("dir", false));
+    QVERIFY(!repository.isManaged("dir/file.txt", true));
+
+    // Removed paths
+    QVERIFY(!repository.isManaged("file.txt", false));
+    QVERIFY(!repository.isManaged("dir/sub", true));
+    QVERIFY(!repository.isManaged(QFileInfo(testOutputManaged + "/dir/sub/")));
+
+    // Prefixes, extensions and parents of managed paths aren't managed
+    QVERIFY(!repository.isManaged("di", true));
+    QVERIFY(!repository.isManaged("dir/file", false));
+    QVERIFY(!repository.isManaged("dir/file.txt.bak", false));
+    QVERIFY(!repository.isManaged("dir/sub/file.txt", false));
+    QVERIFY(!repository.isManaged(QFileInfo(testOutput + "/dir/file.txt")));
+
+    for(int i = 0; i < 10000; ++i)
+        QVERIFY(repository.isManaged(QString("many/%1.txt").arg(i), false));
+    QVERIFY(!repository.isManaged("many/10000.txt", false));
+}
+
+void TestUpdater::localRepositoryIsManaged()
+{
+    QVERIFY(QDir().mkpath(testOutputManaged + "/dir/sub"));
+    try {
+        TestUtils::writeFile(testOutputManaged + "/dir/file.txt", "managed");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    LocalRepository repository(testOutputManaged);
+    QVERIFY(!repository.isManaged("dir/file.txt", false));
+    QVERIFY(!repository.isManaged("dir", true));
+
+    repository.insertDir("dir");
+    repository.insertDir("dir/sub");
+    repository.insertFile("dir/file.txt");
+    repository.insertFile("file.txt");
+    for(int i = 0; i < 10000; ++i)
+        repository.insertFile(QString("many/%1.txt").arg(i));
+    QVERIFY(repository.isManaged("file.txt", false));
+    QVERIFY(repository.isManaged("dir/sub", true));
+    repository.removeFile("file.txt");
+    repository.removeDir("dir/sub");
+    checkManagedPaths(repository);
+    if(QTest::currentTestFailed())
+        return;
+
+    // Saved and loaded again
+    repository.save();
+    checkManagedPaths(LocalRepository(testOutputManaged));
+}
+
+static QByteArray readStatus(const QString &filename)
+{
+    QFile file(filename);
+    return file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void TestUpdater::localRepositoryStatus()
+{
+    const QString statusFile = testOutputStatus + "/status.bin";
+    const QString jsonStatusFile = testOutputStatus + "/status.json";
+    QVERIFY(QDir().mkpath(testOutputStatus));
+
+    LocalRepository repository(testOutputStatus);
+    repository.insertDir("dir");
+    repository.insertFile("dir/a.txt");
+    repository.insertFile("dir/b.txt");
+    repository.setRevision("1");
+    repository.save();
+    const QByteArray written = readStatus(statusFile);
+    QVERIFY(!written.isEmpty());
+    const QByteArray jsonWritten = readStatus(jsonStatusFile);
+    QVERIFY(!jsonWritten.isEmpty());
+
+    // Changes are appended to the status, status.json is only written with the whole status
+    repository.removeFile("dir/a.txt");
+    repository.insertFile("dir/c.txt");
+    repository.setRevision("2");
+    repository.save();
+    QByteArray appended = readStatus(statusFile);
+    QVERIFY(appended.size() > written.size());
+    QVERIFY(appended.startsWith(written));
+    QCOMPARE(readStatus(jsonStatusFile), jsonWritten);
+    {
+        LocalRepository loaded(testOutputStatus);
+        QCOMPARE(loaded.revision(), QString("2"));
+        QCOMPARE(loaded.files(), QSet<QString>() << "dir/b.txt" << "dir/c.txt");
+        QCOMPARE(loaded.dirs(), QSet<QString>() << "dir");
+    }
+
+    // The sequence tells which status is the newest, not the modification times
+    try {
+        TestUtils::writeFile(jsonStatusFile, jsonWritten);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    {
+        LocalRepository loaded(testOutputStatus);
+        QCOMPARE(loaded.revision(), QString("2"));
+        QCOMPARE(loaded.files(), QSet<QString>() << "dir/b.txt" << "dir/c.txt");
+    }
+
+    // The last record was interrupted while being appended, the status is the one before it
+    repository.insertFile("dir/d.txt");
+    repository.setRevision("3");
+    repository.save();
+    QVERIFY(QFile::remove(jsonStatusFile));
+    QFile file(statusFile);
+    QVERIFY(file.resize(file.size() - 1));
+    {
+        LocalRepository loaded(testOutputStatus);
+        QCOMPARE(loaded.revision(), QString("2"));
+        QCOMPARE(loaded.files(), QSet<QString>() << "dir/b.txt" << "dir/c.txt" << "dir/d.txt");
+
+        // Nothing is appended after a torn record, the status is rewritten
+        appended = readStatus(statusFile);
+        loaded.insertFile("dir/e.txt");
+        loaded.save();
+        QVERIFY(!readStatus(statusFile).startsWith(appended));
+    }
+    {
+        LocalRepository loaded(testOutputStatus);
+        QCOMPARE(loaded.revision(), QString("2"));
+        QCOMPARE(loaded.files(), QSet<QString>() << "dir/b.txt" << "dir/c.txt" << "dir/d.txt" << "dir/e.txt");
+    }
+
+    // An empty binary status falls back to status.json
+    QVERIFY(file.resize(0));
+    {
+        LocalRepository loaded(testOutputStatus);
+        QCOMPARE(loaded.revision(), QString("2"));
+        QCOMPARE(loaded.files(), QSet<QString>() << "dir/b.txt" << "dir/c.txt" << "dir/d.txt" << "dir/e.txt");
+        loaded.save();
+        QVERIFY(file.size() > 0);
+    }
+
+    // status.json written by an updater of the previous release, which doesn't know the sequence, is newer
+    try {
+        TestUtils::writeFile(jsonStatusFile, "{ \"version\": \"1\", \"Revision\": \"1\", \"FileList\": [\"dir/b.txt\"], \"DirList\": [\"dir\"] }");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    {
+        LocalRepository loaded(testOutputStatus);
+        QCOMPARE(loaded.revision(), QString("1"));
+        QCOMPARE(loaded.files(), QSet<QString>() << "dir/b.txt");
+    }
+
+    // Neither status can be read
+    QVERIFY(file.resize(0));
+    QVERIFY(QFile::remove(jsonStatusFile));
+    {
+        LocalRepository loaded(testOutputStatus);
+        QVERIFY(!loaded.load());
+        QCOMPARE(loaded.revision(), QString());
+        QVERIFY(loaded.files().isEmpty());
+    }
+}
+
 void TestUpdater::updaterRemoveOtherFiles()
 {
     Updater u;
@@ -89,6 +395,276 @@ void TestUpdater::updaterRemoveOtherFiles()
     QVERIFY(!QDir(testOutputIsManaged + "/dirs/empty_dir1").exists());
 }
 
+/*!
+    \brief Returns the paths of the tree of \a root listed by \a scanner, directories end with a slash
+ */
+static QStringList scannedPaths(const DirScanner &scanner, const QString &root)
+{
+    QStringList paths;
+    DirScanner::Tree tree = scanner.scan(root);
+    for(DirScanner::Tree::const_iterator it = tree.constBegin(); it != tree.constEnd(); ++it)
+    {
+        foreach(const DirScanner::Entry &entry, it.value())
+            paths << DirScanner::childPath(it.key(), entry.name) + (entry.isDir() ? "/" : "");
+    }
+    paths.sort();
+    return paths;
+}
+
+void TestUpdater::dirScanner()
+{
+    // Wide and deep enough to keep several threads busy, with empty and hidden entries
+    try {
+        for(int i = 0; i < 20; ++i)
+        {
+            for(int j = 0; j < 5; ++j)
+            {
+                const QString dir = testOutputScanner + QString("/dir%1/sub%2").arg(i).arg(j);
+                TestUtils::writeFile(dir + "/file.txt", "scanned");
+                TestUtils::writeFile(dir + "/.hidden", "scanned");
+                QVERIFY(QDir().mkpath(dir + "/deep/deeper/empty"));
+                TestUtils::writeFile(dir + "/deep/deeper/file.txt", "scanned");
+            }
+        }
+        TestUtils::writeFile(testOutputScanner + "/root.txt", "scanned");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    QStringList expected;
+    QDirIterator it(testOutputScanner, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden, QDirIterator::Subdirectories);
+    while(it.hasNext())
+    {
+        it.next();
+        expected << it.filePath().mid(testOutputScanner.size() + 1) + (it.fileInfo().isDir() ? "/" : "");
+    }
+    expected.sort();
+    QCOMPARE(expected.size(), 20 * 6 + 20 * 5 * 6 + 1);
+
+    DirScanner scanner;
+    for(int threadCount : { 1, 2, 8 })
+    {
+        scanner.setThreadCount(threadCount);
+        QCOMPARE(scannedPaths(scanner, testOutputScanner), expected);
+    }
+
+    // Entries of each directory are sorted
+    DirScanner::EntryList entries = scanner.list(testOutputScanner);
+    QCOMPARE(entries.size(), 21);
+    for(int i = 1; i < entries.size(); ++i)
+        QVERIFY(entries[i - 1].name < entries[i].name);
+
+    // Filtered directories are listed in their parent, their content isn't
+    scanner.setDescendFilter([](const QString &relativeDir) {
+        return !relativeDir.endsWith("/deep");
+    });
+    QStringList filtered;
+    foreach(const QString &path, expected)
+    {
+        if(!path.contains("/deep/") || path.endsWith("/deep/"))
+            filtered << path;
+    }
+    QCOMPARE(scannedPaths(scanner, testOutputScanner), filtered);
+}
+
+static QByteArray readLocalFile(const QString &path, qint64 start, qint64 end, int expectedStatusCode)
+{
+    LocalFileReply reply(QNetworkRequest(QUrl::fromLocalFile(path)), start, end);
+    QSignalSpy spy(&reply, SIGNAL(finished()));
+    if(!spy.wait())
+        return QByteArray("timeout");
+    if(reply.attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != expectedStatusCode)
+        return QByteArray("status");
+    return reply.readAll();
+}
+
+void TestUpdater::fileStamp()
+{
+    const QString filename = testOutputStamps + "/stamped.txt";
+    try {
+        TestUtils::writeFile(filename, "content 1");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    // A stamp taken right after the modification is valid, but racy if it is saved in the same clock tick
+    FileStamp stamp = FileStamp::stat(filename);
+    stamp.sha1 = "sha1 of content 1";
+    QVERIFY(stamp.isValid());
+    QVERIFY(stamp.matches(FileStamp::stat(filename)));
+    QVERIFY(stamp.isRacy(stamp.mtime));
+    QVERIFY(!stamp.isRacy(qMax(stamp.mtime, stamp.ctime) + 1));
+
+    // Same size, the modification is still seen...
+    try {
+        TestUtils::writeFile(filename, "content 2");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    // Unless it happens in the same clock tick, a stamp saved in that tick being racy
+    FileStamp current = FileStamp::stat(filename);
+    QVERIFY(!stamp.matches(current) || stamp.isRacy(current.mtime));
+    current.sha1 = "sha1 of content 2";
+
+    // Saved stamps are trusted as they were
+    FileStamp saved;
+    saved.fromJsonObject(stamp.toJsonObject());
+    QVERIFY(saved.isValid());
+    QVERIFY(saved.matches(stamp));
+
+    // The status waits for the clock to pass the stamps it saves, without any sleep they're trusted once loaded
+    LocalRepository repository(testOutputStamps);
+    repository.setRevision("1");
+    repository.insertFile("stamped.txt", current);
+    repository.save();
+    QVERIFY(!current.isRacy(FileStamp::stat(repository.directory() + "status.bin").mtime));
+    LocalRepository loaded(testOutputStamps);
+    QVERIFY(loaded.fileStamps().value("stamped.txt").isValid());
+}
+
+void TestUpdater::localFileReply()
+{
+    const QString source = testOutputReply + "/source";
+    {
+        QFile file(source);
+        QVERIFY(file.open(QFile::WriteOnly));
+        QCOMPARE(file.write("0123456789"), Q_INT64_C(10));
+    }
+
+    QCOMPARE(readLocalFile(source, 0, -1, 200), QByteArray("0123456789"));
+    QCOMPARE(readLocalFile(source, 0, 0, 206), QByteArray("0"));
+    QCOMPARE(readLocalFile(source, 3, 3, 206), QByteArray("3"));
+    QCOMPARE(readLocalFile(source, 3, 5, 206), QByteArray("345"));
+    QCOMPARE(readLocalFile(source, 8, 20, 206), QByteArray("89"));
+    QCOMPARE(readLocalFile(source, 4, -1, 206), QByteArray("456789"));
+
+    // Data copied by the kernel and written by the QFile must follow each other
+    QFile destination(testOutputReply + "/destination");
+    QVERIFY(destination.open(QFile::ReadWrite | QFile::Truncate));
+    QCOMPARE(destination.write("ab"), Q_INT64_C(2));
+    {
+        LocalFileReply reply(QNetworkRequest(QUrl::fromLocalFile(source)), 2, 7);
+        QSignalSpy spy(&reply, SIGNAL(finished()));
+        QVERIFY(spy.wait());
+        QCOMPARE(reply.copyTo(&destination, 4), Q_INT64_C(4));
+        QCOMPARE(destination.pos(), Q_INT64_C(6));
+        QCOMPARE(reply.copyTo(&destination, 10), Q_INT64_C(2));
+        QCOMPARE(destination.pos(), Q_INT64_C(8));
+    }
+    QCOMPARE(destination.write("cd"), Q_INT64_C(2));
+    QVERIFY(destination.seek(0));
+    QCOMPARE(destination.readAll(), QByteArray("ab234567cd"));
+}
+
+/*!
+    \brief Reply of a fake server, with the whole response already received
+ */
+class BufferReply : public QNetworkReply
+{
+public:
+    BufferReply(int statusCode, const QByteArray &contentType, const QByteArray &contentRange, const QByteArray &body) :
+        m_body(body), m_position(0)
+    {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, statusCode);
+        if(!contentType.isEmpty())
+            setRawHeader("Content-Type", contentType);
+        if(!contentRange.isEmpty())
+            setRawHeader("Content-Range", contentRange);
+        setOpenMode(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    void abort() Q_DECL_OVERRIDE {}
+    qint64 bytesAvailable() const Q_DECL_OVERRIDE { return m_body.size() - m_position + QNetworkReply::bytesAvailable(); }
+    bool canReadLine() const Q_DECL_OVERRIDE { return m_body.indexOf('\n', m_position) >= 0 || QNetworkReply::canReadLine(); }
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) Q_DECL_OVERRIDE
+    {
+        qint64 size = qMin(maxlen, qint64(m_body.size()) - m_position);
+        memcpy(data, m_body.constData() + m_position, size);
+        m_position += size;
+        return size;
+    }
+
+private:
+    QByteArray m_body;
+    qint64 m_position;
+};
+
+/*!
+    \brief Read all the data of \a reply through \a reader, as "position:data" parts
+ */
+static QStringList readRanges(RangeReader &reader, QNetworkReply *reply)
+{
+    QStringList parts;
+    forever
+    {
+        if(!reader.readHeaders())
+            return parts << "error";
+        qint64 size = reader.bytesAvailable();
+        if(size <= 0)
+            return parts;
+        qint64 position = reader.position();
+        parts << QString::number(position) + ":" + QString::fromLatin1(reply->read(size));
+        reader.consumed(size);
+    }
+}
+
+void TestUpdater::rangeReader()
+{
+    RangeReader::Ranges ranges;
+    ranges << RangeReader::Range(2, 5) << RangeReader::Range(10, 12);
+    QCOMPARE(RangeReader::rangeHeader(ranges), QByteArray("bytes=2-4,10-11"));
+
+    RangeReader reader;
+    {
+        BufferReply reply(206, "multipart/byteranges; boundary=\"XYZ\"", QByteArray(),
+                          "\r\n--XYZ\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes 2-4/20\r\n\r\nabc"
+                          "\r\n--XYZ\r\nContent-Range: bytes 10-11/20\r\n\r\nde\r\n--XYZ--\r\n");
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "2:abc" << "10:de");
+        QVERIFY(!reader.contains(10));
+    }
+    {
+        // Ranges merged by the server
+        BufferReply reply(206, "application/octet-stream", "bytes 2-11/20", "abcdefghij");
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "2:abcdefghij");
+    }
+    {
+        // Range header ignored
+        BufferReply reply(200, "application/octet-stream", QByteArray(), "0123");
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "0:0123");
+    }
+    {
+        // Not understood, multi-range requests must be disabled
+        BufferReply reply(206, "multipart/byteranges", QByteArray(), "abc");
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "error");
+        QVERIFY(reader.isParseError());
+    }
+    {
+        BufferReply reply(206, "multipart/byteranges; boundary=XYZ", QByteArray(), "--XYZ\r\n\r\nabc");
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "error");
+        QVERIFY(reader.isParseError());
+    }
+    {
+        // The request failed, it must go through the retries
+        BufferReply reply(503, "text/html", QByteArray(), "Service Unavailable");
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "error");
+        QVERIFY(!reader.isParseError());
+    }
+    {
+        BufferReply reply(416, QByteArray(), "bytes */20", QByteArray());
+        reader.setReply(&reply, ranges);
+        QCOMPARE(readRanges(reader, &reply), QStringList() << "error");
+        QVERIFY(!reader.isParseError());
+    }
+}
+
 void TestUpdater::updateToV1()
 {
     Updater u;
@@ -113,6 +689,9 @@ void TestUpdater::updateToV1()
         QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
         QCOMPARE(u.localRevision(), QString("1"));
         QCOMPARE(spyWarnings.size(), 0);
+        QVERIFY(u.downloadStatistics().requestCount > 0);
+        QVERIFY(u.downloadStatistics().bytesReceived > 0);
+        QVERIFY(u.downloadStatistics().latency >= 0);
     }
     try {
         (TestUtils::assertFileEquals(testOutputUpdate + "/dir2/patch_same.txt", dataDir + "/rev1/dir2/patch_same.txt"));
@@ -125,6 +704,357 @@ void TestUpdater::updateToV1()
     QVERIFY(QFileInfo(testOutputUpdate + "/empty_dir").isDir());
     QVERIFY(QFileInfo(testOutputUpdate + "/dirs/empty_dir2").isDir());
     QCOMPARE(QDir(testOutputUpdateTmp).entryList(QDir::NoDotAndDotDot).count(), 0);
+
+    Updater reloaded;
+    reloaded.setLocalRepository(testOutputUpdate);
+    QCOMPARE(reloaded.localRevision(), QString("1"));
+    QVERIFY(reloaded.isManaged(testOutputUpdate + "/status.bin"));
+    QVERIFY(reloaded.isManaged(testOutputUpdate + "/path_diff.txt"));
+    QVERIFY(reloaded.isManaged(testOutputUpdate + "/dirs/empty_dir2/"));
+
+    // Stamps written at apply time are trusted by the next check, files aren't hashed again
+    LocalRepository status(testOutputUpdate);
+    QVERIFY(!status.files().isEmpty());
+    foreach(const QString &path, status.files())
+    {
+        FileStamp stamp = status.fileStamps().value(path);
+        QVERIFY2(stamp.isValid(), path.toLatin1());
+        QVERIFY2(stamp.matches(FileStamp::stat(status.directory() + path)), path.toLatin1());
+    }
+}
+
+void TestUpdater::updateToV1Streaming()
+{
+    Updater u;
+    u.setLocalRepository(testOutputStreaming);
+    u.setTmpDirectory(testOutputStreamingTmp);
+    u.setRemoteRepository("file:///" + dataRepoToV1 + "/");
+    u.setStreamingEnabled(true);
+    QVERIFY(u.isStreamingEnabled());
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("1"));
+        QCOMPARE(spyWarnings.size(), 0);
+    }
+    try {
+        (TestUtils::assertFileEquals(testOutputStreaming + "/dir2/patch_same.txt", dataDir + "/rev1/dir2/patch_same.txt"));
+        (TestUtils::assertFileEquals(testOutputStreaming + "/path_diff.txt", dataDir + "/rev1/path_diff.txt"));
+        (TestUtils::assertFileEquals(testOutputStreaming + "/path_diff2.txt", dataDir + "/rev1/path_diff2.txt"));
+        (TestUtils::assertFileEquals(testOutputStreaming + "/rmfile.txt", dataDir + "/rev1/rmfile.txt"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    QVERIFY(!QFile::exists(testOutputStreaming + "/path_diff.txt.stream"));
+    QCOMPARE(QDir(testOutputStreamingTmp).entryList(QDir::NoDotAndDotDot).count(), 0);
+}
+
+void TestUpdater::updateToV1ObjectStore()
+{
+    qint64 bytesReceived[2];
+    const QString repositories[2] = { testOutputStoreFirst, testOutputStoreSecond };
+    for(int i = 0; i < 2; ++i)
+    {
+        Updater u;
+        u.setLocalRepository(repositories[i]);
+        u.setRemoteRepository("file:///" + dataRepoToV1 + "/");
+        u.setObjectStoreDirectory(testOutputStore);
+        QCOMPARE(u.objectStoreDirectory(), testOutputStore + "/");
+        {
+            QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+            u.checkForUpdates();
+            QVERIFY(spy.wait());
+            QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+        }
+        {
+            QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+            QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+            u.update();
+            QVERIFY(spy.wait());
+            QCOMPARE(spy.size(), 1);
+            QCOMPARE(spy[0][0].toBool(), true);
+            QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+            QCOMPARE(spyWarnings.size(), 0);
+            bytesReceived[i] = u.downloadStatistics().bytesReceived;
+        }
+        try {
+            (TestUtils::assertFileEquals(repositories[i] + "/path_diff.txt", dataDir + "/rev1/path_diff.txt"));
+            (TestUtils::assertFileEquals(repositories[i] + "/path_diff2.txt", dataDir + "/rev1/path_diff2.txt"));
+            (TestUtils::assertFileEquals(repositories[i] + "/rmfile.txt", dataDir + "/rev1/rmfile.txt"));
+        } catch(std::exception &msg) {
+            QFAIL(msg.what());
+        }
+        QVERIFY(QDir(testOutputStore).entryList(QDir::Dirs | QDir::NoDotAndDotDot).count() > 0);
+    }
+    // The data of the second update comes from the store
+    QVERIFY(bytesReceived[1] < bytesReceived[0]);
+}
+
+void TestUpdater::objectStoreVerify()
+{
+    const QString filename = testOutputStoreVerify + "/data.txt";
+    const QByteArray content = "object content";
+    const QString sha1 = QCryptographicHash::hash(content, QCryptographicHash::Sha1).toHex();
+    try {
+        TestUtils::writeFile(filename, content);
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    ObjectStore store;
+    store.setDirectory(testOutputStoreVerify + "/objects");
+    QVERIFY(store.insert(sha1, filename));
+    QVERIFY(store.contains(sha1, content.size()));
+
+    // A valid object is kept, an apply failure may be unrelated to its data
+    QVERIFY(store.verify(sha1));
+    QVERIFY(store.contains(sha1, content.size()));
+
+    try {
+        TestUtils::writeFile(store.objectFilename(sha1), "object c0ntent");
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    QVERIFY(!store.verify(sha1));
+    QVERIFY(!QFile::exists(store.objectFilename(sha1)));
+    QVERIFY(store.verify(sha1));
+}
+
+void TestUpdater::updateToV1FromPeer()
+{
+    Updater peer;
+    peer.setLocalRepository(testOutputStoreFirst);
+    peer.setRemoteRepository("file:///" + dataRepoToV1 + "/");
+    QVERIFY(!peer.startPeerServer(0, QHostAddress::LocalHost));
+    peer.setObjectStoreDirectory(testOutputStore);
+    QVERIFY(peer.startPeerServer(0, QHostAddress::LocalHost));
+    QVERIFY(peer.peerServerPort() > 0);
+
+    Updater u;
+    u.setLocalRepository(testOutputPeer);
+    u.setRemoteRepository(QString("http://127.0.0.1:%1/").arg(peer.peerServerPort()));
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+        QCOMPARE(u.remoteRevision(), QString("1"));
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("1"));
+        QCOMPARE(spyWarnings.size(), 0);
+    }
+    try {
+        (TestUtils::assertFileEquals(testOutputPeer + "/dir2/patch_same.txt", dataDir + "/rev1/dir2/patch_same.txt"));
+        (TestUtils::assertFileEquals(testOutputPeer + "/path_diff.txt", dataDir + "/rev1/path_diff.txt"));
+        (TestUtils::assertFileEquals(testOutputPeer + "/path_diff2.txt", dataDir + "/rev1/path_diff2.txt"));
+        (TestUtils::assertFileEquals(testOutputPeer + "/rmfile.txt", dataDir + "/rev1/rmfile.txt"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    peer.stopPeerServer();
+    QCOMPARE(peer.peerServerPort(), quint16(0));
+}
+
+void TestUpdater::updateToV1FromServer()
+{
+    RepositoryServer server(dataRepoToV1);
+    server.setThreadCount(2);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    Updater u;
+    u.setLocalRepository(testOutputServer);
+    u.setRemoteRepository(QString("http://127.0.0.1:%1/").arg(server.serverPort()));
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("1"));
+        QCOMPARE(spyWarnings.size(), 0);
+    }
+    try {
+        (TestUtils::assertFileEquals(testOutputServer + "/dir2/patch_same.txt", dataDir + "/rev1/dir2/patch_same.txt"));
+        (TestUtils::assertFileEquals(testOutputServer + "/path_diff.txt", dataDir + "/rev1/path_diff.txt"));
+        (TestUtils::assertFileEquals(testOutputServer + "/path_diff2.txt", dataDir + "/rev1/path_diff2.txt"));
+        (TestUtils::assertFileEquals(testOutputServer + "/rmfile.txt", dataDir + "/rev1/rmfile.txt"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+}
+
+void TestUpdater::updateToV2FromRoutes()
+{
+    foreach(const QString &name, QDir(dataRepoToV2).entryList(QDir::Files))
+        QVERIFY(QFile::copy(dataRepoToV2 + "/" + name, testOutputRoutesRepo + "/" + name));
+    QVERIFY(QFile::copy(dataRepoToV2 + "/complete_1", testOutputRoutesRepo + "/route_0"));
+
+    try {
+        Repository repository(testOutputRoutesRepo);
+        repository.load();
+        repository.save();
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+    QVERIFY(QFile::exists(testOutputRoutesRepo + "/route"));
+    QVERIFY(QFile::exists(testOutputRoutesRepo + "/route_1"));
+    QVERIFY(!QFile::exists(testOutputRoutesRepo + "/route_2"));
+    QVERIFY(!QFile::exists(testOutputRoutesRepo + "/route_0"));
+
+    // Only the routes can be used
+    QVERIFY(QFile::remove(testOutputRoutesRepo + "/packages"));
+
+    Updater u;
+    u.setLocalRepository(testOutputRoutes);
+    u.setRemoteRepository("file:///" + testOutputRoutesRepo + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("2"));
+        QCOMPARE(spyWarnings.size(), 0);
+    }
+    try {
+        (TestUtils::assertFileEquals(testOutputRoutes + "/dir2/patch_same.txt", dataDir + "/rev2/dir2/patch_same.txt"));
+        (TestUtils::assertFileEquals(testOutputRoutes + "/path_diff.txt", dataDir + "/rev2/path_diff.txt"));
+        (TestUtils::assertFileEquals(testOutputRoutes + "/add.txt", dataDir + "/rev2/add.txt"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+}
+
+void TestUpdater::updateToV2FromBrokenRoute()
+{
+    foreach(const QString &name, QDir(dataRepoToV2).entryList(QDir::Files))
+        QVERIFY(QFile::copy(dataRepoToV2 + "/" + name, testOutputBrokenRouteRepo + "/" + name));
+    try {
+        Repository repository(testOutputBrokenRouteRepo);
+        repository.load();
+        repository.save();
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    // The route of a new installation starts from 1, the packages list must be used
+    QVERIFY(QFile::remove(testOutputBrokenRouteRepo + "/route"));
+    QVERIFY(QFile::copy(testOutputBrokenRouteRepo + "/route_1", testOutputBrokenRouteRepo + "/route"));
+
+    Updater u;
+    u.setLocalRepository(testOutputBrokenRoute);
+    u.setRemoteRepository("file:///" + testOutputBrokenRouteRepo + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("2"));
+        QCOMPARE(spyWarnings.size(), 0);
+    }
+    try {
+        (TestUtils::assertFileEquals(testOutputBrokenRoute + "/path_diff.txt", dataDir + "/rev2/path_diff.txt"));
+        (TestUtils::assertFileEquals(testOutputBrokenRoute + "/add.txt", dataDir + "/rev2/add.txt"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+}
+
+void TestUpdater::updateToV2WithoutPatch()
+{
+    // The patch data is missing and there is no other path to 2
+    foreach(const QString &name, QDir(dataRepoToV2).entryList(QDir::Files))
+    {
+        if(name != "patch1_2")
+            QVERIFY(QFile::copy(dataRepoToV2 + "/" + name, testOutputRerouteRepo + "/" + name));
+    }
+
+    Updater u;
+    u.setLocalRepository(testOutputReroute);
+    {
+        u.setRemoteRepository("file:///" + dataRepoToV1 + "/");
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(u.localRevision(), QString("1"));
+    }
+
+    u.setRemoteRepository("file:///" + testOutputRerouteRepo + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::UpdateRequired, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy.size(), 1);
+        QCOMPARE(spy[0][0].toBool(), false);
+        QVERIFY(!u.errorString().isEmpty());
+        QCOMPARE(u.localRevision(), QString("1"));
+        QVERIFY(spyWarnings.size() > 0);
+        QCOMPARE(spyWarnings[0][0].value<Warning>().type(), Warning::PackageDownload);
+    }
+    try {
+        (TestUtils::assertFileEquals(testOutputReroute + "/path_diff.txt", dataDir + "/rev1/path_diff.txt"));
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
 }
 
 void TestUpdater::updateToV2()
@@ -165,3 +1095,143 @@ void TestUpdater::updateToV2()
     QVERIFY(!QFileInfo(testOutputUpdate + "/dirs/empty_dir2").isDir());
     QCOMPARE(QDir(testOutputUpdateTmp).entryList(QDir::NoDotAndDotDot).count(), 0);
 }
+
+static QByteArray fileContent(const QString &filename)
+{
+    QFile file(filename);
+    return file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+void TestUpdater::blockUndoJournal()
+{
+    const QString filename = testOutputJournal + "/file";
+    const QString journalFilename = testOutputJournal + "/journals/file.journal";
+    const QByteArray original = QByteArray("0123456789").repeated(1000);
+    QFile file(filename);
+
+    // Not committed, the file wasn't modified yet
+    try {
+        TestUtils::writeFile(filename, original);
+        BlockUndoJournal journal(journalFilename);
+        QVERIFY(file.open(QFile::ReadWrite));
+        journal.begin("file", original.size());
+        journal.save(&file, 100, 50);
+        file.close();
+        QVERIFY(journal.exists());
+        QCOMPARE(journal.path(), QString("file"));
+        QVERIFY(!journal.rollback(&file));
+        QVERIFY(!journal.exists());
+        QCOMPARE(fileContent(filename), original);
+    } catch(const QString &msg) {
+        QFAIL(msg.toLatin1());
+    } catch(std::exception &msg) {
+        QFAIL(msg.what());
+    }
+
+    // Committed, then the blocks are written and the file grows
+    try {
+        BlockUndoJournal journal(journalFilename);
+        QVERIFY(file.open(QFile::ReadWrite));
+        journal.begin("file", original.size());
+        journal.save(&file, 100, 50);
+        journal.save(&file, 5000, 100);
+        journal.commit();
+        QCOMPARE(journal.path(), QString("file"));
+        QVERIFY(file.resize(original.size() + 20));
+        QVERIFY(file.seek(100));
+        QCOMPARE(file.write(QByteArray(50, 'x')), Q_INT64_C(50));
+        QVERIFY(file.seek(5000));
+        QCOMPARE(file.write(QByteArray(60, 'y')), Q_INT64_C(60)); // Interrupted in the middle of a block
+        file.close();
+        QVERIFY(journal.rollback(&file));
+        QVERIFY(!journal.exists());
+        QCOMPARE(fileContent(filename), original);
+    } catch(const QString &msg) {
+        QFAIL(msg.toLatin1());
+    }
+
+    // Committed, then interrupted before the file is resized
+    try {
+        BlockUndoJournal journal(journalFilename);
+        QVERIFY(file.open(QFile::ReadWrite));
+        journal.begin("file", original.size());
+        journal.save(&file, original.size() - 1000, 1000);
+        journal.commit();
+        file.close();
+        QVERIFY(journal.rollback(&file));
+        QCOMPARE(fileContent(filename), original);
+
+        // The file was truncated
+        QVERIFY(file.open(QFile::ReadWrite));
+        journal.begin("file", original.size());
+        journal.save(&file, original.size() - 1000, 1000);
+        journal.commit();
+        QVERIFY(file.resize(original.size() - 1000));
+        file.close();
+        QVERIFY(journal.rollback(&file));
+        QCOMPARE(fileContent(filename), original);
+    } catch(const QString &msg) {
+        QFAIL(msg.toLatin1());
+    }
+
+    // Removing the journal makes the modifications permanent
+    try {
+        BlockUndoJournal journal(journalFilename);
+        QVERIFY(file.open(QFile::ReadWrite));
+        journal.begin("file", original.size());
+        journal.save(&file, 0, 10);
+        journal.commit();
+        QVERIFY(file.seek(0));
+        QCOMPARE(file.write("abcdefghij"), Q_INT64_C(10));
+        file.close();
+        journal.remove();
+        QVERIFY(!journal.exists());
+        QCOMPARE(fileContent(filename), "abcdefghij" + original.mid(10));
+    } catch(const QString &msg) {
+        QFAIL(msg.toLatin1());
+    }
+}
+
+void TestUpdater::recoverBlockJournal()
+{
+    // An in place patch of path_diff.txt was interrupted, whatever the next update does it must be rolled back
+    const QString filename = testOutputUpdate + "/path_diff.txt";
+    const QByteArray original = fileContent(filename);
+    QVERIFY(!original.isEmpty());
+    try {
+        BlockUndoJournal journal(BlockPatchOperation::journalDirectory(testOutputUpdateTmp + "/") + "interrupted.journal");
+        QFile file(filename);
+        QVERIFY(file.open(QFile::ReadWrite));
+        journal.begin("path_diff.txt", original.size());
+        journal.save(&file, 0, original.size());
+        journal.commit();
+        QVERIFY(file.seek(0));
+        QCOMPARE(file.write(QByteArray(original.size(), 'x')), qint64(original.size()));
+        file.close();
+    } catch(const QString &msg) {
+        QFAIL(msg.toLatin1());
+    }
+
+    Updater u;
+    u.setLocalRepository(testOutputUpdate);
+    u.setTmpDirectory(testOutputUpdateTmp);
+    u.setRemoteRepository("file:///" + dataRepoToV2 + "/");
+    {
+        QSignalSpy spy(&u, SIGNAL(checkForUpdatesFinished(bool)));
+        u.checkForUpdates();
+        QVERIFY(spy.wait());
+        QVERIFY2(u.state() == Updater::AlreadyUptodate, u.errorString().toLatin1());
+    }
+    {
+        QSignalSpy spyWarnings(&u, SIGNAL(warning(Warning)));
+        QSignalSpy spy(&u, SIGNAL(updateFinished(bool)));
+        u.update();
+        QVERIFY(spy.wait());
+        QCOMPARE(spy[0][0].toBool(), true);
+        QVERIFY2(u.state() == Updater::Uptodate, u.errorString().toLatin1());
+        QCOMPARE(spyWarnings.size(), 1);
+        QCOMPARE(spyWarnings[0][0].value<Warning>().type(), Warning::OperationApply);
+    }
+    QCOMPARE(fileContent(filename), original);
+    QVERIFY(!QDir(BlockPatchOperation::journalDirectory(testOutputUpdateTmp + "/")).exists());
+}
@@ -12,10 +12,27 @@ public:
 private Q_SLOTS:
     void initTestCase();
     void updaterCopy();
+    void updaterCopyIncremental();
     void updaterIsManaged();
+    void localRepositoryIsManaged();
+    void localRepositoryStatus();
     void updaterRemoveOtherFiles();
+    void dirScanner();
+    void fileStamp();
+    void localFileReply();
+    void rangeReader();
     void updateToV1();
+    void updateToV1Streaming();
+    void updateToV1ObjectStore();
+    void objectStoreVerify();
+    void updateToV1FromPeer();
+    void updateToV1FromServer();
+    void updateToV2FromRoutes();
+    void updateToV2FromBrokenRoute();
+    void updateToV2WithoutPatch();
     void updateToV2();
+    void blockUndoJournal();
+    void recoverBlockJournal();
     void cleanupTestCase();
 };
 
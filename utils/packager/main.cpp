@@ -28,6 +28,19 @@ int main(int argc, char *argv[])
          , QCoreApplication::tr("Path to use for temporary files.")
          , "tmp_directory");
     parser.addOption(tmpDirectoryPath);
+
+    QCommandLineOption blockSize(QStringList() << "b" << "block-size"
+         , QCoreApplication::tr("Compress files bigger than block_size by blocks, so damaged files can be repaired by blocks.")
+         , "block_size");
+    parser.addOption(blockSize);
+
+    QCommandLineOption append(QStringList() << "append"
+         , QCoreApplication::tr("Ship files that only grew with their new tail only (requires an updater supporting append operations)."));
+    parser.addOption(append);
+
+    QCommandLineOption blockPatch(QStringList() << "block-patch"
+         , QCoreApplication::tr("Patch huge files in place by changed blocks (requires an updater supporting block patch operations)."));
+    parser.addOption(blockPatch);
     parser.process(app);
 
     QCommandLineOption verbose(QStringList() << "verbose"
@@ -60,6 +73,15 @@ int main(int argc, char *argv[])
         if(parser.isSet(tmpDirectoryPath))
             packager.setTmpDirectoryPath(parser.value(tmpDirectoryPath));
 
+        if(parser.isSet(blockSize))
+            packager.setBlockSize(parser.value(blockSize).toLongLong());
+
+        if(parser.isSet(append))
+            packager.setAppendEnabled(true);
+
+        if(parser.isSet(blockPatch))
+            packager.setBlockPatchEnabled(true);
+
         if(parser.isSet(deltaMetadataFilename))
             packager.setDeltaMetadataFilename(parser.value(deltaMetadataFilename));
 
@@ -2,7 +2,9 @@
 #include <QCoreApplication>
 #include <QMetaEnum>
 #include <QLoggingCategory>
+#include <QThread>
 #include <repository.h>
+#include <repositoryserver.h>
 #include <packager.h>
 #include <common/utils.h>
 
@@ -22,6 +24,7 @@ int main(int argc, char *argv[])
                                                                  "\n - rmpackage: remove a version"
                                                                  "\n - setversion: set current version"
                                                                  "\n - simplify: simplify the repository according to the current version"
+                                                                 "\n - serve: serve the repository over HTTP"
                                                                  ), "<command>");
 
     QCommandLineOption verbose(QStringList() << "verbose"
@@ -59,6 +62,11 @@ int main(int argc, char *argv[])
              , "xdelta3_bin");
         parser.addOption(xdeltaPath);
 
+        QCommandLineOption blockSize(QStringList() << "b" << "block-size"
+             , QCoreApplication::tr("Compress files bigger than block_size by blocks, so damaged files can be repaired by blocks.")
+             , "block_size");
+        parser.addOption(blockSize);
+
         parser.process(app);
 
         const QStringList args = parser.positionalArguments();
@@ -83,6 +91,9 @@ int main(int argc, char *argv[])
             if(parser.isSet(tmpDirectoryPath))
                 packager.setTmpDirectoryPath(parser.value(tmpDirectoryPath));
 
+            if(parser.isSet(blockSize))
+                packager.setBlockSize(parser.value(blockSize).toLongLong());
+
             try
             {
                 printf("Progression ...");
@@ -208,6 +219,50 @@ int main(int argc, char *argv[])
             return 0;
         }
     }
+    else if (command == "serve")
+    {
+        parser.clearPositionalArguments();
+        parser.addPositionalArgument("serve", QCoreApplication::tr("Serve the repository over HTTP, until interrupted."));
+        parser.addPositionalArgument("repository", QCoreApplication::tr("Path to the repository."), "<repository>");
+
+        QCommandLineOption port(QStringList() << "p" << "port"
+             , QCoreApplication::tr("Port to listen on [8080 by default].")
+             , "port", "8080");
+        parser.addOption(port);
+
+        QCommandLineOption address("address"
+             , QCoreApplication::tr("Address to listen on [any by default].")
+             , "address");
+        parser.addOption(address);
+
+        QCommandLineOption threads("threads"
+             , QCoreApplication::tr("Number of threads serving the connections [one per core by default].")
+             , "thread_count");
+        parser.addOption(threads);
+
+        parser.process(app);
+
+        const QStringList args = parser.positionalArguments();
+        if(args.size() < 2)
+            qWarning() << "Error : repository argument is missing";
+        else if(args.size() > 2)
+            qWarning() << "Error : too much arguments";
+        else
+        {
+            RepositoryServer server(args.at(1));
+            server.setThreadCount(parser.isSet(threads) ? parser.value(threads).toInt() : QThread::idealThreadCount());
+
+            QHostAddress hostAddress = parser.isSet(address) ? QHostAddress(parser.value(address)) : QHostAddress(QHostAddress::Any);
+            if(!server.listen(hostAddress, quint16(parser.value(port).toUInt())))
+            {
+                qCritical() << "Unable to listen :" << server.errorString();
+                return 2;
+            }
+            printf("Serving %s on port %d\n", qPrintable(server.directory()), int(server.serverPort()));
+            fflush(stdout);
+            return app.exec();
+        }
+    }
     else if(!command.isEmpty())
     {
         qWarning() << "Error : command not supported " << command.toLatin1().data();
@@ -17,11 +17,19 @@ int main(int argc, char *argv[])
     QCommandLineOption checkonly(QStringList() << "c" << "checkonly"
          , QCoreApplication::tr("Only check for updates."));
 
+    QCommandLineOption objectStorePath(QStringList() << "s" << "store"
+         , QCoreApplication::tr("Path to the object store shared by local repositories.")
+         , "store_directory");
+
+    QCommandLineOption servePort(QStringList() << "serve"
+         , QCoreApplication::tr("Once up-to-date, serve the remote repository to other updaters on port, until interrupted. Requires a store.")
+         , "port");
+
     QCommandLineOption verbose(QStringList() << "verbose"
          , QCoreApplication::tr("Run in verbose mode."));
 
     QCommandLineOption force(QStringList() << "f" << "force"
-         , QCoreApplication::tr("Force integrity checks if the local repository is uptodate."));
+         , QCoreApplication::tr("Force integrity checks if the local repository is uptodate, every file is hashed."));
 
     QCommandLineOption tmpDirectoryPath(QStringList() << "t" << "tmp"
          , QCoreApplication::tr("Path to use for temporary files.")
@@ -30,6 +38,8 @@ int main(int argc, char *argv[])
     parser.addOption(checkonly);
     parser.addOption(force);
     parser.addOption(tmpDirectoryPath);
+    parser.addOption(objectStorePath);
+    parser.addOption(servePort);
     parser.addOption(verbose);
     parser.addPositionalArgument("local_repository", QCoreApplication::tr("Path to the local repository."), "<local_repository>");
     parser.addPositionalArgument("remote_repository", QCoreApplication::tr("Path to the remote repository."), "<remote_repository>");
@@ -57,6 +67,11 @@ int main(int argc, char *argv[])
         if(parser.isSet(tmpDirectoryPath))
             updater.setTmpDirectory(parser.value(tmpDirectoryPath));
 
+        if(parser.isSet(objectStorePath))
+            updater.setObjectStoreDirectory(parser.value(objectStorePath));
+
+        updater.setParanoidCheckEnabled(parser.isSet(force));
+
         if(args.size() == 4)
             updater.setCredentials(args[2], args[3]);
 
@@ -126,6 +141,17 @@ int main(int argc, char *argv[])
             {
                 printf("Already up-to-date\n");
             }
+
+            if(parser.isSet(servePort) && updater.errorString().isEmpty())
+            {
+                if(!updater.startPeerServer(quint16(parser.value(servePort).toUInt())))
+                {
+                    fprintf(stderr, "Failure : unable to serve on port %s\n", qPrintable(parser.value(servePort)));
+                    return 2;
+                }
+                printf("Serving on port %d\n", int(updater.peerServerPort()));
+                return app.exec();
+            }
         }
 
         return 0;